@@ -53,6 +53,7 @@
 
 #include "uribeacon_service.h" /* Interface to this file */
 #include "beaconing.h"      /* Beaconing routines */
+#include "../core/uribeacon_core.h" /* Scan response for a URI continuation */
 
 /*=============================================================================*
  *  Private Definitions
@@ -91,6 +92,10 @@ extern void BeaconStart(bool start)
     uint8 i;
     uint8 len_i = 0;
     uint8 adv_parameter_len = 0;
+    uint8* continuation;
+    uint8 continuation_size;
+    uint8 scanData[URIBEACON_ADV_MAX];
+    uint8 scan_size = 0;
     uint32 beacon_interval = UribeaconGetPeriodMillis();    
     
     /* Stop broadcasting */
@@ -119,6 +124,15 @@ extern void BeaconStart(bool start)
         /* get the beaconing data USING SERVICE */
         UribeaconGetData(&beacon_data, &beacon_data_size);
         
+        /* a URI continuation goes in the scan response, and the flags tell
+         * scanners to ask for it */
+        UribeaconGetContinuation(&continuation, &continuation_size);
+        if (continuation_size > 0)
+        {
+            scan_size = uribeacon_scan_response_build(continuation, continuation_size,
+                                                      scanData, sizeof(scanData));
+        }
+        
         if(beacon_data_size > 0)
         {
             adv_parameter_len = beacon_data[0];
@@ -128,6 +142,10 @@ extern void BeaconStart(bool start)
             for(i = 1; (i < beacon_data_size) && (offset < ADVERT_SIZE); i++,offset++, len_i--)
             {
                 advData[offset] = beacon_data[i];
+                if ((i == URIBEACON_FLAGS_PKT_OFFSET) && (scan_size > 0))
+                {
+                    advData[offset] |= URIBEACON_FLAG_URI_CONTINUED;
+                }
                 
                 if(len_i == 0)
                 {
@@ -146,6 +164,13 @@ extern void BeaconStart(bool start)
             LsStoreAdvScanData(offset, advData, ad_src_advertise);
         }
         
+        /* store the scan response, without its AD length which the
+         * firmware adds like for the advertisement */
+        if (scan_size > 0)
+        {
+            LsStoreAdvScanData(scanData[0], &scanData[1], ad_src_scan_rsp);
+        }
+        
         /* Start broadcasting */
         LsStartStopAdvertise(TRUE, whitelist_disabled, ls_addr_type_random);
     }
@@ -52,6 +52,7 @@
 #include "buzzer.h"         /* Interface to this file */
 #include "hw_access.h"      /* Hardware access */
 #include "uribeacon.h"    /* Definitions used throughout the GATT server */
+#include "event_trace.h"    /* Event trace */
 
 /* Only compile this file if the buzzer code has been requested */
 #ifdef ENABLE_BUZZER
@@ -146,6 +147,8 @@ static void appBuzzerTimerHandler(timer_id tid)
     /* Duration of next timer */
     uint32 beep_timer = SHORT_BEEP_TIMER_VALUE;
 
+    TraceEvent(trace_event_timer, trace_timer_buzzer, tid);
+
     /* The buzzer timer has just expired, so reset the timer ID */
     g_buzz_data.buzzer_tid = TIMER_INVALID;
 
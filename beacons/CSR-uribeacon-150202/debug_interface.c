@@ -42,8 +42,8 @@
 
 #include <debug.h>          /* Simple host interface to the UART driver */
 #include <types.h>          /* Commonly used type definitions */
-#include <gatt_uuid.h>      /* Common Bluetooth UUIDs and macros */
-#include <mem.h>            /* Memory library */
+#include <timer.h>          /* Chip timer functions */
+#include <time.h>           /* Chip time definitions */
 
 /*============================================================================*
  *  Local Header File
@@ -56,17 +56,44 @@
 
 /*============================================================================*
  *  Private Definitions
- *===========================================================================*/
+ *============================================================================*/
+
+/* Messages held until written */
+#define LOG_RECORDS                         (32)
+
+/* Words per message: level and token, argument */
+#define LOG_RECORD_WORDS                    (2)
+
+/* Messages written per expiry of the log timer, to keep each one short */
+#define LOG_DRAIN_RECORDS                   (4)
 
-/* Smallest buffer size required to hold longest 16-bit integer value */
-#define ITOA_BUFFER_SIZE    (7)
+/* Delay before writing logged messages */
+#define LOG_DRAIN_DELAY                     (2 * MILLISECOND)
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Messages logged, oldest first from g_log_first */
+static uint16 g_log_ring[LOG_RECORDS * LOG_RECORD_WORDS];
+static uint16 g_log_first;
+static uint16 g_log_count;
+
+/* Messages lost since the last written */
+static uint16 g_log_dropped;
+
+/* Timer that writes the messages, TIMER_INVALID when none are waiting */
+static timer_id g_log_tid;
 
 /*============================================================================*
  *  Private Function Prototypes
  *============================================================================*/
 
-/* Convert decimal integer value to ASCII string */
-static uint8 itoa(int16 value, char *str);
+/* Write the oldest message to the UART */
+static void logWriteRecord(void);
+
+/* Write up to LOG_DRAIN_RECORDS messages */
+static void logTimerHandler(timer_id tid);
 
 /*============================================================================*
  *  Private Function Implementations
@@ -74,55 +101,84 @@ static uint8 itoa(int16 value, char *str);
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      itoa
+ *      logWriteRecord
+ *
+ *  DESCRIPTION
+ *      Write the oldest message to the UART as "LOG", the level and token,
+ *      and the argument, in hex, or the number of messages dropped if none
+ *      are left.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *---------------------------------------------------------------------------*/
+static void logWriteRecord(void)
+{
+    uint16 header;                      /* Level and token */
+    uint16 arg;                         /* Argument */
+
+    if (g_log_count > 0)
+    {
+        header = g_log_ring[g_log_first * LOG_RECORD_WORDS];
+        arg = g_log_ring[g_log_first * LOG_RECORD_WORDS + 1];
+
+        g_log_count--;
+        if (++g_log_first == LOG_RECORDS)
+        {
+            g_log_first = 0;
+        }
+    }
+    else
+    {
+        header = (LOG_LEVEL_ERROR << 8) | log_dropped;
+        arg = g_log_dropped;
+        g_log_dropped = 0;
+    }
+
+    DebugWriteString("LOG ");
+    DebugWriteUint16(header);
+    DebugWriteString(" ");
+    DebugWriteUint16(arg);
+    DebugWriteString("\r\n");
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      logTimerHandler
  *
  *  DESCRIPTION
- *      Convert a 16-bit signed integer decimal value into a string.
+ *      Write up to LOG_DRAIN_RECORDS messages, and start the timer again if
+ *      more are waiting.
  *
  *  PARAMETERS
- *      value [in]              Decimal value to convert
- *      str [in]                Buffer into which to place string (must have
- *                              room for at least ITOA_BUFFER_SIZE chars)
+ *      tid [in]                ID of timer that has expired
  *
  *  RETURNS
- *      Length of the string.
+ *      Nothing
  *---------------------------------------------------------------------------*/
-static uint8 itoa(int16 value, char *str)
+static void logTimerHandler(timer_id tid)
 {
-    uint8  i = ITOA_BUFFER_SIZE;    /* Index into buffer */
-    uint16 remainder;               /* Remaining value to convert */
-    char   buffer[ITOA_BUFFER_SIZE];/* Buffer for ASCII string */
-    
-    /* Initialise remainder. If value is negative convert remainder from 16-bit
-     * 2's complement negative value to 16-bit absolute value
-     */
-    remainder = (value < 0) ? ~value + 1 : value;
-
-    /* Ensure the string is correctly terminated */    
-    buffer[--i] = '\0';
-
-    /* Loop at least once and until the whole value has been converted */
-    do
+    uint16 written;                     /* Messages written */
+
+    if (tid != g_log_tid)
     {
-        /* Convert the unit value into ASCII and store in the buffer */
-        buffer[--i] = (remainder % 10) + '0';
-        
-        /* Shift the value right one decimal */
-        remainder /= 10;
-    } while (remainder > 0);
-    
-    /* Prepend '-' if the value is negative */
-    if (value < 0)
+        return;
+    }
+    g_log_tid = TIMER_INVALID;
+
+    for (written = 0; (written < LOG_DRAIN_RECORDS) &&
+                      ((g_log_count > 0) || (g_log_dropped > 0)); written++)
     {
-        buffer[--i] = '-';
+        logWriteRecord();
     }
-    
-    /* Copy the buffer into the return string, including NUL terminator */
-    MemCopy(str, buffer + i, ITOA_BUFFER_SIZE - i);
 
-    /* Return length of str, excluding NUL terminator (as per strlen) */
-    return (ITOA_BUFFER_SIZE - 1) - i;
-} /* itoa */
+    if ((g_log_count > 0) || (g_log_dropped > 0))
+    {
+        g_log_tid = TimerCreate(LOG_DRAIN_DELAY, TRUE, logTimerHandler);
+    }
+}
 
 /*============================================================================*
  *  Public Function Implementations
@@ -145,79 +201,82 @@ void DebugIfInit(void)
 {
     /* Initialise debug output */
     DebugInit(0, NULL, NULL);
+
+    g_log_first = 0;
+    g_log_count = 0;
+    g_log_dropped = 0;
+    g_log_tid = TIMER_INVALID;
 } /* DebugIfInit */
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      DebugIfWriteBdAddress
+ *      DebugIfLog
  *
  *  DESCRIPTION
- *      Print out a Bluetooth address.
+ *      Log a message, to be written when the log timer expires. If the
+ *      buffer is full the message is counted as dropped.
  *
  *  PARAMETERS
- *      address [in]            Bluetooth address to write to UART
+ *      level [in]              LOG_LEVEL_ERROR, _INFO or _DEBUG
+ *      token [in]              Message
+ *      arg [in]                Argument for the message
  *
  *  RETURNS
  *      Nothing
  *---------------------------------------------------------------------------*/
-void DebugIfWriteBdAddress(const TYPED_BD_ADDR_T *address)
+void DebugIfLog(uint16 level, log_token token, uint16 arg)
 {
-    DebugWriteUint8(WORD_MSB(address->addr.nap));
-    DebugWriteString(":");
-    DebugWriteUint8(WORD_LSB(address->addr.nap));
-    DebugWriteString(":");
-    DebugWriteUint8(address->addr.uap);
-    DebugWriteString(":");
-    DebugWriteUint8(WORD_LSB(address->addr.lap >> 16));
-    DebugWriteString(":");
-    DebugWriteUint8(WORD_MSB(address->addr.lap));
-    DebugWriteString(":");
-    DebugWriteUint8(WORD_LSB(address->addr.lap));
-} /* DebugIfWriteBdAddress */
+    uint16 index;                       /* Slot for the message */
 
-/*----------------------------------------------------------------------------*
- *  NAME
- *      DebugIfWriteInt
- *
- *  DESCRIPTION
- *      Print out an integer value
- *
- *  PARAMETERS
- *      value [in]              Integer value to write to UART
- *
- *  RETURNS
- *      Nothing
- *---------------------------------------------------------------------------*/
-void DebugIfWriteInt(int16 value)
-{
-    char valueString[ITOA_BUFFER_SIZE];
+    if (g_log_count == LOG_RECORDS)
+    {
+        if (g_log_dropped < 0xFFFF)
+        {
+            g_log_dropped++;
+        }
+        return;
+    }
 
-    itoa(value, valueString);
-    
-    DebugWriteString(valueString);
-} /* DebugIfWriteInt */
+    index = g_log_first + g_log_count;
+    if (index >= LOG_RECORDS)
+    {
+        index -= LOG_RECORDS;
+    }
+    g_log_ring[index * LOG_RECORD_WORDS] = (level << 8) | token;
+    g_log_ring[index * LOG_RECORD_WORDS + 1] = arg;
+    g_log_count++;
+
+    if (g_log_tid == TIMER_INVALID)
+    {
+        g_log_tid = TimerCreate(LOG_DRAIN_DELAY, TRUE, logTimerHandler);
+    }
+} /* DebugIfLog */
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      DebugIfWriteUuid128
+ *      DebugIfFlush
  *
  *  DESCRIPTION
- *      Print out a 128-bit UUID
+ *      Write every message logged to the UART now.
  *
  *  PARAMETERS
- *      uuid [in]               Buffer containing 128-bit UUID to write to UART
+ *      None
  *
  *  RETURNS
  *      Nothing
  *---------------------------------------------------------------------------*/
-void DebugIfWriteUuid128(const uint8 *uuid)
+void DebugIfFlush(void)
 {
-    uint8 i;
-    
-    for(i = 0; i < 16; i++)
+    if (g_log_tid != TIMER_INVALID)
+    {
+        TimerDelete(g_log_tid);
+        g_log_tid = TIMER_INVALID;
+    }
+
+    while ((g_log_count > 0) || (g_log_dropped > 0))
     {
-        DebugWriteUint8(uuid[i]);
+        logWriteRecord();
     }
-} /* DebugIfWriteUuid128 */
+} /* DebugIfFlush */
 
 #endif /* DEBUG_OUTPUT_ENABLED */
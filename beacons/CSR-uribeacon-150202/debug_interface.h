@@ -30,7 +30,12 @@
  *      debug_interface.h
  *
  *  DESCRIPTION
- *      This file defines debug output routines for the application
+ *      This file defines debug output routines for the application.
+ *
+ *      Messages are logged as a number from log_tokens.h and a 16-bit
+ *      argument, into a RAM buffer; a timer writes them to the UART later,
+ *      a few at a time, so logging costs the caller two stores. Each module
+ *      has a log level, and the calls above it compile to nothing.
  *
  *
  *****************************************************************************/
@@ -42,8 +47,7 @@
  *  SDK Header Files
  *============================================================================*/
 
-#include <bluetooth.h>      /* Bluetooth specific type definitions */
-#include <debug.h>          /* Simple host interface to the UART driver */
+#include <types.h>          /* Commonly used type definitions */
 
 /*============================================================================*
  *  Local Header Files
@@ -52,23 +56,73 @@
 #include "user_config.h"    /* User configuration */
 
 /*============================================================================*
- *  Public Function Prototypes
+ *  Public Definitions
  *============================================================================*/
 
+/* Log levels, most severe first */
+#define LOG_LEVEL_NONE                      (0)
+#define LOG_LEVEL_ERROR                     (1)
+#define LOG_LEVEL_INFO                      (2)
+#define LOG_LEVEL_DEBUG                     (3)
+
+/* Level of each module: APP for uribeacon.c and the hardware, SERVICE for
+ * the GATT services, NVM for nvm_access.c. user_config.h may set them;
+ * without DEBUG_OUTPUT_ENABLED nothing is logged. */
 #ifdef DEBUG_OUTPUT_ENABLED
 
-/* Map macros to the debug functions */
-#define DebugIfWriteString(a)          DebugWriteString(a)
-#define DebugIfWriteUint8(a)           DebugWriteUint8(a)
-#define DebugIfWriteUint16(a)          DebugWriteUint16(a)
-#define DebugIfWriteUint32(a)          DebugWriteUint32(a)
+#ifndef LOG_LEVEL_APP
+#define LOG_LEVEL_APP                       LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_SERVICE
+#define LOG_LEVEL_SERVICE                   LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_NVM
+#define LOG_LEVEL_NVM                       LOG_LEVEL_ERROR
+#endif
+
+/* Timers used by the log */
+#define DEBUG_IF_TIMERS                     (1)
+
+#else
+
+#undef LOG_LEVEL_APP
+#undef LOG_LEVEL_SERVICE
+#undef LOG_LEVEL_NVM
+#define LOG_LEVEL_APP                       LOG_LEVEL_NONE
+#define LOG_LEVEL_SERVICE                   LOG_LEVEL_NONE
+#define LOG_LEVEL_NVM                       LOG_LEVEL_NONE
+
+#define DEBUG_IF_TIMERS                     (0)
+
+#endif /* DEBUG_OUTPUT_ENABLED */
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Message numbers */
+typedef enum
+{
+#define LOG_TOKEN(name, text)   name,
+#include "log_tokens.h"
+#undef LOG_TOKEN
+
+    log_token_count
+
+} log_token;
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+#ifdef DEBUG_OUTPUT_ENABLED
 
 /*----------------------------------------------------------------------------*
  *  NAME
  *      DebugIfInit
  *
  *  DESCRIPTION
- *      Initialise debug output.
+ *      Initialise debug output. Called after TimerInit().
  *
  *  PARAMETERS
  *      None
@@ -80,69 +134,91 @@ extern void DebugIfInit(void);
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      DebugIfWriteBdAddress
+ *      DebugIfLog
  *
  *  DESCRIPTION
- *      Print out a Bluetooth address.
+ *      Log a message. Use the Log<Module><Level> macros below, which drop
+ *      the call if the module's level is lower.
  *
  *  PARAMETERS
- *      address [in]            Bluetooth address to write to UART
+ *      level [in]              LOG_LEVEL_ERROR, _INFO or _DEBUG
+ *      token [in]              Message
+ *      arg [in]                Argument for the message
  *
  *  RETURNS
  *      Nothing
- *---------------------------------------------------------------------------*/
-extern void DebugIfWriteBdAddress(const TYPED_BD_ADDR_T *address);
+ *----------------------------------------------------------------------------*/
+extern void DebugIfLog(uint16 level, log_token token, uint16 arg);
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      DebugIfWriteInt
+ *      DebugIfFlush
  *
  *  DESCRIPTION
- *      Print out an integer value
+ *      Write every message logged to the UART now, for when the application
+ *      is about to stop, as ReportPanic() is.
  *
  *  PARAMETERS
- *      value [in]              Integer value to write to UART
+ *      None
  *
  *  RETURNS
  *      Nothing
- *---------------------------------------------------------------------------*/
-extern void DebugIfWriteInt(int16 value);
-
-/* Write an error message with a status code */
-#define DebugIfWriteErrorMessage(msg, error)   \
-    DebugWriteString(msg);                     \
-    DebugWriteString(" (0x");                  \
-    DebugWriteUint16((uint16)error);           \
-    DebugWriteString(")\r\n")
+ *----------------------------------------------------------------------------*/
+extern void DebugIfFlush(void);
 
-/*----------------------------------------------------------------------------*
- *  NAME
- *      DebugIfWriteUuid128
- *
- *  DESCRIPTION
- *      Print out a 128-bit UUID
- *
- *  PARAMETERS
- *      uuid [in]               Buffer containing 128-bit UUID to write to UART
- *
- *  RETURNS
- *      Nothing
- *---------------------------------------------------------------------------*/
-extern void DebugIfWriteUuid128(const uint8 *uuid);
-    
 #else
 
-#define DebugIfWriteString(a)
-#define DebugIfWriteUint8(a)
-#define DebugIfWriteUint16(a)
-#define DebugIfWriteUint32(a)
 #define DebugIfInit()
-#define DebugIfWriteBdAddress(a)
-#define DebugIfWriteInt(a)
-#define DebugIfWriteErrorMessage(msg, error)
-#define DebugIfWriteUuid128(a)
+#define DebugIfFlush()
 
 #endif /* DEBUG_OUTPUT_ENABLED */
 
-#endif /* __DEBUG_INTERFACE_H__ */
+#if LOG_LEVEL_APP >= LOG_LEVEL_ERROR
+#define LogAppError(token, arg)     DebugIfLog(LOG_LEVEL_ERROR, (token), (arg))
+#else
+#define LogAppError(token, arg)
+#endif
+#if LOG_LEVEL_APP >= LOG_LEVEL_INFO
+#define LogAppInfo(token, arg)      DebugIfLog(LOG_LEVEL_INFO, (token), (arg))
+#else
+#define LogAppInfo(token, arg)
+#endif
+#if LOG_LEVEL_APP >= LOG_LEVEL_DEBUG
+#define LogAppDebug(token, arg)     DebugIfLog(LOG_LEVEL_DEBUG, (token), (arg))
+#else
+#define LogAppDebug(token, arg)
+#endif
+
+#if LOG_LEVEL_SERVICE >= LOG_LEVEL_ERROR
+#define LogServiceError(token, arg) DebugIfLog(LOG_LEVEL_ERROR, (token), (arg))
+#else
+#define LogServiceError(token, arg)
+#endif
+#if LOG_LEVEL_SERVICE >= LOG_LEVEL_INFO
+#define LogServiceInfo(token, arg)  DebugIfLog(LOG_LEVEL_INFO, (token), (arg))
+#else
+#define LogServiceInfo(token, arg)
+#endif
+#if LOG_LEVEL_SERVICE >= LOG_LEVEL_DEBUG
+#define LogServiceDebug(token, arg) DebugIfLog(LOG_LEVEL_DEBUG, (token), (arg))
+#else
+#define LogServiceDebug(token, arg)
+#endif
+
+#if LOG_LEVEL_NVM >= LOG_LEVEL_ERROR
+#define LogNvmError(token, arg)     DebugIfLog(LOG_LEVEL_ERROR, (token), (arg))
+#else
+#define LogNvmError(token, arg)
+#endif
+#if LOG_LEVEL_NVM >= LOG_LEVEL_INFO
+#define LogNvmInfo(token, arg)      DebugIfLog(LOG_LEVEL_INFO, (token), (arg))
+#else
+#define LogNvmInfo(token, arg)
+#endif
+#if LOG_LEVEL_NVM >= LOG_LEVEL_DEBUG
+#define LogNvmDebug(token, arg)     DebugIfLog(LOG_LEVEL_DEBUG, (token), (arg))
+#else
+#define LogNvmDebug(token, arg)
+#endif
 
+#endif /* __DEBUG_INTERFACE_H__ */
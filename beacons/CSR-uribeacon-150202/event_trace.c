@@ -0,0 +1,388 @@
+/******************************************************************************
+ *    Copyright (c) 2015 Cambridge Silicon Radio Limited 
+ *    All rights reserved.
+ * 
+ *    Redistribution and use in source and binary forms, with or without modification, 
+ *    are permitted (subject to the limitations in the disclaimer below) provided that the
+ *    following conditions are met:
+ *
+ *    Redistributions of source code must retain the above copyright notice, this list of 
+ *    conditions and the following disclaimer.
+ *
+ *    Redistributions in binary form must reproduce the above copyright notice, this list of conditions 
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ *    Neither the name of copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE. 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS" AND ANY EXPRESS 
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY 
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, 
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER 
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE 
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  FILE
+ *      event_trace.c
+ *
+ *  DESCRIPTION
+ *      Binary event trace kept in a RAM ring. See event_trace.h for the
+ *      format.
+ *
+ 
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <time.h>           /* Chip timer functions */
+#include <debug.h>          /* Simple host interface to the UART driver */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "event_trace.h"    /* Interface to this file */
+#include "user_config.h"    /* User configuration */
+
+#ifdef ENABLE_EVENT_TRACE
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Words per event in the ring: type and arg8, arg16, time */
+#define TRACE_EVENT_WORDS                   (3)
+
+/* Microseconds to ticks of 1024 us */
+#define TRACE_TICK_SHIFT                    (10)
+
+/* Largest value of the dropped counter */
+#define TRACE_DROPPED_MAX                   (0xFFFF)
+
+/* Bytes on each line written by TraceDrainUart() */
+#define TRACE_UART_LINE                     (16)
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* The events, oldest first from g_trace_first. A uint8 takes a whole word
+ * on the XAP, so each event is packed into three words. */
+static uint16 g_trace_ring[TRACE_EVENTS * TRACE_EVENT_WORDS];
+
+/* Index of the oldest event */
+static uint16 g_trace_first;
+
+/* Events in the ring */
+static uint16 g_trace_count;
+
+/* Events overwritten or logged while frozen */
+static uint16 g_trace_dropped;
+
+/* High 16 bits of the time of the last event */
+static uint16 g_trace_epoch;
+
+/* Time of the read in progress, in ticks. The ring does not change while
+ * a read is in progress. */
+static uint32 g_trace_read_time;
+static bool g_trace_frozen;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+/* Store an event in the ring */
+static void traceStore(uint16 type_arg8, uint16 arg16, uint16 time);
+
+/* Return the byte of the trace at offset */
+static uint8 traceByte(uint16 offset);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      traceStore
+ *
+ *  DESCRIPTION
+ *      This function stores an event in the ring, overwriting the oldest if
+ *      it is full.
+ *
+ *  PARAMETERS
+ *      type_arg8 [in]          Event type in the high byte, arg8 in the low
+ *      arg16 [in]              16-bit argument
+ *      time [in]               Low 16 bits of the time, in ticks
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void traceStore(uint16 type_arg8, uint16 arg16, uint16 time)
+{
+    uint16 index;                       /* Slot the event goes in */
+
+    if (g_trace_count < TRACE_EVENTS)
+    {
+        index = g_trace_first + g_trace_count;
+        g_trace_count++;
+    }
+    else
+    {
+        index = g_trace_first;
+        g_trace_first++;
+
+        if (g_trace_dropped < TRACE_DROPPED_MAX)
+        {
+            g_trace_dropped++;
+        }
+    }
+
+    if (index >= TRACE_EVENTS)
+    {
+        index -= TRACE_EVENTS;
+    }
+    if (g_trace_first >= TRACE_EVENTS)
+    {
+        g_trace_first = 0;
+    }
+
+    index *= TRACE_EVENT_WORDS;
+    g_trace_ring[index] = type_arg8;
+    g_trace_ring[index + 1] = arg16;
+    g_trace_ring[index + 2] = time;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      traceByte
+ *
+ *  DESCRIPTION
+ *      This function returns one byte of the trace in the format read by
+ *      the host.
+ *
+ *  PARAMETERS
+ *      offset [in]             Offset of the byte, below
+ *                              TRACE_HDR_SIZE + count * TRACE_EVENT_SIZE
+ *
+ *  RETURNS
+ *      The byte
+ *----------------------------------------------------------------------------*/
+static uint8 traceByte(uint16 offset)
+{
+    uint16 event;                       /* Event holding the byte */
+    uint16 word;                        /* Ring word holding the byte */
+
+    if (offset < TRACE_HDR_SIZE)
+    {
+        switch (offset)
+        {
+        case 0:
+            return TRACE_MAGIC_0;
+        case 1:
+            return TRACE_MAGIC_1;
+        case 2:
+            return TRACE_VERSION;
+        case 3:
+            return (uint8)g_trace_count;
+        case 4:
+            return g_trace_dropped & 0xFF;
+        case 5:
+            return (g_trace_dropped >> 8) & 0xFF;
+        default:
+            return (g_trace_read_time >> (8 * (offset - 6))) & 0xFF;
+        }
+    }
+
+    offset -= TRACE_HDR_SIZE;
+    event = g_trace_first + offset / TRACE_EVENT_SIZE;
+    if (event >= TRACE_EVENTS)
+    {
+        event -= TRACE_EVENTS;
+    }
+    offset %= TRACE_EVENT_SIZE;
+    word = g_trace_ring[event * TRACE_EVENT_WORDS + offset / 2];
+
+    /* The first word is sent type then arg8, the others little endian */
+    if (offset < 2)
+    {
+        return (offset == 0) ? (word >> 8) & 0xFF : word & 0xFF;
+    }
+    return (offset & 1) ? (word >> 8) & 0xFF : word & 0xFF;
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TraceInit
+ *
+ *  DESCRIPTION
+ *      This function empties the ring. Called once at start up.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TraceInit(void)
+{
+    g_trace_first = 0;
+    g_trace_count = 0;
+    g_trace_dropped = 0;
+    g_trace_frozen = FALSE;
+
+    /* Forces a time event before the first event */
+    g_trace_epoch = 0xFFFF;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TraceEvent
+ *
+ *  DESCRIPTION
+ *      This function records an event, preceded by a trace_event_time event
+ *      if the high half of the time has changed since the last one. Called
+ *      from the event handlers, so it only packs three words.
+ *
+ *  PARAMETERS
+ *      type [in]               Event type
+ *      arg8 [in]               8-bit argument
+ *      arg16 [in]              16-bit argument
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TraceEvent(trace_event type, uint8 arg8, uint16 arg16)
+{
+    uint32 now = TimeGet32() >> TRACE_TICK_SHIFT;   /* Time in ticks */
+    uint16 epoch = (uint16)(now >> 16);             /* High half of now */
+
+    if (g_trace_frozen)
+    {
+        if (g_trace_dropped < TRACE_DROPPED_MAX)
+        {
+            g_trace_dropped++;
+        }
+        return;
+    }
+
+    if (epoch != g_trace_epoch)
+    {
+        g_trace_epoch = epoch;
+        traceStore((uint16)trace_event_time << 8, epoch, (uint16)now);
+    }
+    traceStore(((uint16)type << 8) | arg8, arg16, (uint16)now);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TraceRead
+ *
+ *  DESCRIPTION
+ *      This function copies part of the trace for a read of the
+ *      URIBEACON_TRACE characteristic. A read at offset 0 freezes the ring
+ *      and takes the time for the header, so the Read Blobs that follow see
+ *      the same events; a read that returns fewer bytes than size, which
+ *      ends a Read Long, lets events in again.
+ *
+ *  PARAMETERS
+ *      offset [in]             Offset of the first byte
+ *      value [out]             Buffer for the bytes
+ *      size [in]               Size of value
+ *
+ *  RETURNS
+ *      Bytes copied, 0 at or past the end
+ *----------------------------------------------------------------------------*/
+extern uint16 TraceRead(uint16 offset, uint8 *value, uint16 size)
+{
+    uint16 end;                         /* Size of the whole trace */
+    uint16 i;                           /* Loop counter */
+
+    if (offset == 0)
+    {
+        g_trace_read_time = TimeGet32() >> TRACE_TICK_SHIFT;
+        g_trace_frozen = TRUE;
+    }
+
+    end = TRACE_HDR_SIZE + g_trace_count * TRACE_EVENT_SIZE;
+    for (i = 0; (i < size) && (offset + i < end); i++)
+    {
+        value[i] = traceByte(offset + i);
+    }
+
+    /* A short read is the last, as the client stops at one */
+    if (i < size)
+    {
+        g_trace_frozen = FALSE;
+    }
+    return i;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TraceResume
+ *
+ *  DESCRIPTION
+ *      This function lets events into the ring again after a read that did
+ *      not reach the end, for example because the client disconnected.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TraceResume(void)
+{
+    g_trace_frozen = FALSE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TraceDrainUart
+ *
+ *  DESCRIPTION
+ *      This function writes the whole trace to the UART, TRACE_UART_LINE
+ *      bytes a line as hex after "TRACE ", for uribeacon_trace to decode
+ *      from a terminal log. It writes synchronously, so it is meant for
+ *      ReportPanic() where nothing else is left to run.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TraceDrainUart(void)
+{
+#ifdef DEBUG_OUTPUT_ENABLED
+    uint16 end;                         /* Size of the whole trace */
+    uint16 offset;                      /* Byte being written */
+
+    g_trace_read_time = TimeGet32() >> TRACE_TICK_SHIFT;
+    end = TRACE_HDR_SIZE + g_trace_count * TRACE_EVENT_SIZE;
+
+    for (offset = 0; offset < end; offset++)
+    {
+        if ((offset % TRACE_UART_LINE) == 0)
+        {
+            DebugWriteString("\r\nTRACE ");
+        }
+        DebugWriteUint8(traceByte(offset));
+    }
+    DebugWriteString("\r\n");
+#endif /* DEBUG_OUTPUT_ENABLED */
+}
+
+#endif /* ENABLE_EVENT_TRACE */
@@ -0,0 +1,172 @@
+/******************************************************************************
+ *    Copyright (c) 2015 Cambridge Silicon Radio Limited 
+ *    All rights reserved.
+ * 
+ *    Redistribution and use in source and binary forms, with or without modification, 
+ *    are permitted (subject to the limitations in the disclaimer below) provided that the
+ *    following conditions are met:
+ *
+ *    Redistributions of source code must retain the above copyright notice, this list of 
+ *    conditions and the following disclaimer.
+ *
+ *    Redistributions in binary form must reproduce the above copyright notice, this list of conditions 
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ *    Neither the name of copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE. 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS" AND ANY EXPRESS 
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY 
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, 
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER 
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE 
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  FILE
+ *      event_trace.h
+ *
+ *  DESCRIPTION
+ *      Binary event trace kept in a RAM ring, for diagnosing beacons in the
+ *      field without the cost of debug strings on the UART.
+ *
+ *      Each event takes three words: its type and an 8-bit argument, a
+ *      16-bit argument, and the low 16 bits of the time in ticks of 1024 us,
+ *      which wrap every 67 seconds. Whenever the high 16 bits differ from
+ *      the last event's, a trace_event_time event carrying them goes first.
+ *      When the ring is full the oldest event is overwritten.
+ *
+ *      The ring is read from the URIBEACON_TRACE characteristic, or written
+ *      to the UART as hex by TraceDrainUart(), as ReportPanic() does. Both
+ *      give the same bytes, all integers little endian:
+ *
+ *        0  magic 'E' 'T'
+ *        2  version
+ *        3  event count
+ *        4  events dropped, overwritten or while frozen (2)
+ *        6  time when read, in ticks (4)
+ *       10  per event, oldest first: type, 8-bit argument, 16-bit
+ *           argument (2), low 16 bits of the time (2)
+ *
+ *      beacons/linux/uribeacon_trace decodes it into a timeline.
+ *
+ 
+ *
+ *****************************************************************************/
+
+#ifndef __EVENT_TRACE_H__
+#define __EVENT_TRACE_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "user_config.h"    /* User configuration */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Events kept in the ring */
+#define TRACE_EVENTS                        (64)
+
+/* Format of the bytes read */
+#define TRACE_MAGIC_0                       ('E')
+#define TRACE_MAGIC_1                       ('T')
+#define TRACE_VERSION                       (1)
+#define TRACE_HDR_SIZE                      (10)
+#define TRACE_EVENT_SIZE                    (6)
+#define TRACE_SIZE                          (TRACE_HDR_SIZE + \
+                                             TRACE_EVENTS * TRACE_EVENT_SIZE)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Event types. The host decoder knows them by number, so they are only
+ * ever added to. */
+typedef enum
+{
+    /* High 16 bits of the time of the events after it: arg16 */
+    trace_event_time = 1,
+
+    /* AppInit(): arg8 is the last sleep state */
+    trace_event_boot = 2,
+
+    /* SetState(): arg8 is the new state, arg16 the old */
+    trace_event_state = 3,
+
+    /* A timer fired: arg8 is a trace_timer, arg16 the timer ID */
+    trace_event_timer = 4,
+
+    /* GATT access: arg8 is the offset read or the length written, at most
+     * 255, arg16 the handle */
+    trace_event_gatt_read = 5,
+    trace_event_gatt_write = 6,
+
+    /* NVM access: arg8 is the length in words, arg16 the offset */
+    trace_event_nvm_read = 7,
+    trace_event_nvm_write = 8,
+
+    /* ReportPanic(): arg16 is the app_panic_code */
+    trace_event_panic = 9
+
+} trace_event;
+
+/* The application's timers */
+typedef enum
+{
+    trace_timer_advert = 1,
+    trace_timer_idle = 2,
+    trace_timer_conn_param = 3,
+    trace_timer_bonding = 4,
+    trace_timer_buzzer = 5,
+    trace_timer_button = 6
+
+} trace_timer;
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+#ifdef ENABLE_EVENT_TRACE
+
+/* Empty the ring */
+extern void TraceInit(void);
+
+/* Record an event */
+extern void TraceEvent(trace_event type, uint8 arg8, uint16 arg16);
+
+/* Copy up to size bytes of the trace from offset into value and return how
+ * many. A read at offset 0 freezes the ring until a read returns fewer than
+ * size bytes or TraceResume(), so the Read Blobs that follow see the same
+ * events. */
+extern uint16 TraceRead(uint16 offset, uint8 *value, uint16 size);
+
+/* Let events into the ring again after a read that did not finish */
+extern void TraceResume(void);
+
+/* Write the trace to the UART as lines of hex after "TRACE". Blocks until
+ * it is written. Does nothing without DEBUG_OUTPUT_ENABLED. */
+extern void TraceDrainUart(void);
+
+#else
+
+#define TraceInit()
+#define TraceEvent(type, arg8, arg16)
+#define TraceRead(offset, value, size)      (0)
+#define TraceResume()
+#define TraceDrainUart()
+
+#endif /* ENABLE_EVENT_TRACE */
+
+#endif /* __EVENT_TRACE_H__ */
@@ -51,6 +51,7 @@
 #include "uribeacon.h"    /* Definitions used throughout the GATT server */
 #include "buzzer.h"         /* Buzzer functions */
 #include "led.h"            /* LED functions */
+#include "event_trace.h"    /* Event trace */
 
 /*============================================================================*
  *  Private Definitions
@@ -112,6 +113,8 @@ static void handleExtraLongButtonPress(timer_id tid);
  *----------------------------------------------------------------------------*/
 static void handleExtraLongButtonPress(timer_id tid)
 {
+    TraceEvent(trace_event_timer, trace_timer_button, tid);
+
     if(tid == g_app_hw_data.button_press_tid)
     {
         /* Re-initialise button press timer */
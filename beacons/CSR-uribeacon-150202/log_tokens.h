@@ -0,0 +1,65 @@
+/******************************************************************************
+ *    Copyright (c) 2015 Cambridge Silicon Radio Limited 
+ *    All rights reserved.
+ * 
+ *    Redistribution and use in source and binary forms, with or without modification, 
+ *    are permitted (subject to the limitations in the disclaimer below) provided that the
+ *    following conditions are met:
+ *
+ *    Redistributions of source code must retain the above copyright notice, this list of 
+ *    conditions and the following disclaimer.
+ *
+ *    Redistributions in binary form must reproduce the above copyright notice, this list of conditions 
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ *    Neither the name of copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * 
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE. 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS" AND ANY EXPRESS 
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY 
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, 
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER 
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE 
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  FILE
+ *      log_tokens.h
+ *
+ *  DESCRIPTION
+ *      The messages the application logs. The log writes only a message's
+ *      number and argument to the UART; the text is here, and
+ *      beacons/linux/uribeacon_trace -l puts it back, so the texts take no
+ *      room in the image. Each message is LOG_TOKEN(name, text), numbered
+ *      in order from 0; text is a printf format for the 16-bit argument.
+ *      Messages are only added at the end, so old logs still decode.
+ *
+ *      The including file defines LOG_TOKEN; there is no include guard.
+ *
+ 
+ *
+ *****************************************************************************/
+
+/* Some records were lost to a full buffer: the number lost */
+LOG_TOKEN(log_dropped,          "%u records dropped")
+
+/* AppInit(): the last sleep state */
+LOG_TOKEN(log_boot,             "boot, last sleep state %u")
+
+/* SetState(): the old state in the high byte, the new in the low */
+LOG_TOKEN(log_state,            "state 0x%04x")
+
+/* A central connected: the connection ID */
+LOG_TOKEN(log_connected,        "connected, cid 0x%04x")
+
+/* The link dropped: the HCI reason */
+LOG_TOKEN(log_disconnected,     "disconnected, reason 0x%04x")
+
+/* Nvm_Write(): the offset in words */
+LOG_TOKEN(log_nvm_write,        "nvm write at %u")
+
+/* ReportPanic(): the app_panic_code */
+LOG_TOKEN(log_panic,            "panic %u")
@@ -51,6 +51,8 @@
 
 #include "nvm_access.h"     /* Interface to this file */
 #include "uribeacon.h"    /* Definitions used throughout the GATT server */
+#include "event_trace.h"    /* Event trace */
+#include "debug_interface.h"/* Application debug routines */
 
 /*============================================================================*
  *  Public Function Implementations
@@ -103,6 +105,8 @@ void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset)
 {
     sys_status result;
 
+    TraceEvent(trace_event_nvm_read, (uint8)length, offset);
+
     /* Read from NVM. Firmware re-enables the NVM if it is disabled */
     result = NvmRead(buffer, length, offset);
 
@@ -140,6 +144,9 @@ void Nvm_Write(uint16 *buffer, uint16 length, uint16 offset)
 {
     sys_status result;          /* Function status */
 
+    TraceEvent(trace_event_nvm_write, (uint8)length, offset);
+    LogNvmDebug(log_nvm_write, offset);
+
     /* Write to NVM. Firmware re-enables the NVM if it is disabled */
     result = NvmWrite(buffer, length, offset);
 
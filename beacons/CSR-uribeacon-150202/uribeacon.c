@@ -73,6 +73,7 @@
 #include "battery_service.h"/* Battery service interface */
 #include "uribeacon_service.h" /* Beacon service interface */
 #include "beaconing.h"      /* Beacon routines */
+#include "event_trace.h"    /* Event trace */
 
 /*============================================================================*
  *  Private Definitions
@@ -86,8 +87,9 @@
  *  This file:      bonding_reattempt_tid (if PAIRING_SUPPORT defined)
  *  hw_access.c:    button_press_tid
  *  This file:      connectable_advert_tid
+ *  debug_interface.c: g_log_tid (if DEBUG_OUTPUT_ENABLED defined)
  */
-#define MAX_APP_TIMERS                 (6)
+#define MAX_APP_TIMERS                 (6 + DEBUG_IF_TIMERS)
 
 /* Number of Identity Resolving Keys (IRKs) that application can store */
 #define MAX_NUMBER_IRK_STORED          (1)
@@ -568,6 +570,8 @@ static void enableWhiteList(void)
  *----------------------------------------------------------------------------*/
 static void appIdleTimerHandler(timer_id tid)
 {
+    TraceEvent(trace_event_timer, trace_timer_idle, tid);
+
     if(tid == g_app_data.app_tid)
     {
         /* Timer has just expired, so mark it as invalid */
@@ -645,6 +649,8 @@ static void appStartConnUpdateTimer(void)
  *----------------------------------------------------------------------------*/
 static void handleBondingChanceTimerExpiry(timer_id tid)
 {
+    TraceEvent(trace_event_timer, trace_timer_bonding, tid);
+
     if(g_app_data.bonding_reattempt_tid == tid)
     {
         /* The timer has just expired, so mark it as invalid */
@@ -682,6 +688,8 @@ static void requestConnParamUpdate(timer_id tid)
                     PREFERRED_SUPERVISION_TIMEOUT
                 };
 
+    TraceEvent(trace_event_timer, trace_timer_conn_param, tid);
+
     if(g_app_data.con_param_update_tid == tid)
     {
         /* Timer has just expired, so mark it as being invalid */
@@ -761,6 +769,8 @@ static void appExitAdvertising(void)
  *----------------------------------------------------------------------------*/
 static void appAdvertTimerHandler(timer_id tid)
 {
+    TraceEvent(trace_event_timer, trace_timer_advert, tid);
+
     /* Based upon the timer id, stop on-going advertisements */
     if(g_app_data.app_tid == tid)
     {
@@ -1021,6 +1031,7 @@ static void handleSignalGattConnectCfm(GATT_CONNECT_CFM_T *p_event_data)
             {
                 /* Store received UCID */
                 g_app_data.st_ucid = p_event_data->cid;
+                LogAppInfo(log_connected, p_event_data->cid);
 
                 /* Store connected BD Address */
                 g_app_data.con_bd_addr = p_event_data->bd_addr;
@@ -1590,6 +1601,10 @@ static void handleSignalGattAccessInd(GATT_ACCESS_IND_T *p_event_data)
                  ATT_ACCESS_PERMISSION | 
                  ATT_ACCESS_WRITE_COMPLETE))
             {
+                TraceEvent(trace_event_gatt_write,
+                           (p_event_data->size_value > 0xFF) ?
+                               0xFF : p_event_data->size_value,
+                           p_event_data->handle);
                 HandleAccessWrite(p_event_data);
             }
             /* Received GATT ACCESS IND with read access */
@@ -1597,6 +1612,16 @@ static void handleSignalGattAccessInd(GATT_ACCESS_IND_T *p_event_data)
                 (ATT_ACCESS_READ | 
                 ATT_ACCESS_PERMISSION))
             {
+#ifdef ENABLE_EVENT_TRACE
+                /* Reads of the trace itself would only fill it */
+                if(p_event_data->handle != HANDLE_URIBEACON_TRACE)
+                {
+                    TraceEvent(trace_event_gatt_read,
+                               (p_event_data->offset > 0xFF) ?
+                                   0xFF : p_event_data->offset,
+                               p_event_data->handle);
+                }
+#endif /* ENABLE_EVENT_TRACE */
                 HandleAccessRead(p_event_data);
             }
             else
@@ -1636,6 +1661,8 @@ static void handleSignalLmDisconnectComplete(
                 HCI_EV_DATA_DISCONNECT_COMPLETE_T *p_event_data)
 {
 
+    LogAppInfo(log_disconnected, p_event_data->reason);
+
     /* Set UCID to INVALID_UCID */
     g_app_data.st_ucid = GATT_INVALID_UCID;
 
@@ -1651,6 +1678,10 @@ static void handleSignalLmDisconnectComplete(
      * HCI_ERROR_OETC_* - Other end (i.e., remote host) terminated connection
      */
 
+    /* A client that disconnected part way through reading the trace will
+     * not finish */
+    TraceResume();
+
     /* ON DISCONNECT: Update the TX Power in *both* RADIO and ADV the tx_level_mode */
     UribeaconUpdateTxPowerFromMode(UribeaconGetTxPowerMode());
     /* ON DISCONNECT: Write out NVM state for UriBeacon Service (DONE LAST) */
@@ -1699,6 +1730,13 @@ static void handleSignalLmDisconnectComplete(
  *----------------------------------------------------------------------------*/
 extern void ReportPanic(app_panic_code panic_code)
 {
+    /* RAM does not survive the reset, so leave the log and the trace on the
+     * UART */
+    LogAppError(log_panic, panic_code);
+    TraceEvent(trace_event_panic, 0, panic_code);
+    DebugIfFlush();
+    TraceDrainUart();
+
     /* Raise panic */
     Panic(panic_code);
 }
@@ -1767,6 +1805,9 @@ extern void SetState(app_state new_state)
     
     if (old_state != new_state)
     {
+        TraceEvent(trace_event_state, new_state, old_state);
+        LogAppInfo(log_state, (old_state << 8) | new_state);
+
         /* Exit current state */
         switch (old_state)
         {
@@ -2139,12 +2180,9 @@ extern void AppInit(sleep_state last_sleep_state)
     BD_ADDR_T ra;
 #endif
    
-    /* Initialise application debug */
-    DebugIfInit();
-    
-    /* Start the debug messages on the UART */
-    DebugIfWriteString("\r\n\r\n**************************\r\n");
-    DebugIfWriteString("GATT server GAP peripheral\r\n\r\n");
+    /* Start the event trace */
+    TraceInit();
+    TraceEvent(trace_event_boot, last_sleep_state, 0);
 
     /* Use static random address for the application */
 #if defined(USE_STATIC_RANDOM_ADDRESS) && !defined(PAIRING_SUPPORT)
@@ -2157,6 +2195,10 @@ extern void AppInit(sleep_state last_sleep_state)
 
     /* Initialise the application timers */
     TimerInit(MAX_APP_TIMERS, (void*)app_timers);
+
+    /* Initialise application debug, which writes the log from a timer */
+    DebugIfInit();
+    LogAppInfo(log_boot, last_sleep_state);
     
     /* Initialise local timers */
     g_app_data.con_param_update_tid = TIMER_INVALID;
@@ -55,6 +55,8 @@
 #include "beaconing.h"      /* Beaconing routines */
 #include "nvm_access.h"     /* Non-volatile memory access */
 #include "app_gatt_db.h"    /* GATT database definitions */
+#include "event_trace.h"    /* Event trace */
+#include "../core/uribeacon_core.h" /* Shared frame and record format */
 
 /*============================================================================*
  *  Constants Arrays  
@@ -165,9 +167,103 @@ static uint8 g_uribeacon_nvm_write_flag = FALSE;
 /* Temporary buffer used for read/write characteristics */
 static uint8 g_uribeacon_buf[URIBEACON_PERIOD_SIZE];
 
+/* State snapshot, packed when its first part is read */
+static uint8 g_uribeacon_state[URIBEACON_STATE_MAX];
+static uint8 g_uribeacon_state_length;
+
+/* URI continuation advertised in the scan response */
+static uint8 g_uribeacon_continuation[URIBEACON_CONTINUATION_SIZE];
+static uint8 g_uribeacon_continuation_length;
+
 /* NVM Offset at which URIBEACON data is stored */
 static uint16 g_uribeacon_nvm_offset;
 
+/* Persistence record in the shared uribeacon_core format, as stored in NVM */
+static uint8 g_uribeacon_record[URIBEACON_RECORD_SIZE];
+
+/* The continuation follows the record in NVM: its length, the length
+ * inverted as a check, and the data */
+#define URIBEACON_CONTINUATION_NVM_SIZE (2 + URIBEACON_CONTINUATION_SIZE)
+static uint8 g_uribeacon_continuation_nvm[URIBEACON_CONTINUATION_NVM_SIZE];
+
+#ifdef ENABLE_EVENT_TRACE
+/* The trace is too big to copy whole, so each read returns what fits in a
+ * Read Blob Response at the default ATT_MTU (23 octets) - 1 */
+#define URIBEACON_TRACE_CHUNK           (23 - 1)
+static uint8 g_uribeacon_trace_chunk[URIBEACON_TRACE_CHUNK];
+#endif /* ENABLE_EVENT_TRACE */
+
+/*============================================================================*
+ *  Private Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      uribeaconGetConfig
+ *
+ *  DESCRIPTION
+ *      This function copies the Beacon Service data into a uribeacon_core
+ *      configuration.
+ *
+ *  PARAMETERS
+ *      config [out]            Configuration to fill in
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void uribeaconGetConfig(uribeacon_config_t *config)
+{
+    uint8 i;
+
+    config->lock_state = g_uribeacon_data.lock_state;
+    MemCopy(config->lock_code, g_uribeacon_data.lock_code, URIBEACON_LOCK_CODE_SIZE);
+    config->uri_length = g_uribeacon_data.adv_length - BEACON_DATA_HDR_SIZE;
+    MemCopy(config->uri, g_uribeacon_data.adv.uri_data, URIBEACON_DATA_MAX);
+    config->flags = g_uribeacon_data.adv.flags;
+    config->tx_power_mode = g_uribeacon_data.tx_power_mode;
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        config->adv_tx_power_levels[i] = g_uribeacon_data.adv_tx_power_levels[i];
+        config->radio_tx_power_levels[i] = g_uribeacon_data.radio_tx_power_levels[i];
+    }
+    config->period = g_uribeacon_data.period;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      uribeaconSetConfig
+ *
+ *  DESCRIPTION
+ *      This function loads a validated uribeacon_core configuration into the
+ *      Beacon Service data and rebuilds the ADV data from it.
+ *
+ *  PARAMETERS
+ *      config [in]             Configuration to load
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void uribeaconSetConfig(const uribeacon_config_t *config)
+{
+    uint8 i;
+
+    g_uribeacon_data.lock_state = config->lock_state;
+    MemCopy(g_uribeacon_data.lock_code, config->lock_code, URIBEACON_LOCK_CODE_SIZE);
+    g_uribeacon_data.tx_power_mode = config->tx_power_mode;
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        g_uribeacon_data.adv_tx_power_levels[i] = config->adv_tx_power_levels[i] & 0xFF;
+        g_uribeacon_data.radio_tx_power_levels[i] = config->radio_tx_power_levels[i] & 0xFF;
+    }
+    g_uribeacon_data.period = config->period;
+
+    /* URIBEACON_ADV_T is laid out as the frame the core builds */
+    MemSet(g_uribeacon_data.adv.uri_data, 0, URIBEACON_DATA_MAX);
+    g_uribeacon_data.adv_length = uribeacon_frame_build(config,
+                                        (uint8*) &g_uribeacon_data.adv,
+                                        sizeof(g_uribeacon_data.adv));
+}
+
 
 /*============================================================================*
  *  Public Function Implementations
@@ -248,6 +344,9 @@ extern void UribeaconInitChipReset(void)
     
     /* Set default period = 1000 milliseconds */
     g_uribeacon_data.period = 1000;
+
+    /* No URI continuation */
+    g_uribeacon_continuation_length = 0;
     
     /* Flag data structure needs writing to NVM */
     g_uribeacon_nvm_write_flag = TRUE;    
@@ -274,6 +373,7 @@ extern void UribeaconHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
     uint8 *p_val = NULL;                /* Pointer to attribute value */
     sys_status rc = sys_status_success; /* Function status */
     uint8 uri_data_size = 0;            /* Size of uri data */
+    uribeacon_config_t config;          /* Configuration for the snapshot */
     
     switch(p_ind->handle)
     {  
@@ -325,6 +425,38 @@ extern void UribeaconHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
         p_val = g_uribeacon_buf;            
         break;         
         
+    case HANDLE_URIBEACON_STATE:
+        /* Pack on the first read only, so that the Read Blob for the rest
+         * of a long URI continues the same snapshot */
+        if (p_ind->offset == 0)
+        {
+            uribeaconGetConfig(&config);
+            g_uribeacon_state_length = uribeacon_state_write(&config, g_uribeacon_state);
+        }
+        if (p_ind->offset > g_uribeacon_state_length)
+        {
+            rc = gatt_status_invalid_offset;
+        }
+        else
+        {
+            length = g_uribeacon_state_length - p_ind->offset;
+            p_val = &g_uribeacon_state[p_ind->offset];
+        }
+        break;
+
+    case HANDLE_URIBEACON_URI_CONTINUATION:
+        length = g_uribeacon_continuation_length;
+        p_val = g_uribeacon_continuation;
+        break;
+
+#ifdef ENABLE_EVENT_TRACE
+    case HANDLE_URIBEACON_TRACE:
+        length = TraceRead(p_ind->offset, g_uribeacon_trace_chunk,
+                           URIBEACON_TRACE_CHUNK);
+        p_val = g_uribeacon_trace_chunk;
+        break;
+#endif /* ENABLE_EVENT_TRACE */
+
         /* NO MATCH */
         
      default:
@@ -437,6 +569,26 @@ extern void UribeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
         }
         break;     
         
+    case HANDLE_URIBEACON_URI_CONTINUATION:
+        if (g_uribeacon_data.lock_state)
+        {
+            rc = gatt_status_insufficient_authorization;
+        }
+        else if (p_size > URIBEACON_CONTINUATION_SIZE)
+        {
+            rc = gatt_status_invalid_length;
+        }
+        else
+        {
+            /* An empty write removes the continuation */
+            MemCopy(g_uribeacon_continuation, p_value, p_size);
+            g_uribeacon_continuation_length = p_size;
+
+            /* Flag state needs writing to NVM */
+            g_uribeacon_nvm_write_flag = TRUE;
+        }
+        break;
+
     case HANDLE_URIBEACON_FLAGS:
         if (g_uribeacon_data.lock_state)
         {
@@ -528,8 +680,8 @@ extern void UribeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
         /* Update the adv tx power levels */
         else 
         {
-            /* Updated the tx power calibration table for the pkt */
-            MemCopy(g_uribeacon_data.adv_tx_power_levels, p_value, URIBEACON_ADV_TX_POWER_LEVELS_SIZE);
+            /* Updated the tx power calibration table for the radio */
+            MemCopy(g_uribeacon_data.radio_tx_power_levels, p_value, URIBEACON_RADIO_TX_POWER_LEVELS_SIZE);
             
             /* Flag state needs writing to NVM */
             g_uribeacon_nvm_write_flag = TRUE;                 
@@ -547,13 +699,10 @@ extern void UribeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
         }
         else
         {
-            /* Write the period (little endian 16-bits in p_value) */;   
-            g_uribeacon_data.period = p_value[0] + (p_value[1] << 8);  
-            
-            if ((g_uribeacon_data.period < BEACON_PERIOD_MIN) && (g_uribeacon_data.period != 0))
-            { /* minimum beacon period is 100ms; zero turns off beaconing */
-                g_uribeacon_data.period = BEACON_PERIOD_MIN;
-            }
+            /* Write the period (little endian 16-bits in p_value). The
+             * minimum beacon period is 100ms; zero turns off beaconing */
+            g_uribeacon_data.period =
+                    uribeacon_period_clamp(p_value[0] + (p_value[1] << 8));
             /* Flag state needs writing to NVM */
             g_uribeacon_nvm_write_flag = TRUE;           
         }
@@ -603,6 +752,22 @@ extern void UribeaconGetData(uint8** data, uint8* data_size)
     *data_size = g_uribeacon_data.adv_length;
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      UribeaconGetContinuation
+ *
+ *  DESCRIPTION
+ *      This function returns the URI continuation for the scan response
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void UribeaconGetContinuation(uint8** data, uint8* data_size)
+{
+    *data = g_uribeacon_continuation;
+    *data_size = g_uribeacon_continuation_length;
+}
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      UribeaconGetPeriod
@@ -636,13 +801,43 @@ extern uint32 UribeaconGetPeriodMillis(void)
  *----------------------------------------------------------------------------*/
 extern void UribeaconReadDataFromNVM(uint16 *p_offset)
 {
+    uribeacon_config_t config;
+    uint8 length;
+    
     g_uribeacon_nvm_offset = *p_offset;
     
-    /* Read beacon data size */
-    Nvm_Read((uint16*)&g_uribeacon_data, sizeof(g_uribeacon_data),
+    /* Read the beacon record; one byte per word on the XAP */
+    Nvm_Read((uint16*)g_uribeacon_record, URIBEACON_RECORD_SIZE,
              g_uribeacon_nvm_offset);
     
-    *p_offset += sizeof(g_uribeacon_data);
+    if (uribeacon_record_read(&config, g_uribeacon_record) == URIBEACON_OK)
+    {
+        uribeaconSetConfig(&config);
+    }
+    else
+    { /* Corrupt or older record: start from the defaults, which are
+       * flagged for writing to NVM */
+        UribeaconInitChipReset();
+    }
+    
+    /* Read the continuation, which NVM written before it existed does not
+     * hold: its length check then fails and it stays empty */
+    Nvm_Read((uint16*)g_uribeacon_continuation_nvm, URIBEACON_CONTINUATION_NVM_SIZE,
+             g_uribeacon_nvm_offset + URIBEACON_RECORD_SIZE);
+    length = g_uribeacon_continuation_nvm[0] & 0xFF;
+    if ((length <= URIBEACON_CONTINUATION_SIZE) &&
+        ((g_uribeacon_continuation_nvm[1] & 0xFF) == (~length & 0xFF)) &&
+        !g_uribeacon_nvm_write_flag)
+    {
+        MemCopy(g_uribeacon_continuation, &g_uribeacon_continuation_nvm[2], length);
+        g_uribeacon_continuation_length = length;
+    }
+    else
+    {
+        g_uribeacon_continuation_length = 0;
+    }
+    
+    *p_offset += URIBEACON_RECORD_SIZE + URIBEACON_CONTINUATION_NVM_SIZE;
 }
 
 /*----------------------------------------------------------------------------*
@@ -673,13 +868,25 @@ extern void UribeaconWriteDataToNVM(uint16 *p_offset)
     /* Only write out the uribeacon data if it is flagged dirty */
     if (g_uribeacon_nvm_write_flag) 
     {
+        uribeacon_config_t config;
+        
         /* Write all uribeacon service data into NVM */
-        Nvm_Write((uint16*)&g_uribeacon_data, sizeof(g_uribeacon_data),
+        uribeaconGetConfig(&config);
+        uribeacon_record_write(&config, g_uribeacon_record);
+        Nvm_Write((uint16*)g_uribeacon_record, URIBEACON_RECORD_SIZE,
                   g_uribeacon_nvm_offset); 
+
+        g_uribeacon_continuation_nvm[0] = g_uribeacon_continuation_length;
+        g_uribeacon_continuation_nvm[1] = ~g_uribeacon_continuation_length & 0xFF;
+        MemSet(&g_uribeacon_continuation_nvm[2], 0, URIBEACON_CONTINUATION_SIZE);
+        MemCopy(&g_uribeacon_continuation_nvm[2], g_uribeacon_continuation,
+                g_uribeacon_continuation_length);
+        Nvm_Write((uint16*)g_uribeacon_continuation_nvm, URIBEACON_CONTINUATION_NVM_SIZE,
+                  g_uribeacon_nvm_offset + URIBEACON_RECORD_SIZE);
         g_uribeacon_nvm_write_flag = FALSE;
     }
     
-    *p_offset += sizeof(g_uribeacon_data);   
+    *p_offset += URIBEACON_RECORD_SIZE + URIBEACON_CONTINUATION_NVM_SIZE;   
 }
 
 /*----------------------------------------------------------------------------*
@@ -82,6 +82,9 @@
 #define URIBEACON_PERIOD_SIZE (2)
 #define URIBEACON_RESET_SIZE (1)
 
+/* URI continuation for the scan response, limited to one write */
+#define URIBEACON_CONTINUATION_SIZE MAX_CHARACTERISTIC_LENGTH
+
 /* TX Power mode values */
 #define TX_POWER_MODE_LOWEST   (0)
 /* DEFAULT */
@@ -117,9 +120,6 @@
 #define RADIO_TX_POWER_CONFIG RADIO_TX_POWER_NEG_2
 #define ADV_TX_POWER_CONFIG ADV_TX_POWER_FOR_NEG_2
 
-/* Time in milliseconds */
-#define BEACON_PERIOD_MIN (100)
-
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -143,6 +143,9 @@ extern void UribeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
 /* Returns the current value of the beacon data */
 extern void UribeaconGetData(uint8** data, uint8* data_size);
 
+/* Returns the URI continuation for the scan response, of size 0 if none */
+extern void UribeaconGetContinuation(uint8** data, uint8* data_size);
+
 /* Returns the current value of the beacon period */
 extern uint32 UribeaconGetPeriodMillis(void);
 
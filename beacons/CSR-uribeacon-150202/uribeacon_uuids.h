@@ -65,5 +65,8 @@
 #define UUID_URIBEACON_PERIOD                0xee0c2088878640baab9699b91ac981d8
 #define UUID_URIBEACON_RESET                 0xee0c2089878640baab9699b91ac981d8
 #define UUID_URIBEACON_RADIO_TX_POWER_LEVELS 0xee0c208a878640baab9699b91ac981d8  
+#define UUID_URIBEACON_STATE                 0xee0c208b878640baab9699b91ac981d8
+#define UUID_URIBEACON_URI_CONTINUATION      0xee0c208c878640baab9699b91ac981d8
+#define UUID_URIBEACON_TRACE                 0xee0c208d878640baab9699b91ac981d8
 
 #endif /* __URIBEACON_UUIDS_H__ */
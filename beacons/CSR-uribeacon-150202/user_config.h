@@ -65,6 +65,22 @@
 #define DEBUG_OUTPUT_ENABLED
 */
 
+/* With DEBUG_OUTPUT_ENABLED, these macros set the log level of each module,
+ * see debug_interface.h. Messages above a module's level are not compiled.
+ */
+/*#define LOG_LEVEL_APP                  LOG_LEVEL_INFO*/
+/*#define LOG_LEVEL_SERVICE              LOG_LEVEL_INFO*/
+/*#define LOG_LEVEL_NVM                  LOG_LEVEL_ERROR*/
+
+/* The ENABLE_EVENT_TRACE macro controls whether the binary event trace of
+ * event_trace.h is compiled. It takes TRACE_EVENTS * 3 words of RAM and adds
+ * the URIBEACON_TRACE characteristic, which can be read without unlocking the
+ * beacon, so it is meant for development builds only.
+ */
+/*
+#define ENABLE_EVENT_TRACE
+*/
+
 /* The CONNECTED_IDLE_TIMEOUT_VALUE macro specifies how long the application may
  * be idle for during the Connected state. The device will disconnect when this
  * timer expires. Vendors are free to decide whether to enable this timeout, and
@@ -0,0 +1,415 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uribeacon_core.h"
+
+/* AD types */
+#define AD_TYPE_COMPLETE_16BIT_UUIDS    (0x03)
+#define AD_TYPE_SERVICE_DATA            (0x16)
+
+/*
+ * Persistence record layout. Fields are ordered from the least to the most
+ * frequently rewritten so that a differential flash update, which always
+ * ends at the CRC, stays short.
+ */
+#define RECORD_MAGIC_0                  (0x55)  /* 'U' */
+#define RECORD_MAGIC_1                  (0x42)  /* 'B' */
+#define RECORD_VERSION                  (1)
+
+#define RECORD_OFFSET_MAGIC             (0)
+#define RECORD_OFFSET_VERSION           (2)
+#define RECORD_OFFSET_LOCK_STATE        (6)     /* 3 bytes reserved before */
+#define RECORD_OFFSET_LOCK_CODE         (7)
+#define RECORD_OFFSET_ADV_LEVELS        (23)
+#define RECORD_OFFSET_RADIO_LEVELS      (27)
+#define RECORD_OFFSET_URI_LENGTH        (31)
+#define RECORD_OFFSET_URI               (32)
+#define RECORD_OFFSET_TX_POWER_MODE     (50)
+#define RECORD_OFFSET_FLAGS             (51)
+#define RECORD_OFFSET_PERIOD            (52)
+#define RECORD_OFFSET_CRC               (54)
+
+/* State snapshot layout */
+#define STATE_OFFSET_LOCK_STATE         (0)
+#define STATE_OFFSET_FLAGS              (1)
+#define STATE_OFFSET_TX_POWER_MODE      (2)
+#define STATE_OFFSET_PERIOD             (3)
+#define STATE_OFFSET_ADV_LEVELS         (5)
+#define STATE_OFFSET_RADIO_LEVELS       (9)
+#define STATE_OFFSET_URI_LENGTH         (13)
+#define STATE_OFFSET_URI                (14)
+
+/* http://uribeacon.org */
+static const uint8_t default_uri[] =
+{
+    0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08
+};
+
+/* CRC-16/CCITT-FALSE, bitwise to keep the flash cost down. */
+static uint16_t crc16(const uint8_t *data, uint8_t length)
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+    uint8_t bit;
+
+    for (i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)((data[i] & 0xFF) << 8);
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000)
+            {
+                crc = (uint16_t)((crc << 1) ^ 0x1021);
+            }
+            else
+            {
+                crc = (uint16_t)(crc << 1);
+            }
+        }
+    }
+    return crc;
+}
+
+void uribeacon_config_defaults(uribeacon_config_t *config)
+{
+    uint8_t i;
+
+    config->lock_state = 0;
+    for (i = 0; i < URIBEACON_LOCK_CODE_SIZE; i++)
+    {
+        config->lock_code[i] = 0;
+    }
+    config->uri_length = sizeof(default_uri);
+    for (i = 0; i < URIBEACON_URI_MAX; i++)
+    {
+        config->uri[i] = (i < sizeof(default_uri)) ? default_uri[i] : 0;
+    }
+    config->flags = 0;
+    config->tx_power_mode = URIBEACON_TX_POWER_MODE_LOW;
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        config->adv_tx_power_levels[i] = 0;
+        config->radio_tx_power_levels[i] = 0;
+    }
+    config->period = URIBEACON_PERIOD_DEFAULT;
+}
+
+uribeacon_status_t uribeacon_config_validate(const uribeacon_config_t *config)
+{
+    if ((config->lock_state & 0xFF) > 1)
+    {
+        return URIBEACON_ERR_FORMAT;
+    }
+    if ((config->uri_length & 0xFF) > URIBEACON_URI_MAX)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+    if ((config->tx_power_mode & 0xFF) >= URIBEACON_TX_POWER_MODES)
+    {
+        return URIBEACON_ERR_TX_POWER_MODE;
+    }
+    if ((config->period != 0) && (config->period < URIBEACON_PERIOD_MIN))
+    {
+        return URIBEACON_ERR_PERIOD;
+    }
+    return URIBEACON_OK;
+}
+
+uint16_t uribeacon_period_clamp(uint16_t period)
+{
+    if ((period != 0) && (period < URIBEACON_PERIOD_MIN))
+    {
+        return URIBEACON_PERIOD_MIN;
+    }
+    return period;
+}
+
+uint8_t uribeacon_service_data_build(const uribeacon_config_t *config,
+                                     uint8_t *data, uint8_t size)
+{
+    uint8_t length = 0;
+    uint8_t i;
+
+    if ((uribeacon_config_validate(config) != URIBEACON_OK) ||
+        (size < URIBEACON_SERVICE_DATA_HDR_SIZE + config->uri_length))
+    {
+        return 0;
+    }
+
+    data[length++] = URIBEACON_SERVICE_UUID & 0xFF;
+    data[length++] = (URIBEACON_SERVICE_UUID >> 8) & 0xFF;
+    data[length++] = config->flags & 0xFF;
+    data[length++] = config->adv_tx_power_levels[config->tx_power_mode] & 0xFF;
+    for (i = 0; i < config->uri_length; i++)
+    {
+        data[length++] = config->uri[i] & 0xFF;
+    }
+    return length;
+}
+
+uint8_t uribeacon_frame_build(const uribeacon_config_t *config,
+                              uint8_t *frame, uint8_t size)
+{
+    uint8_t length;
+
+    /* Complete list of 16-bit service UUIDs and the service data header */
+    if (size < 6)
+    {
+        return 0;
+    }
+    frame[0] = 3;
+    frame[1] = AD_TYPE_COMPLETE_16BIT_UUIDS;
+    frame[2] = URIBEACON_SERVICE_UUID & 0xFF;
+    frame[3] = (URIBEACON_SERVICE_UUID >> 8) & 0xFF;
+
+    length = uribeacon_service_data_build(config, &frame[6], size - 6);
+    if (length == 0)
+    {
+        return 0;
+    }
+    frame[4] = length + 1;
+    frame[5] = AD_TYPE_SERVICE_DATA;
+    return length + 6;
+}
+
+uribeacon_status_t uribeacon_frame_check(const uint8_t *ad, uint8_t length)
+{
+    uint8_t offset = 0;
+    uint8_t field;
+
+    if (length > URIBEACON_FRAME_MAX)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+    while (offset < length)
+    {
+        field = ad[offset] & 0xFF;
+        /* Every structure has a type and must end within the frame */
+        if ((field == 0) || (field > length - offset - 1))
+        {
+            return URIBEACON_ERR_FORMAT;
+        }
+        offset += field + 1;
+    }
+    return URIBEACON_OK;
+}
+
+uint8_t uribeacon_scan_response_build(const uint8_t *continuation, uint8_t length,
+                                      uint8_t *data, uint8_t size)
+{
+    uint8_t i;
+
+    if ((length == 0) || (length > URIBEACON_CONTINUATION_MAX) || (size < length + 4))
+    {
+        return 0;
+    }
+    data[0] = length + 3;
+    data[1] = AD_TYPE_SERVICE_DATA;
+    data[2] = URIBEACON_SERVICE_UUID & 0xFF;
+    data[3] = (URIBEACON_SERVICE_UUID >> 8) & 0xFF;
+    for (i = 0; i < length; i++)
+    {
+        data[4 + i] = continuation[i] & 0xFF;
+    }
+    return length + 4;
+}
+
+uint8_t uribeacon_continuation_find(const uint8_t *ad, uint8_t length,
+                                    uint8_t *offset)
+{
+    uint8_t position = 0;
+    uint8_t field;
+
+    while (position + 1 < length)
+    {
+        field = ad[position] & 0xFF;
+        if ((field == 0) || (field > length - position - 1))
+        {
+            return 0;
+        }
+        /* Service data with the UriBeacon UUID and at least one URI byte */
+        if ((field > 3) && ((ad[position + 1] & 0xFF) == AD_TYPE_SERVICE_DATA) &&
+            ((ad[position + 2] & 0xFF) == (URIBEACON_SERVICE_UUID & 0xFF)) &&
+            ((ad[position + 3] & 0xFF) == ((URIBEACON_SERVICE_UUID >> 8) & 0xFF)))
+        {
+            if (field - 3 > URIBEACON_CONTINUATION_MAX)
+            {
+                return 0;
+            }
+            *offset = position + 4;
+            return field - 3;
+        }
+        position += field + 1;
+    }
+    return 0;
+}
+
+void uribeacon_record_write(const uribeacon_config_t *config, uint8_t *record)
+{
+    uint8_t i;
+    uint16_t crc;
+
+    for (i = 0; i < URIBEACON_RECORD_SIZE; i++)
+    {
+        record[i] = 0;
+    }
+    record[RECORD_OFFSET_MAGIC] = RECORD_MAGIC_0;
+    record[RECORD_OFFSET_MAGIC + 1] = RECORD_MAGIC_1;
+    record[RECORD_OFFSET_VERSION] = RECORD_VERSION;
+    record[RECORD_OFFSET_LOCK_STATE] = config->lock_state & 0xFF;
+    for (i = 0; i < URIBEACON_LOCK_CODE_SIZE; i++)
+    {
+        record[RECORD_OFFSET_LOCK_CODE + i] = config->lock_code[i] & 0xFF;
+    }
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        record[RECORD_OFFSET_ADV_LEVELS + i] = config->adv_tx_power_levels[i] & 0xFF;
+        record[RECORD_OFFSET_RADIO_LEVELS + i] = config->radio_tx_power_levels[i] & 0xFF;
+    }
+    record[RECORD_OFFSET_URI_LENGTH] = config->uri_length & 0xFF;
+    for (i = 0; i < URIBEACON_URI_MAX; i++)
+    {
+        record[RECORD_OFFSET_URI + i] = config->uri[i] & 0xFF;
+    }
+    record[RECORD_OFFSET_TX_POWER_MODE] = config->tx_power_mode & 0xFF;
+    record[RECORD_OFFSET_FLAGS] = config->flags & 0xFF;
+    record[RECORD_OFFSET_PERIOD] = config->period & 0xFF;
+    record[RECORD_OFFSET_PERIOD + 1] = (config->period >> 8) & 0xFF;
+
+    crc = crc16(record, RECORD_OFFSET_CRC);
+    record[RECORD_OFFSET_CRC] = crc & 0xFF;
+    record[RECORD_OFFSET_CRC + 1] = (crc >> 8) & 0xFF;
+}
+
+/* Sign extends a stored byte; int8_t is wider than 8 bits on the XAP. */
+static int8_t to_int8(uint8_t value)
+{
+    return (int8_t)((value & 0x80) ? (int)(value & 0xFF) - 0x100 : (int)(value & 0xFF));
+}
+
+uribeacon_status_t uribeacon_record_read(uribeacon_config_t *config,
+                                         const uint8_t *record)
+{
+    uribeacon_config_t restored;
+    uribeacon_status_t status;
+    uint16_t crc;
+    uint8_t i;
+
+    if (((record[RECORD_OFFSET_MAGIC] & 0xFF) != RECORD_MAGIC_0) ||
+        ((record[RECORD_OFFSET_MAGIC + 1] & 0xFF) != RECORD_MAGIC_1) ||
+        ((record[RECORD_OFFSET_VERSION] & 0xFF) != RECORD_VERSION))
+    {
+        return URIBEACON_ERR_FORMAT;
+    }
+    crc = (uint16_t)((record[RECORD_OFFSET_CRC] & 0xFF) |
+                     ((record[RECORD_OFFSET_CRC + 1] & 0xFF) << 8));
+    if (crc != crc16(record, RECORD_OFFSET_CRC))
+    {
+        return URIBEACON_ERR_CRC;
+    }
+
+    restored.lock_state = record[RECORD_OFFSET_LOCK_STATE] & 0xFF;
+    for (i = 0; i < URIBEACON_LOCK_CODE_SIZE; i++)
+    {
+        restored.lock_code[i] = record[RECORD_OFFSET_LOCK_CODE + i] & 0xFF;
+    }
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        restored.adv_tx_power_levels[i] = to_int8(record[RECORD_OFFSET_ADV_LEVELS + i]);
+        restored.radio_tx_power_levels[i] = to_int8(record[RECORD_OFFSET_RADIO_LEVELS + i]);
+    }
+    restored.uri_length = record[RECORD_OFFSET_URI_LENGTH] & 0xFF;
+    for (i = 0; i < URIBEACON_URI_MAX; i++)
+    {
+        restored.uri[i] = record[RECORD_OFFSET_URI + i] & 0xFF;
+    }
+    restored.tx_power_mode = record[RECORD_OFFSET_TX_POWER_MODE] & 0xFF;
+    restored.flags = record[RECORD_OFFSET_FLAGS] & 0xFF;
+    restored.period = (uint16_t)((record[RECORD_OFFSET_PERIOD] & 0xFF) |
+                                 ((record[RECORD_OFFSET_PERIOD + 1] & 0xFF) << 8));
+
+    status = uribeacon_config_validate(&restored);
+    if (status == URIBEACON_OK)
+    {
+        *config = restored;
+    }
+    return status;
+}
+
+uint8_t uribeacon_state_write(const uribeacon_config_t *config, uint8_t *state)
+{
+    uint8_t length = config->uri_length & 0xFF;
+    uint8_t i;
+
+    if (length > URIBEACON_URI_MAX)
+    {
+        length = URIBEACON_URI_MAX;
+    }
+    state[STATE_OFFSET_LOCK_STATE] = config->lock_state & 0xFF;
+    state[STATE_OFFSET_FLAGS] = config->flags & 0xFF;
+    state[STATE_OFFSET_TX_POWER_MODE] = config->tx_power_mode & 0xFF;
+    state[STATE_OFFSET_PERIOD] = config->period & 0xFF;
+    state[STATE_OFFSET_PERIOD + 1] = (config->period >> 8) & 0xFF;
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        state[STATE_OFFSET_ADV_LEVELS + i] = config->adv_tx_power_levels[i] & 0xFF;
+        state[STATE_OFFSET_RADIO_LEVELS + i] = config->radio_tx_power_levels[i] & 0xFF;
+    }
+    state[STATE_OFFSET_URI_LENGTH] = length;
+    for (i = 0; i < length; i++)
+    {
+        state[STATE_OFFSET_URI + i] = config->uri[i] & 0xFF;
+    }
+    return STATE_OFFSET_URI + length;
+}
+
+uribeacon_status_t uribeacon_state_read(uribeacon_config_t *config,
+                                        const uint8_t *state, uint8_t length)
+{
+    uribeacon_config_t restored;
+    uribeacon_status_t status;
+    uint8_t i;
+
+    if ((length < URIBEACON_STATE_HDR_SIZE) ||
+        (length != STATE_OFFSET_URI + (state[STATE_OFFSET_URI_LENGTH] & 0xFF)))
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+
+    restored = *config;
+    restored.lock_state = state[STATE_OFFSET_LOCK_STATE] & 0xFF;
+    restored.flags = state[STATE_OFFSET_FLAGS] & 0xFF;
+    restored.tx_power_mode = state[STATE_OFFSET_TX_POWER_MODE] & 0xFF;
+    restored.period = (uint16_t)((state[STATE_OFFSET_PERIOD] & 0xFF) |
+                                 ((state[STATE_OFFSET_PERIOD + 1] & 0xFF) << 8));
+    for (i = 0; i < URIBEACON_TX_POWER_MODES; i++)
+    {
+        restored.adv_tx_power_levels[i] = to_int8(state[STATE_OFFSET_ADV_LEVELS + i]);
+        restored.radio_tx_power_levels[i] = to_int8(state[STATE_OFFSET_RADIO_LEVELS + i]);
+    }
+    restored.uri_length = state[STATE_OFFSET_URI_LENGTH] & 0xFF;
+    for (i = 0; i < URIBEACON_URI_MAX; i++)
+    {
+        restored.uri[i] = (i < restored.uri_length) ? (state[STATE_OFFSET_URI + i] & 0xFF) : 0;
+    }
+
+    status = uribeacon_config_validate(&restored);
+    if (status == URIBEACON_OK)
+    {
+        *config = restored;
+    }
+    return status;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Portable UriBeacon core shared by the firmware in beacons/.
+ *
+ * The core builds the UriBeacon advertising frame, validates a beacon
+ * configuration, serializes it to a fixed size persistence record and
+ * encodes and decodes URIs. It has no static state, allocates nothing and
+ * needs no header beyond <stdint.h>; every buffer is owned by the caller. Values are handled a byte at a time and
+ * masked to 8 bits so the same code runs on targets where char is wider
+ * than 8 bits (the CSR XAP).
+ */
+
+#ifndef URIBEACON_CORE_H__
+#define URIBEACON_CORE_H__
+
+#if defined(URIBEACON_CORE_UENERGY)
+/* The CSR uEnergy SDK has no <stdint.h>. */
+#include <types.h>
+typedef int8   int8_t;
+typedef uint8  uint8_t;
+typedef uint16 uint16_t;
+#else
+#include <stdint.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 16-bit UriBeacon service UUID. */
+#define URIBEACON_SERVICE_UUID          (0xFED8)
+
+/* Maximum size of an advertising payload, including the Flags AD. */
+#define URIBEACON_ADV_MAX               (31)
+
+/* Size of the Flags AD, which the stacks add themselves. */
+#define URIBEACON_ADV_FLAGS_SIZE        (3)
+
+/* Maximum size of the frame built by uribeacon_frame_build(). */
+#define URIBEACON_FRAME_MAX             (URIBEACON_ADV_MAX - URIBEACON_ADV_FLAGS_SIZE)
+
+/* Service data: UUID (2), flags (1), TX power (1) and the encoded URI. */
+#define URIBEACON_SERVICE_DATA_HDR_SIZE (4)
+#define URIBEACON_URI_MAX               (18)
+#define URIBEACON_SERVICE_DATA_MAX      (URIBEACON_SERVICE_DATA_HDR_SIZE + URIBEACON_URI_MAX)
+
+#define URIBEACON_LOCK_CODE_SIZE        (16)
+
+/* A URI longer than URIBEACON_URI_MAX may continue in the scan response, in
+ * a service data AD of its own: UUID (2) and up to URIBEACON_CONTINUATION_MAX
+ * further URI bytes. The advertised flags then have
+ * URIBEACON_FLAG_URI_CONTINUED set. */
+#define URIBEACON_FLAG_URI_CONTINUED    (0x02)
+#define URIBEACON_CONTINUATION_MAX      (URIBEACON_ADV_MAX - 4)
+#define URIBEACON_URI_EXTENDED_MAX      (URIBEACON_URI_MAX + URIBEACON_CONTINUATION_MAX)
+
+/* A deployment dictionary gives the reserved expansion codes
+ * URIBEACON_DICT_CODE_FIRST..URIBEACON_DICT_CODE_LAST site specific strings.
+ * A URI encoded with one carries the dictionary's version, 1 to
+ * URIBEACON_DICT_VERSION_MAX, in the top four bits of the flags; 0 means the
+ * built-in codes only. */
+#define URIBEACON_DICT_CODE_FIRST       (0x0E)
+#define URIBEACON_DICT_CODE_LAST        (0x20)
+#define URIBEACON_DICT_SIZE             (URIBEACON_DICT_CODE_LAST - URIBEACON_DICT_CODE_FIRST + 1)
+#define URIBEACON_DICT_ENTRY_MAX        (32)
+#define URIBEACON_DICT_VERSION_MAX      (15)
+#define URIBEACON_FLAGS_DICT_VERSION(flags) (((flags) >> 4) & 0x0F)
+#define URIBEACON_FLAGS_WITH_DICT(flags, version) \
+    ((uint8_t)(((flags) & 0x0F) | (((version) & 0x0F) << 4)))
+
+/* TX power modes index the power level tables. */
+#define URIBEACON_TX_POWER_MODE_LOWEST  (0)
+#define URIBEACON_TX_POWER_MODE_LOW     (1)
+#define URIBEACON_TX_POWER_MODE_MEDIUM  (2)
+#define URIBEACON_TX_POWER_MODE_HIGH    (3)
+#define URIBEACON_TX_POWER_MODES        (4)
+
+/* Beacon period in milliseconds; zero disables beaconing. */
+#define URIBEACON_PERIOD_MIN            (100)
+#define URIBEACON_PERIOD_DEFAULT        (1000)
+
+/* Size of the persistence record written by uribeacon_record_write(). It is
+ * a multiple of four bytes so it can be stored with word writes. */
+#define URIBEACON_RECORD_SIZE           (56)
+
+/* The state snapshot written by uribeacon_state_write() is the readable
+ * configuration, without the lock code, packed for one GATT read: lock state,
+ * flags, TX power mode, period (2, little endian), the advertised and radio
+ * power levels (4 each), the URI length and the URI. */
+#define URIBEACON_STATE_HDR_SIZE        (14)
+#define URIBEACON_STATE_MAX             (URIBEACON_STATE_HDR_SIZE + URIBEACON_URI_MAX)
+
+typedef enum
+{
+    URIBEACON_OK = 0,
+    URIBEACON_ERR_LENGTH,           /* buffer too small or field too long */
+    URIBEACON_ERR_TX_POWER_MODE,    /* TX power mode out of range */
+    URIBEACON_ERR_PERIOD,           /* non-zero period below the minimum */
+    URIBEACON_ERR_FORMAT,           /* malformed frame or record */
+    URIBEACON_ERR_CRC               /* record failed its integrity check */
+} uribeacon_status_t;
+
+/* A deployment dictionary. entries[i] is the expansion of code
+ * URIBEACON_DICT_CODE_FIRST + i, or NULL if the code is unused. */
+typedef struct
+{
+    uint8_t     version;
+    const char *entries[URIBEACON_DICT_SIZE];
+} uribeacon_dict_t;
+
+/* A beacon configuration, as exposed by the UriBeacon Config Service. The
+ * radio levels are the platform's own register or dBm values. */
+typedef struct
+{
+    uint8_t  lock_state;
+    uint8_t  lock_code[URIBEACON_LOCK_CODE_SIZE];
+    uint8_t  uri_length;
+    uint8_t  uri[URIBEACON_URI_MAX];
+    uint8_t  flags;
+    uint8_t  tx_power_mode;
+    int8_t   adv_tx_power_levels[URIBEACON_TX_POWER_MODES];
+    int8_t   radio_tx_power_levels[URIBEACON_TX_POWER_MODES];
+    uint16_t period;
+} uribeacon_config_t;
+
+/* Default configuration advertising http://uribeacon.org. The power level
+ * tables are platform specific and are left zero. */
+void uribeacon_config_defaults(uribeacon_config_t *config);
+
+/* Checks the ranges of every field. */
+uribeacon_status_t uribeacon_config_validate(const uribeacon_config_t *config);
+
+/* Raises a non-zero period below URIBEACON_PERIOD_MIN to the minimum. */
+uint16_t uribeacon_period_clamp(uint16_t period);
+
+/* Writes the UriBeacon service data (UUID, flags, TX power, URI) to data.
+ * Returns its length, or 0 if the configuration is invalid or size is too
+ * small. */
+uint8_t uribeacon_service_data_build(const uribeacon_config_t *config,
+                                     uint8_t *data, uint8_t size);
+
+/* Writes the complete UriBeacon frame, the 16-bit service UUID list followed
+ * by the service data AD, without the Flags AD. Returns its length, or 0. */
+uint8_t uribeacon_frame_build(const uribeacon_config_t *config,
+                              uint8_t *frame, uint8_t size);
+
+/* Checks that ad holds well formed AD structures that fit an advertising
+ * payload alongside the Flags AD. */
+uribeacon_status_t uribeacon_frame_check(const uint8_t *ad, uint8_t length);
+
+/* Writes the scan response carrying a URI continuation, its service data
+ * AD, to data. Returns its length, or 0 if length is 0 or above
+ * URIBEACON_CONTINUATION_MAX or size is too small. */
+uint8_t uribeacon_scan_response_build(const uint8_t *continuation, uint8_t length,
+                                      uint8_t *data, uint8_t size);
+
+/* Finds the UriBeacon service data AD in the length bytes of scan response
+ * ad. Returns the length of the URI continuation it carries, with its offset
+ * in ad in *offset, or 0 if there is none. */
+uint8_t uribeacon_continuation_find(const uint8_t *ad, uint8_t length,
+                                    uint8_t *offset);
+
+/* Serializes config to record, which must be URIBEACON_RECORD_SIZE bytes. */
+void uribeacon_record_write(const uribeacon_config_t *config, uint8_t *record);
+
+/* Restores config from record. config is only written when the record is
+ * intact and holds a valid configuration. */
+uribeacon_status_t uribeacon_record_read(uribeacon_config_t *config,
+                                         const uint8_t *record);
+
+/* Writes the state snapshot of config to state, which must hold
+ * URIBEACON_STATE_MAX bytes. Returns its length. */
+uint8_t uribeacon_state_write(const uribeacon_config_t *config, uint8_t *state);
+
+/* Restores every field of config but the lock code from a state snapshot.
+ * config is only written when the snapshot is complete and valid. */
+uribeacon_status_t uribeacon_state_read(uribeacon_config_t *config,
+                                        const uint8_t *state, uint8_t length);
+
+/*
+ * URI codec, in uribeacon_uri.c. Firmware that is handed encoded URIs by the
+ * Config Service does not need to link it.
+ */
+
+/* Most characters after the scheme that the encoder takes. */
+#define URIBEACON_URI_TEXT_MAX          (255)
+
+/* Encodes the NUL terminated uri with the scheme prefix and expansion codes
+ * into data, choosing the shortest encoding. On success *length is the
+ * encoded length, zero for an empty uri. Fails with URIBEACON_ERR_FORMAT for
+ * an unknown scheme or a malformed urn:uuid, and URIBEACON_ERR_LENGTH if the
+ * encoding exceeds size or the uri has more than URIBEACON_URI_TEXT_MAX
+ * characters after its scheme. */
+uribeacon_status_t uribeacon_uri_encode(const char *uri, uint8_t *data,
+                                        uint8_t size, uint8_t *length);
+
+/* As uribeacon_uri_encode(), also using the codes of dict, which may be
+ * NULL. The caller advertises dict->version in the flags. */
+uribeacon_status_t uribeacon_uri_encode_dict(const char *uri, const uribeacon_dict_t *dict,
+                                             uint8_t *data, uint8_t size, uint8_t *length);
+
+/* Decodes length bytes of encoded URI into uri as a NUL terminated string;
+ * a urn:uuid is written in lower case. Fails with URIBEACON_ERR_FORMAT for
+ * an unknown scheme or a short UUID, and URIBEACON_ERR_LENGTH if the string
+ * and its terminator exceed size. */
+uribeacon_status_t uribeacon_uri_decode(const uint8_t *data, uint8_t length,
+                                        char *uri, uint16_t size);
+
+/* As uribeacon_uri_decode(), expanding the codes of dict, which may be NULL.
+ * The caller checks that the flags carry dict->version. Reserved codes dict
+ * leaves unused are passed through, as without one. */
+uribeacon_status_t uribeacon_uri_decode_dict(const uint8_t *data, uint8_t length,
+                                             const uribeacon_dict_t *dict,
+                                             char *uri, uint16_t size);
+
+/* Checks a dictionary: a version of 1 to URIBEACON_DICT_VERSION_MAX, and
+ * entries of 1 to URIBEACON_DICT_ENTRY_MAX printable characters other than
+ * space. */
+uribeacon_status_t uribeacon_dict_check(const uribeacon_dict_t *dict);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URIBEACON_CORE_H__ */
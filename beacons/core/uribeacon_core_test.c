@@ -0,0 +1,448 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host tests and benchmark for the portable UriBeacon core.
+ *
+ *   uribeacon_core_test           run the tests
+ *   uribeacon_core_test --bench   time frame building, the record round trip and
+ *                                 URI decoding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uribeacon_core.h"
+
+static int failures = 0;
+
+#define EXPECT_EQ(expected, actual)                                         \
+    do {                                                                    \
+        long long e = (expected), a = (actual);                             \
+        if (e != a) {                                                       \
+            fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n",       \
+                    __FILE__, __LINE__, #actual, e, a);                     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define EXPECT_BYTES(expected, actual, length)                              \
+    do {                                                                    \
+        if (memcmp((expected), (actual), (length)) != 0) {                  \
+            fprintf(stderr, "%s:%d: %s does not match\n",                   \
+                    __FILE__, __LINE__, #actual);                           \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void test_config(uribeacon_config_t *config)
+{
+    static const int8_t adv_levels[] = {-20, -4, 0, 10};
+
+    uribeacon_config_defaults(config);
+    memcpy(config->adv_tx_power_levels, adv_levels, sizeof(adv_levels));
+}
+
+static void test_default_frame(void)
+{
+    static const uint8_t expected[] = {
+        0x03, 0x03, 0xD8, 0xFE,
+        0x10, 0x16, 0xD8, 0xFE,
+        0x00,                   /* flags */
+        0xFC,                   /* TX_POWER_MODE_LOW: -4 dBm */
+        0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08
+    };
+    uribeacon_config_t config;
+    uint8_t frame[URIBEACON_FRAME_MAX];
+
+    test_config(&config);
+    EXPECT_EQ(URIBEACON_OK, uribeacon_config_validate(&config));
+    EXPECT_EQ(sizeof(expected), uribeacon_frame_build(&config, frame, sizeof(frame)));
+    EXPECT_BYTES(expected, frame, sizeof(expected));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_frame_check(frame, sizeof(expected)));
+}
+
+static void test_longest_frame_fits(void)
+{
+    uribeacon_config_t config;
+    uint8_t frame[URIBEACON_FRAME_MAX];
+
+    test_config(&config);
+    config.uri_length = URIBEACON_URI_MAX;
+    EXPECT_EQ(URIBEACON_FRAME_MAX, uribeacon_frame_build(&config, frame, sizeof(frame)));
+    EXPECT_EQ(0, uribeacon_frame_build(&config, frame, sizeof(frame) - 1));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_frame_check(frame, URIBEACON_FRAME_MAX));
+}
+
+static void test_invalid_config_builds_nothing(void)
+{
+    uribeacon_config_t config;
+    uint8_t frame[URIBEACON_FRAME_MAX];
+
+    test_config(&config);
+    config.tx_power_mode = URIBEACON_TX_POWER_MODES;
+    EXPECT_EQ(URIBEACON_ERR_TX_POWER_MODE, uribeacon_config_validate(&config));
+    EXPECT_EQ(0, uribeacon_frame_build(&config, frame, sizeof(frame)));
+
+    test_config(&config);
+    config.uri_length = URIBEACON_URI_MAX + 1;
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_config_validate(&config));
+    EXPECT_EQ(0, uribeacon_service_data_build(&config, frame, sizeof(frame)));
+
+    test_config(&config);
+    config.period = URIBEACON_PERIOD_MIN - 1;
+    EXPECT_EQ(URIBEACON_ERR_PERIOD, uribeacon_config_validate(&config));
+    config.period = 0;
+    EXPECT_EQ(URIBEACON_OK, uribeacon_config_validate(&config));
+}
+
+static void test_period_clamp(void)
+{
+    EXPECT_EQ(0, uribeacon_period_clamp(0));
+    EXPECT_EQ(URIBEACON_PERIOD_MIN, uribeacon_period_clamp(1));
+    EXPECT_EQ(URIBEACON_PERIOD_MIN, uribeacon_period_clamp(URIBEACON_PERIOD_MIN));
+    EXPECT_EQ(5000, uribeacon_period_clamp(5000));
+}
+
+static void test_frame_check_rejects_malformed(void)
+{
+    static const uint8_t truncated[] = {0x03, 0x03, 0xD8};
+    static const uint8_t empty_field[] = {0x03, 0x03, 0xD8, 0xFE, 0x00};
+    uint8_t too_long[URIBEACON_FRAME_MAX + 1];
+
+    memset(too_long, 0, sizeof(too_long));
+    too_long[0] = sizeof(too_long) - 1;
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_frame_check(truncated, sizeof(truncated)));
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_frame_check(empty_field, sizeof(empty_field)));
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_frame_check(too_long, sizeof(too_long)));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_frame_check(too_long, 0));
+}
+
+static void test_record_round_trip(void)
+{
+    static const int8_t radio_levels[] = {-18, -10, -2, 6};
+    uribeacon_config_t config;
+    uribeacon_config_t restored;
+    uint8_t record[URIBEACON_RECORD_SIZE];
+
+    EXPECT_EQ(0, URIBEACON_RECORD_SIZE % 4);
+
+    test_config(&config);
+    memcpy(config.radio_tx_power_levels, radio_levels, sizeof(radio_levels));
+    memset(config.lock_code, 0xA5, sizeof(config.lock_code));
+    config.lock_state = 1;
+    config.flags = 0x01;
+    config.tx_power_mode = URIBEACON_TX_POWER_MODE_HIGH;
+    config.period = 0x1234;
+    uribeacon_record_write(&config, record);
+
+    memset(&restored, 0, sizeof(restored));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_record_read(&restored, record));
+    EXPECT_EQ(0, memcmp(&config, &restored, sizeof(config)));
+}
+
+static void test_record_rejects_damage(void)
+{
+    uribeacon_config_t config;
+    uribeacon_config_t restored;
+    uint8_t record[URIBEACON_RECORD_SIZE];
+    unsigned i;
+
+    test_config(&config);
+
+    /* Erased flash */
+    memset(record, 0xFF, sizeof(record));
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_record_read(&restored, record));
+
+    /* Any single bit flip past the magic and version */
+    for (i = 3 * 8; i < sizeof(record) * 8; i++) {
+        uribeacon_record_write(&config, record);
+        record[i / 8] ^= 1 << (i % 8);
+        if (uribeacon_record_read(&restored, record) != URIBEACON_ERR_CRC) {
+            fprintf(stderr, "%s:%d: bit %u flip not detected\n", __FILE__, __LINE__, i);
+            failures++;
+            break;
+        }
+    }
+
+    /* An intact record holding an invalid configuration leaves config alone */
+    config.tx_power_mode = 7;
+    uribeacon_record_write(&config, record);
+    test_config(&restored);
+    EXPECT_EQ(URIBEACON_ERR_TX_POWER_MODE, uribeacon_record_read(&restored, record));
+    EXPECT_EQ(URIBEACON_TX_POWER_MODE_LOW, restored.tx_power_mode);
+}
+
+static void test_state_round_trip(void)
+{
+    static const int8_t radio_levels[] = {-18, -10, -2, 6};
+    uribeacon_config_t config;
+    uribeacon_config_t restored;
+    uint8_t state[URIBEACON_STATE_MAX];
+    uint8_t length;
+
+    test_config(&config);
+    memcpy(config.radio_tx_power_levels, radio_levels, sizeof(radio_levels));
+    config.lock_state = 1;
+    config.flags = 0x01;
+    config.period = 0x1234;
+    length = uribeacon_state_write(&config, state);
+    EXPECT_EQ(URIBEACON_STATE_HDR_SIZE + config.uri_length, length);
+
+    /* The lock code is not part of the snapshot and is left alone */
+    memset(&restored, 0, sizeof(restored));
+    memset(restored.lock_code, 0xA5, sizeof(restored.lock_code));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_state_read(&restored, state, length));
+    memcpy(restored.lock_code, config.lock_code, sizeof(config.lock_code));
+    EXPECT_EQ(0, memcmp(&config, &restored, sizeof(config)));
+
+    /* A full URI still fits */
+    config.uri_length = URIBEACON_URI_MAX;
+    EXPECT_EQ(URIBEACON_STATE_MAX, uribeacon_state_write(&config, state));
+
+    /* Truncated, for example by a read that stopped at the MTU */
+    length = uribeacon_state_write(&config, state);
+    test_config(&restored);
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_state_read(&restored, state, length - 1));
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_state_read(&restored, state, 3));
+    config.tx_power_mode = 7;
+    length = uribeacon_state_write(&config, state);
+    EXPECT_EQ(URIBEACON_ERR_TX_POWER_MODE, uribeacon_state_read(&restored, state, length));
+    EXPECT_EQ(URIBEACON_TX_POWER_MODE_LOW, restored.tx_power_mode);
+}
+
+static void test_scan_response(void)
+{
+    static const uint8_t expected[] = {0x06, 0x16, 0xD8, 0xFE, 'f', 'l', 'e'};
+    uint8_t continuation[URIBEACON_CONTINUATION_MAX + 1];
+    uint8_t data[URIBEACON_ADV_MAX];
+    uint8_t offset = 0;
+
+    EXPECT_EQ(sizeof(expected), uribeacon_scan_response_build((const uint8_t *)"fle", 3,
+                                                              data, sizeof(data)));
+    EXPECT_BYTES(expected, data, sizeof(expected));
+    EXPECT_EQ(3, uribeacon_continuation_find(data, sizeof(expected), &offset));
+    EXPECT_EQ(4, offset);
+
+    /* A full continuation fills the scan response; one byte more is refused */
+    memset(continuation, 'x', sizeof(continuation));
+    EXPECT_EQ(URIBEACON_ADV_MAX, uribeacon_scan_response_build(continuation,
+              URIBEACON_CONTINUATION_MAX, data, sizeof(data)));
+    EXPECT_EQ(URIBEACON_CONTINUATION_MAX, uribeacon_continuation_find(data, sizeof(data), &offset));
+    EXPECT_EQ(0, uribeacon_scan_response_build(continuation, sizeof(continuation),
+                                               data, sizeof(data)));
+    EXPECT_EQ(0, uribeacon_scan_response_build(continuation, 0, data, sizeof(data)));
+    EXPECT_EQ(0, uribeacon_scan_response_build(continuation, 10, data, 13));
+
+    /* Found after other structures; absent from a name or a bare UUID */
+    data[0] = 0x03;
+    data[1] = 0x09;
+    data[2] = 'a';
+    data[3] = 'b';
+    uribeacon_scan_response_build((const uint8_t *)"fle", 3, &data[4], sizeof(data) - 4);
+    EXPECT_EQ(3, uribeacon_continuation_find(data, 11, &offset));
+    EXPECT_EQ(8, offset);
+    EXPECT_EQ(0, uribeacon_continuation_find(data, 4, &offset));
+    data[4] = 0x03;
+    EXPECT_EQ(0, uribeacon_continuation_find(data, 8, &offset));
+    /* Truncated */
+    data[4] = 0x06;
+    EXPECT_EQ(0, uribeacon_continuation_find(data, 10, &offset));
+}
+
+static void test_uri_codec(void)
+{
+    static const uint8_t url[] = {0x03, '1', '2', '3', 0x00, '1', '2', '3'};
+    static const uint8_t uuid[] = {
+        0x04, 0xB1, 0xE1, 0x3D, 0x51, 0x5F, 0xC9, 0x4D, 0x5B,
+        0x90, 0x2B, 0xAB, 0x66, 0x8D, 0xD5, 0x49, 0x81
+    };
+    uint8_t data[URIBEACON_URI_MAX];
+    uint8_t length = 0xFF;
+    char uri[64];
+
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode("", data, sizeof(data), &length));
+    EXPECT_EQ(0, length);
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode("HTTPS://123.com/123", data, sizeof(data), &length));
+    EXPECT_EQ(sizeof(url), length);
+    EXPECT_BYTES(url, data, sizeof(url));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode(url, sizeof(url), uri, sizeof(uri)));
+    EXPECT_EQ(0, strcmp("https://123.com/123", uri));
+
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode("urn:uuid:B1E13D51-5FC9-4D5B-902B-AB668DD54981",
+                                                 data, sizeof(data), &length));
+    EXPECT_EQ(sizeof(uuid), length);
+    EXPECT_BYTES(uuid, data, sizeof(uuid));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode(uuid, sizeof(uuid), uri, sizeof(uri)));
+    EXPECT_EQ(0, strcmp("urn:uuid:b1e13d51-5fc9-4d5b-902b-ab668dd54981", uri));
+
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_uri_encode("ftp://a.com", data, sizeof(data), &length));
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_uri_encode("urn:uuid:B1E13D51", data, sizeof(data), &length));
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_uri_encode("http://www.abcdefghijklmnopq.org",
+                                                         data, sizeof(data), &length));
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_uri_decode(uuid, sizeof(uuid) - 1, uri, sizeof(uri)));
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_uri_decode(url, sizeof(url), uri, 19));
+}
+
+static void test_uri_dictionary(void)
+{
+    static const char *const long_url = "https://events.example.com/venues/hall-b/booth/12";
+    static const uint8_t encoded[] = {0x03, 0x0E, 0x0F, 'h', 'a', 'l', 'l', '-', 'b', 0x10, '1', '2'};
+    uribeacon_dict_t dict;
+    uint8_t data[URIBEACON_URI_MAX];
+    uint8_t length;
+    char uri[64];
+
+    memset(&dict, 0, sizeof(dict));
+    dict.version = 1;
+    dict.entries[0] = "events.example.com/";
+    dict.entries[1] = "venues/";
+    dict.entries[2] = "/booth/";
+    EXPECT_EQ(URIBEACON_OK, uribeacon_dict_check(&dict));
+
+    /* Too long for an advertisement without the dictionary, 12 bytes with it */
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_uri_encode(long_url, data, sizeof(data), &length));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode_dict(long_url, &dict, data, sizeof(data), &length));
+    EXPECT_EQ(sizeof(encoded), length);
+    EXPECT_BYTES(encoded, data, sizeof(encoded));
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode_dict(data, length, &dict, uri, sizeof(uri)));
+    EXPECT_EQ(0, strcmp(long_url, uri));
+    /* Without it the codes pass through */
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode(data, length, uri, sizeof(uri)));
+    EXPECT_EQ(0x0E, uri[8]);
+
+    /* The shortest encoding, where the longest first match is not: "examp"
+     * then "le.com/shop" beats "example", ".com/" and "shop" spelt out */
+    memset(&dict, 0, sizeof(dict));
+    dict.version = 2;
+    dict.entries[0] = "examp";
+    dict.entries[1] = "example";
+    dict.entries[2] = "le.com/shop";
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode_dict("http://example.com/shop", &dict, data,
+                                                      sizeof(data), &length));
+    EXPECT_EQ(3, length);
+    EXPECT_EQ(0x0E, data[1]);
+    EXPECT_EQ(0x10, data[2]);
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode_dict(data, length, &dict, uri, sizeof(uri)));
+    EXPECT_EQ(0, strcmp("http://example.com/shop", uri));
+
+    EXPECT_EQ(2, URIBEACON_FLAGS_DICT_VERSION(URIBEACON_FLAGS_WITH_DICT(0x01, 2)));
+    EXPECT_EQ(0x21, URIBEACON_FLAGS_WITH_DICT(0x01, 2));
+
+    /* Malformed dictionaries */
+    EXPECT_EQ(URIBEACON_OK, uribeacon_dict_check(&dict));
+    dict.entries[3] = "";
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_dict_check(&dict));
+    dict.entries[3] = "a b";
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_dict_check(&dict));
+    dict.entries[3] = "0123456789012345678901234567890123";
+    EXPECT_EQ(URIBEACON_ERR_LENGTH, uribeacon_dict_check(&dict));
+    dict.entries[3] = NULL;
+    dict.version = URIBEACON_DICT_VERSION_MAX + 1;
+    EXPECT_EQ(URIBEACON_ERR_FORMAT, uribeacon_dict_check(&dict));
+}
+
+static void run_tests(void)
+{
+    test_default_frame();
+    test_longest_frame_fits();
+    test_invalid_config_builds_nothing();
+    test_period_clamp();
+    test_frame_check_rejects_malformed();
+    test_record_round_trip();
+    test_record_rejects_damage();
+    test_state_round_trip();
+    test_scan_response();
+    test_uri_codec();
+    test_uri_dictionary();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+}
+
+static double ns_per_iteration(clock_t start, long iterations)
+{
+    return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / iterations;
+}
+
+static void run_benchmarks(void)
+{
+    static const long ITERATIONS = 2000000;
+    uribeacon_config_t config;
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    uint8_t record[URIBEACON_RECORD_SIZE];
+    uribeacon_dict_t dict;
+    uint8_t uri[64];
+    uint8_t uri_length;
+    char text[64];
+    unsigned sink = 0;
+    clock_t start;
+    long i;
+
+    test_config(&config);
+    config.uri_length = URIBEACON_URI_MAX;
+
+    start = clock();
+    for (i = 0; i < ITERATIONS; i++) {
+        config.flags = (uint8_t)i;
+        sink += uribeacon_frame_build(&config, frame, sizeof(frame));
+    }
+    printf("%-16s %8.1f ns\n", "frame build", ns_per_iteration(start, ITERATIONS));
+
+    start = clock();
+    for (i = 0; i < ITERATIONS; i++) {
+        config.flags = (uint8_t)i;
+        uribeacon_record_write(&config, record);
+        sink += uribeacon_record_read(&config, record);
+    }
+    printf("%-16s %8.1f ns\n", "record round trip", ns_per_iteration(start, ITERATIONS));
+
+    /* Dictionary codes are expanded by the same direct lookup as the
+     * built-in ones, so a URI decodes as fast either way per code */
+    memset(&dict, 0, sizeof(dict));
+    dict.version = 1;
+    dict.entries[0] = "events.example";
+    dict.entries[1] = "venues/";
+    uribeacon_uri_encode("https://events.example.com/venues/", uri, sizeof(uri), &uri_length);
+    start = clock();
+    for (i = 0; i < ITERATIONS; i++) {
+        sink += uribeacon_uri_decode(uri, uri_length, text, sizeof(text));
+    }
+    printf("%-16s %8.1f ns\n", "uri decode", ns_per_iteration(start, ITERATIONS));
+    uribeacon_uri_encode_dict("https://events.example.com/venues/", &dict, uri, sizeof(uri),
+                              &uri_length);
+    start = clock();
+    for (i = 0; i < ITERATIONS; i++) {
+        sink += uribeacon_uri_decode_dict(uri, uri_length, &dict, text, sizeof(text));
+    }
+    printf("%-16s %8.1f ns\n", "uri decode dict", ns_per_iteration(start, ITERATIONS));
+
+    if (sink == 0) {
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if ((argc > 1) && (strcmp(argv[1], "--bench") == 0)) {
+        run_benchmarks();
+        return EXIT_SUCCESS;
+    }
+    run_tests();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
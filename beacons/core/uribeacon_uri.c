@@ -0,0 +1,403 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include "uribeacon_core.h"
+
+/* Scheme prefix codes, see specification/AdvertisingMode.md */
+#define SCHEME_COUNT                    (5)
+#define SCHEME_URN_UUID                 (4)
+
+/* HTTP URL expansion codes 0x00..0x0d, then the deployment dictionary's */
+#define EXPANSION_COUNT                 (14)
+#define CODE_COUNT                      (URIBEACON_DICT_CODE_LAST + 1)
+
+/* Marks a character copied as is in the shortest encoding. */
+#define CHOICE_LITERAL                  (0xFF)
+
+#define UUID_SIZE                       (16)
+#define UUID_STRING_LENGTH              (36)
+
+static const char *const schemes[SCHEME_COUNT] =
+{
+    "http://www.",
+    "https://www.",
+    "http://",
+    "https://",
+    "urn:uuid:"
+};
+
+static const char *const expansions[EXPANSION_COUNT] =
+{
+    ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+    ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov"
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* The expansion of code, by direct lookup, or NULL if it has none. */
+static const char *expansion_of(uint8_t code, const uribeacon_dict_t *dict)
+{
+    if (code < EXPANSION_COUNT)
+    {
+        return expansions[code];
+    }
+    if ((dict != NULL) && (code >= URIBEACON_DICT_CODE_FIRST) &&
+        (code <= URIBEACON_DICT_CODE_LAST))
+    {
+        return dict->entries[code - URIBEACON_DICT_CODE_FIRST];
+    }
+    return NULL;
+}
+
+/* Returns the length of prefix if str starts with it, otherwise 0. Scheme
+ * prefixes are matched without regard to case. */
+static uint8_t match_prefix(const char *str, const char *prefix, uint8_t fold_case)
+{
+    uint8_t i;
+    char c;
+
+    for (i = 0; prefix[i] != '\0'; i++)
+    {
+        c = str[i];
+        if (fold_case && (c >= 'A') && (c <= 'Z'))
+        {
+            c = c - 'A' + 'a';
+        }
+        if (c != prefix[i])
+        {
+            return 0;
+        }
+    }
+    return i;
+}
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Parses a canonical 8-4-4-4-12 UUID string into 16 big endian bytes. */
+static uribeacon_status_t encode_uuid(const char *uuid, uint8_t *data)
+{
+    uint8_t i;
+    uint8_t out = 0;
+    int high;
+    int low;
+
+    for (i = 0; i < UUID_STRING_LENGTH; i += 2)
+    {
+        if ((i == 8) || (i == 13) || (i == 18) || (i == 23))
+        {
+            if (uuid[i] != '-')
+            {
+                return URIBEACON_ERR_FORMAT;
+            }
+            i++;
+        }
+        high = hex_value(uuid[i]);
+        low = (high < 0) ? -1 : hex_value(uuid[i + 1]);
+        if (low < 0)
+        {
+            return URIBEACON_ERR_FORMAT;
+        }
+        data[out++] = (uint8_t)((high << 4) | low);
+    }
+    return (uuid[UUID_STRING_LENGTH] == '\0') ? URIBEACON_OK : URIBEACON_ERR_FORMAT;
+}
+
+/* Encodes text, the URI after its scheme, with the fewest codes. cost[p] is
+ * the length of the shortest encoding of the text from p, found from the end
+ * back; choice[p] is the code that starts it. A tie goes to the longest
+ * expansion, as ".com/" over ".com" then "/". */
+static uribeacon_status_t encode_text(const char *text, const uribeacon_dict_t *dict,
+                                      uint8_t *data, uint8_t size, uint8_t *length)
+{
+    uint8_t cost[URIBEACON_URI_TEXT_MAX + 1];
+    uint8_t choice[URIBEACON_URI_TEXT_MAX];
+    uint16_t n = 0;
+    uint16_t p;
+    uint8_t best_length;
+    uint8_t match;
+    uint8_t code;
+    uint8_t out = 0;
+    const char *expansion;
+
+    while (text[n] != '\0')
+    {
+        if (n == URIBEACON_URI_TEXT_MAX)
+        {
+            return URIBEACON_ERR_LENGTH;
+        }
+        n++;
+    }
+
+    cost[n] = 0;
+    for (p = n; p-- > 0;)
+    {
+        cost[p] = cost[p + 1] + 1;
+        choice[p] = CHOICE_LITERAL;
+        best_length = 1;
+        for (code = 0; code < CODE_COUNT; code++)
+        {
+            expansion = expansion_of(code, dict);
+            match = (expansion == NULL) ? 0 : match_prefix(&text[p], expansion, 0);
+            if ((match != 0) && ((cost[p + match] + 1 < cost[p]) ||
+                                 ((cost[p + match] + 1 == cost[p]) && (match > best_length))))
+            {
+                cost[p] = cost[p + match] + 1;
+                choice[p] = code;
+                best_length = match;
+            }
+        }
+    }
+    if (cost[0] > size)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+
+    for (p = 0; p < n;)
+    {
+        if (choice[p] == CHOICE_LITERAL)
+        {
+            data[out++] = text[p++] & 0xFF;
+        }
+        else
+        {
+            data[out++] = choice[p];
+            p += match_prefix(&text[p], expansion_of(choice[p], dict), 0);
+        }
+    }
+    *length = out;
+    return URIBEACON_OK;
+}
+
+uribeacon_status_t uribeacon_uri_encode(const char *uri, uint8_t *data,
+                                        uint8_t size, uint8_t *length)
+{
+    return uribeacon_uri_encode_dict(uri, NULL, data, size, length);
+}
+
+uribeacon_status_t uribeacon_uri_encode_dict(const char *uri, const uribeacon_dict_t *dict,
+                                             uint8_t *data, uint8_t size, uint8_t *length)
+{
+    uint8_t scheme;
+    uint16_t position = 0;
+    uint8_t text_length;
+
+    if (uri[0] == '\0')
+    {
+        *length = 0;
+        return URIBEACON_OK;
+    }
+
+    for (scheme = 0; scheme < SCHEME_COUNT; scheme++)
+    {
+        position = match_prefix(uri, schemes[scheme], 1);
+        if (position != 0)
+        {
+            break;
+        }
+    }
+    if (scheme == SCHEME_COUNT)
+    {
+        return URIBEACON_ERR_FORMAT;
+    }
+    if (size < 1)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+    data[0] = scheme;
+
+    if (scheme == SCHEME_URN_UUID)
+    {
+        if (size < 1 + UUID_SIZE)
+        {
+            return URIBEACON_ERR_LENGTH;
+        }
+        if (encode_uuid(&uri[position], &data[1]) != URIBEACON_OK)
+        {
+            return URIBEACON_ERR_FORMAT;
+        }
+        *length = 1 + UUID_SIZE;
+        return URIBEACON_OK;
+    }
+
+    if (encode_text(&uri[position], dict, &data[1], size - 1, &text_length) != URIBEACON_OK)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+    *length = 1 + text_length;
+    return URIBEACON_OK;
+}
+
+uribeacon_status_t uribeacon_dict_check(const uribeacon_dict_t *dict)
+{
+    uint8_t i;
+    uint8_t j;
+    const char *entry;
+
+    if ((dict->version == 0) || (dict->version > URIBEACON_DICT_VERSION_MAX))
+    {
+        return URIBEACON_ERR_FORMAT;
+    }
+    for (i = 0; i < URIBEACON_DICT_SIZE; i++)
+    {
+        entry = dict->entries[i];
+        if (entry == NULL)
+        {
+            continue;
+        }
+        for (j = 0; entry[j] != '\0'; j++)
+        {
+            if (j == URIBEACON_DICT_ENTRY_MAX)
+            {
+                return URIBEACON_ERR_LENGTH;
+            }
+            if ((entry[j] <= ' ') || (entry[j] > '~'))
+            {
+                return URIBEACON_ERR_FORMAT;
+            }
+        }
+        if (j == 0)
+        {
+            return URIBEACON_ERR_LENGTH;
+        }
+    }
+    return URIBEACON_OK;
+}
+
+/* Appends str to uri at *out, leaving room for the terminator. */
+static uribeacon_status_t append(char *uri, uint16_t size, uint16_t *out,
+                                 const char *str)
+{
+    for (; *str != '\0'; str++)
+    {
+        if (*out + 1 >= size)
+        {
+            return URIBEACON_ERR_LENGTH;
+        }
+        uri[(*out)++] = *str;
+    }
+    return URIBEACON_OK;
+}
+
+uribeacon_status_t uribeacon_uri_decode(const uint8_t *data, uint8_t length,
+                                        char *uri, uint16_t size)
+{
+    return uribeacon_uri_decode_dict(data, length, NULL, uri, size);
+}
+
+uribeacon_status_t uribeacon_uri_decode_dict(const uint8_t *data, uint8_t length,
+                                             const uribeacon_dict_t *dict,
+                                             char *uri, uint16_t size)
+{
+    uint16_t out = 0;
+    uint8_t scheme;
+    uint8_t i;
+    uint8_t value;
+    const char *expansion;
+    char digit[2];
+
+    if (size < 1)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+    uri[0] = '\0';
+    if (length == 0)
+    {
+        return URIBEACON_OK;
+    }
+
+    scheme = data[0] & 0xFF;
+    if (scheme >= SCHEME_COUNT)
+    {
+        return URIBEACON_ERR_FORMAT;
+    }
+    if (append(uri, size, &out, schemes[scheme]) != URIBEACON_OK)
+    {
+        return URIBEACON_ERR_LENGTH;
+    }
+
+    digit[1] = '\0';
+    if (scheme == SCHEME_URN_UUID)
+    {
+        /* Bytes after the UUID are ignored, as by the Android library */
+        if (length < 1 + UUID_SIZE)
+        {
+            return URIBEACON_ERR_FORMAT;
+        }
+        for (i = 0; i < UUID_SIZE; i++)
+        {
+            if ((i == 4) || (i == 6) || (i == 8) || (i == 10))
+            {
+                if (append(uri, size, &out, "-") != URIBEACON_OK)
+                {
+                    return URIBEACON_ERR_LENGTH;
+                }
+            }
+            value = data[1 + i] & 0xFF;
+            digit[0] = hex_digits[value >> 4];
+            if (append(uri, size, &out, digit) != URIBEACON_OK)
+            {
+                return URIBEACON_ERR_LENGTH;
+            }
+            digit[0] = hex_digits[value & 0x0F];
+            if (append(uri, size, &out, digit) != URIBEACON_OK)
+            {
+                return URIBEACON_ERR_LENGTH;
+            }
+        }
+    }
+    else
+    {
+        for (i = 1; i < length; i++)
+        {
+            value = data[i] & 0xFF;
+            expansion = (value < CODE_COUNT) ? expansion_of(value, dict) : NULL;
+            if (expansion != NULL)
+            {
+                if (append(uri, size, &out, expansion) != URIBEACON_OK)
+                {
+                    return URIBEACON_ERR_LENGTH;
+                }
+            }
+            else
+            {
+                /* Reserved codes are passed through, as by the Android library */
+                digit[0] = (char)value;
+                if (append(uri, size, &out, digit) != URIBEACON_OK)
+                {
+                    return URIBEACON_ERR_LENGTH;
+                }
+            }
+        }
+    }
+    uri[out] = '\0';
+    return URIBEACON_OK;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "advertiser.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+// LE Set Advertising Parameters: ADV_NONCONN_IND from the public address on
+// all three channels, with no filter.
+#define ADV_NONCONN_IND                 (0x03)
+#define ADV_CHANNELS_ALL                (0x07)
+
+static uint64_t monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+bool buildAdvertisingPayload(const uribeacon_config_t &config, AdvertisingPayload &payload) {
+    payload.data[0] = 2;
+    payload.data[1] = 0x01;     // Flags
+    payload.data[2] = ADVERTISER_FLAGS;
+    uint8_t length = uribeacon_frame_build(&config, &payload.data[URIBEACON_ADV_FLAGS_SIZE],
+                                           URIBEACON_FRAME_MAX);
+    payload.length = URIBEACON_ADV_FLAGS_SIZE + length;
+    return length > 0;
+}
+
+Advertiser::Advertiser(HciTransport &transport, const AdvertiserOptions &options)
+    : transport(transport),
+      options(options),
+      jitter(options.seed),
+      startNs(0) {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    memset(&counters, 0, sizeof(counters));
+}
+
+Advertiser::~Advertiser() {
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+    }
+}
+
+void Advertiser::addPayload(const AdvertisingPayload &payload) {
+    payloads.push_back(payload);
+}
+
+bool Advertiser::start(void) {
+    if ((timerFd < 0) || (stopFd < 0)) {
+        return false;
+    }
+    if (payloads.empty() || (options.intervalMs < ADVERTISER_INTERVAL_MIN_MS) ||
+        (options.intervalMs > ADVERTISER_INTERVAL_MAX_MS) || (options.rotationMs == 0) ||
+        (2 * options.jitterMs >= options.rotationMs)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // The interval is in 0.625 ms units, used as both minimum and maximum.
+    uint16_t interval = static_cast<uint16_t>(options.intervalMs * 8 / 5);
+    uint8_t params[15];
+    memset(params, 0, sizeof(params));
+    params[0] = interval & 0xFF;
+    params[1] = interval >> 8;
+    params[2] = interval & 0xFF;
+    params[3] = interval >> 8;
+    params[4] = ADV_NONCONN_IND;
+    params[13] = ADV_CHANNELS_ALL;
+
+    // Parameters can only be changed while advertising is off.
+    if (!setEnable(false) || !send(HCI_LE_SET_ADV_PARAMETERS, params, sizeof(params)) ||
+        !setData(payloads[0]) || !setEnable(true)) {
+        return false;
+    }
+    startNs = monotonicNs();
+    return true;
+}
+
+bool Advertiser::run(void) {
+    bool reachable = true;
+    bool armed = false;
+    uint64_t n = 1;
+    uint64_t dueNs = rotationNs(n);
+
+    while (reachable) {
+        // A single payload is never rotated; the timer is left disarmed.
+        if ((payloads.size() > 1) && !armed) {
+            itimerspec due;
+            memset(&due, 0, sizeof(due));
+            due.it_value.tv_sec = static_cast<time_t>(dueNs / 1000000000);
+            due.it_value.tv_nsec = static_cast<long>(dueNs % 1000000000);
+            if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &due, NULL) < 0) {
+                return false;
+            }
+            armed = true;
+        }
+
+        pollfd fds[2] = { { timerFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) < 0) {
+            continue;
+        }
+
+        uint64_t lateUs = (monotonicNs() - dueNs) / 1000;
+        if (lateUs > ADVERTISER_LATE_US) {
+            counters.late++;
+        }
+        counters.maxLateUs = std::max(counters.maxLateUs, lateUs);
+        counters.rotations++;
+        if (!setData(payloads[n % payloads.size()])) {
+            if (errno != EIO) {
+                reachable = false;
+            }
+            counters.failures++;
+        }
+        dueNs = rotationNs(++n);
+        armed = false;
+    }
+
+    int saved = errno;
+    bool stopped = setEnable(false);
+    if (!reachable) {
+        errno = saved;
+        return false;
+    }
+    return stopped;
+}
+
+void Advertiser::stop(void) {
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) {
+        // Already signalled.
+    }
+}
+
+bool Advertiser::send(uint16_t opcode, const uint8_t *params, uint8_t length) {
+    int status = transport.command(opcode, params, length);
+    if (status != 0) {
+        if (status > 0) {
+            errno = EIO;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Advertiser::setData(const AdvertisingPayload &payload) {
+    // The length, then the data zero padded to 31 bytes.
+    uint8_t params[1 + URIBEACON_ADV_MAX];
+    memset(params, 0, sizeof(params));
+    params[0] = payload.length;
+    memcpy(&params[1], payload.data, payload.length);
+    return send(HCI_LE_SET_ADV_DATA, params, sizeof(params));
+}
+
+bool Advertiser::setEnable(bool enable) {
+    uint8_t params[1] = { static_cast<uint8_t>(enable ? 1 : 0) };
+    return send(HCI_LE_SET_ADV_ENABLE, params, sizeof(params));
+}
+
+uint64_t Advertiser::rotationNs(uint64_t n) {
+    uint64_t dueNs = startNs + n * options.rotationMs * 1000000ull;
+    if (options.jitterMs > 0) {
+        int64_t spanUs = static_cast<int64_t>(options.jitterMs) * 1000;
+        std::uniform_int_distribution<int64_t> offsetUs(-spanUs, spanUs);
+        dueNs += offsetUs(jitter) * 1000;
+    }
+    // start() keeps the jitter below half the rotation, so rotations stay
+    // in order.
+    return dueNs;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// UriBeacon advertiser. The advertising data is built in memory with the
+// shared core and set with LE controller commands, replacing the hcitool and
+// hciconfig calls of the old uribeacon_advertise script.
+//
+// Several payloads are rotated on a fixed schedule: payload n is set at
+// start + n * rotation, on an absolute CLOCK_MONOTONIC timer, so a late
+// wakeup delays one rotation without moving the ones after it. Jitter moves
+// each rotation up to jitterMs either side of its place in the schedule,
+// from a seeded generator so a run can be repeated. The controller keeps
+// advertising between rotations; only the data changes.
+
+#ifndef URIBEACON_ADVERTISER_H__
+#define URIBEACON_ADVERTISER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include "hci_transport.h"
+#include "uribeacon_core.h"
+
+// LE controller commands.
+#define HCI_LE_SET_ADV_PARAMETERS       HCI_OPCODE(HCI_OGF_LE_CTL, 0x0006)
+#define HCI_LE_SET_ADV_DATA             HCI_OPCODE(HCI_OGF_LE_CTL, 0x0008)
+#define HCI_LE_SET_ADV_ENABLE           HCI_OPCODE(HCI_OGF_LE_CTL, 0x000A)
+
+// Flags AD of every payload: LE General Discoverable, and simultaneous LE
+// and BR/EDR to the same device, as the script advertised.
+#define ADVERTISER_FLAGS                (0x1A)
+
+// Advertising interval limits for non-connectable advertising, in ms.
+#define ADVERTISER_INTERVAL_MIN_MS      (100)
+#define ADVERTISER_INTERVAL_MAX_MS      (10240)
+
+// A rotation this late, in microseconds, is counted as late.
+#define ADVERTISER_LATE_US              (1000)
+
+struct AdvertiserOptions {
+    uint32_t intervalMs;        // advertising interval
+    uint32_t rotationMs;        // time each payload is advertised
+    uint32_t jitterMs;          // largest move of a rotation, below rotationMs / 2
+    uint32_t seed;              // of the jitter
+
+    AdvertiserOptions()
+        : intervalMs(ADVERTISER_INTERVAL_MIN_MS),
+          rotationMs(1000),
+          jitterMs(0),
+          seed(1) {
+    }
+};
+
+// Advertising data: the Flags AD then the UriBeacon frame.
+struct AdvertisingPayload {
+    uint8_t length;
+    uint8_t data[URIBEACON_ADV_MAX];
+};
+
+// Builds the payload advertising config. Returns false if it is invalid.
+bool buildAdvertisingPayload(const uribeacon_config_t &config, AdvertisingPayload &payload);
+
+class Advertiser {
+public:
+    struct Stats {
+        uint64_t rotations;
+        uint64_t failures;      // rotations the controller refused
+        uint64_t late;          // rotations over ADVERTISER_LATE_US late
+        uint64_t maxLateUs;
+    };
+
+    Advertiser(HciTransport &transport, const AdvertiserOptions &options);
+    ~Advertiser();
+
+    void addPayload(const AdvertisingPayload &payload);
+
+    // Stops any advertising, sets the parameters and the first payload and
+    // starts advertising. Returns false with errno set, EINVAL for bad
+    // options or no payloads and EIO if the controller refused a command.
+    bool start(void);
+
+    // Rotates the payloads until stop(), then stops advertising. Returns
+    // false with errno set if the controller could not be reached.
+    bool run(void);
+
+    // Makes run() return. Safe from a signal handler or another thread.
+    void stop(void);
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+private:
+    // Sends a command, failing with EIO if the controller refused it.
+    bool send(uint16_t opcode, const uint8_t *params, uint8_t length);
+    bool setData(const AdvertisingPayload &payload);
+    bool setEnable(bool enable);
+    // When rotation n is due, in monotonic ns.
+    uint64_t rotationNs(uint64_t n);
+
+    HciTransport &transport;
+    AdvertiserOptions options;
+    std::vector<AdvertisingPayload> payloads;
+    std::minstd_rand jitter;
+    uint64_t startNs;
+    int timerFd;
+    int stopFd;
+    Stats counters;
+};
+
+#endif // URIBEACON_ADVERTISER_H__
@@ -0,0 +1,529 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the advertiser and the extended advertiser, against a mock
+// controller on a socketpair, which keeps packet boundaries as an HCI socket
+// does, and on a pty, a byte stream as a UART is. The mock records every
+// command and when it arrived.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "advertiser.h"
+#include "extended_adv.h"
+#include "test_util.h"
+
+// How late a mocked controller may see a rotation on a loaded machine.
+#define TOLERANCE_NS                    (20000000ull)
+
+static uint64_t monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+struct Command {
+    uint16_t opcode;
+    std::vector<uint8_t> params;
+    uint64_t arrivedNs;
+};
+
+// How a mock controller answers.
+enum Answer {
+    ANSWER_COMPLETE,            // Command Complete
+    ANSWER_STATUS,              // Command Status
+    ANSWER_NONE,
+};
+
+// Answers every command until the other end is closed, refusing
+// refuseOpcode with Command Disallowed. A stream controller writes its
+// answers a byte at a time, after an unrelated event.
+class MockController {
+public:
+    MockController(int fd, bool stream, Answer answers = ANSWER_COMPLETE, uint16_t refuseOpcode = 0)
+        : fd(fd),
+          stream(stream),
+          answers(answers),
+          refuseOpcode(refuseOpcode),
+          thread(&MockController::serve, this) {
+    }
+
+    ~MockController() {
+        thread.join();
+        close(fd);
+    }
+
+    std::vector<Command> received(void) {
+        std::lock_guard<std::mutex> hold(lock);
+        return commands;
+    }
+
+private:
+    void serve(void) {
+        std::vector<uint8_t> input;
+        uint8_t chunk[512];
+        ssize_t count;
+        while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+            input.insert(input.end(), chunk, chunk + count);
+            while ((input.size() >= 4) && (input.size() >= 4u + input[3])) {
+                Command command;
+                command.opcode = static_cast<uint16_t>(input[1] | (input[2] << 8));
+                command.params.assign(input.begin() + 4, input.begin() + 4 + input[3]);
+                command.arrivedNs = monotonicNs();
+                input.erase(input.begin(), input.begin() + 4 + input[3]);
+                {
+                    std::lock_guard<std::mutex> hold(lock);
+                    commands.push_back(command);
+                }
+                if (answers != ANSWER_NONE) {
+                    answer(command.opcode);
+                }
+            }
+        }
+    }
+
+    void answer(uint16_t opcode) {
+        uint8_t status = (opcode == refuseOpcode) ? 0x0C : 0x00;
+        uint8_t complete[] = {
+            HCI_EVENT_PKT, HCI_EV_CMD_COMPLETE, 4, 1,
+            static_cast<uint8_t>(opcode), static_cast<uint8_t>(opcode >> 8), status
+        };
+        uint8_t pending[] = {
+            HCI_EVENT_PKT, HCI_EV_CMD_STATUS, 4, status, 1,
+            static_cast<uint8_t>(opcode), static_cast<uint8_t>(opcode >> 8)
+        };
+        if (!stream) {
+            send((answers == ANSWER_STATUS) ? pending : complete, sizeof(complete));
+            return;
+        }
+        // Number of Completed Packets, which the advertiser must skip.
+        static const uint8_t OTHER[] = { HCI_EVENT_PKT, 0x13, 5, 1, 0x40, 0x00, 0x01, 0x00 };
+        send(OTHER, sizeof(OTHER));
+        const uint8_t *event = (answers == ANSWER_STATUS) ? pending : complete;
+        for (size_t i = 0; i < sizeof(complete); i++) {
+            send(&event[i], 1);
+        }
+    }
+
+    void send(const uint8_t *bytes, size_t length) {
+        if (write(fd, bytes, length) != static_cast<ssize_t>(length)) {
+            fprintf(stderr, "mock controller write failed\n");
+            failures++;
+        }
+    }
+
+    int fd;
+    bool stream;
+    Answer answers;
+    uint16_t refuseOpcode;
+    std::mutex lock;
+    std::vector<Command> commands;
+    std::thread thread;
+};
+
+// A raw pty pair: the advertiser's end in fds[0], the controller's in fds[1].
+static void openPty(int fds[2]) {
+    fds[1] = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    grantpt(fds[1]);
+    unlockpt(fds[1]);
+    fds[0] = open(ptsname(fds[1]), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    struct termios tio;
+    tcgetattr(fds[0], &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fds[0], TCSANOW, &tio);
+}
+
+static AdvertisingPayload payloadFor(const char *uri) {
+    uribeacon_config_t config;
+    uribeacon_config_defaults(&config);
+    uribeacon_uri_encode(uri, config.uri, URIBEACON_URI_MAX, &config.uri_length);
+    AdvertisingPayload payload;
+    buildAdvertisingPayload(config, payload);
+    return payload;
+}
+
+static void testPayload(void) {
+    static const uint8_t EXPECTED[] = {
+        0x02, 0x01, 0x1A,
+        0x03, 0x03, 0xD8, 0xFE,
+        0x10, 0x16, 0xD8, 0xFE, 0x01, 0xEC,
+        0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08
+    };
+    uribeacon_config_t config;
+    uribeacon_config_defaults(&config);
+    config.flags = 0x01;
+    config.adv_tx_power_levels[config.tx_power_mode] = -20;
+    AdvertisingPayload payload;
+    EXPECT_EQ(true, buildAdvertisingPayload(config, payload));
+    EXPECT_EQ(sizeof(EXPECTED), payload.length);
+    EXPECT_EQ(0, memcmp(EXPECTED, payload.data, sizeof(EXPECTED)));
+
+    config.uri_length = URIBEACON_URI_MAX + 1;
+    EXPECT_EQ(false, buildAdvertisingPayload(config, payload));
+}
+
+// Advertising is stopped, configured and started with the exact commands
+// hcitool and hciconfig sent.
+static void testStart(void) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    MockController controller(fds[1], false);
+    AdvertisingPayload payload = payloadFor("http://uribeacon.org");
+    {
+        FdHciTransport transport(fds[0]);
+        AdvertiserOptions options;
+        options.intervalMs = 250;
+        Advertiser advertiser(transport, options);
+        advertiser.addPayload(payload);
+        EXPECT_EQ(true, advertiser.start());
+        advertiser.stop();
+        EXPECT_EQ(true, advertiser.run());
+        EXPECT_EQ(0, advertiser.stats().rotations);
+    }
+    close(fds[0]);
+
+    std::vector<Command> commands = controller.received();
+    EXPECT_EQ(5, commands.size());
+    if (commands.size() != 5) {
+        return;
+    }
+    static const uint8_t PARAMETERS[] = {
+        0x90, 0x01, 0x90, 0x01, 0x03, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00
+    };
+    EXPECT_EQ(0x200A, commands[0].opcode);
+    EXPECT_EQ(1, commands[0].params.size());
+    EXPECT_EQ(0, commands[0].params[0]);
+    EXPECT_EQ(0x2006, commands[1].opcode);
+    EXPECT_EQ(sizeof(PARAMETERS), commands[1].params.size());
+    EXPECT_EQ(0, memcmp(PARAMETERS, commands[1].params.data(), sizeof(PARAMETERS)));
+    EXPECT_EQ(0x2008, commands[2].opcode);
+    EXPECT_EQ(32, commands[2].params.size());
+    EXPECT_EQ(payload.length, commands[2].params[0]);
+    EXPECT_EQ(0, memcmp(payload.data, &commands[2].params[1], payload.length));
+    EXPECT_EQ(0, commands[2].params[31]);
+    EXPECT_EQ(0x200A, commands[3].opcode);
+    EXPECT_EQ(1, commands[3].params[0]);
+    // And stopped when run() returns.
+    EXPECT_EQ(0x200A, commands[4].opcode);
+    EXPECT_EQ(0, commands[4].params[0]);
+}
+
+// Rotates three payloads for a while through fds[0], returning the Set
+// Advertising Data commands the controller saw.
+static std::vector<Command> rotate(int fds[2], MockController &controller,
+                                   const AdvertiserOptions &options, uint32_t runMs,
+                                   Advertiser::Stats &stats) {
+    AdvertisingPayload payloads[3] = {
+        payloadFor("http://a.example.com"),
+        payloadFor("http://b.example.com"),
+        payloadFor("http://c.example.com"),
+    };
+    {
+        FdHciTransport transport(fds[0]);
+        Advertiser advertiser(transport, options);
+        for (int i = 0; i < 3; i++) {
+            advertiser.addPayload(payloads[i]);
+        }
+        EXPECT_EQ(true, advertiser.start());
+        std::thread runner([&advertiser]() {
+            EXPECT_EQ(true, advertiser.run());
+        });
+        usleep(runMs * 1000);
+        advertiser.stop();
+        runner.join();
+        stats = advertiser.stats();
+    }
+    close(fds[0]);
+
+    std::vector<Command> data;
+    std::vector<Command> commands = controller.received();
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (commands[i].opcode == HCI_LE_SET_ADV_DATA) {
+            // In rotation order.
+            int expected = data.size() % 3;
+            EXPECT_EQ(0, memcmp(payloads[expected].data, &commands[i].params[1],
+                                payloads[expected].length));
+            data.push_back(commands[i]);
+        }
+    }
+    EXPECT_EQ(HCI_LE_SET_ADV_ENABLE, commands.back().opcode);
+    EXPECT_EQ(0, commands.back().params[0]);
+    EXPECT_EQ(data.size() - 1, stats.rotations);
+    return data;
+}
+
+// Rotations keep to the schedule over a pty, without drifting.
+static void testRotation(void) {
+    int fds[2];
+    openPty(fds);
+    MockController controller(fds[1], true);
+    AdvertiserOptions options;
+    options.rotationMs = 40;
+    Advertiser::Stats stats;
+    std::vector<Command> data = rotate(fds, controller, options, 430, stats);
+
+    EXPECT_EQ(true, data.size() >= 10);
+    for (size_t i = 1; i < data.size(); i++) {
+        uint64_t nominalNs = data[0].arrivedNs + i * 40000000ull;
+        if ((data[i].arrivedNs < nominalNs) || (data[i].arrivedNs > nominalNs + TOLERANCE_NS)) {
+            fprintf(stderr, "rotation %zu at %+.3f ms\n", i,
+                    (static_cast<int64_t>(data[i].arrivedNs - nominalNs)) / 1e6);
+            failures++;
+        }
+    }
+    EXPECT_EQ(0, stats.failures);
+}
+
+// Jitter moves rotations either way within its bound, and some earlier
+// than the schedule, which a late timer never would.
+static void testJitter(void) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    MockController controller(fds[1], false);
+    AdvertiserOptions options;
+    options.rotationMs = 40;
+    options.jitterMs = 15;
+    options.seed = 7;
+    Advertiser::Stats stats;
+    std::vector<Command> data = rotate(fds, controller, options, 430, stats);
+
+    EXPECT_EQ(true, data.size() >= 10);
+    int early = 0;
+    for (size_t i = 1; i < data.size(); i++) {
+        int64_t offsetNs = static_cast<int64_t>(data[i].arrivedNs - data[0].arrivedNs) -
+                           static_cast<int64_t>(i * 40000000ull);
+        if ((offsetNs < -15000000) || (offsetNs > static_cast<int64_t>(15000000 + TOLERANCE_NS))) {
+            fprintf(stderr, "rotation %zu at %+.3f ms\n", i, offsetNs / 1e6);
+            failures++;
+        }
+        early += (offsetNs < -2000000);
+    }
+    EXPECT_EQ(true, early > 0);
+}
+
+static void testErrors(void) {
+    AdvertisingPayload payload = payloadFor("http://uribeacon.org");
+    int fds[2];
+
+    // A refused command, in Command Complete or Command Status.
+    for (int status = 0; status < 2; status++) {
+        openPty(fds);
+        MockController controller(fds[1], true, (status == 1) ? ANSWER_STATUS : ANSWER_COMPLETE,
+                                  HCI_LE_SET_ADV_PARAMETERS);
+        {
+            FdHciTransport transport(fds[0]);
+            Advertiser advertiser(transport, AdvertiserOptions());
+            advertiser.addPayload(payload);
+            errno = 0;
+            EXPECT_EQ(false, advertiser.start());
+            EXPECT_EQ(EIO, errno);
+        }
+        close(fds[0]);
+        EXPECT_EQ(2, controller.received().size());
+    }
+
+    // No answer.
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    {
+        MockController controller(fds[1], false, ANSWER_NONE);
+        FdHciTransport transport(fds[0], 50);
+        uint8_t enable = 0;
+        uint64_t sentNs = monotonicNs();
+        EXPECT_EQ(-1, transport.command(HCI_LE_SET_ADV_ENABLE, &enable, 1));
+        EXPECT_EQ(ETIMEDOUT, errno);
+        EXPECT_EQ(true, monotonicNs() - sentNs >= 50000000);
+        close(fds[0]);
+    }
+
+    // Options the controller would refuse, or that reorder rotations.
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    {
+        MockController controller(fds[1], false);
+        FdHciTransport transport(fds[0]);
+        AdvertiserOptions options;
+        Advertiser empty(transport, options);
+        EXPECT_EQ(false, empty.start());
+        EXPECT_EQ(EINVAL, errno);
+        options.intervalMs = 50;
+        Advertiser fast(transport, options);
+        fast.addPayload(payload);
+        EXPECT_EQ(false, fast.start());
+        EXPECT_EQ(EINVAL, errno);
+        options.intervalMs = 100;
+        options.rotationMs = 40;
+        options.jitterMs = 20;
+        Advertiser jittery(transport, options);
+        jittery.addPayload(payload);
+        EXPECT_EQ(false, jittery.start());
+        EXPECT_EQ(EINVAL, errno);
+        close(fds[0]);
+        EXPECT_EQ(0, controller.received().size());
+    }
+}
+
+static bool sameParams(const Command &command, const uint8_t *expected, size_t length) {
+    return (command.params.size() == length) &&
+           (memcmp(expected, command.params.data(), length) == 0);
+}
+
+// Two URIs too long for legacy advertising get a set each, started by one
+// command, with the bytes a Bluetooth 5 controller expects.
+static void testExtended(void) {
+    static const char *URIS[2] = {
+        "https://example.com/a/path/much/too/long/for/legacy/advertising",
+        "http://www.example.org/another/long/path",
+    };
+    ExtendedPayload payloads[2];
+    for (int i = 0; i < 2; i++) {
+        uint8_t uri[EXTENDED_URI_MAX];
+        uint8_t uriLength;
+        uribeacon_uri_encode(URIS[i], uri, sizeof(uri), &uriLength);
+        EXPECT_EQ(true, uriLength > URIBEACON_URI_MAX);
+        EXPECT_EQ(true, buildExtendedPayload(0x00, -20, uri, uriLength, payloads[i]));
+    }
+    static const uint8_t HEADER[] = {
+        0x02, 0x01, 0x1A,
+        0x03, 0x03, 0xD8, 0xFE,
+        0x39, 0x16, 0xD8, 0xFE, 0x00, 0xEC, 0x03, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x00
+    };
+    EXPECT_EQ(13 + 0x39 - 5, payloads[0].length);
+    EXPECT_EQ(0, memcmp(HEADER, payloads[0].data, sizeof(HEADER)));
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    MockController controller(fds[1], false);
+    {
+        FdHciTransport transport(fds[0]);
+        ExtendedAdvertiser advertiser(transport, 250);
+        advertiser.addPayload(payloads[0]);
+        advertiser.addPayload(payloads[1]);
+        EXPECT_EQ(true, advertiser.start());
+        EXPECT_EQ(true, advertiser.stop());
+    }
+    close(fds[0]);
+
+    std::vector<Command> commands = controller.received();
+    EXPECT_EQ(9, commands.size());
+    if (commands.size() != 9) {
+        return;
+    }
+    static const uint8_t DISABLE_ALL[] = { 0x00, 0x00 };
+    static const uint8_t PARAMETERS[] = {
+        0x01, 0x00, 0x00, 0x90, 0x01, 0x00, 0x90, 0x01, 0x00, 0x07, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x01, 0x00, 0x01, 0x01, 0x00
+    };
+    static const uint8_t DATA[] = { 0x01, 0x03, 0x01 };
+    static const uint8_t ENABLE[] = {
+        0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00
+    };
+    EXPECT_EQ(0x2039, commands[0].opcode);
+    EXPECT_EQ(true, sameParams(commands[0], DISABLE_ALL, sizeof(DISABLE_ALL)));
+    EXPECT_EQ(0x203D, commands[1].opcode);
+    EXPECT_EQ(0, commands[1].params.size());
+    EXPECT_EQ(0x2036, commands[2].opcode);
+    EXPECT_EQ(0, commands[2].params[0]);
+    EXPECT_EQ(0x2037, commands[3].opcode);
+    EXPECT_EQ(0x2036, commands[4].opcode);
+    EXPECT_EQ(true, sameParams(commands[4], PARAMETERS, sizeof(PARAMETERS)));
+    EXPECT_EQ(0x2037, commands[5].opcode);
+    EXPECT_EQ(sizeof(DATA) + 1 + payloads[1].length, commands[5].params.size());
+    EXPECT_EQ(0, memcmp(DATA, commands[5].params.data(), sizeof(DATA)));
+    EXPECT_EQ(payloads[1].length, commands[5].params[3]);
+    EXPECT_EQ(0, memcmp(payloads[1].data, &commands[5].params[4], payloads[1].length));
+    EXPECT_EQ(0x2039, commands[6].opcode);
+    EXPECT_EQ(true, sameParams(commands[6], ENABLE, sizeof(ENABLE)));
+    EXPECT_EQ(0x2039, commands[7].opcode);
+    EXPECT_EQ(true, sameParams(commands[7], DISABLE_ALL, sizeof(DISABLE_ALL)));
+    EXPECT_EQ(0x203D, commands[8].opcode);
+
+    // The longest URI fits one command; a longer one, or too many sets, not.
+    uint8_t uri[EXTENDED_URI_MAX + 1];
+    memset(uri, 'a', sizeof(uri));
+    uri[0] = 0x02;
+    EXPECT_EQ(true, buildExtendedPayload(0x00, 0, uri, EXTENDED_URI_MAX, payloads[0]));
+    EXPECT_EQ(true, EXT_ADV_DATA_HDR_SIZE + payloads[0].length <= 255);
+    EXPECT_EQ(false, buildExtendedPayload(0x00, 0, uri, sizeof(uri), payloads[0]));
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    {
+        MockController refused(fds[1], false);
+        FdHciTransport transport(fds[0]);
+        ExtendedAdvertiser advertiser(transport, 250);
+        EXPECT_EQ(false, advertiser.start());
+        EXPECT_EQ(EINVAL, errno);
+        for (int i = 0; i <= EXTENDED_SETS_MAX; i++) {
+            advertiser.addPayload(payloads[0]);
+        }
+        EXPECT_EQ(false, advertiser.start());
+        EXPECT_EQ(EINVAL, errno);
+        close(fds[0]);
+        EXPECT_EQ(0, refused.received().size());
+    }
+}
+
+// An extended scan is stopped, configured and started; stopping it takes
+// one command.
+static void testExtendedScan(void) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    MockController controller(fds[1], false);
+    {
+        FdHciTransport transport(fds[0]);
+        EXPECT_EQ(true, setExtendedScan(transport, true));
+        EXPECT_EQ(true, setExtendedScan(transport, false));
+    }
+    close(fds[0]);
+
+    std::vector<Command> commands = controller.received();
+    EXPECT_EQ(4, commands.size());
+    if (commands.size() != 4) {
+        return;
+    }
+    static const uint8_t OFF[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t PARAMETERS[] = { 0x00, 0x00, 0x01, 0x01, 0x10, 0x00, 0x10, 0x00 };
+    static const uint8_t ON[] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    EXPECT_EQ(0x2042, commands[0].opcode);
+    EXPECT_EQ(true, sameParams(commands[0], OFF, sizeof(OFF)));
+    EXPECT_EQ(0x2041, commands[1].opcode);
+    EXPECT_EQ(true, sameParams(commands[1], PARAMETERS, sizeof(PARAMETERS)));
+    EXPECT_EQ(0x2042, commands[2].opcode);
+    EXPECT_EQ(true, sameParams(commands[2], ON, sizeof(ON)));
+    EXPECT_EQ(0x2042, commands[3].opcode);
+    EXPECT_EQ(true, sameParams(commands[3], OFF, sizeof(OFF)));
+}
+
+int main(int argc, char **argv) {
+    testPayload();
+    testStart();
+    testRotation();
+    testJitter();
+    testErrors();
+    testExtended();
+    testExtendedScan();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
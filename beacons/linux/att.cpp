@@ -0,0 +1,154 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "att.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// From <bluetooth/bluetooth.h> and <bluetooth/l2cap.h>.
+#define AF_BLUETOOTH_                   (31)
+#define BTPROTO_L2CAP_                  (0)
+#define BDADDR_LE_PUBLIC_               (1)
+#define BDADDR_LE_RANDOM_               (2)
+#define ATT_CID                         (4)
+
+struct sockaddr_l2_ {
+    sa_family_t family;
+    unsigned short psm;
+    uint8_t address[6];         // little endian
+    unsigned short cid;
+    uint8_t addressType;
+};
+
+// 00000000-0000-1000-8000-00805f9b34fb, little endian.
+static const uint8_t BASE_UUID[16] = {
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+bool operator==(const AttUuid &a, const AttUuid &b) {
+    return memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+}
+
+AttUuid attUuid16(uint16_t uuid) {
+    AttUuid expanded;
+    memcpy(expanded.bytes, BASE_UUID, sizeof(expanded.bytes));
+    expanded.bytes[12] = uuid & 0xFF;
+    expanded.bytes[13] = uuid >> 8;
+    return expanded;
+}
+
+static int hexValue(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool parseAttUuid(const char *text, AttUuid &uuid) {
+    // Written most significant byte first.
+    int index = 15;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '-') {
+            continue;
+        }
+        int high = hexValue(c[0]);
+        int low = (high >= 0) ? hexValue(c[1]) : -1;
+        if ((index < 0) || (low < 0)) {
+            return false;
+        }
+        uuid.bytes[index--] = static_cast<uint8_t>((high << 4) | low);
+        c++;
+    }
+    return index == -1;
+}
+
+bool readAttUuid(const uint8_t *bytes, size_t length, AttUuid &uuid) {
+    if (length == 2) {
+        uuid = attUuid16(static_cast<uint16_t>(bytes[0] | (bytes[1] << 8)));
+        return true;
+    }
+    if (length == 16) {
+        memcpy(uuid.bytes, bytes, sizeof(uuid.bytes));
+        return true;
+    }
+    return false;
+}
+
+uint16_t attShortUuid(const AttUuid &uuid) {
+    if ((memcmp(uuid.bytes, BASE_UUID, 12) != 0) || (uuid.bytes[14] != 0) || (uuid.bytes[15] != 0)) {
+        return 0;
+    }
+    return static_cast<uint16_t>(uuid.bytes[12] | (uuid.bytes[13] << 8));
+}
+
+bool SocketAttBearer::send(const uint8_t *pdu, size_t length) {
+    for (;;) {
+        ssize_t sent = ::send(fd, pdu, length, MSG_NOSIGNAL);
+        if (sent == static_cast<ssize_t>(length)) {
+            return true;
+        }
+        if ((sent < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (sent >= 0) {
+            errno = EMSGSIZE;
+        }
+        return false;
+    }
+}
+
+int connectAtt(const uint8_t address[6], bool randomAddress, bool nonBlocking) {
+    int fd = socket(AF_BLUETOOTH_, SOCK_SEQPACKET | SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0),
+                    BTPROTO_L2CAP_);
+    if (fd < 0) {
+        return -1;
+    }
+
+    sockaddr_l2_ local;
+    memset(&local, 0, sizeof(local));
+    local.family = AF_BLUETOOTH_;
+    local.cid = ATT_CID;
+    local.addressType = BDADDR_LE_PUBLIC_;
+
+    sockaddr_l2_ remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.family = AF_BLUETOOTH_;
+    for (int i = 0; i < 6; i++) {
+        remote.address[i] = address[5 - i];
+    }
+    remote.cid = ATT_CID;
+    remote.addressType = randomAddress ? BDADDR_LE_RANDOM_ : BDADDR_LE_PUBLIC_;
+
+    if ((bind(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) < 0) ||
+        ((connect(fd, reinterpret_cast<sockaddr *>(&remote), sizeof(remote)) < 0) &&
+         (!nonBlocking || (errno != EINPROGRESS)))) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
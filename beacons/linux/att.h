@@ -0,0 +1,116 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// The parts of the Attribute Protocol a configuration client needs: PDU
+// opcodes and errors, 128-bit UUIDs, and the bearer PDUs are sent over.
+// Nothing here needs the BlueZ headers.
+
+#ifndef URIBEACON_ATT_H__
+#define URIBEACON_ATT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ATT opcodes.
+#define ATT_ERROR_RSP                   (0x01)
+#define ATT_READ_BY_TYPE_REQ            (0x08)
+#define ATT_READ_BY_TYPE_RSP            (0x09)
+#define ATT_READ_REQ                    (0x0A)
+#define ATT_READ_RSP                    (0x0B)
+#define ATT_READ_BLOB_REQ               (0x0C)
+#define ATT_READ_BLOB_RSP               (0x0D)
+#define ATT_READ_MULTIPLE_REQ           (0x0E)
+#define ATT_READ_MULTIPLE_RSP           (0x0F)
+#define ATT_READ_BY_GROUP_TYPE_REQ      (0x10)
+#define ATT_READ_BY_GROUP_TYPE_RSP      (0x11)
+#define ATT_WRITE_REQ                   (0x12)
+#define ATT_WRITE_RSP                   (0x13)
+#define ATT_WRITE_CMD                   (0x52)
+
+// ATT error codes, as config servers answer them.
+#define ATT_ERR_INVALID_HANDLE          (0x01)
+#define ATT_ERR_READ_NOT_PERMITTED      (0x02)
+#define ATT_ERR_WRITE_NOT_PERMITTED     (0x03)
+#define ATT_ERR_REQUEST_NOT_SUPPORTED   (0x06)
+#define ATT_ERR_INVALID_OFFSET          (0x07)
+#define ATT_ERR_INSUFFICIENT_AUTHORIZATION (0x08)
+#define ATT_ERR_ATTRIBUTE_NOT_FOUND     (0x0A)
+#define ATT_ERR_INVALID_LENGTH          (0x0D)
+
+// Every LE link carries PDUs of at least this size; config values fit it.
+#define ATT_DEFAULT_MTU                 (23)
+
+// GATT declarations and characteristic properties.
+#define GATT_PRIMARY_SERVICE            (0x2800)
+#define GATT_CHARACTERISTIC             (0x2803)
+#define GATT_PROP_READ                  (0x02)
+#define GATT_PROP_WRITE_NO_RSP          (0x04)
+#define GATT_PROP_WRITE                 (0x08)
+
+// A UUID as it is sent, 128 bits little endian. 16-bit UUIDs are expanded
+// with the Bluetooth base UUID so the two compare equal.
+struct AttUuid {
+    uint8_t bytes[16];
+};
+
+bool operator==(const AttUuid &a, const AttUuid &b);
+
+// The Bluetooth base UUID with a 16-bit UUID in it.
+AttUuid attUuid16(uint16_t uuid);
+
+// Parses "ee0c2080-8786-40ba-ab96-99b91ac981d8". Returns false if the text
+// is not a UUID.
+bool parseAttUuid(const char *text, AttUuid &uuid);
+
+// Reads a UUID of length 2 or 16 from a PDU.
+bool readAttUuid(const uint8_t *bytes, size_t length, AttUuid &uuid);
+
+// If uuid is in the base UUID range, its 16-bit form, else 0.
+uint16_t attShortUuid(const AttUuid &uuid);
+
+// Where a client sends its PDUs. Responses come back through the client's
+// receive(), from whatever loop reads the link, so one thread can drive
+// many clients.
+class AttBearer {
+public:
+    virtual ~AttBearer() {}
+
+    // Sends one PDU. Returns false with errno set.
+    virtual bool send(const uint8_t *pdu, size_t length) = 0;
+};
+
+// A bearer over a socket that keeps PDU boundaries: an LE L2CAP socket on
+// the ATT channel, or one end of a SOCK_SEQPACKET socketpair. The socket is
+// not owned.
+class SocketAttBearer : public AttBearer {
+public:
+    explicit SocketAttBearer(int fd)
+        : fd(fd) {
+    }
+
+    bool send(const uint8_t *pdu, size_t length) override;
+
+private:
+    int fd;
+};
+
+// Connects an LE L2CAP socket to the ATT channel of address, most
+// significant byte first, a random address if randomAddress. Returns the
+// blocking socket or -1 with errno set. A nonBlocking socket is returned
+// while it connects, and is writable once it has, with SO_ERROR set if it
+// failed.
+int connectAtt(const uint8_t address[6], bool randomAddress, bool nonBlocking = false);
+
+#endif // URIBEACON_ATT_H__
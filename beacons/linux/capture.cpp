@@ -0,0 +1,519 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define FOOTER_HEADER_SIZE              (24)
+#define FOOTER_BUCKET_SIZE              (16)
+#define FOOTER_DEVICE_SIZE              (16)
+#define FOOTER_RUN_SIZE                 (8)
+
+// Records are written out in chunks of about this size.
+#define WRITE_CHUNK                     (1 << 20)
+
+static void put32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void put64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static uint32_t fnv(const uint8_t *bytes, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// An advertiser's address, most significant byte first, and type.
+static uint64_t deviceKey(const AdvertisingReport &report) {
+    uint64_t key = 0;
+    for (int i = 5; i >= 0; i--) {
+        key = (key << 8) | report.address[i];
+    }
+    return (key << 8) | report.addressType;
+}
+
+static bool validHeader(const uint8_t *header) {
+    return (memcmp(header, "UBCP", 4) == 0) && (header[4] == CAPTURE_VERSION);
+}
+
+CaptureWriter::CaptureWriter()
+    : fd(-1),
+      bucketUs(0),
+      offset(0),
+      latestUs(0),
+      frameCount(0) {
+}
+
+CaptureWriter::~CaptureWriter() {
+    if (fd >= 0) {
+        close();
+    }
+}
+
+bool CaptureWriter::open(const char *path, uint32_t bucketMs) {
+    if (bucketMs == 0) {
+        errno = EINVAL;
+        return false;
+    }
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bucketUs = static_cast<uint64_t>(bucketMs) * 1000;
+    offset = CAPTURE_HEADER_SIZE;
+    latestUs = 0;
+    frameCount = 0;
+    buckets.clear();
+    runs.clear();
+
+    buffer.assign(CAPTURE_HEADER_SIZE, 0);
+    memcpy(&buffer[0], "UBCP", 4);
+    buffer[4] = CAPTURE_VERSION;
+    put64(&buffer[8], bucketUs);
+    buffer.reserve(WRITE_CHUNK + CAPTURE_RECORD_HEADER_SIZE + HCI_FRAME_MAX);
+    return true;
+}
+
+bool CaptureWriter::flushBuffer(void) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t length = ::write(fd, &buffer[written], buffer.size() - written);
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += length;
+    }
+    buffer.clear();
+    return true;
+}
+
+void CaptureWriter::indexFrame(const HciFrame &frame, uint64_t timestampUs, uint64_t at) {
+    if (buckets.empty() || (timestampUs / bucketUs != buckets.back().first / bucketUs)) {
+        buckets.push_back(std::make_pair(timestampUs, at));
+    }
+    uint32_t bucket = static_cast<uint32_t>(buckets.size() - 1);
+
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    int count = parseAdvertisingReports(frame, reports);
+    for (int i = 0; i < count; i++) {
+        std::vector<std::pair<uint32_t, uint32_t> > &list = runs[deviceKey(reports[i])];
+        if (list.empty() || (list.back().first + list.back().second < bucket)) {
+            list.push_back(std::make_pair(bucket, 1));
+        } else if (list.back().first + list.back().second == bucket) {
+            list.back().second++;
+        }
+    }
+}
+
+bool CaptureWriter::write(const HciFrame &frame, uint64_t timestampUs) {
+    if (timestampUs < latestUs) {
+        timestampUs = latestUs;
+    }
+    latestUs = timestampUs;
+    indexFrame(frame, timestampUs, offset);
+
+    size_t at = buffer.size();
+    buffer.resize(at + CAPTURE_RECORD_HEADER_SIZE + frame.length);
+    uint8_t *record = &buffer[at];
+    put64(record, timestampUs);
+    record[8] = frame.incoming ? 1 : 0;
+    record[9] = frame.length & 0xFF;
+    record[10] = frame.length >> 8;
+    memcpy(&record[CAPTURE_RECORD_HEADER_SIZE], frame.bytes, frame.length);
+    offset += CAPTURE_RECORD_HEADER_SIZE + frame.length;
+    frameCount++;
+
+    return (buffer.size() < WRITE_CHUNK) || flushBuffer();
+}
+
+bool CaptureWriter::close(void) {
+    std::vector<uint64_t> keys;
+    size_t runCount = 0;
+    for (auto it = runs.begin(); it != runs.end(); ++it) {
+        keys.push_back(it->first);
+        runCount += it->second.size();
+    }
+    std::sort(keys.begin(), keys.end());
+
+    size_t footerStart = buffer.size();
+    size_t footerLength = FOOTER_HEADER_SIZE + buckets.size() * FOOTER_BUCKET_SIZE +
+                          keys.size() * FOOTER_DEVICE_SIZE + runCount * FOOTER_RUN_SIZE;
+    buffer.resize(footerStart + footerLength + CAPTURE_TRAILER_SIZE, 0);
+    uint8_t *footer = &buffer[footerStart];
+    put32(&footer[0], static_cast<uint32_t>(buckets.size()));
+    put32(&footer[4], static_cast<uint32_t>(keys.size()));
+    put32(&footer[8], static_cast<uint32_t>(runCount));
+    put64(&footer[16], latestUs);
+
+    uint8_t *p = &footer[FOOTER_HEADER_SIZE];
+    for (size_t i = 0; i < buckets.size(); i++, p += FOOTER_BUCKET_SIZE) {
+        put64(p, buckets[i].first);
+        put64(p + 8, buckets[i].second);
+    }
+    uint32_t first = 0;
+    for (size_t i = 0; i < keys.size(); i++, p += FOOTER_DEVICE_SIZE) {
+        uint64_t key = keys[i];
+        for (int j = 0; j < 6; j++) {
+            p[j] = (key >> (8 * (6 - j))) & 0xFF;
+        }
+        p[6] = key & 0xFF;
+        uint32_t count = static_cast<uint32_t>(runs[key].size());
+        put32(p + 8, first);
+        put32(p + 12, count);
+        first += count;
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        const std::vector<std::pair<uint32_t, uint32_t> > &list = runs[keys[i]];
+        for (size_t j = 0; j < list.size(); j++, p += FOOTER_RUN_SIZE) {
+            put32(p, list[j].first);
+            put32(p + 4, list[j].second);
+        }
+    }
+
+    put64(p, offset);
+    put32(p + 8, fnv(footer, footerLength));
+    memcpy(p + 12, "UBCI", 4);
+
+    bool ok = flushBuffer();
+    int error = errno;
+    if ((::close(fd) < 0) && ok) {
+        ok = false;
+        error = errno;
+    }
+    fd = -1;
+    buckets.clear();
+    runs.clear();
+    errno = error;
+    return ok;
+}
+
+CaptureReader::CaptureReader()
+    : map(NULL),
+      mapLength(0),
+      frameEnd(0),
+      latestUs(0),
+      hasIndex(false) {
+}
+
+CaptureReader::~CaptureReader() {
+    if (map != NULL) {
+        munmap(const_cast<uint8_t *>(map), mapLength);
+    }
+}
+
+bool CaptureReader::open(const char *path, bool useIndex) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if ((fd < 0) || (fstat(fd, &info) < 0)) {
+        int error = errno;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        errno = error;
+        return false;
+    }
+    if (info.st_size < CAPTURE_HEADER_SIZE) {
+        ::close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    map = static_cast<const uint8_t *>(mapped);
+    mapLength = info.st_size;
+    if (!validHeader(map)) {
+        errno = EINVAL;
+        return false;
+    }
+    madvise(mapped, mapLength, MADV_SEQUENTIAL);
+
+    hasIndex = loadIndex();
+    if (!hasIndex) {
+        // Find the end of the last whole record, and its time.
+        buckets.clear();
+        devices.clear();
+        runs.clear();
+        uint64_t at = CAPTURE_HEADER_SIZE;
+        while (mapLength - at >= CAPTURE_RECORD_HEADER_SIZE) {
+            size_t length = map[at + 9] | (map[at + 10] << 8);
+            if ((length > HCI_FRAME_MAX) || (mapLength - at - CAPTURE_RECORD_HEADER_SIZE < length)) {
+                break;
+            }
+            latestUs = get64(&map[at]);
+            at += CAPTURE_RECORD_HEADER_SIZE + length;
+        }
+        frameEnd = at;
+    } else if (!useIndex) {
+        // Keep the end of the frames, but scan them.
+        buckets.clear();
+        devices.clear();
+        runs.clear();
+        hasIndex = false;
+    }
+    return true;
+}
+
+bool CaptureReader::loadIndex(void) {
+    if (mapLength < CAPTURE_HEADER_SIZE + FOOTER_HEADER_SIZE + CAPTURE_TRAILER_SIZE) {
+        return false;
+    }
+    const uint8_t *trailer = &map[mapLength - CAPTURE_TRAILER_SIZE];
+    uint64_t footerOffset = get64(trailer);
+    if ((memcmp(&trailer[12], "UBCI", 4) != 0) || (footerOffset < CAPTURE_HEADER_SIZE) ||
+        (footerOffset > mapLength - CAPTURE_TRAILER_SIZE - FOOTER_HEADER_SIZE)) {
+        return false;
+    }
+    const uint8_t *footer = &map[footerOffset];
+    size_t footerLength = mapLength - CAPTURE_TRAILER_SIZE - footerOffset;
+    uint64_t bucketCount = get32(&footer[0]);
+    uint64_t deviceCount = get32(&footer[4]);
+    uint64_t runCount = get32(&footer[8]);
+    if ((FOOTER_HEADER_SIZE + bucketCount * FOOTER_BUCKET_SIZE + deviceCount * FOOTER_DEVICE_SIZE +
+         runCount * FOOTER_RUN_SIZE != footerLength) || (fnv(footer, footerLength) != get32(&trailer[8]))) {
+        return false;
+    }
+    frameEnd = footerOffset;
+    latestUs = get64(&footer[16]);
+
+    const uint8_t *p = &footer[FOOTER_HEADER_SIZE];
+    buckets.resize(bucketCount);
+    for (size_t i = 0; i < bucketCount; i++, p += FOOTER_BUCKET_SIZE) {
+        buckets[i].startUs = get64(p);
+        buckets[i].offset = get64(p + 8);
+        if ((buckets[i].offset < CAPTURE_HEADER_SIZE) || (buckets[i].offset >= frameEnd)) {
+            return false;
+        }
+    }
+    devices.resize(deviceCount);
+    for (size_t i = 0; i < deviceCount; i++, p += FOOTER_DEVICE_SIZE) {
+        uint64_t key = 0;
+        for (int j = 0; j < 7; j++) {
+            key = (key << 8) | p[j];
+        }
+        devices[i].key = key;
+        devices[i].firstRun = get32(p + 8);
+        devices[i].runCount = get32(p + 12);
+        if ((devices[i].firstRun > runCount) ||
+            (devices[i].runCount > runCount - devices[i].firstRun)) {
+            return false;
+        }
+    }
+    runs.resize(runCount);
+    for (size_t i = 0; i < runCount; i++, p += FOOTER_RUN_SIZE) {
+        runs[i].first = get32(p);
+        runs[i].count = get32(p + 4);
+        if ((runs[i].count == 0) || (runs[i].first >= bucketCount) ||
+            (runs[i].count > bucketCount - runs[i].first)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t CaptureReader::firstUs(void) const {
+    return frameEnd > CAPTURE_HEADER_SIZE ? get64(&map[CAPTURE_HEADER_SIZE]) : 0;
+}
+
+// Reads the records in [from, to) up to the first one after toUs.
+uint64_t CaptureReader::scanBytes(uint64_t from, uint64_t to, uint64_t fromUs, uint64_t toUs,
+                                  const uint8_t *address, FrameCallback onFrame,
+                                  void *context) const {
+    HciFrame frame;
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    uint64_t read = 0;
+
+    while (to - from >= CAPTURE_RECORD_HEADER_SIZE) {
+        const uint8_t *record = &map[from];
+        uint16_t length = static_cast<uint16_t>(record[9] | (record[10] << 8));
+        if ((length > HCI_FRAME_MAX) || (to - from - CAPTURE_RECORD_HEADER_SIZE < length)) {
+            break;
+        }
+        frame.timestampUs = get64(record);
+        if (frame.timestampUs > toUs) {
+            break;
+        }
+        from += CAPTURE_RECORD_HEADER_SIZE + length;
+        read++;
+        if (frame.timestampUs < fromUs) {
+            continue;
+        }
+        frame.incoming = (record[8] & 1) != 0;
+        frame.length = length;
+        memcpy(frame.bytes, &record[CAPTURE_RECORD_HEADER_SIZE], length);
+        if (address != NULL) {
+            int count = parseAdvertisingReports(frame, reports);
+            bool match = false;
+            for (int i = 0; (i < count) && !match; i++) {
+                match = true;
+                for (int j = 0; j < 6; j++) {
+                    match = match && (reports[i].address[j] == address[5 - j]);
+                }
+            }
+            if (!match) {
+                continue;
+            }
+        }
+        onFrame(frame, context);
+    }
+    return read;
+}
+
+uint64_t CaptureReader::scanRange(uint64_t fromUs, uint64_t toUs, FrameCallback onFrame,
+                                  void *context) const {
+    uint64_t from = CAPTURE_HEADER_SIZE;
+    if (!buckets.empty()) {
+        // The last bucket starting at or before fromUs.
+        size_t bucket = std::upper_bound(buckets.begin(), buckets.end(), fromUs,
+                                         [](uint64_t time, const Bucket &b) {
+                                             return time < b.startUs;
+                                         }) - buckets.begin();
+        from = buckets[bucket > 0 ? bucket - 1 : 0].offset;
+    }
+    return scanBytes(from, frameEnd, fromUs, toUs, NULL, onFrame, context);
+}
+
+uint64_t CaptureReader::scanDevice(const uint8_t address[6], uint64_t fromUs, uint64_t toUs,
+                                   FrameCallback onFrame, void *context) const {
+    if (!hasIndex) {
+        return scanBytes(CAPTURE_HEADER_SIZE, frameEnd, fromUs, toUs, address, onFrame, context);
+    }
+
+    uint64_t prefix = 0;
+    for (int i = 0; i < 6; i++) {
+        prefix = (prefix << 8) | address[i];
+    }
+    // Every address type of the address, merged into one list of runs.
+    std::vector<Run> list;
+    auto device = std::lower_bound(devices.begin(), devices.end(), prefix << 8,
+                                   [](const Device &d, uint64_t key) {
+                                       return d.key < key;
+                                   });
+    for (; (device != devices.end()) && ((device->key >> 8) == prefix); ++device) {
+        list.insert(list.end(), runs.begin() + device->firstRun,
+                    runs.begin() + device->firstRun + device->runCount);
+    }
+    std::sort(list.begin(), list.end(), [](const Run &a, const Run &b) {
+        return a.first < b.first;
+    });
+
+    // Each run is read in one pass, from its first bucket to the start of
+    // the bucket after it, skipping buckets an earlier run covered.
+    uint64_t read = 0;
+    size_t next = 0;
+    for (size_t i = 0; i < list.size(); i++) {
+        size_t first = std::max<size_t>(list[i].first, next);
+        size_t end = list[i].first + list[i].count;
+        if (first >= end) {
+            continue;
+        }
+        next = end;
+        if (buckets[first].startUs > toUs) {
+            break;
+        }
+        if ((end < buckets.size()) && (buckets[end].startUs < fromUs)) {
+            continue;
+        }
+        // The last bucket of the run starting at or before fromUs.
+        size_t start = std::upper_bound(buckets.begin() + first, buckets.begin() + end, fromUs,
+                                        [](uint64_t time, const Bucket &b) {
+                                            return time < b.startUs;
+                                        }) - buckets.begin();
+        first = start > first ? start - 1 : first;
+        read += scanBytes(buckets[first].offset, end < buckets.size() ? buckets[end].offset : frameEnd,
+                          fromUs, toUs, address, onFrame, context);
+    }
+    return read;
+}
+
+bool recoverCapture(const char *path) {
+    CaptureReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    if (reader.indexed()) {
+        return true;
+    }
+
+    CaptureWriter writer;
+    writer.fd = ::open(path, O_WRONLY | O_CLOEXEC);
+    if (writer.fd < 0) {
+        return false;
+    }
+    writer.bucketUs = get64(&reader.map[8]);
+    if (writer.bucketUs == 0) {
+        writer.bucketUs = CAPTURE_BUCKET_MS * 1000;
+    }
+
+    // Index the whole records as the writer would have.
+    HciFrame frame;
+    uint64_t at = CAPTURE_HEADER_SIZE;
+    while (at < reader.frameEnd) {
+        const uint8_t *record = &reader.map[at];
+        frame.timestampUs = get64(record);
+        frame.incoming = (record[8] & 1) != 0;
+        frame.length = static_cast<uint16_t>(record[9] | (record[10] << 8));
+        memcpy(frame.bytes, &record[CAPTURE_RECORD_HEADER_SIZE], frame.length);
+        writer.indexFrame(frame, frame.timestampUs, at);
+        writer.latestUs = frame.timestampUs;
+        writer.frameCount++;
+        at += CAPTURE_RECORD_HEADER_SIZE + frame.length;
+    }
+    writer.offset = at;
+
+    if ((ftruncate(writer.fd, at) < 0) || (lseek(writer.fd, at, SEEK_SET) < 0)) {
+        int error = errno;
+        ::close(writer.fd);
+        writer.fd = -1;
+        errno = error;
+        return false;
+    }
+    return writer.close();
+}
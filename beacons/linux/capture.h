@@ -0,0 +1,183 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Indexed binary capture files.
+//
+// A capture is a header, the HCI frames in the order they were captured,
+// and, once the writer closes it, an index footer: a sparse table of time
+// buckets and the file offset of each bucket's first frame, and per device
+// address the runs of consecutive buckets holding its advertisements. A time
+// range query seeks to its first bucket; a per device query reads only that
+// device's buckets. A capture whose writer died has no footer; it is read
+// by scanning, and recoverCapture() adds one. All integers are little endian.
+//
+//   Header                          Frame record
+//    0  magic 'U' 'B' 'C' 'P'        0  timestamp, us since the epoch (8)
+//    4  version                      8  flags, bit 0 set if incoming
+//    5  reserved (3)                 9  length (2)
+//    8  bucket width, us (8)        11  the frame, from its packet indicator
+//
+//   Footer
+//    0  bucket count (4)
+//    4  device count (4)
+//    8  run count (4)
+//   12  reserved (4)
+//   16  last frame timestamp (8)
+//   24  buckets: first timestamp (8), offset of first frame (8)
+//       devices, sorted: address, most significant byte first (6),
+//         address type, reserved, first run (4), run count (4)
+//       runs: first bucket (4), bucket count (4)
+//
+//   Trailer, the last 16 bytes
+//    0  footer offset (8)
+//    8  FNV-1a of the footer (4)
+//   12  magic 'U' 'B' 'C' 'I'
+//
+// Frame timestamps never decrease; a frame stamped earlier than the one
+// before it is recorded with the earlier frame's time.
+
+#ifndef URIBEACON_CAPTURE_H__
+#define URIBEACON_CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hci.h"
+
+#define CAPTURE_VERSION                 (1)
+#define CAPTURE_HEADER_SIZE             (16)
+#define CAPTURE_RECORD_HEADER_SIZE      (11)
+#define CAPTURE_TRAILER_SIZE            (16)
+#define CAPTURE_BUCKET_MS               (1000)
+
+class CaptureWriter {
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    // Creates path, replacing any file there. Returns false with errno set.
+    bool open(const char *path, uint32_t bucketMs = CAPTURE_BUCKET_MS);
+
+    bool isOpen(void) const {
+        return fd >= 0;
+    }
+
+    // Appends a frame captured at timestampUs. Returns false with errno set
+    // if the write failed.
+    bool write(const HciFrame &frame, uint64_t timestampUs);
+
+    // Writes the index and closes the file. Returns false with errno set.
+    bool close(void);
+
+    uint64_t frames(void) const {
+        return frameCount;
+    }
+
+private:
+    friend bool recoverCapture(const char *path);
+
+    bool flushBuffer(void);
+    void indexFrame(const HciFrame &frame, uint64_t timestampUs, uint64_t offset);
+
+    int fd;
+    uint64_t bucketUs;
+    uint64_t offset;            // of the next record
+    uint64_t latestUs;
+    uint64_t frameCount;
+    std::vector<uint8_t> buffer;
+    std::vector<std::pair<uint64_t, uint64_t> > buckets;
+    // Address and type, as in the footer, to runs of buckets.
+    std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, uint32_t> > > runs;
+};
+
+// Adds the index to a capture whose writer did not close it, dropping a
+// partly written last frame. Returns false with errno set.
+bool recoverCapture(const char *path);
+
+class CaptureReader {
+public:
+    typedef void (*FrameCallback)(const HciFrame &frame, void *context);
+
+    CaptureReader();
+    ~CaptureReader();
+
+    // Maps path. Returns false with errno set, EINVAL if it is not a
+    // capture. Without useIndex the footer is ignored and queries scan.
+    bool open(const char *path, bool useIndex = true);
+
+    // False for a capture without a valid footer, which is scanned instead.
+    bool indexed(void) const {
+        return hasIndex;
+    }
+
+    // Passes each frame captured in [fromUs, toUs] to onFrame. Returns the
+    // number of frames read, matching or not.
+    uint64_t scanRange(uint64_t fromUs, uint64_t toUs, FrameCallback onFrame, void *context) const;
+
+    // As scanRange(), for the frames carrying an advertisement from address,
+    // most significant byte first, of any address type.
+    uint64_t scanDevice(const uint8_t address[6], uint64_t fromUs, uint64_t toUs,
+                        FrameCallback onFrame, void *context) const;
+
+    size_t bucketCount(void) const {
+        return buckets.size();
+    }
+
+    size_t deviceCount(void) const {
+        return devices.size();
+    }
+
+    // Time of the first and last frames, 0 for an empty capture.
+    uint64_t firstUs(void) const;
+    uint64_t lastUs(void) const {
+        return latestUs;
+    }
+
+private:
+    friend bool recoverCapture(const char *path);
+
+    struct Bucket {
+        uint64_t startUs;
+        uint64_t offset;
+    };
+
+    struct Device {
+        uint64_t key;           // address and type, as in the footer
+        uint32_t firstRun;
+        uint32_t runCount;
+    };
+
+    struct Run {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    bool loadIndex(void);
+    uint64_t scanBytes(uint64_t from, uint64_t to, uint64_t fromUs, uint64_t toUs,
+                       const uint8_t *address, FrameCallback onFrame, void *context) const;
+
+    const uint8_t *map;
+    size_t mapLength;
+    uint64_t frameEnd;          // end of the frame records
+    uint64_t latestUs;
+    bool hasIndex;
+    std::vector<Bucket> buckets;
+    std::vector<Device> devices;
+    std::vector<Run> runs;
+};
+
+#endif // URIBEACON_CAPTURE_H__
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for indexed captures: queries through the index must return what a
+// full scan returns.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "capture.h"
+#include "test_util.h"
+
+#define DEVICES                         (20)
+#define START_US                        (1425477600000000ull)
+
+struct Written {
+    uint64_t timestampUs;
+    int device;
+};
+
+static void deviceAddress(int device, uint8_t address[6]) {
+    static const uint8_t base[6] = { 0xC0, 0x5E, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(address, base, 6);
+    address[5] = static_cast<uint8_t>(device);
+}
+
+// Devices come and go over a minute, with 250 ms buckets. One frame is
+// stamped out of order, and a command frame carries no report.
+static std::vector<Written> writeCapture(const char *path) {
+    static const uint8_t data[] = { 0x02, 0x01, 0x06 };
+    std::vector<Written> written;
+    CaptureWriter writer;
+    if (!writer.open(path, 250)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t seed = 1;
+    AdvertisingReport report;
+    report.eventType = 0;
+    report.dataLength = sizeof(data);
+    report.data = data;
+    HciFrame frame;
+    for (int i = 0; i < 6000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t timestampUs = START_US + i * 10000ull;
+        int device = static_cast<int>((i / 300 + (seed >> 8) % 5) % DEVICES);
+        uint8_t address[6];
+        deviceAddress(device, address);
+        for (int j = 0; j < 6; j++) {
+            report.address[j] = address[5 - j];
+        }
+        report.addressType = device % 2;
+        report.rssi = -60;
+        if (i == 3000) {
+            timestampUs -= 500000;
+        }
+        buildAdvertisingReport(report, timestampUs, frame);
+        writer.write(frame, timestampUs);
+        written.push_back(Written());
+        written.back().timestampUs = (i == 3000) ? written[i - 1].timestampUs : timestampUs;
+        written.back().device = device;
+    }
+
+    static const uint8_t command[] = { 0x01, 0x0C, 0x20, 0x02, 0x01, 0x00 };
+    frame.timestampUs = START_US + 60000000;
+    frame.incoming = false;
+    frame.length = sizeof(command);
+    memcpy(frame.bytes, command, sizeof(command));
+    writer.write(frame, frame.timestampUs);
+    written.push_back(Written());
+    written.back().timestampUs = frame.timestampUs;
+    written.back().device = -1;
+
+    EXPECT_EQ(6001, writer.frames());
+    EXPECT_EQ(true, writer.close());
+    return written;
+}
+
+struct Found {
+    std::vector<uint64_t> timestamps;
+};
+
+static void collect(const HciFrame &frame, void *context) {
+    static_cast<Found *>(context)->timestamps.push_back(frame.timestampUs);
+}
+
+static std::vector<uint64_t> expected(const std::vector<Written> &written, int device,
+                                      uint64_t fromUs, uint64_t toUs) {
+    std::vector<uint64_t> timestamps;
+    for (size_t i = 0; i < written.size(); i++) {
+        if ((written[i].timestampUs >= fromUs) && (written[i].timestampUs <= toUs) &&
+            ((device < 0) || (written[i].device == device))) {
+            timestamps.push_back(written[i].timestampUs);
+        }
+    }
+    return timestamps;
+}
+
+// Runs range and device queries, and counts those that differ from the
+// reference.
+static int checkQueries(const CaptureReader &reader, const std::vector<Written> &written) {
+    static const uint64_t ranges[][2] = {
+        { 0, UINT64_MAX },
+        { START_US + 12345678, START_US + 17000000 },
+        { START_US + 29000000, START_US + 30500000 },      // the late frame
+        { START_US + 60000000, START_US + 60000000 },
+        { START_US + 70000000, UINT64_MAX },
+    };
+    int mismatches = 0;
+
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+        Found found;
+        reader.scanRange(ranges[r][0], ranges[r][1], collect, &found);
+        if (found.timestamps != expected(written, -1, ranges[r][0], ranges[r][1])) {
+            fprintf(stderr, "range %zu differs\n", r);
+            mismatches++;
+        }
+        for (int device = 0; device < DEVICES + 1; device++) {
+            uint8_t address[6];
+            deviceAddress(device, address);
+            Found byDevice;
+            reader.scanDevice(address, ranges[r][0], ranges[r][1], collect, &byDevice);
+            if (byDevice.timestamps != expected(written, device, ranges[r][0], ranges[r][1])) {
+                fprintf(stderr, "range %zu device %d differs\n", r, device);
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+static void testIndexedQueries(const char *path) {
+    std::vector<Written> written = writeCapture(path);
+    CaptureReader reader;
+    EXPECT_EQ(true, reader.open(path));
+    EXPECT_EQ(true, reader.indexed());
+    EXPECT_EQ(241, reader.bucketCount());
+    EXPECT_EQ(DEVICES, reader.deviceCount());
+    EXPECT_EQ(START_US, reader.firstUs());
+    EXPECT_EQ(START_US + 60000000, reader.lastUs());
+    EXPECT_EQ(0, checkQueries(reader, written));
+
+    // A device query reads a fraction of the capture.
+    uint8_t address[6];
+    deviceAddress(0, address);
+    uint64_t ignored = 0;
+    EXPECT_EQ(true, reader.scanDevice(address, 0, UINT64_MAX,
+                                      [](const HciFrame &, void *) {}, &ignored) < 1500);
+
+    CaptureReader scanning;
+    EXPECT_EQ(true, scanning.open(path, false));
+    EXPECT_EQ(false, scanning.indexed());
+    EXPECT_EQ(START_US + 60000000, scanning.lastUs());
+    EXPECT_EQ(0, checkQueries(scanning, written));
+}
+
+static void testRecovery(const char *path) {
+    std::vector<Written> written = writeCapture(path);
+
+    // Cut the footer off and part of the last frame, as a crash would.
+    struct stat info;
+    stat(path, &info);
+    size_t frameBytes = 0;
+    for (size_t i = 0; i < written.size(); i++) {
+        frameBytes += CAPTURE_RECORD_HEADER_SIZE + (written[i].device < 0 ? 6 : 18);
+    }
+    EXPECT_EQ(true, truncate(path, CAPTURE_HEADER_SIZE + frameBytes - 3) == 0);
+    written.pop_back();
+
+    CaptureReader damaged;
+    EXPECT_EQ(true, damaged.open(path));
+    EXPECT_EQ(false, damaged.indexed());
+    EXPECT_EQ(0, checkQueries(damaged, written));
+
+    EXPECT_EQ(true, recoverCapture(path));
+    CaptureReader recovered;
+    EXPECT_EQ(true, recovered.open(path));
+    EXPECT_EQ(true, recovered.indexed());
+    EXPECT_EQ(written.back().timestampUs, recovered.lastUs());
+    EXPECT_EQ(0, checkQueries(recovered, written));
+
+    // Corrupting the footer makes the reader fall back to scanning.
+    stat(path, &info);
+    int fd = open(path, O_RDWR);
+    uint8_t byte = 0xFF;
+    EXPECT_EQ(1, pwrite(fd, &byte, 1, info.st_size - CAPTURE_TRAILER_SIZE - 1));
+    close(fd);
+    CaptureReader corrupt;
+    EXPECT_EQ(true, corrupt.open(path));
+    EXPECT_EQ(false, corrupt.indexed());
+}
+
+static void testNotACapture(const char *path) {
+    FILE *file = fopen(path, "wb");
+    fputs("HCI sniffer - Bluetooth packet analyzer ver 5.23\n", file);
+    fclose(file);
+    CaptureReader reader;
+    EXPECT_EQ(false, reader.open(path));
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/capture_testXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    testIndexedQueries(path);
+    testRecovery(path);
+    testNotACapture(path);
+    unlink(path);
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,713 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config_client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#define ATT_HANDLE_VALUE_NTF            (0x1B)
+#define ATT_HANDLE_VALUE_IND            (0x1D)
+#define ATT_HANDLE_VALUE_CFM            (0x1E)
+
+// Service data AD type, as in a v1 frame.
+#define AD_TYPE_SERVICE_DATA            (0x16)
+
+static const char *SERVICE_UUIDS[] = {
+    NULL,
+    "b35d7da6-eed4-4d59-8f89-f6573edea967",
+    "ee0c2080-8786-40ba-ab96-99b91ac981d8",
+};
+
+static const char *CHARACTERISTIC_UUIDS[CONFIG_CHARACTERISTICS] = {
+    "ee0c2081-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2082-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2083-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2084-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2085-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2086-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2087-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2088-8786-40ba-ab96-99b91ac981d8",
+    "ee0c2089-8786-40ba-ab96-99b91ac981d8",
+    "ee0c208a-8786-40ba-ab96-99b91ac981d8",
+    "ee0c208b-8786-40ba-ab96-99b91ac981d8",
+    "b35d7da7-eed4-4d59-8f89-f6573edea967",
+    "b35d7da8-eed4-4d59-8f89-f6573edea967",
+    "b35d7da9-eed4-4d59-8f89-f6573edea967",
+};
+
+static const char *STATUS_NAMES[] = {
+    "ok", "refused", "no config service", "missing characteristic", "malformed response",
+    "locked", "invalid config", "verify failed", "timed out", "link failed",
+};
+
+// The characteristics a protocol must have to be read.
+static const ConfigCharacteristic V1_READ[] = {
+    CONFIG_V1_DATA_1, CONFIG_V1_DATA_2, CONFIG_V1_DATA_SIZE,
+};
+static const ConfigCharacteristic V2_READ[] = {
+    CONFIG_LOCK_STATE, CONFIG_URI_DATA, CONFIG_FLAGS, CONFIG_ADV_TX_POWER_LEVELS,
+    CONFIG_TX_POWER_MODE, CONFIG_PERIOD,
+};
+
+struct UuidTable {
+    AttUuid services[3];
+    AttUuid characteristics[CONFIG_CHARACTERISTICS];
+
+    UuidTable() {
+        memset(&services[0], 0, sizeof(services[0]));
+        for (int i = 1; i < 3; i++) {
+            parseAttUuid(SERVICE_UUIDS[i], services[i]);
+        }
+        for (int i = 0; i < CONFIG_CHARACTERISTICS; i++) {
+            parseAttUuid(CHARACTERISTIC_UUIDS[i], characteristics[i]);
+        }
+    }
+};
+
+static const UuidTable &uuids(void) {
+    static const UuidTable table;
+    return table;
+}
+
+// The size of a value, or 0 if it varies.
+static size_t fixedLength(int characteristic) {
+    switch (characteristic) {
+    case CONFIG_LOCK_STATE:
+    case CONFIG_FLAGS:
+    case CONFIG_TX_POWER_MODE:
+    case CONFIG_V1_DATA_SIZE:
+        return 1;
+    case CONFIG_PERIOD:
+        return 2;
+    case CONFIG_ADV_TX_POWER_LEVELS:
+    case CONFIG_RADIO_TX_POWER_LEVELS:
+        return URIBEACON_TX_POWER_MODES;
+    default:
+        return 0;
+    }
+}
+
+static bool isV1(int characteristic) {
+    return characteristic >= CONFIG_V1_DATA_1;
+}
+
+static uint16_t readLe16(const uint8_t *bytes) {
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+const AttUuid &configServiceUuid(ConfigProtocol protocol) {
+    return uuids().services[protocol];
+}
+
+const AttUuid &configCharacteristicUuid(ConfigCharacteristic characteristic) {
+    return uuids().characteristics[characteristic];
+}
+
+const char *configProtocolName(ConfigProtocol protocol) {
+    static const char *NAMES[] = { "none", "v1", "v2" };
+    return NAMES[protocol];
+}
+
+const char *configStatusName(ConfigStatus status) {
+    return STATUS_NAMES[status];
+}
+
+ConfigRequest::ConfigRequest()
+    : write(false),
+      haveKey(false),
+      timeoutMs(CONFIG_TIMEOUT_MS),
+      sync(false),
+      batchReads(true) {
+    uribeacon_config_defaults(&config);
+    memset(key, 0, sizeof(key));
+}
+
+ConfigClient::ConfigClient(AttBearer &bearer, const ConfigRequest &request)
+    : bearer(bearer),
+      request(request),
+      phase(PHASE_IDLE),
+      awaiting(false),
+      deadline(0),
+      startNs(0),
+      phaseNs(0),
+      serviceStart(0),
+      serviceEnd(0),
+      v1Size(0),
+      v1Written(0),
+      readMultiple(request.batchReads),
+      stateLength(0) {
+    memset(&result, 0, sizeof(result));
+    memset(valueHandles, 0, sizeof(valueHandles));
+    memset(properties, 0, sizeof(properties));
+    memset(v1Frame, 0, sizeof(v1Frame));
+    memset(state, 0, sizeof(state));
+}
+
+void ConfigClient::start(uint64_t nowNs) {
+    startNs = nowNs;
+    phaseNs = nowNs;
+    phase = PHASE_SERVICES;
+    enqueue(ATT_READ_BY_GROUP_TYPE_REQ, 0x0001, -1);
+    pump(nowNs);
+}
+
+void ConfigClient::receive(const uint8_t *pdu, size_t length, uint64_t nowNs) {
+    if ((phase == PHASE_DONE) || (length == 0) || (pdu[0] == ATT_HANDLE_VALUE_NTF)) {
+        return;
+    }
+    if (pdu[0] == ATT_HANDLE_VALUE_IND) {
+        uint8_t confirm = ATT_HANDLE_VALUE_CFM;
+        if (!bearer.send(&confirm, 1)) {
+            result.linkError = errno;
+            finish(CONFIG_ERR_LINK, nowNs);
+        }
+        return;
+    }
+    if (!awaiting) {
+        finish(CONFIG_ERR_MALFORMED, nowNs);
+        return;
+    }
+
+    Operation operation = queue.front();
+    queue.pop_front();
+    awaiting = false;
+
+    ConfigStatus status;
+    if ((pdu[0] == ATT_ERROR_RSP) && (length == 5) && (pdu[1] == operation.opcode)) {
+        // Discovery runs until there is nothing left to find.
+        bool discovering = (operation.opcode == ATT_READ_BY_GROUP_TYPE_REQ) ||
+                           (operation.opcode == ATT_READ_BY_TYPE_REQ);
+        status = CONFIG_OK;
+        if ((operation.opcode == ATT_READ_MULTIPLE_REQ) &&
+            (pdu[4] == ATT_ERR_REQUEST_NOT_SUPPORTED)) {
+            // Read the batch one value at a time; v1 data 1 follows data size.
+            readMultiple = false;
+            for (size_t i = 0; i + 1 < operation.value.size(); i += 2) {
+                int characteristic = characteristicOf(readLe16(&operation.value[i]));
+                if ((characteristic >= 0) && (characteristic != CONFIG_V1_DATA_1)) {
+                    enqueueRead(static_cast<ConfigCharacteristic>(characteristic));
+                }
+            }
+        } else if (!discovering || (pdu[4] != ATT_ERR_ATTRIBUTE_NOT_FOUND)) {
+            result.attError = pdu[4];
+            status = CONFIG_ERR_ATT;
+        }
+    } else if (pdu[0] != operation.opcode + 1) {
+        status = CONFIG_ERR_MALFORMED;
+    } else if (operation.opcode == ATT_READ_BY_GROUP_TYPE_REQ) {
+        status = onServices(pdu, length);
+    } else if (operation.opcode == ATT_READ_BY_TYPE_REQ) {
+        status = onCharacteristics(pdu, length);
+    } else if (operation.opcode == ATT_READ_REQ) {
+        status = onRead(operation.characteristic, pdu + 1, length - 1);
+    } else if (operation.opcode == ATT_READ_BLOB_REQ) {
+        status = onState(pdu + 1, length - 1);
+    } else if (operation.opcode == ATT_READ_MULTIPLE_REQ) {
+        status = onReadMultiple(operation, pdu + 1, length - 1);
+    } else {
+        status = (length == 1) ? CONFIG_OK : CONFIG_ERR_MALFORMED;
+    }
+
+    if (status != CONFIG_OK) {
+        finish(status, nowNs);
+        return;
+    }
+    pump(nowNs);
+}
+
+void ConfigClient::tick(uint64_t nowNs) {
+    if (awaiting && (nowNs >= deadline)) {
+        finish(CONFIG_ERR_TIMEOUT, nowNs);
+    }
+}
+
+void ConfigClient::enqueue(uint8_t opcode, uint16_t handle, int characteristic,
+                           const uint8_t *value, size_t length) {
+    Operation operation;
+    operation.opcode = opcode;
+    operation.handle = handle;
+    operation.characteristic = characteristic;
+    operation.value.assign(value, value + length);
+    queue.push_back(operation);
+}
+
+void ConfigClient::enqueueWrite(ConfigCharacteristic characteristic, const uint8_t *value,
+                                size_t length) {
+    // The lock is always acknowledged, so a failed unlock is not followed by
+    // writes the beacon silently drops.
+    bool command = (properties[characteristic] & GATT_PROP_WRITE_NO_RSP) &&
+                   (characteristic != CONFIG_LOCK) && (characteristic != CONFIG_UNLOCK);
+    enqueue(command ? ATT_WRITE_CMD : ATT_WRITE_REQ, valueHandles[characteristic],
+            characteristic, value, length);
+}
+
+void ConfigClient::enqueueRead(ConfigCharacteristic characteristic) {
+    enqueue(ATT_READ_REQ, valueHandles[characteristic], characteristic);
+}
+
+int ConfigClient::characteristicOf(uint16_t valueHandle) const {
+    for (int i = 0; i < CONFIG_CHARACTERISTICS; i++) {
+        if (valueHandles[i] == valueHandle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ConfigClient::enqueueReads(const ConfigCharacteristic *characteristics, size_t count) {
+    if (!readMultiple || (count < 2)) {
+        for (size_t i = 0; i < count; i++) {
+            enqueueRead(characteristics[i]);
+        }
+        return;
+    }
+    uint8_t handles[2 * CONFIG_CHARACTERISTICS];
+    for (size_t i = 0; i < count; i++) {
+        handles[2 * i] = valueHandles[characteristics[i]] & 0xFF;
+        handles[2 * i + 1] = valueHandles[characteristics[i]] >> 8;
+    }
+    enqueue(ATT_READ_MULTIPLE_REQ, 0, -1, handles, 2 * count);
+}
+
+void ConfigClient::pump(uint64_t nowNs) {
+    while (phase != PHASE_DONE) {
+        if (awaiting) {
+            return;
+        }
+        if (queue.empty()) {
+            advance(nowNs);
+            continue;
+        }
+
+        const Operation &operation = queue.front();
+        uint8_t pdu[ATT_DEFAULT_MTU];
+        size_t length = 3;
+        pdu[0] = operation.opcode;
+        pdu[1] = operation.handle & 0xFF;
+        pdu[2] = operation.handle >> 8;
+        if ((operation.opcode == ATT_READ_BY_GROUP_TYPE_REQ) ||
+            (operation.opcode == ATT_READ_BY_TYPE_REQ)) {
+            uint16_t end = (operation.opcode == ATT_READ_BY_TYPE_REQ) ? serviceEnd : 0xFFFF;
+            uint16_t type = (operation.opcode == ATT_READ_BY_TYPE_REQ) ? GATT_CHARACTERISTIC
+                                                                      : GATT_PRIMARY_SERVICE;
+            pdu[3] = end & 0xFF;
+            pdu[4] = end >> 8;
+            pdu[5] = type & 0xFF;
+            pdu[6] = type >> 8;
+            length = 7;
+        } else if (operation.opcode == ATT_READ_MULTIPLE_REQ) {
+            memcpy(&pdu[1], operation.value.data(), operation.value.size());
+            length = 1 + operation.value.size();
+        } else if (!operation.value.empty()) {
+            memcpy(&pdu[3], operation.value.data(), operation.value.size());
+            length += operation.value.size();
+        }
+
+        if (!bearer.send(pdu, length)) {
+            result.linkError = errno;
+            finish(CONFIG_ERR_LINK, nowNs);
+            return;
+        }
+        if (operation.opcode == ATT_WRITE_CMD) {
+            result.commands++;
+            queue.pop_front();
+        } else {
+            result.requests++;
+            awaiting = true;
+            deadline = nowNs + request.timeoutMs * 1000000ull;
+        }
+    }
+}
+
+void ConfigClient::advance(uint64_t nowNs) {
+    switch (phase) {
+    case PHASE_SERVICES:
+        if (result.protocol == CONFIG_PROTOCOL_NONE) {
+            finish(CONFIG_ERR_NO_SERVICE, nowNs);
+            return;
+        }
+        phase = PHASE_CHARACTERISTICS;
+        if (serviceStart < serviceEnd) {
+            enqueue(ATT_READ_BY_TYPE_REQ, serviceStart + 1, -1);
+        }
+        return;
+
+    case PHASE_CHARACTERISTICS: {
+        result.discoverNs = nowNs - startNs;
+        const ConfigCharacteristic *reads = V2_READ;
+        size_t count = sizeof(V2_READ) / sizeof(V2_READ[0]);
+        if (result.protocol == CONFIG_PROTOCOL_V1) {
+            reads = V1_READ;
+            count = sizeof(V1_READ) / sizeof(V1_READ[0]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            if ((valueHandles[reads[i]] == 0) || !(properties[reads[i]] & GATT_PROP_READ)) {
+                finish(CONFIG_ERR_MISSING, nowNs);
+                return;
+            }
+        }
+
+        phase = PHASE_READ;
+        phaseNs = nowNs;
+        if (properties[CONFIG_STATE] & GATT_PROP_READ) {
+            enqueueRead(CONFIG_STATE);
+            return;
+        }
+        if (result.protocol == CONFIG_PROTOCOL_V1) {
+            // Data size and data 1 together, else data 1 follows the size.
+            // Data 2 follows if the frame is longer.
+            static const ConfigCharacteristic V1_BATCH[] = {
+                CONFIG_V1_DATA_SIZE, CONFIG_V1_DATA_1,
+            };
+            enqueueReads(V1_BATCH, readMultiple ? 2 : 1);
+            return;
+        }
+        // 13 bytes of fixed size values, then the URI on its own, as it
+        // would not fit after them.
+        ConfigCharacteristic batch[] = {
+            CONFIG_LOCK_STATE, CONFIG_FLAGS, CONFIG_ADV_TX_POWER_LEVELS, CONFIG_TX_POWER_MODE,
+            CONFIG_PERIOD, CONFIG_RADIO_TX_POWER_LEVELS,
+        };
+        enqueueReads(batch, (valueHandles[CONFIG_RADIO_TX_POWER_LEVELS] != 0) ? 6 : 5);
+        enqueueRead(CONFIG_URI_DATA);
+        return;
+    }
+
+    case PHASE_READ: {
+        result.readNs = nowNs - phaseNs;
+        if (result.protocol == CONFIG_PROTOCOL_V1) {
+            // Only the service data is configured; an empty frame is a beacon
+            // that never was.
+            uribeacon_config_t &found = result.found;
+            uribeacon_config_defaults(&found);
+            found.uri_length = 0;
+            for (size_t offset = 0; offset + 1 < v1Size; offset += v1Frame[offset] + 1) {
+                const uint8_t *ad = &v1Frame[offset];
+                if ((ad[0] >= 5) && (ad[0] - 5 <= URIBEACON_URI_MAX) &&
+                    (offset + ad[0] + 1 <= v1Size) && (ad[1] == AD_TYPE_SERVICE_DATA) &&
+                    (readLe16(&ad[2]) == URIBEACON_SERVICE_UUID)) {
+                    found.flags = ad[4];
+                    found.adv_tx_power_levels[found.tx_power_mode] = static_cast<int8_t>(ad[5]);
+                    found.uri_length = ad[0] - 5;
+                    memcpy(found.uri, &ad[6], found.uri_length);
+                }
+            }
+        }
+        if (!request.write) {
+            finish(CONFIG_OK, nowNs);
+            return;
+        }
+        phase = PHASE_WRITE;
+        phaseNs = nowNs;
+        ConfigStatus status = planWrites();
+        if (status != CONFIG_OK) {
+            finish(status, nowNs);
+        }
+        return;
+    }
+
+    case PHASE_WRITE:
+        result.writeNs = nowNs - phaseNs;
+        finish(CONFIG_OK, nowNs);
+        return;
+
+    default:
+        return;
+    }
+}
+
+ConfigStatus ConfigClient::onServices(const uint8_t *pdu, size_t length) {
+    size_t size = (length >= 2) ? pdu[1] : 0;
+    if (((size != 6) && (size != 20)) || ((length - 2) % size != 0)) {
+        return CONFIG_ERR_MALFORMED;
+    }
+    uint16_t end = 0;
+    for (size_t offset = 2; offset < length; offset += size) {
+        AttUuid uuid;
+        readAttUuid(&pdu[offset + 4], size - 4, uuid);
+        end = readLe16(&pdu[offset + 2]);
+        for (int protocol = CONFIG_PROTOCOL_V1; protocol <= CONFIG_PROTOCOL_V2; protocol++) {
+            if (uuid == configServiceUuid(static_cast<ConfigProtocol>(protocol))) {
+                result.protocol = static_cast<ConfigProtocol>(protocol);
+                serviceStart = readLe16(&pdu[offset]);
+                serviceEnd = end;
+            }
+        }
+    }
+    // A beacon has one config service; stop at the first.
+    if ((result.protocol == CONFIG_PROTOCOL_NONE) && (end != 0xFFFF)) {
+        enqueue(ATT_READ_BY_GROUP_TYPE_REQ, end + 1, -1);
+    }
+    return CONFIG_OK;
+}
+
+ConfigStatus ConfigClient::onCharacteristics(const uint8_t *pdu, size_t length) {
+    size_t size = (length >= 2) ? pdu[1] : 0;
+    if (((size != 7) && (size != 21)) || ((length - 2) % size != 0)) {
+        return CONFIG_ERR_MALFORMED;
+    }
+    uint16_t declaration = 0;
+    for (size_t offset = 2; offset < length; offset += size) {
+        AttUuid uuid;
+        readAttUuid(&pdu[offset + 5], size - 5, uuid);
+        declaration = readLe16(&pdu[offset]);
+        for (int i = 0; i < CONFIG_CHARACTERISTICS; i++) {
+            if ((isV1(i) == (result.protocol == CONFIG_PROTOCOL_V1)) &&
+                (uuid == configCharacteristicUuid(static_cast<ConfigCharacteristic>(i)))) {
+                properties[i] = pdu[offset + 2];
+                valueHandles[i] = readLe16(&pdu[offset + 3]);
+            }
+        }
+    }
+    if (declaration < serviceEnd) {
+        enqueue(ATT_READ_BY_TYPE_REQ, declaration + 1, -1);
+    }
+    return CONFIG_OK;
+}
+
+ConfigStatus ConfigClient::onRead(int characteristic, const uint8_t *value, size_t length) {
+    uribeacon_config_t &found = result.found;
+    switch (characteristic) {
+    case CONFIG_LOCK_STATE:
+        if (length != 1) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        found.lock_state = (value[0] != 0);
+        return CONFIG_OK;
+
+    case CONFIG_URI_DATA:
+        if (length > URIBEACON_URI_MAX) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        found.uri_length = static_cast<uint8_t>(length);
+        memcpy(found.uri, value, length);
+        return CONFIG_OK;
+
+    case CONFIG_FLAGS:
+    case CONFIG_TX_POWER_MODE:
+        if (length != 1) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        if (characteristic == CONFIG_FLAGS) {
+            found.flags = value[0];
+        } else {
+            found.tx_power_mode = value[0];
+        }
+        return CONFIG_OK;
+
+    case CONFIG_ADV_TX_POWER_LEVELS:
+    case CONFIG_RADIO_TX_POWER_LEVELS:
+        if (length != URIBEACON_TX_POWER_MODES) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        memcpy((characteristic == CONFIG_ADV_TX_POWER_LEVELS) ? found.adv_tx_power_levels
+                                                             : found.radio_tx_power_levels,
+               value, length);
+        result.foundRadioLevels |= (characteristic == CONFIG_RADIO_TX_POWER_LEVELS);
+        return CONFIG_OK;
+
+    case CONFIG_PERIOD:
+        if (length != 2) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        found.period = readLe16(value);
+        return CONFIG_OK;
+
+    case CONFIG_STATE:
+        return onState(value, length);
+
+    case CONFIG_V1_DATA_SIZE:
+        if ((length != 1) || (value[0] > URIBEACON_FRAME_MAX)) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        if (phase == PHASE_WRITE) {
+            return (value[0] == v1Written) ? CONFIG_OK : CONFIG_ERR_VERIFY;
+        }
+        v1Size = value[0];
+        if (v1Size > 0) {
+            enqueueRead(CONFIG_V1_DATA_1);
+        }
+        return CONFIG_OK;
+
+    case CONFIG_V1_DATA_1:
+    case CONFIG_V1_DATA_2: {
+        size_t offset = (characteristic == CONFIG_V1_DATA_1) ? 0 : CONFIG_V1_DATA_1_MAX;
+        if (offset + length > sizeof(v1Frame)) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        memcpy(&v1Frame[offset], value, length);
+        if ((characteristic == CONFIG_V1_DATA_1) && (v1Size > CONFIG_V1_DATA_1_MAX)) {
+            enqueueRead(CONFIG_V1_DATA_2);
+        }
+        return CONFIG_OK;
+    }
+
+    default:
+        return CONFIG_ERR_MALFORMED;
+    }
+}
+
+ConfigStatus ConfigClient::onReadMultiple(const Operation &operation, const uint8_t *value,
+                                          size_t length) {
+    size_t offset = 0;
+    for (size_t i = 0; i + 1 < operation.value.size(); i += 2) {
+        int characteristic = characteristicOf(readLe16(&operation.value[i]));
+        size_t size = fixedLength(characteristic);
+        // Only the last value may vary, and it takes the rest.
+        if (size == 0) {
+            size = length - offset;
+        }
+        if ((characteristic < 0) || (offset + size > length)) {
+            return CONFIG_ERR_MALFORMED;
+        }
+        ConfigStatus status;
+        if (characteristic == CONFIG_V1_DATA_SIZE) {
+            // Data 1 is in the batch.
+            v1Size = value[offset];
+            status = (v1Size > URIBEACON_FRAME_MAX) ? CONFIG_ERR_MALFORMED : CONFIG_OK;
+        } else {
+            status = onRead(characteristic, &value[offset], size);
+        }
+        if (status != CONFIG_OK) {
+            return status;
+        }
+        offset += size;
+    }
+    return (offset == length) ? CONFIG_OK : CONFIG_ERR_MALFORMED;
+}
+
+ConfigStatus ConfigClient::onState(const uint8_t *value, size_t length) {
+    if (stateLength + length > sizeof(state)) {
+        return CONFIG_ERR_MALFORMED;
+    }
+    memcpy(&state[stateLength], value, length);
+    stateLength += static_cast<uint8_t>(length);
+    // The header gives the whole length; a read that filled the MTU and
+    // left the URI short is continued where it stopped.
+    if ((length == ATT_DEFAULT_MTU - 1) && (stateLength >= URIBEACON_STATE_HDR_SIZE) &&
+        (stateLength < URIBEACON_STATE_HDR_SIZE + state[URIBEACON_STATE_HDR_SIZE - 1])) {
+        uint8_t offset[2] = { stateLength, 0 };
+        enqueue(ATT_READ_BLOB_REQ, valueHandles[CONFIG_STATE], CONFIG_STATE, offset,
+                sizeof(offset));
+        return CONFIG_OK;
+    }
+    if (uribeacon_state_read(&result.found, state, stateLength) != URIBEACON_OK) {
+        return CONFIG_ERR_MALFORMED;
+    }
+    result.foundRadioLevels = true;
+    return CONFIG_OK;
+}
+
+void ConfigClient::planWrite(bool differs, ConfigCharacteristic characteristic,
+                             const uint8_t *value, size_t length) {
+    if (request.sync && !differs) {
+        result.writesAvoided++;
+        return;
+    }
+    enqueueWrite(characteristic, value, length);
+    result.writes++;
+}
+
+ConfigStatus ConfigClient::planWrites(void) {
+    const uribeacon_config_t &config = request.config;
+    if (uribeacon_config_validate(&config) != URIBEACON_OK) {
+        return CONFIG_ERR_INVALID;
+    }
+
+    if (result.protocol == CONFIG_PROTOCOL_V1) {
+        uint8_t frame[URIBEACON_FRAME_MAX];
+        uint8_t length = uribeacon_frame_build(&config, frame, sizeof(frame));
+        if (length == 0) {
+            return CONFIG_ERR_INVALID;
+        }
+        // Data 1 sets the length and data 2 extends it, so data 1 can be
+        // left alone only if data 2 restores the length.
+        bool same = (length == v1Size) && (memcmp(frame, v1Frame, length) == 0);
+        bool sameHead = (length > CONFIG_V1_DATA_1_MAX) && (v1Size >= CONFIG_V1_DATA_1_MAX) &&
+                        (memcmp(frame, v1Frame, CONFIG_V1_DATA_1_MAX) == 0);
+        memcpy(v1Frame, frame, length);
+        v1Written = length;
+        planWrite(!same && !sameHead, CONFIG_V1_DATA_1, v1Frame,
+                  std::min<size_t>(length, CONFIG_V1_DATA_1_MAX));
+        if (length > CONFIG_V1_DATA_1_MAX) {
+            planWrite(!same, CONFIG_V1_DATA_2, &v1Frame[CONFIG_V1_DATA_1_MAX],
+                      length - CONFIG_V1_DATA_1_MAX);
+        }
+        if (result.writes > 0) {
+            enqueueRead(CONFIG_V1_DATA_SIZE);
+        }
+        return CONFIG_OK;
+    }
+
+    const uribeacon_config_t &found = result.found;
+    bool differs[] = {
+        (found.uri_length != config.uri_length) ||
+            (memcmp(found.uri, config.uri, config.uri_length) != 0),
+        found.flags != config.flags,
+        memcmp(found.adv_tx_power_levels, config.adv_tx_power_levels,
+               sizeof(config.adv_tx_power_levels)) != 0,
+        found.tx_power_mode != config.tx_power_mode,
+        found.period != config.period,
+    };
+    bool anyDiffers = false;
+    for (size_t i = 0; i < sizeof(differs) / sizeof(differs[0]); i++) {
+        anyDiffers |= differs[i];
+    }
+    // A locked beacon is unlocked to write it, or to leave it unlocked.
+    bool unlock = found.lock_state && (!request.sync || anyDiffers || !config.lock_state);
+    bool lock = config.lock_state && (!request.sync || !found.lock_state || unlock);
+
+    if (unlock) {
+        if (!request.haveKey) {
+            return CONFIG_ERR_LOCKED;
+        }
+        if (valueHandles[CONFIG_UNLOCK] == 0) {
+            return CONFIG_ERR_MISSING;
+        }
+    }
+    if (lock && (valueHandles[CONFIG_LOCK] == 0)) {
+        return CONFIG_ERR_MISSING;
+    }
+    if (found.lock_state) {
+        planWrite(unlock, CONFIG_UNLOCK, request.key, sizeof(request.key));
+    }
+    uint8_t levels[URIBEACON_TX_POWER_MODES];
+    memcpy(levels, config.adv_tx_power_levels, sizeof(levels));
+    uint8_t period[2] = { static_cast<uint8_t>(config.period & 0xFF),
+                          static_cast<uint8_t>(config.period >> 8) };
+    planWrite(differs[0], CONFIG_URI_DATA, config.uri, config.uri_length);
+    planWrite(differs[1], CONFIG_FLAGS, &config.flags, 1);
+    planWrite(differs[2], CONFIG_ADV_TX_POWER_LEVELS, levels, sizeof(levels));
+    planWrite(differs[3], CONFIG_TX_POWER_MODE, &config.tx_power_mode, 1);
+    planWrite(differs[4], CONFIG_PERIOD, period, sizeof(period));
+    if (config.lock_state) {
+        planWrite(lock, CONFIG_LOCK, config.lock_code, sizeof(config.lock_code));
+    }
+    if (!queue.empty() && (queue.back().opcode == ATT_WRITE_CMD)) {
+        enqueueRead(CONFIG_LOCK_STATE);
+    }
+    return CONFIG_OK;
+}
+
+void ConfigClient::finish(ConfigStatus status, uint64_t nowNs) {
+    phase = PHASE_DONE;
+    result.status = status;
+    result.totalNs = nowNs - startNs;
+    queue.clear();
+    awaiting = false;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Client for the UriBeacon configuration services, for provisioning
+// stations. It speaks both protocols the Android library does:
+//
+//   v1  the nRF51 service b35d7da6-...: the whole frame, as the core builds
+//       it, written in two parts, data 1 (20 bytes) and data 2, with its
+//       length readable from data size
+//   v2  the ee0c2080-... service of the spec, one characteristic a field
+//
+// and picks one from the services the beacon has. ATT allows one request
+// at a time on a link, so the client keeps its operations queued and sends
+// the next request straight from the response to the last rather than a
+// round trip through the caller, as GattRequestQueue does. Writes go as
+// Write Commands, without waiting for a response, where the characteristic
+// allows them, as nRF51 data 1 and data 2 do; a read after them confirms
+// the beacon has applied them, since the link keeps PDUs in order.
+//
+// A v2 beacon with the state characteristic, ee0c208b, is read from that
+// alone: the configuration packed as uribeacon_state_write() does, in one
+// read, and a Read Blob for the rest of a URI longer than 8 bytes. On other
+// beacons, reads of fixed size values are batched into one Read Multiple, whose
+// response fits the default MTU, with the one variable length value last
+// or read on its own; a server without Read Multiple is read one value at
+// a time instead. A sync pass writes only what it read differently from
+// the configuration asked for, so a beacon already configured is left
+// untouched, and its NVM is not committed.
+//
+// The client is a state machine: whatever reads the link passes each PDU
+// to receive() and calls tick() for timeouts, so one thread can drive many
+// clients, over real links or simulated ones.
+
+#ifndef URIBEACON_CONFIG_CLIENT_H__
+#define URIBEACON_CONFIG_CLIENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "att.h"
+#include "uribeacon_core.h"
+
+// v1 data 1 holds this much of the frame, data 2 the rest.
+#define CONFIG_V1_DATA_1_MAX            (20)
+
+#define CONFIG_TIMEOUT_MS               (5000)
+
+enum ConfigProtocol {
+    CONFIG_PROTOCOL_NONE,
+    CONFIG_PROTOCOL_V1,
+    CONFIG_PROTOCOL_V2,
+};
+
+// The characteristics of both protocols.
+enum ConfigCharacteristic {
+    CONFIG_LOCK_STATE,
+    CONFIG_LOCK,
+    CONFIG_UNLOCK,
+    CONFIG_URI_DATA,
+    CONFIG_FLAGS,
+    CONFIG_ADV_TX_POWER_LEVELS,
+    CONFIG_TX_POWER_MODE,
+    CONFIG_PERIOD,
+    CONFIG_RESET,
+    CONFIG_RADIO_TX_POWER_LEVELS,       // CSR's own, ee0c208a
+    CONFIG_STATE,                       // CSR's read only snapshot, ee0c208b
+    CONFIG_V1_DATA_1,
+    CONFIG_V1_DATA_2,
+    CONFIG_V1_DATA_SIZE,
+    CONFIG_CHARACTERISTICS,
+};
+
+enum ConfigStatus {
+    CONFIG_OK,
+    CONFIG_ERR_ATT,             // the beacon refused a request, see attError
+    CONFIG_ERR_NO_SERVICE,      // it has neither config service
+    CONFIG_ERR_MISSING,         // a characteristic the protocol needs is missing
+    CONFIG_ERR_MALFORMED,       // a response was malformed or unexpected
+    CONFIG_ERR_LOCKED,          // locked, with no key to unlock it
+    CONFIG_ERR_INVALID,         // the configuration to write is invalid
+    CONFIG_ERR_VERIFY,          // v1 data size read back differs from the write
+    CONFIG_ERR_TIMEOUT,
+    CONFIG_ERR_LINK,            // the bearer failed, see linkError
+};
+
+const AttUuid &configServiceUuid(ConfigProtocol protocol);
+const AttUuid &configCharacteristicUuid(ConfigCharacteristic characteristic);
+const char *configProtocolName(ConfigProtocol protocol);
+const char *configStatusName(ConfigStatus status);
+
+struct ConfigRequest {
+    bool write;                 // else the beacon is only read
+    // To write. The radio power levels are left alone, and so is the lock
+    // unless lock_state is set, which locks the beacon with lock_code once
+    // the rest is written. v1 has no lock and only advertises the power
+    // level of tx_power_mode.
+    uribeacon_config_t config;
+    bool haveKey;
+    uint8_t key[URIBEACON_LOCK_CODE_SIZE];     // unlocks a locked v2 beacon
+    uint32_t timeoutMs;         // for each response
+    // With write, writes only the fields read differently. A locked beacon
+    // is taken to be locked with lock_code, which cannot be read.
+    bool sync;
+    bool batchReads;            // try Read Multiple first
+
+    ConfigRequest();
+};
+
+struct ConfigReport {
+    ConfigStatus status;
+    uint8_t attError;           // with CONFIG_ERR_ATT
+    int linkError;              // errno, with CONFIG_ERR_LINK
+    ConfigProtocol protocol;
+    // As read before writing. From v1, only the URI, the flags and the
+    // power level, as that of the default tx_power_mode.
+    uribeacon_config_t found;
+    bool foundRadioLevels;
+    // Time spent discovering the service, reading and writing.
+    uint64_t discoverNs;
+    uint64_t readNs;
+    uint64_t writeNs;
+    uint64_t totalNs;
+    uint32_t requests;          // PDUs sent that wait for a response
+    uint32_t commands;          // and that do not
+    // Writes sent, and those a full write would have sent that a sync found
+    // the beacon did not need.
+    uint32_t writes;
+    uint32_t writesAvoided;
+};
+
+class ConfigClient {
+public:
+    ConfigClient(AttBearer &bearer, const ConfigRequest &request);
+
+    // Starts discovery. Times are from any monotonic clock, real or
+    // simulated, and only their differences are reported.
+    void start(uint64_t nowNs);
+
+    // A PDU from the beacon.
+    void receive(const uint8_t *pdu, size_t length, uint64_t nowNs);
+
+    // Fails the pass if the beacon is late to answer.
+    void tick(uint64_t nowNs);
+
+    bool done(void) const {
+        return phase == PHASE_DONE;
+    }
+
+    // When the outstanding request times out, or 0 if none is.
+    uint64_t deadlineNs(void) const {
+        return awaiting ? deadline : 0;
+    }
+
+    const ConfigReport &report(void) const {
+        return result;
+    }
+
+private:
+    enum Phase {
+        PHASE_IDLE,
+        PHASE_SERVICES,
+        PHASE_CHARACTERISTICS,
+        PHASE_READ,
+        PHASE_WRITE,
+        PHASE_DONE,
+    };
+
+    struct Operation {
+        uint8_t opcode;
+        uint16_t handle;            // or the first handle of a discovery
+        int characteristic;         // the ConfigCharacteristic read or written
+        std::vector<uint8_t> value;
+    };
+
+    void enqueue(uint8_t opcode, uint16_t handle, int characteristic,
+                 const uint8_t *value = NULL, size_t length = 0);
+    void enqueueWrite(ConfigCharacteristic characteristic, const uint8_t *value, size_t length);
+    void enqueueRead(ConfigCharacteristic characteristic);
+    int characteristicOf(uint16_t valueHandle) const;
+    // One Read Multiple, or one read each if the server has none.
+    void enqueueReads(const ConfigCharacteristic *characteristics, size_t count);
+    // Sends queued operations until one waits for a response, and moves to
+    // the next phase when the queue empties.
+    void pump(uint64_t nowNs);
+    void advance(uint64_t nowNs);
+    ConfigStatus onServices(const uint8_t *pdu, size_t length);
+    ConfigStatus onCharacteristics(const uint8_t *pdu, size_t length);
+    ConfigStatus onRead(int characteristic, const uint8_t *value, size_t length);
+    ConfigStatus onReadMultiple(const Operation &operation, const uint8_t *value, size_t length);
+    // A part of the state snapshot; reads the next until it is whole.
+    ConfigStatus onState(const uint8_t *value, size_t length);
+    // Plans a write unless sync finds it unneeded.
+    void planWrite(bool differs, ConfigCharacteristic characteristic, const uint8_t *value,
+                   size_t length);
+    ConfigStatus planWrites(void);
+    void finish(ConfigStatus status, uint64_t nowNs);
+
+    AttBearer &bearer;
+    ConfigRequest request;
+    ConfigReport result;
+    Phase phase;
+    std::deque<Operation> queue;
+    bool awaiting;              // the front of the queue was sent
+    uint64_t deadline;
+    uint64_t startNs;
+    uint64_t phaseNs;           // when the current phase started
+    uint16_t serviceStart;
+    uint16_t serviceEnd;
+    uint16_t valueHandles[CONFIG_CHARACTERISTICS];
+    uint8_t properties[CONFIG_CHARACTERISTICS];
+    uint8_t v1Size;             // frame length from data size
+    uint8_t v1Frame[URIBEACON_FRAME_MAX];
+    uint8_t v1Written;          // frame length written
+    bool readMultiple;          // until the server refuses it
+    uint8_t state[URIBEACON_STATE_MAX];
+    uint8_t stateLength;        // read so far
+};
+
+#endif // URIBEACON_CONFIG_CLIENT_H__
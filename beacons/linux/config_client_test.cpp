@@ -0,0 +1,376 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the config client against simulated v1 and v2 beacons, and over
+// a socketpair, which keeps PDU boundaries as an L2CAP socket does.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include "config_client.h"
+#include "config_sim.h"
+#include "test_util.h"
+
+#define LATENCY_NS                      (10000000ull)
+
+static const uint8_t KEY[URIBEACON_LOCK_CODE_SIZE] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// Runs one pass against beacon, and disconnects.
+static ConfigReport run(SimulatedBeacon &beacon, const ConfigRequest &request) {
+    SimulatedNetwork network;
+    SimulatedLink link(network, beacon, LATENCY_NS);
+    ConfigClient client(link, request);
+    link.attach(&client);
+    client.start(network.now());
+    while (!client.done()) {
+        if (!network.step()) {
+            network.advance(client.deadlineNs());
+        }
+        client.tick(network.now());
+    }
+    link.close();
+    return client.report();
+}
+
+static ConfigRequest writeRequest(void) {
+    ConfigRequest request;
+    request.write = true;
+    uribeacon_config_t &config = request.config;
+    uribeacon_uri_encode("https://example.com/config", config.uri, URIBEACON_URI_MAX,
+                         &config.uri_length);
+    config.flags = 0x01;
+    config.tx_power_mode = URIBEACON_TX_POWER_MODE_HIGH;
+    for (int i = 0; i < URIBEACON_TX_POWER_MODES; i++) {
+        config.adv_tx_power_levels[i] = static_cast<int8_t>(-30 + 10 * i);
+    }
+    config.period = 500;
+    return request;
+}
+
+static void testUuids(void) {
+    AttUuid uuid;
+    EXPECT_EQ(true, parseAttUuid("ee0c2080-8786-40ba-ab96-99b91ac981d8", uuid));
+    EXPECT_EQ(0xD8, uuid.bytes[0]);
+    EXPECT_EQ(0x80, uuid.bytes[12]);
+    EXPECT_EQ(0xEE, uuid.bytes[15]);
+    EXPECT_EQ(true, uuid == configServiceUuid(CONFIG_PROTOCOL_V2));
+    EXPECT_EQ(0, attShortUuid(uuid));
+    EXPECT_EQ(false, parseAttUuid("ee0c2080-8786-40ba-ab96-99b91ac981d", uuid));
+    EXPECT_EQ(false, parseAttUuid("ee0c2080+8786-40ba-ab96-99b91ac981d8", uuid));
+    EXPECT_EQ(false, parseAttUuid("ee0c2080-8786-40ba-ab96-99b91ac981dx", uuid));
+
+    static const uint8_t SHORT[] = { 0x00, 0x28 };
+    EXPECT_EQ(true, readAttUuid(SHORT, sizeof(SHORT), uuid));
+    EXPECT_EQ(true, uuid == attUuid16(GATT_PRIMARY_SERVICE));
+    EXPECT_EQ(GATT_PRIMARY_SERVICE, attShortUuid(uuid));
+    EXPECT_EQ(false, readAttUuid(SHORT, 1, uuid));
+}
+
+static void testReadV2(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V2);
+    ConfigReport report = run(beacon, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(CONFIG_PROTOCOL_V2, report.protocol);
+    EXPECT_EQ(0, memcmp(&beacon.config(), &report.found, sizeof(report.found)));
+    EXPECT_EQ(true, report.foundRadioLevels);
+    EXPECT_EQ(0, report.commands);
+    EXPECT_EQ(0, report.writeNs);
+    // Every request is a round trip, and nothing else takes time.
+    EXPECT_EQ(report.requests * 2 * LATENCY_NS, report.totalNs);
+    EXPECT_EQ(report.totalNs, report.discoverNs + report.readNs);
+    // The state snapshot, and a Read Blob for the end of the 11 byte URI.
+    EXPECT_EQ(2 * 2 * LATENCY_NS, report.readNs);
+    EXPECT_EQ(report.requests, beacon.stats().requests);
+    EXPECT_EQ(0, beacon.stats().nvmCommits);
+
+    // A URI of up to 8 bytes is read in one exchange, and a full one in two.
+    ConfigRequest request;
+    request.write = true;
+    uribeacon_uri_encode("http://a.bc", request.config.uri, URIBEACON_URI_MAX,
+                         &request.config.uri_length);
+    run(beacon, request);
+    report = run(beacon, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(request.config.uri_length, report.found.uri_length);
+    EXPECT_EQ(0, memcmp(request.config.uri, report.found.uri, request.config.uri_length));
+    EXPECT_EQ(1 * 2 * LATENCY_NS, report.readNs);
+    request.config.uri_length = URIBEACON_URI_MAX;
+    memset(request.config.uri, 'x', URIBEACON_URI_MAX);
+    run(beacon, request);
+    report = run(beacon, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(0, memcmp(&beacon.config(), &report.found, sizeof(report.found)));
+    EXPECT_EQ(2 * 2 * LATENCY_NS, report.readNs);
+
+    // Without the snapshot, the CSR firmware refuses Read Multiple, and each
+    // value is read alone.
+    SimulatedBeacon older(CONFIG_PROTOCOL_V2, false);
+    report = run(older, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(0, memcmp(&older.config(), &report.found, sizeof(report.found)));
+    EXPECT_EQ(8 * 2 * LATENCY_NS, report.readNs);
+
+    request = ConfigRequest();
+    request.batchReads = false;
+    EXPECT_EQ(7 * 2 * LATENCY_NS, run(older, request).readNs);
+
+    // Fixed size values in one batch, the URI in another read.
+    older.setReadMultiple(true);
+    report = run(older, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(0, memcmp(&older.config(), &report.found, sizeof(report.found)));
+    EXPECT_EQ(2 * 2 * LATENCY_NS, report.readNs);
+}
+
+static void testWriteV2(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V2);
+    ConfigRequest request = writeRequest();
+    ConfigReport report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    // The CSR service takes no Write Commands.
+    EXPECT_EQ(0, report.commands);
+    EXPECT_EQ(5 * 2 * LATENCY_NS, report.writeNs);
+    EXPECT_EQ(5, beacon.stats().writes);
+    EXPECT_EQ(1, beacon.stats().nvmCommits);
+
+    const uribeacon_config_t &config = beacon.config();
+    EXPECT_EQ(request.config.uri_length, config.uri_length);
+    EXPECT_EQ(0, memcmp(request.config.uri, config.uri, config.uri_length));
+    EXPECT_EQ(0x01, config.flags);
+    EXPECT_EQ(URIBEACON_TX_POWER_MODE_HIGH, config.tx_power_mode);
+    EXPECT_EQ(0, config.adv_tx_power_levels[3]);
+    EXPECT_EQ(500, config.period);
+    EXPECT_EQ(0, config.lock_state);
+
+    // What was there before is reported.
+    EXPECT_EQ(1000, report.found.period);
+
+    request.config.period = 50;
+    EXPECT_EQ(CONFIG_ERR_INVALID, run(beacon, request).status);
+}
+
+static void testLock(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V2);
+    beacon.lock(KEY);
+    ConfigRequest request = writeRequest();
+    ConfigReport report = run(beacon, request);
+    EXPECT_EQ(CONFIG_ERR_LOCKED, report.status);
+    EXPECT_EQ(true, report.found.lock_state);
+    EXPECT_EQ(0, beacon.stats().writes);
+
+    // A wrong key is refused and nothing after it is sent.
+    request.haveKey = true;
+    memset(request.key, 0xEE, sizeof(request.key));
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_ERR_ATT, report.status);
+    EXPECT_EQ(ATT_ERR_INSUFFICIENT_AUTHORIZATION, report.attError);
+    EXPECT_EQ(0, beacon.stats().writes);
+
+    // Unlocked, written and locked again with a new code.
+    memcpy(request.key, KEY, sizeof(request.key));
+    request.config.lock_state = 1;
+    memset(request.config.lock_code, 0x42, sizeof(request.config.lock_code));
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(7, beacon.stats().writes);
+    EXPECT_EQ(1, beacon.config().lock_state);
+    EXPECT_EQ(0x42, beacon.config().lock_code[15]);
+    EXPECT_EQ(500, beacon.config().period);
+}
+
+static void testV1(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V1);
+    ConfigReport report = run(beacon, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(CONFIG_PROTOCOL_V1, report.protocol);
+    uribeacon_config_t defaults;
+    uribeacon_config_defaults(&defaults);
+    EXPECT_EQ(defaults.uri_length, report.found.uri_length);
+    EXPECT_EQ(0, memcmp(defaults.uri, report.found.uri, defaults.uri_length));
+    // Data size and data 1 together, then data 2, as the default frame is
+    // 21 bytes.
+    EXPECT_EQ(2 * 2 * LATENCY_NS, report.readNs);
+
+    ConfigRequest request = writeRequest();
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    uint8_t length = uribeacon_frame_build(&request.config, frame, sizeof(frame));
+    EXPECT_EQ(true, length > CONFIG_V1_DATA_1_MAX);
+    EXPECT_EQ(length, beacon.frame().size());
+    EXPECT_EQ(0, memcmp(frame, beacon.frame().data(), length));
+    // Data 1 and 2 go as commands, and only the read of the size after
+    // them waits: one round trip for the whole write.
+    EXPECT_EQ(2, report.commands);
+    EXPECT_EQ(2, beacon.stats().commands);
+    EXPECT_EQ(2 * LATENCY_NS, report.writeNs);
+    EXPECT_EQ(1, beacon.stats().nvmCommits);
+
+    // Read back as written; the power level is that of the default mode.
+    report = run(beacon, ConfigRequest());
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(request.config.uri_length, report.found.uri_length);
+    EXPECT_EQ(0x01, report.found.flags);
+    EXPECT_EQ(0, report.found.adv_tx_power_levels[URIBEACON_TX_POWER_MODE_LOW]);
+    EXPECT_EQ(2 * 2 * LATENCY_NS, report.readNs);
+}
+
+// A sync writes what differs, and nothing to a beacon already configured.
+static void testSync(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V2);
+    beacon.setReadMultiple(true);
+    ConfigRequest request = writeRequest();
+    request.sync = true;
+    ConfigReport report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(5, report.writes);
+    EXPECT_EQ(0, report.writesAvoided);
+
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(0, report.writes);
+    EXPECT_EQ(5, report.writesAvoided);
+    EXPECT_EQ(0, report.writeNs);
+    EXPECT_EQ(5, beacon.stats().writes);
+    EXPECT_EQ(1, beacon.stats().nvmCommits);
+
+    request.config.period = 2000;
+    report = run(beacon, request);
+    EXPECT_EQ(1, report.writes);
+    EXPECT_EQ(4, report.writesAvoided);
+    EXPECT_EQ(2000, beacon.config().period);
+    EXPECT_EQ(2, beacon.stats().nvmCommits);
+
+    // Locked as wanted needs no key; a change unlocks and locks it again.
+    memcpy(request.config.lock_code, KEY, sizeof(KEY));
+    request.config.lock_state = 1;
+    beacon.lock(KEY);
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(0, report.writes);
+    EXPECT_EQ(7, report.writesAvoided);
+    request.config.flags = 0x02;
+    EXPECT_EQ(CONFIG_ERR_LOCKED, run(beacon, request).status);
+    request.haveKey = true;
+    memcpy(request.key, KEY, sizeof(KEY));
+    report = run(beacon, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(3, report.writes);
+    EXPECT_EQ(0x02, beacon.config().flags);
+    EXPECT_EQ(1, beacon.config().lock_state);
+
+    // v1 rewrites only data 2 when the frame differs after data 1.
+    SimulatedBeacon v1(CONFIG_PROTOCOL_V1);
+    request = writeRequest();
+    request.sync = true;
+    run(v1, request);
+    report = run(v1, request);
+    EXPECT_EQ(0, report.writes);
+    EXPECT_EQ(2, report.writesAvoided);
+    EXPECT_EQ(0, report.commands);
+    request.config.uri[request.config.uri_length - 1] ^= 1;
+    report = run(v1, request);
+    EXPECT_EQ(CONFIG_OK, report.status);
+    EXPECT_EQ(1, report.writes);
+    EXPECT_EQ(1, report.writesAvoided);
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    uint8_t length = uribeacon_frame_build(&request.config, frame, sizeof(frame));
+    EXPECT_EQ(length, v1.frame().size());
+    EXPECT_EQ(0, memcmp(frame, v1.frame().data(), length));
+}
+
+static void testTimeout(void) {
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V2);
+    beacon.setSilent(true);
+    ConfigRequest request;
+    request.timeoutMs = 300;
+    ConfigReport report = run(beacon, request);
+    EXPECT_EQ(CONFIG_ERR_TIMEOUT, report.status);
+    EXPECT_EQ(300000000ull, report.totalNs);
+    EXPECT_EQ(1, report.requests);
+}
+
+// The beacon answers on the other end of a socketpair, from a thread.
+static void testSocket(void) {
+    int fds[2];
+    EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds));
+    SimulatedBeacon beacon(CONFIG_PROTOCOL_V1);
+    std::thread server([&beacon, &fds]() {
+        uint8_t pdu[ATT_DEFAULT_MTU];
+        ssize_t length;
+        while ((length = recv(fds[1], pdu, sizeof(pdu), 0)) > 0) {
+            uint8_t response[ATT_DEFAULT_MTU];
+            size_t size = beacon.handle(pdu, static_cast<size_t>(length), response);
+            if (size > 0) {
+                send(fds[1], response, size, MSG_NOSIGNAL);
+            }
+        }
+    });
+
+    SocketAttBearer bearer(fds[0]);
+    ConfigRequest request = writeRequest();
+    ConfigClient client(bearer, request);
+    client.start(1);
+    while (!client.done()) {
+        struct pollfd pfd = { fds[0], POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) != 1) {
+            break;
+        }
+        uint8_t pdu[ATT_DEFAULT_MTU];
+        ssize_t length = recv(fds[0], pdu, sizeof(pdu), 0);
+        if (length <= 0) {
+            break;
+        }
+        client.receive(pdu, static_cast<size_t>(length), 2);
+    }
+    EXPECT_EQ(true, client.done());
+    EXPECT_EQ(CONFIG_OK, client.report().status);
+    EXPECT_EQ(2, client.report().commands);
+
+    shutdown(fds[0], SHUT_RDWR);
+    server.join();
+    close(fds[0]);
+    close(fds[1]);
+
+    // A bearer that cannot send fails the pass.
+    ConfigClient broken(bearer, request);
+    broken.start(1);
+    EXPECT_EQ(true, broken.done());
+    EXPECT_EQ(CONFIG_ERR_LINK, broken.report().status);
+    EXPECT_EQ(EBADF, broken.report().linkError);
+}
+
+int main(int argc, char **argv) {
+    testUuids();
+    testReadV2();
+    testWriteV2();
+    testLock();
+    testV1();
+    testSync();
+    testTimeout();
+    testSocket();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
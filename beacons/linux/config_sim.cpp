@@ -0,0 +1,618 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config_sim.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+// The CSR firmware's advertised power levels, in dBm at 0 m.
+static const int8_t CSR_ADV_TX_POWER_LEVELS[URIBEACON_TX_POWER_MODES] = { -22, -14, -6, 2 };
+
+static const char DEVICE_NAME[] = "UriBeacon";
+
+#define GAP_SERVICE                     (0x1800)
+#define GAP_DEVICE_NAME                 (0x2A00)
+
+static uint16_t readLe16(const uint8_t *bytes) {
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+static size_t errorResponse(uint8_t opcode, uint16_t handle, uint8_t error, uint8_t *response) {
+    response[0] = ATT_ERROR_RSP;
+    response[1] = opcode;
+    response[2] = handle & 0xFF;
+    response[3] = handle >> 8;
+    response[4] = error;
+    return 5;
+}
+
+// A UUID in its shortest form, as a declaration holds it.
+static void appendUuid(std::vector<uint8_t> &value, const AttUuid &uuid) {
+    uint16_t shortUuid = attShortUuid(uuid);
+    if (shortUuid != 0) {
+        value.push_back(shortUuid & 0xFF);
+        value.push_back(shortUuid >> 8);
+    } else {
+        value.insert(value.end(), uuid.bytes, uuid.bytes + sizeof(uuid.bytes));
+    }
+}
+
+SimulatedBeacon::SimulatedBeacon(ConfigProtocol protocol, bool snapshot)
+    : kind(protocol),
+      dirty(false),
+      silent(false),
+      readMultiple(protocol == CONFIG_PROTOCOL_V1),
+      drops(0) {
+    memset(&counts, 0, sizeof(counts));
+    uribeacon_config_defaults(&state);
+    memcpy(state.adv_tx_power_levels, CSR_ADV_TX_POWER_LEVELS, sizeof(state.adv_tx_power_levels));
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    v1Frame.assign(frame, frame + uribeacon_frame_build(&state, frame, sizeof(frame)));
+
+    addService(attUuid16(GAP_SERVICE));
+    addCharacteristic(attUuid16(GAP_DEVICE_NAME), GATT_PROP_READ, -1);
+    attributes.back().value.assign(DEVICE_NAME, DEVICE_NAME + sizeof(DEVICE_NAME) - 1);
+
+    addService(configServiceUuid(protocol));
+    if (protocol == CONFIG_PROTOCOL_V1) {
+        static const uint8_t DATA = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_WRITE_NO_RSP;
+        addCharacteristic(configCharacteristicUuid(CONFIG_V1_DATA_1), DATA, CONFIG_V1_DATA_1);
+        addCharacteristic(configCharacteristicUuid(CONFIG_V1_DATA_2), DATA, CONFIG_V1_DATA_2);
+        addCharacteristic(configCharacteristicUuid(CONFIG_V1_DATA_SIZE),
+                          GATT_PROP_READ | GATT_PROP_WRITE_NO_RSP, CONFIG_V1_DATA_SIZE);
+        return;
+    }
+    static const uint8_t READ_WRITE = GATT_PROP_READ | GATT_PROP_WRITE;
+    static const uint8_t PROPERTIES[] = {
+        GATT_PROP_READ, GATT_PROP_WRITE, GATT_PROP_WRITE, READ_WRITE, READ_WRITE,
+        READ_WRITE, READ_WRITE, READ_WRITE, GATT_PROP_WRITE, READ_WRITE, GATT_PROP_READ,
+    };
+    int last = snapshot ? CONFIG_STATE : CONFIG_RADIO_TX_POWER_LEVELS;
+    for (int i = 0; i <= last; i++) {
+        ConfigCharacteristic characteristic = static_cast<ConfigCharacteristic>(i);
+        addCharacteristic(configCharacteristicUuid(characteristic), PROPERTIES[i], i);
+    }
+}
+
+void SimulatedBeacon::addService(const AttUuid &uuid) {
+    Attribute service;
+    service.type = attUuid16(GATT_PRIMARY_SERVICE);
+    appendUuid(service.value, uuid);
+    service.characteristic = -1;
+    service.properties = GATT_PROP_READ;
+    attributes.push_back(service);
+}
+
+void SimulatedBeacon::addCharacteristic(const AttUuid &uuid, uint8_t properties,
+                                        int characteristic) {
+    uint16_t valueHandle = static_cast<uint16_t>(attributes.size() + 2);
+    Attribute declaration;
+    declaration.type = attUuid16(GATT_CHARACTERISTIC);
+    declaration.value.push_back(properties);
+    declaration.value.push_back(valueHandle & 0xFF);
+    declaration.value.push_back(valueHandle >> 8);
+    appendUuid(declaration.value, uuid);
+    declaration.characteristic = -1;
+    declaration.properties = GATT_PROP_READ;
+    attributes.push_back(declaration);
+
+    Attribute value;
+    value.type = uuid;
+    value.characteristic = characteristic;
+    value.properties = properties;
+    attributes.push_back(value);
+}
+
+void SimulatedBeacon::lock(const uint8_t code[URIBEACON_LOCK_CODE_SIZE]) {
+    state.lock_state = 1;
+    memcpy(state.lock_code, code, URIBEACON_LOCK_CODE_SIZE);
+}
+
+void SimulatedBeacon::disconnect(void) {
+    if (dirty) {
+        counts.nvmCommits++;
+        dirty = false;
+    }
+}
+
+size_t SimulatedBeacon::handle(const uint8_t *pdu, size_t length, uint8_t *response) {
+    if (silent || (length == 0)) {
+        return 0;
+    }
+    if (drops > 0) {
+        drops--;
+        return 0;
+    }
+    uint8_t opcode = pdu[0];
+    if (opcode == ATT_WRITE_CMD) {
+        counts.commands++;
+    } else {
+        counts.requests++;
+    }
+
+    if (((opcode == ATT_READ_BY_GROUP_TYPE_REQ) || (opcode == ATT_READ_BY_TYPE_REQ)) &&
+        ((length == 7) || (length == 21))) {
+        uint16_t start = readLe16(&pdu[1]);
+        uint16_t end = readLe16(&pdu[3]);
+        AttUuid type;
+        readAttUuid(&pdu[5], length - 5, type);
+        bool group = (opcode == ATT_READ_BY_GROUP_TYPE_REQ);
+        if ((start == 0) || (start > end)) {
+            return errorResponse(opcode, start, ATT_ERR_INVALID_HANDLE, response);
+        }
+        if (group && !(type == attUuid16(GATT_PRIMARY_SERVICE))) {
+            return errorResponse(opcode, start, ATT_ERR_REQUEST_NOT_SUPPORTED, response);
+        }
+
+        // As many entries of the first one's size as fit.
+        size_t used = 2;
+        response[0] = opcode + 1;
+        response[1] = 0;
+        for (size_t i = start - 1; (i < attributes.size()) && (i < end); i++) {
+            const Attribute &attribute = attributes[i];
+            if (!(attribute.type == type)) {
+                continue;
+            }
+            size_t size = (group ? 4 : 2) + attribute.value.size();
+            if (((response[1] != 0) && (size != response[1])) || (used + size > ATT_DEFAULT_MTU)) {
+                break;
+            }
+            response[1] = static_cast<uint8_t>(size);
+            uint16_t handle = static_cast<uint16_t>(i + 1);
+            response[used++] = handle & 0xFF;
+            response[used++] = handle >> 8;
+            if (group) {
+                // A group ends where the next service starts; the last at 0xFFFF.
+                uint16_t groupEnd = 0xFFFF;
+                for (size_t j = i + 1; j < attributes.size(); j++) {
+                    if (attributes[j].type == type) {
+                        groupEnd = static_cast<uint16_t>(j);
+                        break;
+                    }
+                }
+                response[used++] = groupEnd & 0xFF;
+                response[used++] = groupEnd >> 8;
+            }
+            memcpy(&response[used], attribute.value.data(), attribute.value.size());
+            used += attribute.value.size();
+        }
+        if (response[1] == 0) {
+            return errorResponse(opcode, start, ATT_ERR_ATTRIBUTE_NOT_FOUND, response);
+        }
+        return used;
+    }
+
+    if ((opcode == ATT_READ_MULTIPLE_REQ) && readMultiple) {
+        if ((length < 5) || (length % 2 != 1)) {
+            return errorResponse(opcode, 0, ATT_ERR_INVALID_LENGTH, response);
+        }
+        // The values one after another, cut at the MTU.
+        size_t used = 1;
+        response[0] = ATT_READ_MULTIPLE_RSP;
+        for (size_t i = 1; i < length; i += 2) {
+            uint16_t handle = readLe16(&pdu[i]);
+            if ((handle == 0) || (handle > attributes.size())) {
+                return errorResponse(opcode, handle, ATT_ERR_INVALID_HANDLE, response);
+            }
+            const Attribute &attribute = attributes[handle - 1];
+            if (!(attribute.properties & GATT_PROP_READ)) {
+                return errorResponse(opcode, handle, ATT_ERR_READ_NOT_PERMITTED, response);
+            }
+            std::vector<uint8_t> value = read(attribute);
+            size_t size = std::min<size_t>(value.size(), ATT_DEFAULT_MTU - used);
+            memcpy(&response[used], value.data(), size);
+            used += size;
+        }
+        return used;
+    }
+    if ((opcode != ATT_READ_REQ) && (opcode != ATT_READ_BLOB_REQ) && (opcode != ATT_WRITE_REQ) &&
+        (opcode != ATT_WRITE_CMD)) {
+        return errorResponse(opcode, 0, ATT_ERR_REQUEST_NOT_SUPPORTED, response);
+    }
+    // Commands are never answered, not even with an error.
+    bool command = (opcode == ATT_WRITE_CMD);
+    if (length < 3) {
+        return command ? 0 : errorResponse(opcode, 0, ATT_ERR_INVALID_LENGTH, response);
+    }
+    uint16_t handle = readLe16(&pdu[1]);
+    if ((handle == 0) || (handle > attributes.size())) {
+        return command ? 0 : errorResponse(opcode, handle, ATT_ERR_INVALID_HANDLE, response);
+    }
+    const Attribute &attribute = attributes[handle - 1];
+
+    if (opcode == ATT_READ_REQ) {
+        if (!(attribute.properties & GATT_PROP_READ)) {
+            return errorResponse(opcode, handle, ATT_ERR_READ_NOT_PERMITTED, response);
+        }
+        std::vector<uint8_t> value = read(attribute);
+        size_t size = std::min<size_t>(value.size(), ATT_DEFAULT_MTU - 1);
+        response[0] = ATT_READ_RSP;
+        memcpy(&response[1], value.data(), size);
+        return size + 1;
+    }
+    if (opcode == ATT_READ_BLOB_REQ) {
+        if (length != 5) {
+            return errorResponse(opcode, handle, ATT_ERR_INVALID_LENGTH, response);
+        }
+        if (!(attribute.properties & GATT_PROP_READ)) {
+            return errorResponse(opcode, handle, ATT_ERR_READ_NOT_PERMITTED, response);
+        }
+        std::vector<uint8_t> value = read(attribute);
+        size_t offset = readLe16(&pdu[3]);
+        if (offset > value.size()) {
+            return errorResponse(opcode, handle, ATT_ERR_INVALID_OFFSET, response);
+        }
+        size_t size = std::min<size_t>(value.size() - offset, ATT_DEFAULT_MTU - 1);
+        response[0] = ATT_READ_BLOB_RSP;
+        memcpy(&response[1], value.data() + offset, size);
+        return size + 1;
+    }
+
+    uint8_t permitted = command ? GATT_PROP_WRITE_NO_RSP : GATT_PROP_WRITE;
+    uint8_t error = ATT_ERR_WRITE_NOT_PERMITTED;
+    if ((attribute.characteristic >= 0) && (attribute.properties & permitted)) {
+        error = write(attribute.characteristic, &pdu[3], length - 3);
+    }
+    if (error == 0) {
+        counts.writes++;
+        dirty = true;
+    }
+    if (command) {
+        return 0;
+    }
+    if (error != 0) {
+        return errorResponse(opcode, handle, error, response);
+    }
+    response[0] = ATT_WRITE_RSP;
+    return 1;
+}
+
+std::vector<uint8_t> SimulatedBeacon::read(const Attribute &attribute) const {
+    const uint8_t *bytes = NULL;
+    size_t length = 0;
+    uint8_t period[2] = { static_cast<uint8_t>(state.period & 0xFF),
+                          static_cast<uint8_t>(state.period >> 8) };
+    switch (attribute.characteristic) {
+    case CONFIG_LOCK_STATE:
+        bytes = &state.lock_state;
+        length = 1;
+        break;
+    case CONFIG_URI_DATA:
+        bytes = state.uri;
+        length = state.uri_length;
+        break;
+    case CONFIG_FLAGS:
+        bytes = &state.flags;
+        length = 1;
+        break;
+    case CONFIG_ADV_TX_POWER_LEVELS:
+        bytes = reinterpret_cast<const uint8_t *>(state.adv_tx_power_levels);
+        length = URIBEACON_TX_POWER_MODES;
+        break;
+    case CONFIG_TX_POWER_MODE:
+        bytes = &state.tx_power_mode;
+        length = 1;
+        break;
+    case CONFIG_PERIOD:
+        bytes = period;
+        length = sizeof(period);
+        break;
+    case CONFIG_RADIO_TX_POWER_LEVELS:
+        bytes = reinterpret_cast<const uint8_t *>(state.radio_tx_power_levels);
+        length = URIBEACON_TX_POWER_MODES;
+        break;
+    case CONFIG_V1_DATA_1:
+        bytes = v1Frame.data();
+        length = std::min<size_t>(v1Frame.size(), CONFIG_V1_DATA_1_MAX);
+        break;
+    case CONFIG_V1_DATA_2:
+        if (v1Frame.size() > CONFIG_V1_DATA_1_MAX) {
+            bytes = &v1Frame[CONFIG_V1_DATA_1_MAX];
+            length = v1Frame.size() - CONFIG_V1_DATA_1_MAX;
+        }
+        break;
+    case CONFIG_V1_DATA_SIZE: {
+        uint8_t size = static_cast<uint8_t>(v1Frame.size());
+        return std::vector<uint8_t>(1, size);
+    }
+    case CONFIG_STATE: {
+        uint8_t snapshot[URIBEACON_STATE_MAX];
+        return std::vector<uint8_t>(snapshot, snapshot + uribeacon_state_write(&state, snapshot));
+    }
+    default:
+        return attribute.value;
+    }
+    return std::vector<uint8_t>(bytes, bytes + length);
+}
+
+uint8_t SimulatedBeacon::write(int characteristic, const uint8_t *value, size_t length) {
+    if (kind == CONFIG_PROTOCOL_V1) {
+        // ble_uri.c: data 1 starts the frame over, data 2 extends it.
+        switch (characteristic) {
+        case CONFIG_V1_DATA_1:
+            if (length > CONFIG_V1_DATA_1_MAX) {
+                return ATT_ERR_INVALID_LENGTH;
+            }
+            v1Frame.assign(value, value + length);
+            return 0;
+        case CONFIG_V1_DATA_2:
+            if (length > URIBEACON_FRAME_MAX - CONFIG_V1_DATA_1_MAX) {
+                return ATT_ERR_INVALID_LENGTH;
+            }
+            v1Frame.resize(CONFIG_V1_DATA_1_MAX);
+            v1Frame.insert(v1Frame.end(), value, value + length);
+            return 0;
+        default:
+            if ((length != 1) || (value[0] > URIBEACON_FRAME_MAX)) {
+                return ATT_ERR_INVALID_LENGTH;
+            }
+            v1Frame.resize(value[0]);
+            return 0;
+        }
+    }
+
+    // UribeaconHandleAccessWrite.
+    if (characteristic == CONFIG_LOCK) {
+        if (state.lock_state) {
+            return ATT_ERR_INSUFFICIENT_AUTHORIZATION;
+        }
+        if (length != URIBEACON_LOCK_CODE_SIZE) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        lock(value);
+        return 0;
+    }
+    if (characteristic == CONFIG_UNLOCK) {
+        if (length != URIBEACON_LOCK_CODE_SIZE) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        if (state.lock_state) {
+            if (memcmp(value, state.lock_code, URIBEACON_LOCK_CODE_SIZE) != 0) {
+                return ATT_ERR_INSUFFICIENT_AUTHORIZATION;
+            }
+            state.lock_state = 0;
+        }
+        return 0;
+    }
+    if (state.lock_state) {
+        return ATT_ERR_INSUFFICIENT_AUTHORIZATION;
+    }
+
+    switch (characteristic) {
+    case CONFIG_URI_DATA:
+        if (length > URIBEACON_URI_MAX) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        state.uri_length = static_cast<uint8_t>(length);
+        memcpy(state.uri, value, length);
+        return 0;
+    case CONFIG_FLAGS:
+        if (length != 1) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        state.flags = value[0];
+        return 0;
+    case CONFIG_TX_POWER_MODE:
+        if (length != 1) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        if (value[0] > URIBEACON_TX_POWER_MODE_HIGH) {
+            return ATT_ERR_WRITE_NOT_PERMITTED;
+        }
+        state.tx_power_mode = value[0];
+        return 0;
+    case CONFIG_ADV_TX_POWER_LEVELS:
+    case CONFIG_RADIO_TX_POWER_LEVELS:
+        if (length != URIBEACON_TX_POWER_MODES) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        memcpy((characteristic == CONFIG_ADV_TX_POWER_LEVELS) ? state.adv_tx_power_levels
+                                                             : state.radio_tx_power_levels,
+               value, length);
+        return 0;
+    case CONFIG_PERIOD:
+        if (length != 2) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        state.period = uribeacon_period_clamp(readLe16(value));
+        return 0;
+    case CONFIG_RESET:
+        if (length != 1) {
+            return ATT_ERR_INVALID_LENGTH;
+        }
+        if (value[0] != 0) {
+            uribeacon_config_defaults(&state);
+            memcpy(state.adv_tx_power_levels, CSR_ADV_TX_POWER_LEVELS,
+                   sizeof(state.adv_tx_power_levels));
+        }
+        return 0;
+    default:
+        return ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+}
+
+static void deliverToClient(void *context, SimulatedEvent event, const uint8_t *pdu,
+                            size_t length, uint64_t nowNs) {
+    if (event == SIMULATED_TO_CLIENT) {
+        static_cast<ConfigClient *>(context)->receive(pdu, length, nowNs);
+    }
+}
+
+SimulatedLink::SimulatedLink(SimulatedNetwork &network, SimulatedBeacon &beacon,
+                             uint64_t latencyNs)
+    : network(network),
+      beacon(beacon),
+      latencyNs(latencyNs),
+      receive(NULL),
+      context(NULL),
+      closed(false) {
+}
+
+void SimulatedLink::attach(ConfigClient *client) {
+    attach(deliverToClient, client);
+}
+
+void SimulatedLink::connect(uint64_t delayNs, bool fail) {
+    network.schedule(network.now() + delayNs, this,
+                     fail ? SIMULATED_CONNECT_FAILED : SIMULATED_CONNECTED);
+}
+
+bool SimulatedLink::send(const uint8_t *pdu, size_t length) {
+    if (closed) {
+        errno = ENOTCONN;
+        return false;
+    }
+    network.schedule(network.now() + latencyNs, this, SIMULATED_TO_BEACON, pdu, length);
+    return true;
+}
+
+void SimulatedLink::close(void) {
+    if (!closed) {
+        closed = true;
+        beacon.disconnect();
+    }
+}
+
+void SimulatedLink::deliver(SimulatedEvent event, const std::vector<uint8_t> &pdu) {
+    if (closed) {
+        return;
+    }
+    if (event == SIMULATED_TO_BEACON) {
+        uint8_t response[ATT_DEFAULT_MTU];
+        size_t length = beacon.handle(pdu.data(), pdu.size(), response);
+        if (length > 0) {
+            network.schedule(network.now() + latencyNs, this, SIMULATED_TO_CLIENT, response,
+                             length);
+        }
+    } else if (receive != NULL) {
+        receive(context, event, pdu.empty() ? NULL : pdu.data(), pdu.size(), network.now());
+    }
+}
+
+void SimulatedNetwork::schedule(uint64_t atNs, SimulatedLink *link, SimulatedEvent event,
+                                const uint8_t *pdu, size_t length) {
+    Event entry;
+    entry.atNs = atNs;
+    entry.sequence = sequence++;
+    entry.link = link;
+    entry.event = event;
+    if (pdu != NULL) {
+        entry.pdu.assign(pdu, pdu + length);
+    }
+    events.push(entry);
+}
+
+bool SimulatedNetwork::step(void) {
+    if (events.empty()) {
+        return false;
+    }
+    Event entry = events.top();
+    events.pop();
+    clock = std::max(clock, entry.atNs);
+    entry.link->deliver(entry.event, entry.pdu);
+    return true;
+}
+
+void SimulatedNetwork::advance(uint64_t atNs) {
+    while (!events.empty() && (events.top().atNs <= atNs)) {
+        step();
+    }
+    clock = std::max(clock, atNs);
+}
+
+SimulatedTransport::SimulatedTransport(SimulatedNetwork &network, uint64_t latencyNs,
+                                       uint64_t connectNs)
+    : network(network),
+      latencyNs(latencyNs),
+      connectNs(connectNs),
+      provisioner(NULL) {
+}
+
+bool SimulatedTransport::open(int slot, const std::string &target) {
+    if (static_cast<size_t>(slot) >= slots.size()) {
+        slots.resize(slot + 1, NULL);
+    }
+    slots[slot] = NULL;
+    std::map<std::string, SimulatedBeacon *>::iterator beacon = beacons.find(target);
+    if (beacon == beacons.end()) {
+        return true;
+    }
+
+    links.push_back(std::unique_ptr<SimulatedLink>(
+        new SimulatedLink(network, *beacon->second, latencyNs)));
+    Endpoint *endpoint = new Endpoint;
+    endpoint->transport = this;
+    endpoint->slot = slot;
+    endpoint->link = links.back().get();
+    endpoints.push_back(std::unique_ptr<Endpoint>(endpoint));
+    slots[slot] = endpoint;
+    endpoint->link->attach(onReceive, endpoint);
+
+    unsigned &failures = connectFailures[target];
+    endpoint->link->connect(connectNs, failures > 0);
+    if (failures > 0) {
+        failures--;
+    }
+    return true;
+}
+
+bool SimulatedTransport::send(int slot, const uint8_t *pdu, size_t length) {
+    if (slots[slot] == NULL) {
+        errno = ENOTCONN;
+        return false;
+    }
+    return slots[slot]->link->send(pdu, length);
+}
+
+void SimulatedTransport::close(int slot) {
+    if (slots[slot] != NULL) {
+        slots[slot]->link->close();
+        slots[slot] = NULL;
+    }
+}
+
+void SimulatedTransport::onReceive(void *context, SimulatedEvent event, const uint8_t *pdu,
+                                   size_t length, uint64_t nowNs) {
+    Endpoint *endpoint = static_cast<Endpoint *>(context);
+    Provisioner *provisioner = endpoint->transport->provisioner;
+    if (provisioner == NULL) {
+        return;
+    }
+    if (event == SIMULATED_CONNECTED) {
+        provisioner->connected(endpoint->slot, nowNs);
+    } else if (event == SIMULATED_CONNECT_FAILED) {
+        provisioner->linkFailed(endpoint->slot, ECONNABORTED, nowNs);
+    } else {
+        provisioner->receive(endpoint->slot, pdu, length, nowNs);
+    }
+}
+
+void runSimulated(SimulatedNetwork &network, Provisioner &provisioner) {
+    while (!provisioner.done()) {
+        uint64_t next = network.nextNs();
+        uint64_t deadline = provisioner.deadlineNs();
+        if ((next != 0) && ((deadline == 0) || (next <= deadline))) {
+            network.step();
+        } else if (deadline != 0) {
+            network.advance(deadline);
+        } else {
+            return;
+        }
+        provisioner.tick(network.now());
+    }
+}
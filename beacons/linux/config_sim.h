@@ -0,0 +1,273 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Simulated config servers, to test and measure provisioning without
+// beacons.
+//
+// SimulatedBeacon answers ATT PDUs from an attribute table as the firmware
+// does: the v2 service with the checks of the CSR UribeaconHandleAccessWrite
+// (lock, lengths, power mode range, period clamp), or the v1 service of the
+// nRF51 ble_uri.c, whose data characteristics take Write Commands. The
+// nRF51 SoftDevice answers Read Multiple and the CSR firmware does not, but
+// has the state snapshot characteristic unless built before it. Writes
+// are held in RAM and counted as one NVM commit when the link drops, as both
+// firmwares do.
+//
+// SimulatedNetwork carries PDUs over any number of SimulatedLinks on a
+// virtual clock, each way after the link's latency, so a pass that takes
+// seconds over the air runs in microseconds and always the same way.
+// SimulatedTransport opens such links for a Provisioner, to beacons by
+// name.
+
+#ifndef URIBEACON_CONFIG_SIM_H__
+#define URIBEACON_CONFIG_SIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include "att.h"
+#include "config_client.h"
+#include "provisioner.h"
+#include "uribeacon_core.h"
+
+class SimulatedBeacon {
+public:
+    struct Stats {
+        uint32_t requests;
+        uint32_t commands;
+        uint32_t writes;        // accepted
+        uint32_t nvmCommits;
+    };
+
+    // A v2 beacon has the state snapshot characteristic if snapshot is set.
+    explicit SimulatedBeacon(ConfigProtocol protocol, bool snapshot = true);
+
+    // Answers pdu into response, which holds ATT_DEFAULT_MTU bytes. Returns
+    // the response length, 0 for a command or if the beacon is silent.
+    size_t handle(const uint8_t *pdu, size_t length, uint8_t *response);
+
+    // Commits pending writes.
+    void disconnect(void);
+
+    // Locks a v2 beacon with code.
+    void lock(const uint8_t code[URIBEACON_LOCK_CODE_SIZE]);
+
+    // Drops every request from now on, as a beacon out of range does.
+    void setSilent(bool silent) {
+        this->silent = silent;
+    }
+
+    // Whether Read Multiple is answered.
+    void setReadMultiple(bool enabled) {
+        readMultiple = enabled;
+    }
+
+    // Drops the next count PDUs, as a noisy link does.
+    void dropPdus(unsigned count) {
+        drops = count;
+    }
+
+    ConfigProtocol protocol(void) const {
+        return kind;
+    }
+
+    // The v2 configuration. It starts as the CSR defaults.
+    const uribeacon_config_t &config(void) const {
+        return state;
+    }
+
+    // The v1 frame. It starts as the frame of the CSR defaults.
+    const std::vector<uint8_t> &frame(void) const {
+        return v1Frame;
+    }
+
+    const Stats &stats(void) const {
+        return counts;
+    }
+
+private:
+    struct Attribute {
+        AttUuid type;
+        std::vector<uint8_t> value;     // of declarations
+        int characteristic;             // whose value this is, or -1
+        uint8_t properties;
+    };
+
+    void addService(const AttUuid &uuid);
+    void addCharacteristic(const AttUuid &uuid, uint8_t properties, int characteristic);
+    std::vector<uint8_t> read(const Attribute &attribute) const;
+    // Returns an ATT error, or 0 if the write is applied.
+    uint8_t write(int characteristic, const uint8_t *value, size_t length);
+
+    ConfigProtocol kind;
+    std::vector<Attribute> attributes;  // handle 1 first
+    uribeacon_config_t state;
+    std::vector<uint8_t> v1Frame;
+    bool dirty;
+    bool silent;
+    bool readMultiple;
+    unsigned drops;
+    Stats counts;
+};
+
+class SimulatedNetwork;
+
+enum SimulatedEvent {
+    SIMULATED_CONNECTED,
+    SIMULATED_CONNECT_FAILED,
+    SIMULATED_TO_BEACON,
+    SIMULATED_TO_CLIENT,
+};
+
+// Called with what a link delivers to its client: a PDU, or the outcome of
+// connecting, with pdu NULL.
+typedef void (*SimulatedReceive)(void *context, SimulatedEvent event, const uint8_t *pdu,
+                                 size_t length, uint64_t nowNs);
+
+// A link between a client and a beacon. Sends are delivered after
+// latencyNs, and so are the beacon's responses.
+class SimulatedLink : public AttBearer {
+public:
+    SimulatedLink(SimulatedNetwork &network, SimulatedBeacon &beacon, uint64_t latencyNs);
+
+    void attach(SimulatedReceive receive, void *context) {
+        this->receive = receive;
+        this->context = context;
+    }
+
+    // Delivers responses to client.
+    void attach(ConfigClient *client);
+
+    // Reports the link up, or failed, after delayNs.
+    void connect(uint64_t delayNs, bool fail = false);
+
+    bool send(const uint8_t *pdu, size_t length) override;
+
+    // Disconnects, committing the beacon's writes. Later sends fail with
+    // ENOTCONN and PDUs in flight are dropped.
+    void close(void);
+
+    void deliver(SimulatedEvent event, const std::vector<uint8_t> &pdu);
+
+private:
+    SimulatedNetwork &network;
+    SimulatedBeacon &beacon;
+    uint64_t latencyNs;
+    SimulatedReceive receive;
+    void *context;
+    bool closed;
+};
+
+class SimulatedNetwork {
+public:
+    SimulatedNetwork()
+        : clock(0),
+          sequence(0) {
+    }
+
+    uint64_t now(void) const {
+        return clock;
+    }
+
+    void schedule(uint64_t atNs, SimulatedLink *link, SimulatedEvent event,
+                  const uint8_t *pdu = NULL, size_t length = 0);
+
+    // Delivers the next PDU, moving the clock to it. Returns false if none
+    // is in flight.
+    bool step(void);
+
+    // Delivers the PDUs due by atNs and moves the clock there.
+    void advance(uint64_t atNs);
+
+    // When the next PDU is due, or 0 if none is in flight.
+    uint64_t nextNs(void) const {
+        return events.empty() ? 0 : events.top().atNs;
+    }
+
+private:
+    struct Event {
+        uint64_t atNs;
+        uint64_t sequence;      // keeps PDUs due together in order
+        SimulatedLink *link;
+        SimulatedEvent event;
+        std::vector<uint8_t> pdu;
+    };
+
+    struct Later {
+        bool operator()(const Event &a, const Event &b) const {
+            return (a.atNs != b.atNs) ? (a.atNs > b.atNs) : (a.sequence > b.sequence);
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, Later> events;
+    uint64_t clock;
+    uint64_t sequence;
+};
+
+// Links for a Provisioner to simulated beacons. A connect to a name with no
+// beacon never completes, as one to a beacon out of range does not.
+class SimulatedTransport : public ProvisionTransport {
+public:
+    SimulatedTransport(SimulatedNetwork &network, uint64_t latencyNs, uint64_t connectNs);
+
+    void attach(Provisioner *provisioner) {
+        this->provisioner = provisioner;
+    }
+
+    void addBeacon(const std::string &target, SimulatedBeacon *beacon) {
+        beacons[target] = beacon;
+    }
+
+    // Fails the next count connects to target.
+    void failConnects(const std::string &target, unsigned count) {
+        connectFailures[target] = count;
+    }
+
+    bool open(int slot, const std::string &target) override;
+    bool send(int slot, const uint8_t *pdu, size_t length) override;
+    void close(int slot) override;
+
+private:
+    struct Endpoint {
+        SimulatedTransport *transport;
+        int slot;
+        SimulatedLink *link;
+    };
+
+    static void onReceive(void *context, SimulatedEvent event, const uint8_t *pdu, size_t length,
+                          uint64_t nowNs);
+
+    SimulatedNetwork &network;
+    uint64_t latencyNs;
+    uint64_t connectNs;
+    Provisioner *provisioner;
+    std::map<std::string, SimulatedBeacon *> beacons;
+    std::map<std::string, unsigned> connectFailures;
+    // Links, and the endpoints they deliver to, are kept until the
+    // transport is destroyed, as PDUs may still be in flight to them.
+    std::vector<std::unique_ptr<SimulatedLink> > links;
+    std::vector<std::unique_ptr<Endpoint> > endpoints;
+    std::vector<Endpoint *> slots;
+};
+
+// Runs provisioner, started, until it is done, delivering PDUs and ticking
+// it as the virtual clock reaches them.
+void runSimulated(SimulatedNetwork &network, Provisioner &provisioner);
+
+#endif // URIBEACON_CONFIG_SIM_H__
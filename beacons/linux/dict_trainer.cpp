@@ -0,0 +1,457 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dict_trainer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <thread>
+
+// Most bytes an encoding can take, the size the encoder is given.
+#define ENCODED_MAX                     (255)
+
+// Candidates re-encoded at a time in the later rounds. It does not depend on
+// the threads, so neither does the dictionary.
+#define REFRESH_BATCH                   (64)
+
+// The characters a dictionary entry may hold, as uribeacon_dict_check().
+static bool entryChar(char c) {
+    return (c > ' ') && (c <= '~');
+}
+
+void sortSuffixes(const std::string &text, size_t depth, std::vector<uint32_t> &sa) {
+    uint32_t n = static_cast<uint32_t>(text.size());
+    sa.resize(n);
+    if (n == 0) {
+        return;
+    }
+    std::vector<uint32_t> rank(n);
+    std::vector<uint32_t> next(n);
+    std::vector<uint32_t> order(n);
+    std::vector<uint32_t> counts(std::max<uint32_t>(n, 256) + 1);
+
+    // Sorted on the first character, with ranks from 1; 0 is past the end.
+    for (uint32_t i = 0; i < n; i++) {
+        counts[static_cast<uint8_t>(text[i])]++;
+    }
+    for (uint32_t c = 1; c <= 256; c++) {
+        counts[c] += counts[c - 1];
+    }
+    for (uint32_t i = n; i-- > 0;) {
+        sa[--counts[static_cast<uint8_t>(text[i])]] = i;
+    }
+    rank[sa[0]] = 1;
+    for (uint32_t j = 1; j < n; j++) {
+        rank[sa[j]] = rank[sa[j - 1]] + (text[sa[j]] != text[sa[j - 1]] ? 1 : 0);
+    }
+
+    // Each pass sorts on twice as many characters: on the rank of the first
+    // k, then the rank of the k after them.
+    for (size_t k = 1; (k < depth) && (rank[sa[n - 1]] < n); k *= 2) {
+        uint32_t classes = rank[sa[n - 1]];
+        uint32_t out = 0;
+        for (uint32_t i = n - static_cast<uint32_t>(std::min<size_t>(k, n)); i < n; i++) {
+            order[out++] = i;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            if (sa[j] >= k) {
+                order[out++] = static_cast<uint32_t>(sa[j] - k);
+            }
+        }
+        std::fill(counts.begin(), counts.begin() + classes + 1, 0);
+        for (uint32_t i = 0; i < n; i++) {
+            counts[rank[i]]++;
+        }
+        for (uint32_t c = 1; c <= classes; c++) {
+            counts[c] += counts[c - 1];
+        }
+        for (uint32_t j = n; j-- > 0;) {
+            sa[--counts[rank[order[j]]]] = order[j];
+        }
+        next[sa[0]] = 1;
+        for (uint32_t j = 1; j < n; j++) {
+            uint32_t a = sa[j - 1];
+            uint32_t b = sa[j];
+            uint32_t afterA = (a + k < n) ? rank[a + k] : 0;
+            uint32_t afterB = (b + k < n) ? rank[b + k] : 0;
+            next[b] = next[a] + (((rank[a] != rank[b]) || (afterA != afterB)) ? 1 : 0);
+        }
+        rank.swap(next);
+    }
+}
+
+DictTrainer::DictTrainer(const DictTrainerOptions &options)
+    : options(options),
+      rejected(0) {
+}
+
+bool DictTrainer::add(const std::string &url) {
+    std::string uri = url;
+    if (uri.find(':') == std::string::npos) {
+        uri = "http://" + uri;
+    }
+    std::unordered_map<std::string, size_t>::iterator found = index.find(uri);
+    if (found != index.end()) {
+        urls[found->second].weight++;
+        return true;
+    }
+    uint8_t data[ENCODED_MAX];
+    uint8_t length;
+    if ((uribeacon_uri_encode(uri.c_str(), data, sizeof(data), &length) != URIBEACON_OK) ||
+        (length == 0)) {
+        rejected++;
+        return false;
+    }
+    index[uri] = urls.size();
+    Url entry;
+    entry.uri = uri;
+    entry.weight = 1;
+    urls.push_back(entry);
+    return true;
+}
+
+bool DictTrainer::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        if (line[length] == '\0' && !feof(file)) {
+            // Longer than any URL that encodes; skip the rest of it.
+            int c;
+            while (((c = fgetc(file)) != EOF) && (c != '\n')) {
+            }
+            rejected++;
+            continue;
+        }
+        line[length] = '\0';
+        if ((length == 0) || (line[0] == '#')) {
+            continue;
+        }
+        add(line);
+    }
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed) {
+        errno = EIO;
+        return false;
+    }
+    return true;
+}
+
+uint8_t DictTrainer::encodedLength(const Url &url, const uribeacon_dict_t *dict) const {
+    uint8_t data[ENCODED_MAX];
+    uint8_t length = 0;
+    uribeacon_uri_encode_dict(url.uri.c_str(), dict, data, sizeof(data), &length);
+    return length;
+}
+
+uint64_t DictTrainer::cost(uint8_t length) const {
+    return length + ((length > URIBEACON_URI_MAX) ? options.fitWeight : 0);
+}
+
+// Orders candidates by the bytes they would save, most first, then longest
+// first, then by where they are in the corpus, so training is repeatable.
+static bool betterCandidate(uint64_t estimateA, uint32_t lengthA, uint32_t offsetA,
+                            uint64_t estimateB, uint32_t lengthB, uint32_t offsetB) {
+    if (estimateA != estimateB) {
+        return estimateA > estimateB;
+    }
+    if (lengthA != lengthB) {
+        return lengthA > lengthB;
+    }
+    return offsetA < offsetB;
+}
+
+void DictTrainer::findCandidates(std::vector<Candidate> &candidates) {
+    uint32_t n = static_cast<uint32_t>(corpus.size());
+
+    // run[p] is how many characters from p an entry could take.
+    std::vector<uint8_t> run(n + 1);
+    for (uint32_t p = n; p-- > 0;) {
+        run[p] = entryChar(corpus[p])
+                     ? static_cast<uint8_t>(std::min(run[p + 1] + 1, URIBEACON_DICT_ENTRY_MAX))
+                     : 0;
+    }
+    // weights[j] is the number of times the URLs of suffixes before j were
+    // added, so an interval's occurrences are a difference.
+    std::vector<uint64_t> weights(n + 1);
+    for (uint32_t j = 0; j < n; j++) {
+        weights[j + 1] = weights[j] + urls[urlOf[sa[j]]].weight;
+    }
+
+    struct Worse {
+        bool operator()(const Candidate &a, const Candidate &b) const {
+            return betterCandidate(a.estimate, a.length, a.offset, b.estimate, b.length,
+                                   b.offset);
+        }
+    };
+    std::priority_queue<Candidate, std::vector<Candidate>, Worse> kept;
+
+    // Walks the intervals of suffixes sharing a prefix, from the common
+    // prefix lengths of neighbours. An interval whose prefix is h long, in
+    // one whose prefix is parent long, holds the substrings of lengths
+    // parent + 1 to h.
+    struct Open {
+        uint32_t height;
+        uint32_t first;
+    };
+    std::vector<Open> stack;
+    Open bottom = { 0, 0 };
+    stack.push_back(bottom);
+    for (uint32_t j = 1; j <= n; j++) {
+        uint32_t height = 0;
+        if (j < n) {
+            uint32_t a = sa[j - 1];
+            uint32_t b = sa[j];
+            uint32_t limit = std::min(run[a], run[b]);
+            while ((height < limit) && (corpus[a + height] == corpus[b + height])) {
+                height++;
+            }
+        }
+        uint32_t first = j - 1;
+        while (height < stack.back().height) {
+            Open top = stack.back();
+            stack.pop_back();
+            uint32_t parent = std::max(height, stack.back().height);
+            uint64_t occurrences = weights[j] - weights[top.first];
+            for (uint32_t length = std::max<uint32_t>(parent + 1, 2); length <= top.height;
+                 length++) {
+                Candidate candidate;
+                candidate.offset = sa[top.first];
+                candidate.length = length;
+                candidate.first = top.first;
+                candidate.last = j - 1;
+                candidate.estimate = occurrences * (length - 1);
+                if (kept.size() < options.candidates) {
+                    kept.push(candidate);
+                } else if ((options.candidates > 0) &&
+                           betterCandidate(candidate.estimate, candidate.length,
+                                           candidate.offset, kept.top().estimate,
+                                           kept.top().length, kept.top().offset)) {
+                    kept.pop();
+                    kept.push(candidate);
+                }
+            }
+            first = top.first;
+        }
+        if (height > stack.back().height) {
+            Open open = { height, first };
+            stack.push_back(open);
+        }
+    }
+
+    candidates.clear();
+    while (!kept.empty()) {
+        candidates.push_back(kept.top());
+        kept.pop();
+    }
+    std::reverse(candidates.begin(), candidates.end());
+}
+
+// A dictionary of entries, for encoding only.
+static void fillDict(const std::vector<std::string> &entries, uribeacon_dict_t &dict) {
+    memset(&dict, 0, sizeof(dict));
+    dict.version = 1;
+    for (size_t i = 0; i < entries.size(); i++) {
+        dict.entries[i] = entries[i].c_str();
+    }
+}
+
+void DictTrainer::evaluate(const std::vector<Candidate> &candidates, const size_t *which,
+                           size_t count, const std::vector<std::string> &chosen,
+                           std::vector<int64_t> &deltas) {
+    unsigned threads = options.threads;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    // Thread t takes which[t], which[t + threads], ... Each URL holding a
+    // candidate is encoded once, however often the candidate occurs in it.
+    auto work = [&](unsigned t) {
+        uribeacon_dict_t dict;
+        fillDict(chosen, dict);
+        std::vector<uint32_t> seen(urls.size(), 0);
+        uint32_t stamp = 0;
+        for (size_t i = t; i < count; i += threads) {
+            size_t c = which[i];
+            const Candidate &candidate = candidates[c];
+            std::string entry = corpus.substr(candidate.offset, candidate.length);
+            dict.entries[chosen.size()] = entry.c_str();
+            stamp++;
+            int64_t delta = 0;
+            for (uint32_t j = candidate.first; j <= candidate.last; j++) {
+                uint32_t u = urlOf[sa[j]];
+                if (seen[u] == stamp) {
+                    continue;
+                }
+                seen[u] = stamp;
+                int64_t before = static_cast<int64_t>(cost(current[u]));
+                int64_t after = static_cast<int64_t>(cost(encodedLength(urls[u], &dict)));
+                delta += (after - before) * urls[u].weight;
+            }
+            deltas[c] = delta;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+        workers.push_back(std::thread(work, t));
+    }
+    if (threads > 0) {
+        work(0);
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+void DictTrainer::choose(const std::vector<Candidate> &candidates, std::vector<size_t> &live,
+                         std::vector<int64_t> &deltas, std::vector<std::string> &chosen) {
+    // deltas holds each live candidate's change in cost with the entries
+    // chosen when it was last encoded. An entry nearly always saves no more
+    // than it did a round before, as the entries chosen since take some of
+    // its text, so that bounds what it saves now. Each round re-encodes the
+    // candidates that saved the most, a batch at a time, until one saves at
+    // least as much as any not yet re-encoded may.
+    while ((chosen.size() < URIBEACON_DICT_SIZE) && !live.empty()) {
+        std::stable_sort(live.begin(), live.end(), [&deltas](size_t a, size_t b) {
+            return deltas[a] < deltas[b];
+        });
+        size_t best = 0;
+        size_t refreshed = 0;
+        while (refreshed < live.size()) {
+            size_t count = std::min<size_t>(REFRESH_BATCH, live.size() - refreshed);
+            evaluate(candidates, &live[refreshed], count, chosen, deltas);
+            refreshed += count;
+            for (size_t i = 0; i < refreshed; i++) {
+                if ((deltas[live[i]] < deltas[live[best]]) ||
+                    ((deltas[live[i]] == deltas[live[best]]) && (live[i] < live[best]))) {
+                    best = i;
+                }
+            }
+            if ((refreshed < live.size()) && (deltas[live[best]] <= deltas[live[refreshed]])) {
+                break;
+            }
+        }
+        if (deltas[live[best]] >= 0) {
+            return;
+        }
+        const Candidate &winner = candidates[live[best]];
+        chosen.push_back(corpus.substr(winner.offset, winner.length));
+
+        uribeacon_dict_t dict;
+        fillDict(chosen, dict);
+        for (uint32_t j = winner.first; j <= winner.last; j++) {
+            uint32_t u = urlOf[sa[j]];
+            current[u] = encodedLength(urls[u], &dict);
+        }
+        live.erase(live.begin() + best);
+    }
+}
+
+bool DictTrainer::prune(std::vector<std::string> &chosen) {
+    bool pruned = false;
+    for (size_t i = chosen.size(); i-- > 0;) {
+        std::vector<std::string> without = chosen;
+        without.erase(without.begin() + i);
+        uribeacon_dict_t dict;
+        fillDict(without, dict);
+        std::vector<uint8_t> lengths(urls.size());
+        int64_t delta = 0;
+        for (size_t u = 0; u < urls.size(); u++) {
+            lengths[u] = encodedLength(urls[u], &dict);
+            delta += (static_cast<int64_t>(cost(lengths[u])) -
+                      static_cast<int64_t>(cost(current[u]))) * urls[u].weight;
+        }
+        if (delta <= 0) {
+            chosen.swap(without);
+            current.swap(lengths);
+            pruned = true;
+        }
+    }
+    return pruned;
+}
+
+bool DictTrainer::train(Dictionary &dictionary, DictTrainerReport &report) {
+    if (urls.empty()) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // The text after each URL's scheme, one a line; the newlines cannot be
+    // in an entry, so no candidate spans two URLs.
+    corpus.clear();
+    urlOf.clear();
+    current.resize(urls.size());
+    memset(&report, 0, sizeof(report));
+    for (size_t u = 0; u < urls.size(); u++) {
+        const Url &url = urls[u];
+        uint8_t data[ENCODED_MAX];
+        uint8_t length;
+        char scheme[32];
+        uribeacon_uri_encode(url.uri.c_str(), data, sizeof(data), &length);
+        current[u] = length;
+        report.urls += url.weight;
+        report.bytesBuiltIn += static_cast<uint64_t>(length) * url.weight;
+        report.fitBuiltIn += (length <= URIBEACON_URI_MAX) ? url.weight : 0;
+        // A scheme alone decodes to its prefix; a urn:uuid has no text.
+        if (uribeacon_uri_decode(data, 1, scheme, sizeof(scheme)) != URIBEACON_OK) {
+            continue;
+        }
+        corpus.append(url.uri, strlen(scheme), std::string::npos);
+        corpus += '\n';
+        urlOf.resize(corpus.size(), static_cast<uint32_t>(u));
+    }
+
+    sortSuffixes(corpus, URIBEACON_DICT_ENTRY_MAX, sa);
+    std::vector<Candidate> candidates;
+    findCandidates(candidates);
+
+    // Greedy choice tends to take an early entry that later ones make
+    // redundant, as "ts.example" before "events.example.com/" and
+    // "tickets.example.org/". Those are dropped once and their codes chosen
+    // again.
+    std::vector<std::string> chosen;
+    std::vector<int64_t> deltas(candidates.size(), 0);
+    std::vector<size_t> live(candidates.size());
+    for (size_t c = 0; c < live.size(); c++) {
+        live[c] = c;
+    }
+    evaluate(candidates, live.data(), live.size(), chosen, deltas);
+    std::vector<int64_t> alone = deltas;
+    choose(candidates, live, deltas, chosen);
+    if (prune(chosen)) {
+        // With fewer entries a candidate may save more than it last did,
+        // but not more than it did alone.
+        deltas = alone;
+        choose(candidates, live, deltas, chosen);
+    }
+
+    if (!dictionary.assign(options.version, chosen.data(), chosen.size())) {
+        return false;
+    }
+    for (size_t u = 0; u < urls.size(); u++) {
+        report.bytesTrained += static_cast<uint64_t>(current[u]) * urls[u].weight;
+        report.fitTrained += (current[u] <= URIBEACON_URI_MAX) ? urls[u].weight : 0;
+    }
+    return true;
+}
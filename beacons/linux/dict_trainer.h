@@ -0,0 +1,137 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Learns a deployment dictionary from a corpus of URLs.
+//
+// Candidates are the substrings that repeat in the corpus. The text after
+// each distinct URL's scheme is concatenated, and its suffixes are sorted on
+// their first URIBEACON_DICT_ENTRY_MAX characters, all an entry can use.
+// Every interval of the sorted suffixes sharing a prefix is a repeated
+// substring, and the intervals are found from the common prefix lengths of
+// neighbours. The ones that would save the most bytes if each occurrence
+// became one code are kept.
+//
+// Entries are then chosen greedily, one code at a time. Each round encodes
+// the URLs holding each candidate with the entries chosen so far plus that
+// candidate, with the core's shortest encoding, and takes the candidate that
+// lowers the corpus' cost the most. Later rounds re-encode the candidates
+// that saved the most first, and stop once none left could beat the best, so
+// most are not re-encoded at all. A URL costs its encoded length, plus
+// fitWeight if it is longer than the URIBEACON_URI_MAX bytes of a legacy
+// advertisement, so URLs brought under the limit count for more. The
+// candidates of a round are spread over threads. Training stops when the
+// codes run out or no candidate helps; then entries that later ones made
+// redundant are dropped, and their codes chosen again once.
+
+#ifndef URIBEACON_DICT_TRAINER_H__
+#define URIBEACON_DICT_TRAINER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dictionary.h"
+#include "uribeacon_core.h"
+
+// Candidates kept for the greedy rounds.
+#define DICT_TRAINER_CANDIDATES         (4096)
+
+struct DictTrainerOptions {
+    uint8_t version;            // of the dictionary trained
+    unsigned threads;           // 0 for one per CPU
+    size_t candidates;
+    uint32_t fitWeight;         // bytes a URL over URIBEACON_URI_MAX costs
+
+    DictTrainerOptions()
+        : version(1),
+          threads(0),
+          candidates(DICT_TRAINER_CANDIDATES),
+          fitWeight(URIBEACON_URI_MAX) {
+    }
+};
+
+// The corpus encoded with the built-in codes and with the dictionary. Each
+// URL is counted as often as it was added.
+struct DictTrainerReport {
+    uint64_t urls;
+    uint64_t fitBuiltIn;        // within URIBEACON_URI_MAX bytes
+    uint64_t fitTrained;
+    uint64_t bytesBuiltIn;      // encoded bytes in all
+    uint64_t bytesTrained;
+};
+
+// Sorts the suffixes of text on their first depth characters, by prefix
+// doubling with radix sorts. sa[i] is the offset of the i-th suffix.
+void sortSuffixes(const std::string &text, size_t depth, std::vector<uint32_t> &sa);
+
+class DictTrainer {
+public:
+    explicit DictTrainer(const DictTrainerOptions &options = DictTrainerOptions());
+
+    // Adds a URL, as http:// if it has no scheme. Returns false if it cannot
+    // be encoded.
+    bool add(const std::string &url);
+
+    // Adds the URLs of a file, one a line; blank lines and lines starting
+    // with '#' are skipped. Returns false with errno set if it cannot be
+    // read.
+    bool load(const char *path);
+
+    // Chooses the entries of dictionary. Returns false with errno EINVAL if
+    // no URLs have been added.
+    bool train(Dictionary &dictionary, DictTrainerReport &report);
+
+    // Lines that could not be added.
+    uint64_t skipped(void) const {
+        return rejected;
+    }
+
+private:
+    struct Url {
+        std::string uri;
+        uint32_t weight;        // times added
+    };
+
+    struct Candidate {
+        uint32_t offset;        // in corpus
+        uint32_t length;
+        uint32_t first;         // suffixes holding it, sa[first..last]
+        uint32_t last;
+        uint64_t estimate;      // bytes saved if each became one code
+    };
+
+    void findCandidates(std::vector<Candidate> &candidates);
+    void evaluate(const std::vector<Candidate> &candidates, const size_t *which, size_t count,
+                  const std::vector<std::string> &chosen, std::vector<int64_t> &deltas);
+    void choose(const std::vector<Candidate> &candidates, std::vector<size_t> &live,
+                std::vector<int64_t> &deltas, std::vector<std::string> &chosen);
+    bool prune(std::vector<std::string> &chosen);
+    uint8_t encodedLength(const Url &url, const uribeacon_dict_t *dict) const;
+    uint64_t cost(uint8_t length) const;
+
+    DictTrainerOptions options;
+    std::vector<Url> urls;
+    std::unordered_map<std::string, size_t> index;
+    uint64_t rejected;
+
+    // Filled by train().
+    std::string corpus;
+    std::vector<uint32_t> urlOf;    // URL of each corpus offset
+    std::vector<uint32_t> sa;
+    std::vector<uint8_t> current;   // encoded length with the chosen entries
+};
+
+#endif // URIBEACON_DICT_TRAINER_H__
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the dictionary trainer.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "dict_trainer.h"
+#include "dictionary.h"
+#include "test_util.h"
+
+// The suffixes come out in order on their first depth characters.
+static void testSortSuffixes(void) {
+    static const size_t DEPTHS[] = { 1, 3, 32, 1000 };
+    uint32_t seed = 7;
+    for (int round = 0; round < 20; round++) {
+        std::string text;
+        size_t length = 1 + round * 37;
+        for (size_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            text += "ab/.c\n"[(seed >> 16) % (round < 10 ? 2 : 6)];
+        }
+        for (size_t d = 0; d < sizeof(DEPTHS) / sizeof(DEPTHS[0]); d++) {
+            std::vector<uint32_t> sa;
+            sortSuffixes(text, DEPTHS[d], sa);
+            EXPECT_EQ(text.size(), sa.size());
+            std::vector<bool> seen(text.size(), false);
+            for (size_t j = 0; j < sa.size(); j++) {
+                EXPECT_EQ(false, seen[sa[j]]);
+                seen[sa[j]] = true;
+                if (j > 0) {
+                    std::string previous = text.substr(sa[j - 1], DEPTHS[d]);
+                    EXPECT_EQ(true, previous <= text.substr(sa[j], DEPTHS[d]));
+                }
+            }
+        }
+    }
+    std::vector<uint32_t> empty(3);
+    sortSuffixes("", 32, empty);
+    EXPECT_EQ(0, empty.size());
+}
+
+// Venue pages that do not fit a legacy advertisement with the built-in
+// codes alone.
+static void addVenues(DictTrainer &trainer) {
+    static const char *const HALLS[] = { "hall-a", "hall-b", "hall-c", "annex" };
+    for (int h = 0; h < 4; h++) {
+        for (int booth = 1; booth <= 40; booth++) {
+            char url[128];
+            snprintf(url, sizeof(url), "https://events.example.com/venues/%s/booth/%d",
+                     HALLS[h], booth);
+            trainer.add(url);
+        }
+    }
+    for (int i = 0; i < 10; i++) {
+        trainer.add("https://events.example.com/schedule");
+    }
+}
+
+static void testTrain(void) {
+    DictTrainerOptions options;
+    options.version = 4;
+    options.threads = 1;
+    DictTrainer trainer(options);
+    addVenues(trainer);
+    Dictionary dictionary;
+    DictTrainerReport report;
+    EXPECT_EQ(true, trainer.train(dictionary, report));
+
+    EXPECT_EQ(4, dictionary.version());
+    EXPECT_EQ(true, dictionary.size() > 0);
+    EXPECT_EQ(170, report.urls);
+    EXPECT_EQ(0, report.fitBuiltIn);
+    EXPECT_EQ(170, report.fitTrained);
+    EXPECT_EQ(true, report.bytesTrained * 2 < report.bytesBuiltIn);
+
+    // The report matches encoding each URL with the dictionary, which
+    // decodes back to the URL.
+    Dictionary loaded;
+    EXPECT_EQ(true, loaded.parse(dictionary.format()));
+    uint8_t data[URIBEACON_URI_MAX];
+    uint8_t length;
+    char text[256];
+    const char *url = "https://events.example.com/venues/annex/booth/17";
+    EXPECT_EQ(URIBEACON_OK,
+              uribeacon_uri_encode_dict(url, loaded.codes(), data, sizeof(data), &length));
+    EXPECT_EQ(URIBEACON_OK,
+              uribeacon_uri_decode_dict(data, length, loaded.codes(), text, sizeof(text)));
+    EXPECT_EQ(0, strcmp(url, text));
+
+    // The same dictionary however many threads share the work.
+    options.threads = 4;
+    DictTrainer parallel(options);
+    addVenues(parallel);
+    Dictionary parallelDictionary;
+    DictTrainerReport parallelReport;
+    EXPECT_EQ(true, parallel.train(parallelDictionary, parallelReport));
+    EXPECT_EQ(true, parallelDictionary.format() == dictionary.format());
+    EXPECT_EQ(report.bytesTrained, parallelReport.bytesTrained);
+}
+
+static void testNothingToLearn(void) {
+    DictTrainer trainer;
+    Dictionary dictionary;
+    DictTrainerReport report;
+    errno = 0;
+    EXPECT_EQ(false, trainer.train(dictionary, report));
+    EXPECT_EQ(EINVAL, errno);
+
+    EXPECT_EQ(false, trainer.add("ftp://example.com/file"));
+    EXPECT_EQ(false, trainer.add("urn:uuid:not-a-uuid"));
+    EXPECT_EQ(false, trainer.add("https://" + std::string(300, 'a')));
+    EXPECT_EQ(3, trainer.skipped());
+
+    // Nothing repeats, so no entry would save a byte.
+    EXPECT_EQ(true, trainer.add("urn:uuid:6ba7b810-9dad-11d1-80b4-00c04fd430c8"));
+    EXPECT_EQ(true, trainer.add("uribeacon.org"));
+    EXPECT_EQ(true, trainer.train(dictionary, report));
+    EXPECT_EQ(0, dictionary.size());
+    EXPECT_EQ(report.bytesBuiltIn, report.bytesTrained);
+}
+
+int main(void) {
+    testSortSuffixes();
+    testTrain();
+    testNothingToLearn();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dictionary.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Dictionary::Dictionary()
+    : count(0) {
+    memset(&dict, 0, sizeof(dict));
+}
+
+bool Dictionary::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, length);
+    }
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed) {
+        errno = EIO;
+        return false;
+    }
+    return parse(text);
+}
+
+bool Dictionary::parse(const std::string &text) {
+    std::string parsed[URIBEACON_DICT_SIZE];
+    size_t parsedCount = 0;
+    long version = -1;
+    size_t start = 0;
+
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && (line[line.size() - 1] == '\r')) {
+            line.erase(line.size() - 1);
+        }
+        if (line.empty() || (line[0] == '#')) {
+            continue;
+        }
+        if (version < 0) {
+            char *rest;
+            if (line.compare(0, 8, "version ") != 0) {
+                errno = EINVAL;
+                return false;
+            }
+            version = strtol(line.c_str() + 8, &rest, 10);
+            if ((*rest != '\0') || (version < 1) || (version > URIBEACON_DICT_VERSION_MAX)) {
+                errno = EINVAL;
+                return false;
+            }
+            continue;
+        }
+        if (parsedCount == URIBEACON_DICT_SIZE) {
+            errno = EINVAL;
+            return false;
+        }
+        parsed[parsedCount++] = line;
+    }
+    if (version < 0) {
+        errno = EINVAL;
+        return false;
+    }
+    return assign(static_cast<uint8_t>(version), parsed, parsedCount);
+}
+
+std::string Dictionary::format(void) const {
+    char line[32];
+    snprintf(line, sizeof(line), "version %u\n", dict.version);
+    std::string text = line;
+    for (size_t i = 0; i < count; i++) {
+        text += entries[i];
+        text += '\n';
+    }
+    return text;
+}
+
+bool Dictionary::assign(uint8_t version, const std::string *newEntries, size_t newCount) {
+    uribeacon_dict_t checked;
+    memset(&checked, 0, sizeof(checked));
+    checked.version = version;
+    if (newCount > URIBEACON_DICT_SIZE) {
+        errno = EINVAL;
+        return false;
+    }
+    for (size_t i = 0; i < newCount; i++) {
+        checked.entries[i] = newEntries[i].c_str();
+    }
+    if (uribeacon_dict_check(&checked) != URIBEACON_OK) {
+        errno = EINVAL;
+        return false;
+    }
+
+    memset(&dict, 0, sizeof(dict));
+    dict.version = version;
+    for (size_t i = 0; i < URIBEACON_DICT_SIZE; i++) {
+        entries[i] = (i < newCount) ? newEntries[i] : std::string();
+    }
+    for (size_t i = 0; i < newCount; i++) {
+        dict.entries[i] = entries[i].c_str();
+    }
+    count = newCount;
+    return true;
+}
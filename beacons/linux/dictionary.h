@@ -0,0 +1,77 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Deployment dictionaries: site specific expansions of the reserved URI codes
+// 0x0e..0x20, see uribeacon_core.h. A dictionary file is text, a version line
+// then one entry per line, taking the codes in order from 0x0e:
+//
+//   # example.com venues
+//   version 2
+//   events.example.com/
+//   venues/
+//
+// Blank lines and lines starting with '#' are skipped. The advertiser encodes
+// with the dictionary and the gateway decodes with it; both must load the
+// same version.
+
+#ifndef URIBEACON_DICTIONARY_H__
+#define URIBEACON_DICTIONARY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "uribeacon_core.h"
+
+class Dictionary {
+public:
+    Dictionary();
+
+    // Reads a dictionary file. Returns false with errno set, EINVAL if it is
+    // malformed or fails uribeacon_dict_check().
+    bool load(const char *path);
+
+    // Parses the text of a dictionary file, as load().
+    bool parse(const std::string &text);
+
+    // The dictionary as text, which parse() reads back.
+    std::string format(void) const;
+
+    // Replaces the entries, up to URIBEACON_DICT_SIZE.
+    bool assign(uint8_t version, const std::string *entries, size_t count);
+
+    // For the core codec, with entries pointing into this object.
+    const uribeacon_dict_t *codes(void) const {
+        return &dict;
+    }
+
+    uint8_t version(void) const {
+        return dict.version;
+    }
+
+    size_t size(void) const {
+        return count;
+    }
+
+    // codes() points into the object, so it is not copied.
+    Dictionary(const Dictionary &) = delete;
+    Dictionary &operator=(const Dictionary &) = delete;
+
+private:
+    std::string entries[URIBEACON_DICT_SIZE];
+    size_t count;
+    uribeacon_dict_t dict;
+};
+
+#endif // URIBEACON_DICTIONARY_H__
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "event_trace.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *const STATE_NAMES[] = {
+    "init", "beaconing", "fast_advertising", "connected", "disconnecting", "idle"
+};
+
+static const char *const TIMER_NAMES[] = {
+    NULL, "advert", "idle", "conn_param", "bonding", "buzzer", "button"
+};
+
+static const char *const PANIC_NAMES[] = {
+    "set_advert_params", "set_advert_data", "set_scan_rsp_data", "db_registration",
+    "nvm_read", "nvm_write", "read_tx_pwr_level", "delete_whitelist", "add_whitelist",
+    "con_param_update", "invalid_state", "unexpected_beep_type"
+};
+
+// Texts of the firmware's log messages.
+static const char *const LOG_TEXTS[] = {
+#define LOG_TOKEN(name, text) text,
+#include "../CSR-uribeacon-150202/log_tokens.h"
+#undef LOG_TOKEN
+};
+
+static const char LOG_LEVELS[] = "-EID";
+
+#define NAME(names, value)                                                  \
+    (((value) < sizeof(names) / sizeof(names[0])) ? names[value] : NULL)
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+}
+
+bool decodeEventTrace(const uint8_t *data, size_t length, EventTrace &trace) {
+    if ((length < EVENT_TRACE_HEADER_SIZE) || (data[0] != 'E') || (data[1] != 'T') ||
+        (data[2] != EVENT_TRACE_VERSION) ||
+        (length != EVENT_TRACE_HEADER_SIZE + static_cast<size_t>(data[3]) * EVENT_TRACE_EVENT_SIZE)) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t count = data[3];
+    const uint8_t *events = data + EVENT_TRACE_HEADER_SIZE;
+    const int64_t HIGH = ~static_cast<int64_t>(0xFFFF);
+    std::vector<int64_t> ticks(count);
+
+    // From the first time event on, each event's high bits are the last
+    // time event's; they only go down when the clock wraps.
+    size_t first = 0;
+    while ((first < count) && (events[first * EVENT_TRACE_EVENT_SIZE] != TRACE_EVENT_TIME)) {
+        first++;
+    }
+    int64_t high = 0;
+    for (size_t i = first; i < count; i++) {
+        const uint8_t *event = events + i * EVENT_TRACE_EVENT_SIZE;
+        if (event[0] == TRACE_EVENT_TIME) {
+            int64_t next = (high & ~static_cast<int64_t>(EVENT_TRACE_TICKS_WRAP - 1)) |
+                           (static_cast<int64_t>(get16(event + 2)) << 16);
+            if ((i > first) && (next < high)) {
+                next += EVENT_TRACE_TICKS_WRAP;
+            }
+            high = next;
+        }
+        ticks[i] = high | get16(event + 4);
+    }
+
+    // The time of the read follows the last event.
+    int64_t readTicks = get32(data + 6) & (EVENT_TRACE_TICKS_WRAP - 1);
+    if (first < count) {
+        int64_t last = ticks[count - 1];
+        readTicks |= last & ~static_cast<int64_t>(EVENT_TRACE_TICKS_WRAP - 1);
+        if (readTicks < last) {
+            readTicks += EVENT_TRACE_TICKS_WRAP;
+        }
+    }
+
+    // Before that, each event is the latest time with its low bits that is
+    // not after the next event.
+    int64_t next = (first < count) ? ticks[first] : readTicks;
+    for (size_t i = first; i-- > 0;) {
+        int64_t t = (next & HIGH) | get16(events + i * EVENT_TRACE_EVENT_SIZE + 4);
+        if (t > next) {
+            t -= 0x10000;
+        }
+        ticks[i] = next = t;
+    }
+    int64_t shift = ((count > 0) && (ticks[0] < 0)) ? EVENT_TRACE_TICKS_WRAP : 0;
+
+    trace.dropped = get16(data + 4);
+    trace.readTicks = readTicks + shift;
+    trace.events.clear();
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *event = events + i * EVENT_TRACE_EVENT_SIZE;
+        if (event[0] == TRACE_EVENT_TIME) {
+            continue;
+        }
+        TraceEvent decoded;
+        decoded.type = event[0];
+        decoded.arg8 = event[1];
+        decoded.arg16 = get16(event + 2);
+        decoded.ticks = ticks[i] + shift;
+        trace.events.push_back(decoded);
+    }
+    return true;
+}
+
+static bool appendHex(const std::string &text, std::vector<uint8_t> &data) {
+    size_t i = 0;
+    while (i < text.size()) {
+        if (isspace(static_cast<unsigned char>(text[i])) || (text[i] == ',') ||
+            (text[i] == ':')) {
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while ((end < text.size()) && isxdigit(static_cast<unsigned char>(text[end]))) {
+            end++;
+        }
+        if ((end == i + 1) && (text[i] == '0') && (end < text.size()) &&
+            ((text[end] == 'x') || (text[end] == 'X'))) {
+            i = end + 1;
+            continue;
+        }
+        bool separated = (end == text.size()) || isspace(static_cast<unsigned char>(text[end])) ||
+                         (text[end] == ',') || (text[end] == ':');
+        if ((end == i) || ((end - i) % 2 != 0) || !separated) {
+            return false;
+        }
+        for (; i < end; i += 2) {
+            data.push_back(static_cast<uint8_t>(strtoul(text.substr(i, 2).c_str(), NULL, 16)));
+        }
+    }
+    return true;
+}
+
+bool parseEventTraceHex(const std::string &text, std::vector<uint8_t> &data) {
+    static const char MARK[] = "TRACE";
+    bool marked = text.find(MARK) != std::string::npos;
+    data.clear();
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        size_t from = marked ? text.find(MARK, start) : start;
+        if (from < end) {
+            if (marked) {
+                from += sizeof(MARK) - 1;
+            }
+            if (!appendHex(text.substr(from, end - from), data)) {
+                errno = EINVAL;
+                return false;
+            }
+        }
+        start = end + 1;
+    }
+    if (data.empty()) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+static std::string describe(const TraceEvent &event) {
+    char text[96];
+    const char *name;
+    switch (event.type) {
+    case TRACE_EVENT_BOOT:
+        snprintf(text, sizeof(text), "boot, last sleep state %u", event.arg8);
+        break;
+    case TRACE_EVENT_STATE: {
+        const char *from = NAME(STATE_NAMES, event.arg16);
+        const char *to = NAME(STATE_NAMES, event.arg8);
+        char fromNumber[8], toNumber[8];
+        snprintf(fromNumber, sizeof(fromNumber), "%u", event.arg16);
+        snprintf(toNumber, sizeof(toNumber), "%u", event.arg8);
+        snprintf(text, sizeof(text), "state %s -> %s", from != NULL ? from : fromNumber,
+                 to != NULL ? to : toNumber);
+        break;
+    }
+    case TRACE_EVENT_TIMER:
+        name = NAME(TIMER_NAMES, event.arg8);
+        if (name != NULL) {
+            snprintf(text, sizeof(text), "timer %s, id %u", name, event.arg16);
+        } else {
+            snprintf(text, sizeof(text), "timer %u, id %u", event.arg8, event.arg16);
+        }
+        break;
+    case TRACE_EVENT_GATT_READ:
+        snprintf(text, sizeof(text), "gatt read 0x%04x, offset %u%s", event.arg16, event.arg8,
+                 event.arg8 == 0xFF ? "+" : "");
+        break;
+    case TRACE_EVENT_GATT_WRITE:
+        snprintf(text, sizeof(text), "gatt write 0x%04x, %u%s bytes", event.arg16, event.arg8,
+                 event.arg8 == 0xFF ? "+" : "");
+        break;
+    case TRACE_EVENT_NVM_READ:
+    case TRACE_EVENT_NVM_WRITE:
+        snprintf(text, sizeof(text), "nvm %s %u words at %u",
+                 event.type == TRACE_EVENT_NVM_READ ? "read" : "write", event.arg8,
+                 event.arg16);
+        break;
+    case TRACE_EVENT_PANIC:
+        name = NAME(PANIC_NAMES, event.arg16);
+        if (name != NULL) {
+            snprintf(text, sizeof(text), "panic %s", name);
+        } else {
+            snprintf(text, sizeof(text), "panic %u", event.arg16);
+        }
+        break;
+    default:
+        snprintf(text, sizeof(text), "event 0x%02x, 0x%02x, 0x%04x", event.type, event.arg8,
+                 event.arg16);
+        break;
+    }
+    return text;
+}
+
+std::string formatEventTrace(const EventTrace &trace) {
+    char line[160];
+    snprintf(line, sizeof(line), "%zu events, %u dropped, read at %.3f s\n"
+             "    time s  before s  event\n",
+             trace.events.size(), trace.dropped,
+             trace.readTicks * (EVENT_TRACE_TICK_US / 1e6));
+    std::string text = line;
+    for (size_t i = 0; i < trace.events.size(); i++) {
+        const TraceEvent &event = trace.events[i];
+        snprintf(line, sizeof(line), "%10.3f %9.3f  %s\n",
+                 event.ticks * (EVENT_TRACE_TICK_US / 1e6),
+                 (trace.readTicks - event.ticks) * (EVENT_TRACE_TICK_US / 1e6),
+                 describe(event).c_str());
+        text += line;
+    }
+    return text;
+}
+
+std::string formatUartLog(const std::string &text) {
+    static const char MARK[] = "LOG ";
+    std::string log;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        size_t mark = text.find(MARK, start);
+        unsigned header, arg;
+        if ((mark < end) &&
+            (sscanf(text.c_str() + mark + sizeof(MARK) - 1, "%4x %4x", &header, &arg) == 2)) {
+            unsigned level = header >> 8;
+            unsigned token = header & 0xFF;
+            char message[96];
+            const char *format = NAME(LOG_TEXTS, token);
+            if (format != NULL) {
+                snprintf(message, sizeof(message), format, arg);
+            } else {
+                snprintf(message, sizeof(message), "message %u, 0x%04x", token, arg);
+            }
+            log += (level < sizeof(LOG_LEVELS) - 1) ? LOG_LEVELS[level] : '?';
+            log += ' ';
+            log += message;
+            log += '\n';
+        }
+        start = end + 1;
+    }
+    return log;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Event traces from the CSR beacon firmware, see event_trace.h there: its
+// last events, read from the URIBEACON_TRACE characteristic or from the
+// TRACE lines it writes to the UART before a panic. All integers are little
+// endian.
+//
+//   Header                          Event
+//    0  magic 'E' 'T'                0  type
+//    2  version                      1  8-bit argument
+//    3  event count                  2  16-bit argument (2)
+//    4  events dropped (2)           4  low 16 bits of the time (2)
+//    6  time when read (4)
+//
+// Times are ticks of 1024 us from the beacon's 32-bit microsecond clock, so
+// they wrap every 71 minutes. A time event carries the high bits of the
+// events after it; events before the first time event left in the ring are
+// dated back from it, or from the time of the read if there is none, taking
+// each gap to be under 67 seconds.
+//
+// The same UART carries the firmware's log, as lines of "LOG", the level in
+// the high byte and message number in the low byte of one hex word, and
+// the message's argument in another. The messages are listed in the
+// firmware's log_tokens.h, which formatUartLog() reads for their texts.
+
+#ifndef URIBEACON_EVENT_TRACE_H__
+#define URIBEACON_EVENT_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define EVENT_TRACE_VERSION             (1)
+#define EVENT_TRACE_HEADER_SIZE         (10)
+#define EVENT_TRACE_EVENT_SIZE          (6)
+#define EVENT_TRACE_TICK_US             (1024)
+
+// Ticks before the clock wraps.
+#define EVENT_TRACE_TICKS_WRAP          (1ULL << 22)
+
+// The firmware's trace_event.
+enum TraceEventType {
+    TRACE_EVENT_TIME = 1,
+    TRACE_EVENT_BOOT = 2,           // arg8 last sleep state
+    TRACE_EVENT_STATE = 3,          // arg8 new app_state, arg16 old
+    TRACE_EVENT_TIMER = 4,          // arg8 TraceTimer, arg16 timer ID
+    TRACE_EVENT_GATT_READ = 5,      // arg8 offset, arg16 handle
+    TRACE_EVENT_GATT_WRITE = 6,     // arg8 length, arg16 handle
+    TRACE_EVENT_NVM_READ = 7,       // arg8 words, arg16 offset
+    TRACE_EVENT_NVM_WRITE = 8,
+    TRACE_EVENT_PANIC = 9           // arg16 app_panic_code
+};
+
+// The firmware's trace_timer.
+enum TraceTimer {
+    TRACE_TIMER_ADVERT = 1,
+    TRACE_TIMER_IDLE = 2,
+    TRACE_TIMER_CONN_PARAM = 3,
+    TRACE_TIMER_BONDING = 4,
+    TRACE_TIMER_BUZZER = 5,
+    TRACE_TIMER_BUTTON = 6
+};
+
+struct TraceEvent {
+    uint8_t type;
+    uint8_t arg8;
+    uint16_t arg16;
+    uint64_t ticks;                 // unwrapped, on the clock of readTicks
+};
+
+struct EventTrace {
+    uint16_t dropped;               // overwritten, or logged during a read
+    uint64_t readTicks;
+    std::vector<TraceEvent> events; // oldest first, without time events
+};
+
+// Decodes a trace. Returns false with errno EINVAL if it is malformed.
+bool decodeEventTrace(const uint8_t *data, size_t length, EventTrace &trace);
+
+// Reads the bytes of a trace from text: the hex after "TRACE" on the lines
+// that have it, as the firmware writes to the UART, or else every hex byte,
+// as tools print a characteristic's value, with any "0x" and separators.
+// Returns false with errno EINVAL if there are none or a byte is malformed.
+bool parseEventTraceHex(const std::string &text, std::vector<uint8_t> &data);
+
+// One line per event: its time in seconds, how many seconds before the
+// read, and what happened, with the firmware's names for states, timers and panics.
+std::string formatEventTrace(const EventTrace &trace);
+
+// The LOG lines of a UART log, one per line with the level's initial and
+// the message. Other lines are skipped.
+std::string formatUartLog(const std::string &text);
+
+#endif // URIBEACON_EVENT_TRACE_H__
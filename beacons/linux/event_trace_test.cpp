@@ -0,0 +1,247 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for decoding the CSR firmware's event trace.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "event_trace.h"
+#include "test_util.h"
+
+// Packs a trace as the firmware does. Times are full ticks; the time events
+// are the caller's.
+struct Raw {
+    uint8_t type;
+    uint8_t arg8;
+    uint16_t arg16;
+    uint32_t ticks;
+};
+
+static std::vector<uint8_t> pack(const std::vector<Raw> &events, uint32_t readTicks,
+                                 uint16_t dropped = 0) {
+    std::vector<uint8_t> data;
+    data.push_back('E');
+    data.push_back('T');
+    data.push_back(EVENT_TRACE_VERSION);
+    data.push_back(static_cast<uint8_t>(events.size()));
+    data.push_back(dropped & 0xFF);
+    data.push_back(dropped >> 8);
+    for (int i = 0; i < 4; i++) {
+        data.push_back((readTicks >> (8 * i)) & 0xFF);
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        data.push_back(events[i].type);
+        data.push_back(events[i].arg8);
+        data.push_back(events[i].arg16 & 0xFF);
+        data.push_back(events[i].arg16 >> 8);
+        data.push_back(events[i].ticks & 0xFF);
+        data.push_back((events[i].ticks >> 8) & 0xFF);
+    }
+    return data;
+}
+
+static Raw raw(uint8_t type, uint8_t arg8, uint16_t arg16, uint32_t ticks) {
+    Raw event = { type, arg8, arg16, ticks };
+    return event;
+}
+
+static Raw timeEvent(uint32_t ticks) {
+    return raw(TRACE_EVENT_TIME, 0, ticks >> 16, ticks);
+}
+
+static void testDecode(void) {
+    std::vector<Raw> events;
+    events.push_back(timeEvent(0x10));
+    events.push_back(raw(TRACE_EVENT_BOOT, 1, 0, 0x10));
+    events.push_back(raw(TRACE_EVENT_STATE, 1, 0, 0x20));
+    events.push_back(raw(TRACE_EVENT_NVM_WRITE, 12, 40, 0xFFF0));
+    events.push_back(timeEvent(0x10005));
+    events.push_back(raw(TRACE_EVENT_STATE, 3, 1, 0x10005));
+    std::vector<uint8_t> data = pack(events, 0x10100, 2);
+
+    EventTrace trace;
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(2, trace.dropped);
+    EXPECT_EQ(0x10100, trace.readTicks);
+    EXPECT_EQ(4, trace.events.size());
+    EXPECT_EQ(TRACE_EVENT_BOOT, trace.events[0].type);
+    EXPECT_EQ(0x10, trace.events[0].ticks);
+    EXPECT_EQ(0xFFF0, trace.events[2].ticks);
+    EXPECT_EQ(12, trace.events[2].arg8);
+    EXPECT_EQ(40, trace.events[2].arg16);
+    EXPECT_EQ(0x10005, trace.events[3].ticks);
+
+    std::string text = formatEventTrace(trace);
+    EXPECT_EQ(true, text.find("4 events, 2 dropped") != std::string::npos);
+    EXPECT_EQ(true, text.find("state init -> beaconing") != std::string::npos);
+    EXPECT_EQ(true, text.find("state beaconing -> connected") != std::string::npos);
+    EXPECT_EQ(true, text.find("nvm write 12 words at 40") != std::string::npos);
+
+    // An empty ring.
+    data = pack(std::vector<Raw>(), 1234);
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(0, trace.events.size());
+    EXPECT_EQ(1234, trace.readTicks);
+}
+
+// The ring overwrote the time event of the oldest events.
+static void testDateBack(void) {
+    std::vector<Raw> events;
+    events.push_back(raw(TRACE_EVENT_TIMER, TRACE_TIMER_ADVERT, 3, 0x2FF00));
+    events.push_back(raw(TRACE_EVENT_GATT_READ, 0xFF, 0x0021, 0x2FFF0));
+    events.push_back(timeEvent(0x30010));
+    events.push_back(raw(TRACE_EVENT_PANIC, 0, 5, 0x30010));
+    std::vector<uint8_t> data = pack(events, 0x30020);
+
+    EventTrace trace;
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(3, trace.events.size());
+    EXPECT_EQ(0x2FF00, trace.events[0].ticks);
+    EXPECT_EQ(0x2FFF0, trace.events[1].ticks);
+    EXPECT_EQ(0x30010, trace.events[2].ticks);
+    std::string text = formatEventTrace(trace);
+    EXPECT_EQ(true, text.find("timer advert, id 3") != std::string::npos);
+    EXPECT_EQ(true, text.find("gatt read 0x0021, offset 255+") != std::string::npos);
+    EXPECT_EQ(true, text.find("panic nvm_write") != std::string::npos);
+
+    // With no time event at all, from the time of the read.
+    events.erase(events.begin() + 2);
+    data = pack(events, 0x30020);
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(0x2FF00, trace.events[0].ticks);
+    EXPECT_EQ(0x30010, trace.events[2].ticks);
+    EXPECT_EQ(0x30020, trace.readTicks);
+
+    // Dating back past zero moves everything up a wrap.
+    events.clear();
+    events.push_back(raw(TRACE_EVENT_BOOT, 0, 0, 0xFFF0));
+    events.push_back(timeEvent(0x10));
+    data = pack(events, 0x20);
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(EVENT_TRACE_TICKS_WRAP - 0x10, trace.events[0].ticks);
+    EXPECT_EQ(EVENT_TRACE_TICKS_WRAP + 0x20, trace.readTicks);
+}
+
+// The 22-bit clock wraps between time events.
+static void testClockWrap(void) {
+    std::vector<Raw> events;
+    events.push_back(timeEvent(0x3FFF00));
+    events.push_back(raw(TRACE_EVENT_STATE, 2, 1, 0x3FFF00));
+    events.push_back(timeEvent(0x000100));
+    events.push_back(raw(TRACE_EVENT_STATE, 1, 2, 0x000100));
+    std::vector<uint8_t> data = pack(events, 0x000200);
+
+    EventTrace trace;
+    EXPECT_EQ(true, decodeEventTrace(data.data(), data.size(), trace));
+    EXPECT_EQ(0x3FFF00, trace.events[0].ticks);
+    EXPECT_EQ(EVENT_TRACE_TICKS_WRAP + 0x100, trace.events[1].ticks);
+    EXPECT_EQ(EVENT_TRACE_TICKS_WRAP + 0x200, trace.readTicks);
+}
+
+static void testMalformed(void) {
+    std::vector<Raw> events;
+    events.push_back(raw(TRACE_EVENT_BOOT, 0, 0, 0));
+    std::vector<uint8_t> data = pack(events, 0);
+    EventTrace trace;
+
+    std::vector<uint8_t> bad = data;
+    bad[0] = 'X';
+    errno = 0;
+    EXPECT_EQ(false, decodeEventTrace(bad.data(), bad.size(), trace));
+    EXPECT_EQ(EINVAL, errno);
+    bad = data;
+    bad[2] = EVENT_TRACE_VERSION + 1;
+    EXPECT_EQ(false, decodeEventTrace(bad.data(), bad.size(), trace));
+    EXPECT_EQ(false, decodeEventTrace(data.data(), data.size() - 1, trace));
+    bad = data;
+    bad.push_back(0);
+    EXPECT_EQ(false, decodeEventTrace(bad.data(), bad.size(), trace));
+    EXPECT_EQ(false, decodeEventTrace(data.data(), 3, trace));
+}
+
+static void testHex(void) {
+    std::vector<Raw> events;
+    events.push_back(timeEvent(0x20000));
+    events.push_back(raw(TRACE_EVENT_PANIC, 0, 10, 0x20000));
+    std::vector<uint8_t> data = pack(events, 0x20001);
+    std::string hex;
+    for (size_t i = 0; i < data.size(); i++) {
+        char byte[3];
+        snprintf(byte, sizeof(byte), "%02X", data[i]);
+        hex += byte;
+    }
+
+    // A UART log, as TraceDrainUart() writes it among other output.
+    std::string log = "GATT server GAP peripheral\r\n\r\nTRACE " + hex.substr(0, 32) +
+                      "\r\nTRACE " + hex.substr(32) + "\r\n";
+    std::vector<uint8_t> parsed;
+    EXPECT_EQ(true, parseEventTraceHex(log, parsed));
+    EXPECT_EQ(true, parsed == data);
+    EventTrace trace;
+    EXPECT_EQ(true, decodeEventTrace(parsed.data(), parsed.size(), trace));
+    EXPECT_EQ(true, formatEventTrace(trace).find("panic invalid_state") != std::string::npos);
+
+    // A characteristic value as tools print it.
+    std::string spaced, prefixed;
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        spaced += hex.substr(i, 2) + (i % 32 == 30 ? "\n" : " ");
+        prefixed += "0x" + hex.substr(i, 2) + ", ";
+    }
+    EXPECT_EQ(true, parseEventTraceHex(spaced, parsed));
+    EXPECT_EQ(true, parsed == data);
+    EXPECT_EQ(true, parseEventTraceHex(prefixed, parsed));
+    EXPECT_EQ(true, parsed == data);
+
+    errno = 0;
+    EXPECT_EQ(false, parseEventTraceHex("no trace here\n", parsed));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(false, parseEventTraceHex("45 5\n", parsed));
+    EXPECT_EQ(false, parseEventTraceHex("", parsed));
+}
+
+// The firmware's log lines, as debug_interface.c writes them.
+static void testUartLog(void) {
+    std::string text = formatUartLog("LOG 0201 0000\r\n"
+                                     "TRACE 4554\r\n"
+                                     "LOG 0202 0103\r\n"
+                                     "LOG 0106 000A\r\n"
+                                     "LOG 0100 0003\r\n"
+                                     "LOG 03FE 1234\r\n"
+                                     "LOG garbled\r\n");
+    EXPECT_EQ(0, strcmp("I boot, last sleep state 0\n"
+                        "I state 0x0103\n"
+                        "E panic 10\n"
+                        "E 3 records dropped\n"
+                        "D message 254, 0x1234\n",
+                        text.c_str()));
+}
+
+int main(void) {
+    testDecode();
+    testDateBack();
+    testClockWrap();
+    testMalformed();
+    testHex();
+    testUartLog();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extended_adv.h"
+
+#include <errno.h>
+#include <string.h>
+#include "advertiser.h"
+#include "sighting.h"
+
+static_assert(EXTENDED_URI_MAX <= SIGHTING_URI_MAX, "sightings must hold an extended URI");
+static_assert(URIBEACON_ADV_FLAGS_SIZE + 6 + URIBEACON_SERVICE_DATA_HDR_SIZE + EXTENDED_URI_MAX <=
+                  EXTENDED_ADV_DATA_MAX,
+              "an extended payload must fit one command");
+
+#define AD_TYPE_FLAGS                   (0x01)
+#define AD_TYPE_COMPLETE_16BIT_UUIDS    (0x03)
+#define AD_TYPE_SERVICE_DATA            (0x16)
+
+// Extended advertising parameters.
+#define EXT_ADV_PROPERTIES_NONCONN      (0x0000)
+#define EXT_ADV_CHANNELS_ALL            (0x07)
+#define EXT_ADV_TX_POWER_ANY            (0x7F)
+#define EXT_ADV_PHY_1M                  (0x01)
+#define EXT_ADV_OPERATION_COMPLETE      (0x03)
+#define EXT_ADV_NO_FRAGMENTS            (0x01)
+
+// Extended scan parameters.
+#define EXT_SCAN_PHY_1M                 (0x01)
+#define EXT_SCAN_ACTIVE                 (0x01)
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+// Sends a command, failing with EIO if the controller refused it.
+static bool send(HciTransport &transport, uint16_t opcode, const uint8_t *params,
+                 uint8_t length) {
+    int status = transport.command(opcode, params, length);
+    if (status != 0) {
+        if (status > 0) {
+            errno = EIO;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool buildExtendedPayload(uint8_t flags, int8_t txPower, const uint8_t *uri, uint8_t uriLength,
+                          ExtendedPayload &payload) {
+    if ((uriLength == 0) || (uriLength > EXTENDED_URI_MAX)) {
+        return false;
+    }
+    uint8_t *data = payload.data;
+    data[0] = 2;
+    data[1] = AD_TYPE_FLAGS;
+    data[2] = ADVERTISER_FLAGS;
+    data[3] = 3;
+    data[4] = AD_TYPE_COMPLETE_16BIT_UUIDS;
+    data[5] = URIBEACON_SERVICE_UUID & 0xFF;
+    data[6] = URIBEACON_SERVICE_UUID >> 8;
+    data[7] = static_cast<uint8_t>(1 + URIBEACON_SERVICE_DATA_HDR_SIZE + uriLength);
+    data[8] = AD_TYPE_SERVICE_DATA;
+    data[9] = URIBEACON_SERVICE_UUID & 0xFF;
+    data[10] = URIBEACON_SERVICE_UUID >> 8;
+    data[11] = flags;
+    data[12] = static_cast<uint8_t>(txPower);
+    memcpy(&data[13], uri, uriLength);
+    payload.length = static_cast<uint8_t>(13 + uriLength);
+    return true;
+}
+
+void encodeExtendedParameters(uint8_t handle, uint32_t intervalMs, uint8_t *params) {
+    // The interval is in 0.625 ms units, three bytes, used as both minimum
+    // and maximum. Peer address and filter policy are left 0.
+    uint32_t interval = intervalMs * 8 / 5;
+    memset(params, 0, EXT_ADV_PARAMETERS_SIZE);
+    params[0] = handle;
+    put16(&params[1], EXT_ADV_PROPERTIES_NONCONN);
+    for (int i = 0; i < 3; i++) {
+        params[3 + i] = (interval >> (8 * i)) & 0xFF;
+        params[6 + i] = (interval >> (8 * i)) & 0xFF;
+    }
+    params[9] = EXT_ADV_CHANNELS_ALL;
+    params[19] = EXT_ADV_TX_POWER_ANY;
+    params[20] = EXT_ADV_PHY_1M;
+    params[22] = EXT_ADV_PHY_1M;
+    params[23] = handle & 0x0F;
+}
+
+uint8_t encodeExtendedData(uint8_t handle, const ExtendedPayload &payload, uint8_t *params) {
+    params[0] = handle;
+    params[1] = EXT_ADV_OPERATION_COMPLETE;
+    params[2] = EXT_ADV_NO_FRAGMENTS;
+    params[3] = payload.length;
+    memcpy(&params[EXT_ADV_DATA_HDR_SIZE], payload.data, payload.length);
+    return static_cast<uint8_t>(EXT_ADV_DATA_HDR_SIZE + payload.length);
+}
+
+uint8_t encodeExtendedEnable(bool enable, uint8_t sets, uint8_t *params) {
+    params[0] = enable ? 1 : 0;
+    params[1] = sets;
+    for (uint8_t i = 0; i < sets; i++) {
+        uint8_t *set = &params[2 + 4 * i];
+        set[0] = i;
+        put16(&set[1], 0);
+        set[3] = 0;
+    }
+    return static_cast<uint8_t>(EXT_ADV_ENABLE_SIZE(sets));
+}
+
+void encodeExtendedScanParameters(uint32_t intervalMs, uint32_t windowMs, uint8_t *params) {
+    params[0] = 0;              // public address
+    params[1] = 0;              // accept all
+    params[2] = EXT_SCAN_PHY_1M;
+    params[3] = EXT_SCAN_ACTIVE;
+    put16(&params[4], static_cast<uint16_t>(intervalMs * 8 / 5));
+    put16(&params[6], static_cast<uint16_t>(windowMs * 8 / 5));
+}
+
+void encodeExtendedScanEnable(bool enable, uint8_t *params) {
+    params[0] = enable ? 1 : 0;
+    params[1] = 0;              // report duplicates
+    put16(&params[2], 0);       // until disabled
+    put16(&params[4], 0);
+}
+
+ExtendedAdvertiser::ExtendedAdvertiser(HciTransport &transport, uint32_t intervalMs)
+    : transport(transport),
+      intervalMs(intervalMs) {
+}
+
+void ExtendedAdvertiser::addPayload(const ExtendedPayload &payload) {
+    payloads.push_back(payload);
+}
+
+bool ExtendedAdvertiser::start(void) {
+    if (payloads.empty() || (payloads.size() > EXTENDED_SETS_MAX) ||
+        (intervalMs < ADVERTISER_INTERVAL_MIN_MS) || (intervalMs > ADVERTISER_INTERVAL_MAX_MS)) {
+        errno = EINVAL;
+        return false;
+    }
+    // Sets left by an earlier run would keep their old data.
+    if (!stop()) {
+        return false;
+    }
+    uint8_t params[EXT_ADV_DATA_HDR_SIZE + EXTENDED_ADV_DATA_MAX];
+    for (size_t i = 0; i < payloads.size(); i++) {
+        uint8_t handle = static_cast<uint8_t>(i);
+        encodeExtendedParameters(handle, intervalMs, params);
+        if (!send(transport, HCI_LE_SET_EXT_ADV_PARAMETERS, params, EXT_ADV_PARAMETERS_SIZE)) {
+            return false;
+        }
+        uint8_t length = encodeExtendedData(handle, payloads[i], params);
+        if (!send(transport, HCI_LE_SET_EXT_ADV_DATA, params, length)) {
+            return false;
+        }
+    }
+    uint8_t length = encodeExtendedEnable(true, static_cast<uint8_t>(payloads.size()), params);
+    return send(transport, HCI_LE_SET_EXT_ADV_ENABLE, params, length);
+}
+
+bool ExtendedAdvertiser::stop(void) {
+    uint8_t params[EXT_ADV_ENABLE_SIZE(0)];
+    uint8_t length = encodeExtendedEnable(false, 0, params);
+    return send(transport, HCI_LE_SET_EXT_ADV_ENABLE, params, length) &&
+           send(transport, HCI_LE_CLEAR_ADV_SETS, NULL, 0);
+}
+
+bool setExtendedScan(HciTransport &transport, bool enable) {
+    uint8_t params[EXT_SCAN_PARAMETERS_SIZE];
+    encodeExtendedScanEnable(false, params);
+    if (!send(transport, HCI_LE_SET_EXT_SCAN_ENABLE, params, EXT_SCAN_ENABLE_SIZE)) {
+        return false;
+    }
+    if (!enable) {
+        return true;
+    }
+    // Parameters can only be changed while scanning is off.
+    encodeExtendedScanParameters(EXTENDED_SCAN_INTERVAL_MS, EXTENDED_SCAN_INTERVAL_MS, params);
+    if (!send(transport, HCI_LE_SET_EXT_SCAN_PARAMETERS, params, EXT_SCAN_PARAMETERS_SIZE)) {
+        return false;
+    }
+    encodeExtendedScanEnable(true, params);
+    return send(transport, HCI_LE_SET_EXT_SCAN_ENABLE, params, EXT_SCAN_ENABLE_SIZE);
+}
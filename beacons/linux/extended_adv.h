@@ -0,0 +1,129 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Bluetooth 5 extended advertising and scanning.
+//
+// A legacy advertisement holds 31 bytes, which leaves 18 for the encoded URI.
+// An extended advertisement is announced on the primary channels and carried
+// on a secondary one, with room for up to 251 bytes of data in one command,
+// so the URI can run to EXTENDED_URI_MAX bytes. Each URI gets an advertising
+// set of its own, and the controller advertises all of them at once; there is
+// nothing to rotate.
+//
+// The command parameters are built by the encode functions, separately from
+// the classes that send them, so the exact bytes can be checked in the tests.
+
+#ifndef URIBEACON_EXTENDED_ADV_H__
+#define URIBEACON_EXTENDED_ADV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "hci_transport.h"
+#include "uribeacon_core.h"
+
+// LE controller commands.
+#define HCI_LE_SET_EXT_ADV_PARAMETERS   HCI_OPCODE(HCI_OGF_LE_CTL, 0x0036)
+#define HCI_LE_SET_EXT_ADV_DATA         HCI_OPCODE(HCI_OGF_LE_CTL, 0x0037)
+#define HCI_LE_SET_EXT_ADV_ENABLE       HCI_OPCODE(HCI_OGF_LE_CTL, 0x0039)
+#define HCI_LE_CLEAR_ADV_SETS           HCI_OPCODE(HCI_OGF_LE_CTL, 0x003D)
+#define HCI_LE_SET_EXT_SCAN_PARAMETERS  HCI_OPCODE(HCI_OGF_LE_CTL, 0x0041)
+#define HCI_LE_SET_EXT_SCAN_ENABLE      HCI_OPCODE(HCI_OGF_LE_CTL, 0x0042)
+
+// Most advertising data one LE Set Extended Advertising Data command carries.
+#define EXTENDED_ADV_DATA_MAX           (251)
+
+// Longest encoded URI advertised: the payload then fits one command and one
+// LE Extended Advertising Report event, so it is never fragmented.
+#define EXTENDED_URI_MAX                (200)
+
+// Advertising sets started at once. Controllers support from one to a few
+// dozen; one that supports fewer refuses the parameters of the extra sets.
+#define EXTENDED_SETS_MAX               (16)
+
+// Scan interval and window, as `hcitool lescan` uses, in ms.
+#define EXTENDED_SCAN_INTERVAL_MS       (10)
+
+// Command parameter sizes.
+#define EXT_ADV_PARAMETERS_SIZE         (25)
+#define EXT_ADV_DATA_HDR_SIZE           (4)
+#define EXT_ADV_ENABLE_SIZE(sets)       (2 + 4 * (sets))
+#define EXT_SCAN_PARAMETERS_SIZE        (8)
+#define EXT_SCAN_ENABLE_SIZE            (6)
+
+// Extended advertising data: the Flags AD, then the UriBeacon frame with the
+// long URI.
+struct ExtendedPayload {
+    uint8_t length;
+    uint8_t data[EXTENDED_ADV_DATA_MAX];
+};
+
+// Builds the payload advertising the encoded uri. Returns false if the URI is
+// empty or longer than EXTENDED_URI_MAX.
+bool buildExtendedPayload(uint8_t flags, int8_t txPower, const uint8_t *uri, uint8_t uriLength,
+                          ExtendedPayload &payload);
+
+// LE Set Extended Advertising Parameters: non-connectable, non-scannable
+// extended advertising from the public address on all three primary channels,
+// on the 1M PHY, with the handle as the advertising SID. params holds
+// EXT_ADV_PARAMETERS_SIZE bytes.
+void encodeExtendedParameters(uint8_t handle, uint32_t intervalMs, uint8_t *params);
+
+// LE Set Extended Advertising Data, the whole payload in one operation.
+// params holds EXT_ADV_DATA_HDR_SIZE + payload.length bytes. Returns the
+// length.
+uint8_t encodeExtendedData(uint8_t handle, const ExtendedPayload &payload, uint8_t *params);
+
+// LE Set Extended Advertising Enable for sets 0 to sets - 1, with no duration
+// or event limit. Disabling with no sets disables them all. params holds
+// EXT_ADV_ENABLE_SIZE(sets) bytes. Returns the length.
+uint8_t encodeExtendedEnable(bool enable, uint8_t sets, uint8_t *params);
+
+// LE Set Extended Scan Parameters: an active scan on the 1M PHY, accepting
+// every advertisement. params holds EXT_SCAN_PARAMETERS_SIZE bytes.
+void encodeExtendedScanParameters(uint32_t intervalMs, uint32_t windowMs, uint8_t *params);
+
+// LE Set Extended Scan Enable, reporting duplicates, until disabled. params
+// holds EXT_SCAN_ENABLE_SIZE bytes.
+void encodeExtendedScanEnable(bool enable, uint8_t *params);
+
+class ExtendedAdvertiser {
+public:
+    ExtendedAdvertiser(HciTransport &transport, uint32_t intervalMs);
+
+    void addPayload(const ExtendedPayload &payload);
+
+    // Stops and removes any advertising sets, then creates one set per
+    // payload and starts them together. The controller keeps advertising
+    // them until stop(). Returns false with errno set, EINVAL for a bad
+    // interval, no payloads or more than EXTENDED_SETS_MAX, and EIO if the
+    // controller refused a command.
+    bool start(void);
+
+    // Stops advertising and removes the sets.
+    bool stop(void);
+
+private:
+    HciTransport &transport;
+    uint32_t intervalMs;
+    std::vector<ExtendedPayload> payloads;
+};
+
+// Starts or stops an extended scan through transport, for a controller whose
+// extended advertisements only reach the host that way. Returns false with
+// errno set, EIO if the controller refused a command.
+bool setExtendedScan(HciTransport &transport, bool enable);
+
+#endif // URIBEACON_EXTENDED_ADV_H__
@@ -0,0 +1,501 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gateway.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "extended_adv.h"
+#include "hci_transport.h"
+
+#define MAX_EVENTS                      (64)
+#define INPUT_CHUNK                     (65536)
+
+// How often beacons that went quiet are looked for.
+#define EXPIRY_SWEEP_US                 (1000000)
+
+// Beacons whose advertisement can wait for its scan response at once.
+#define GATEWAY_JOIN_PENDING_MAX        (1024)
+
+// Poll interval while draining subscriber queues at the end of the input.
+#define DRAIN_POLL_MS                   (10)
+
+static uint64_t monotonicMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+Gateway::Gateway(const GatewayOptions &options)
+    : options(options),
+      epollFd(epoll_create1(EPOLL_CLOEXEC)),
+      inputFd(-1),
+      timerFd(-1),
+      stopFd(-1),
+      scanFd(-1),
+      inputPolled(false),
+      inputDone(false),
+      latestUs(0),
+      lastExpiryUs(0),
+      receivedNs(0),
+      lastLatencyReportMs(0),
+      malformedCounted(0),
+      continuations(options.joinTimeoutMs, GATEWAY_JOIN_PENDING_MAX),
+      beacons(options.publishIntervalMs, options.expiryMs, options.maxBeacons),
+      urls(options.urlCapacity, options.dictionary),
+      output(epollFd, options.batchRecords, options.queueBatches) {
+    memset(&counters, 0, sizeof(counters));
+    if (options.metrics != NULL) {
+        registerMetrics();
+    }
+    if (options.latencyReportMs != 0) {
+        stageLatency.reset(new PipelineLatency());
+        output.traceLatency(stageLatency.get());
+    }
+}
+
+Gateway::~Gateway() {
+    if (scanFd >= 0) {
+        FdHciTransport transport(scanFd);
+        setExtendedScan(transport, false);
+        close(scanFd);
+    }
+    if ((inputFd >= 0) && (inputFd != options.inputFd)) {
+        close(inputFd);
+    }
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+    }
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+}
+
+static bool watch(int epollFd, int fd) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool Gateway::start(void) {
+    if (epollFd < 0) {
+        return false;
+    }
+
+    if (options.inputFd >= 0) {
+        inputFd = options.inputFd;
+        fcntl(inputFd, F_SETFL, fcntl(inputFd, F_GETFL) | O_NONBLOCK);
+        if (!watch(epollFd, inputFd)) {
+            if (errno != EPERM) {
+                return false;
+            }
+            inputPolled = true;
+        }
+    } else {
+        inputFd = openHciSocket(options.hciDevice);
+        if ((inputFd < 0) || !watch(epollFd, inputFd)) {
+            return false;
+        }
+        // Stamped by the kernel on arrival, for the queue stage.
+        int one = 1;
+        if (stageLatency && (setsockopt(inputFd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0)) {
+            return false;
+        }
+        // Extended advertisements are only reported to an extended scan,
+        // which `hcitool lescan` cannot start.
+        if (options.extendedScan) {
+            scanFd = openHciCommandSocket(options.hciDevice);
+            if (scanFd < 0) {
+                return false;
+            }
+            FdHciTransport transport(scanFd);
+            if (!setExtendedScan(transport, true)) {
+                return false;
+            }
+        }
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((timerFd < 0) || (stopFd < 0) || !watch(epollFd, timerFd) || !watch(epollFd, stopFd)) {
+        return false;
+    }
+    itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_interval.tv_sec = options.flushIntervalMs / 1000;
+    interval.it_interval.tv_nsec = (options.flushIntervalMs % 1000) * 1000000;
+    interval.it_value = interval.it_interval;
+    if (timerfd_settime(timerFd, 0, &interval, NULL) < 0) {
+        return false;
+    }
+
+    if ((options.capturePath != NULL) && !recorder.open(options.capturePath)) {
+        return false;
+    }
+    lastLatencyReportMs = monotonicMs();
+    return output.listen(options.socketPath);
+}
+
+void Gateway::run(void) {
+    epoll_event events[MAX_EVENTS];
+    uint64_t drainDeadline = 0;
+    bool stopping = false;
+
+    while (!stopping) {
+        int timeout = -1;
+        if (inputDone) {
+            if (output.idle() || (monotonicMs() >= drainDeadline)) {
+                break;
+            }
+            timeout = DRAIN_POLL_MS;
+        } else if (inputPolled) {
+            timeout = 0;
+        }
+
+        int count = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if ((count < 0) && (errno != EINTR)) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == inputFd) {
+                if (options.inputFd >= 0) {
+                    readInput();
+                } else {
+                    readHci();
+                }
+            } else if (fd == timerFd) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) > 0) {
+                    tick();
+                }
+            } else if (fd == stopFd) {
+                stopping = true;
+            } else if (fd == output.listenFd()) {
+                output.acceptSubscribers();
+            } else {
+                output.handleEvents(fd, events[i].events);
+            }
+        }
+        if (inputPolled && !inputDone) {
+            readInput();
+        }
+        if (inputDone && (drainDeadline == 0)) {
+            output.flush();
+            drainDeadline = monotonicMs() + options.drainMs;
+        }
+    }
+    output.flush();
+    countMalformedLines();
+    if (recorder.isOpen() && !recorder.close()) {
+        counters.captureErrors++;
+    }
+    if (options.metrics != NULL) {
+        updateMetrics(true);
+    }
+    if (stageLatency) {
+        reportLatency();
+    }
+}
+
+void Gateway::stop(void) {
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) {
+        // Already signalled.
+    }
+}
+
+void Gateway::onFrame(const HciFrame &frame, void *context) {
+    static_cast<Gateway *>(context)->ingest(frame);
+}
+
+void Gateway::readInput(void) {
+    char buffer[INPUT_CHUNK];
+
+    // One chunk at a time, so the subscribers get a turn in between.
+    ssize_t length = read(inputFd, buffer, sizeof(buffer));
+    if (length > 0) {
+        receivedNs = stageLatency ? wallClockNs() : 0;
+        parser.feed(buffer, length, onFrame, this);
+        receivedNs = 0;
+        return;
+    }
+    if ((length < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+        return;
+    }
+    parser.finish(onFrame, this);
+    countMalformedLines();
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, inputFd, NULL);
+    inputDone = true;
+}
+
+void Gateway::readHci(void) {
+    HciFrame frame;
+    char control[CMSG_SPACE(sizeof(timespec))];
+    iovec data = { frame.bytes, sizeof(frame.bytes) };
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+
+    for (;;) {
+        message.msg_control = stageLatency ? control : NULL;
+        message.msg_controllen = stageLatency ? sizeof(control) : 0;
+        ssize_t length = recvmsg(inputFd, &message, 0);
+        if (length <= 0) {
+            if ((length < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+                // The adapter went away.
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, inputFd, NULL);
+                inputDone = true;
+            }
+            return;
+        }
+        frame.timestampUs = wallClockUs();
+        frame.incoming = true;
+        frame.length = static_cast<uint16_t>(length);
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL;
+             header = CMSG_NXTHDR(&message, header)) {
+            if ((header->cmsg_level == SOL_SOCKET) && (header->cmsg_type == SCM_TIMESTAMPNS)) {
+                timespec stamp;
+                memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+                receivedNs = static_cast<uint64_t>(stamp.tv_sec) * 1000000000 + stamp.tv_nsec;
+            }
+        }
+        ingest(frame);
+        receivedNs = 0;
+    }
+}
+
+void Gateway::ingest(const HciFrame &frame) {
+    if ((options.metrics == NULL) || (counters.frames % GATEWAY_INGEST_SAMPLE_INTERVAL != 0)) {
+        process(frame);
+        return;
+    }
+    uint64_t startNs = monotonicNs();
+    process(frame);
+    options.metrics->observe(metricIds.ingestTime, monotonicNs() - startNs);
+}
+
+void Gateway::process(const HciFrame &frame) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    uint64_t timestampUs = frame.timestampUs;
+
+    if ((timestampUs == 0) || !options.captureTimestamps) {
+        timestampUs = wallClockUs();
+    }
+    latestUs = timestampUs;
+    counters.frames++;
+
+    // Each stage is timed from the end of the one before.
+    uint64_t frameReceivedNs = receivedNs;
+    uint64_t stageNs = 0;
+    if (stageLatency) {
+        stageNs = wallClockNs();
+        if (frameReceivedNs == 0) {
+            frameReceivedNs = stageNs;
+        }
+        stageLatency->record(LATENCY_QUEUE, stageNs - frameReceivedNs);
+    }
+
+    if (recorder.isOpen() && !recorder.write(frame, timestampUs)) {
+        recorder.close();
+        counters.captureErrors++;
+    }
+
+    Sighting sighting;
+    while (continuations.expire(timestampUs, sighting)) {
+        accept(sighting, frameReceivedNs, stageNs);
+    }
+
+    int count = parseAdvertisingReports(frame, reports);
+    if (count < 0) {
+        counters.malformed++;
+        return;
+    }
+    counters.reports += count;
+    for (int i = 0; i < count; i++) {
+        if (continuations.add(reports[i], timestampUs, sighting)) {
+            accept(sighting, frameReceivedNs, stageNs);
+        }
+    }
+}
+
+void Gateway::accept(const Sighting &sighting, uint64_t frameReceivedNs, uint64_t &stageNs) {
+    Sighting interned = sighting;
+    Sighting smoothed;
+
+    interned.urlId = urls.intern(interned);
+    if (interned.urlId == 0) {
+        counters.invalidUris++;
+        return;
+    }
+    counters.uriBeacons++;
+    if (stageLatency) {
+        uint64_t decodedNs = wallClockNs();
+        stageLatency->record(LATENCY_DECODE, decodedNs - stageNs);
+        stageNs = decodedNs;
+    }
+    bool due = beacons.update(interned, smoothed);
+    if (stageLatency) {
+        uint64_t dedupedNs = wallClockNs();
+        stageLatency->record(LATENCY_DEDUP, dedupedNs - stageNs);
+        stageNs = dedupedNs;
+    }
+    if (due) {
+        output.publish(smoothed, frameReceivedNs);
+    }
+}
+
+// The parser keeps its own count; fold it in on every flush, so a live
+// stream reports malformed lines as they come.
+void Gateway::countMalformedLines(void) {
+    counters.malformed += parser.malformedLines() - malformedCounted;
+    malformedCounted = parser.malformedLines();
+}
+
+void Gateway::tick(void) {
+    output.flush();
+    countMalformedLines();
+    bool sweep = latestUs - lastExpiryUs >= EXPIRY_SWEEP_US;
+    if (sweep) {
+        counters.expired += beacons.expire(latestUs);
+        lastExpiryUs = latestUs;
+    }
+    if (options.metrics != NULL) {
+        updateMetrics(sweep);
+    }
+    if (stageLatency && (monotonicMs() - lastLatencyReportMs >= options.latencyReportMs)) {
+        reportLatency();
+        stageLatency->reset();
+        lastLatencyReportMs = monotonicMs();
+    }
+}
+
+void Gateway::reportLatency(void) {
+    fprintf(stderr, "latency over the last %.1f s\n", (monotonicMs() - lastLatencyReportMs) / 1e3);
+    stageLatency->dump(stderr);
+}
+
+void Gateway::registerMetrics(void) {
+    static const uint64_t INGEST_BOUNDS_NS[] = {
+        250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000,
+    };
+    MetricsRegistry &registry = *options.metrics;
+    MetricIds &ids = metricIds;
+
+    ids.frames = registry.counter("uribeacon_frames_total", "HCI frames read.");
+    ids.reports = registry.counter("uribeacon_reports_total", "LE advertising reports.");
+    ids.malformed = registry.counter("uribeacon_decode_errors_total",
+                                     "Input that did not decode, by reason.",
+                                     "reason=\"malformed\"");
+    ids.invalidUris = registry.counter("uribeacon_decode_errors_total",
+                                       "Input that did not decode, by reason.",
+                                       "reason=\"invalid_uri\"");
+    ids.uriBeacons = registry.counter("uribeacon_uribeacons_total",
+                                      "Advertisements carrying a valid UriBeacon frame.");
+    ids.beacons = registry.gauge("uribeacon_beacons", "Beacons being tracked.");
+    ids.rejected = registry.counter("uribeacon_beacons_rejected_total",
+                                    "New beacons dropped because the tracker was full.");
+    ids.evicted = registry.counter("uribeacon_subscribers_evicted_total",
+                                   "Subscribers dropped for falling behind.");
+    ids.captureErrors = registry.counter("uribeacon_capture_errors_total",
+                                         "Writes to the capture that failed, stopping it.");
+    ids.expired = registry.counter("uribeacon_beacons_expired_total",
+                                   "Beacons forgotten after going silent.");
+    ids.sightings = registry.counter("uribeacon_sightings_published_total",
+                                     "Sightings published to subscribers.");
+    ids.batches = registry.counter("uribeacon_batches_published_total",
+                                   "Sighting batches published.");
+    ids.subscribers = registry.gauge("uribeacon_subscribers", "Connected subscribers.");
+    ids.urlHits = registry.counter("uribeacon_url_lookups_total", "Encoded URL lookups.",
+                                   "result=\"hit\"");
+    ids.urlMisses = registry.counter("uribeacon_url_lookups_total", "Encoded URL lookups.",
+                                     "result=\"decoded\"");
+    ids.joined = registry.counter("uribeacon_uri_continuations_total",
+                                  "Advertisements flagged as continuing their URI, by outcome.",
+                                  "result=\"joined\"");
+    ids.incomplete = registry.counter("uribeacon_uri_continuations_total",
+                                      "Advertisements flagged as continuing their URI, by outcome.",
+                                      "result=\"incomplete\"");
+    ids.ingestTime = registry.histogram(
+        "uribeacon_ingest_seconds", "Time to decode, track and publish one HCI frame, sampled.",
+        std::vector<uint64_t>(INGEST_BOUNDS_NS, INGEST_BOUNDS_NS + sizeof(INGEST_BOUNDS_NS) /
+                                                                   sizeof(INGEST_BOUNDS_NS[0])),
+        1e-9);
+    ids.advertisements = registry.family("uribeacon_beacon_advertisements_total",
+                                         "Advertisements from each tracked beacon.", "counter");
+}
+
+void Gateway::onBeacon(const Sighting &last, uint64_t advertisements, void *context) {
+    char line[128];
+    snprintf(line, sizeof(line),
+             "uribeacon_beacon_advertisements_total{address=\"%02X:%02X:%02X:%02X:%02X:%02X\","
+             "type=\"%u\"} %llu\n",
+             last.address[0], last.address[1], last.address[2], last.address[3],
+             last.address[4], last.address[5], last.addressType,
+             (unsigned long long)advertisements);
+    static_cast<std::string *>(context)->append(line);
+}
+
+// Copies the counters kept by the gateway and its parts into the registry.
+// The hot path keeps incrementing plain integers, and pays only for the
+// sampled timing.
+void Gateway::updateMetrics(bool beaconSeries) {
+    MetricsRegistry &registry = *options.metrics;
+    const Publisher::Stats &published = output.stats();
+    const UrlTable::Stats &lookups = urls.stats();
+
+    registry.set(metricIds.frames, counters.frames);
+    registry.set(metricIds.reports, counters.reports);
+    registry.set(metricIds.malformed, counters.malformed);
+    registry.set(metricIds.invalidUris, counters.invalidUris);
+    registry.set(metricIds.uriBeacons, counters.uriBeacons);
+    registry.set(metricIds.beacons, beacons.size());
+    registry.set(metricIds.rejected, beacons.rejected());
+    registry.set(metricIds.expired, counters.expired);
+    registry.set(metricIds.sightings, published.sightings);
+    registry.set(metricIds.batches, published.batches);
+    registry.set(metricIds.subscribers, output.subscriberCount());
+    registry.set(metricIds.evicted, published.evicted);
+    registry.set(metricIds.urlHits, lookups.hits);
+    registry.set(metricIds.urlMisses, lookups.misses);
+    registry.set(metricIds.joined, continuations.stats().joined);
+    registry.set(metricIds.incomplete, continuations.stats().incomplete);
+    registry.set(metricIds.captureErrors, counters.captureErrors);
+    if (beaconSeries) {
+        beaconSamples.clear();
+        beacons.visit(onBeacon, &beaconSamples);
+        registry.setSamples(metricIds.advertisements, beaconSamples);
+    }
+}
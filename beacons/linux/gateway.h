@@ -0,0 +1,197 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// The UriBeacon gateway: HCI ingest, decode, deduplication and smoothing,
+// and batched publication to local subscribers, on one epoll loop.
+
+#ifndef URIBEACON_GATEWAY_H__
+#define URIBEACON_GATEWAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include "capture.h"
+#include "hci.h"
+#include "joiner.h"
+#include "latency.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "tracker.h"
+#include "url_table.h"
+
+// One frame in this many is timed for the ingest time histogram, to keep the
+// clock off the hot path.
+#define GATEWAY_INGEST_SAMPLE_INTERVAL  (1024)
+
+struct GatewayOptions {
+    const char *socketPath;
+    int inputFd;                // `hcidump --raw` text, or -1
+    int hciDevice;              // read hciN directly when inputFd is -1
+    bool extendedScan;          // and run an extended scan on it
+    bool captureTimestamps;     // use `hcidump -t` times instead of arrival
+    uint32_t flushIntervalMs;   // longest a sighting waits in an open batch
+    size_t batchRecords;
+    size_t queueBatches;        // per subscriber, before eviction
+    uint32_t publishIntervalMs;
+    uint32_t expiryMs;
+    size_t maxBeacons;
+    uint32_t joinTimeoutMs;     // wait for a scan response continuing a URI
+    size_t urlCapacity;         // distinct URLs kept decoded
+    const uribeacon_dict_t *dictionary; // deployment dictionary, or NULL
+    uint32_t drainMs;           // time allowed to drain queues at end of input
+    const char *capturePath;    // record the input to an indexed capture
+    MetricsRegistry *metrics;   // gateway metrics are added when not NULL
+    uint32_t latencyReportMs;   // trace stage latency, printing it this often
+
+    GatewayOptions()
+        : socketPath("/tmp/uribeacon.sock"),
+          inputFd(0),
+          hciDevice(0),
+          extendedScan(false),
+          captureTimestamps(false),
+          flushIntervalMs(50),
+          batchRecords(256),
+          queueBatches(64),
+          publishIntervalMs(1000),
+          expiryMs(30000),
+          maxBeacons(65536),
+          joinTimeoutMs(100),
+          urlCapacity(4096),
+          dictionary(NULL),
+          drainMs(1000),
+          capturePath(NULL),
+          metrics(NULL),
+          latencyReportMs(0) {
+    }
+};
+
+class Gateway {
+public:
+    struct Stats {
+        uint64_t frames;
+        uint64_t reports;
+        uint64_t malformed;     // unparseable lines and events
+        uint64_t uriBeacons;    // reports carrying a valid UriBeacon frame
+        uint64_t invalidUris;   // UriBeacon frames whose URI did not decode
+        uint64_t expired;
+        uint64_t captureErrors; // recording stopped after a failed write
+    };
+
+    explicit Gateway(const GatewayOptions &options);
+    ~Gateway();
+
+    // Opens the input, the subscriber socket and the flush timer. Returns
+    // false with errno set.
+    bool start(void);
+
+    // Runs until the input ends and the subscriber queues drain, or stop().
+    void run(void);
+
+    // Safe to call from a signal handler or another thread.
+    void stop(void);
+
+    // Processes one captured frame, as the input does.
+    void ingest(const HciFrame &frame);
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+    const Publisher &publisher(void) const {
+        return output;
+    }
+
+    const BeaconTracker &tracker(void) const {
+        return beacons;
+    }
+
+    const ScanResponseJoiner &joiner(void) const {
+        return continuations;
+    }
+
+    const UrlTable &urlTable(void) const {
+        return urls;
+    }
+
+    // The stage latencies since the last report, or NULL if not traced.
+    const PipelineLatency *latency(void) const {
+        return stageLatency.get();
+    }
+
+private:
+    // Ids of the gateway's metrics in options.metrics.
+    struct MetricIds {
+        int frames;
+        int reports;
+        int malformed;
+        int uriBeacons;
+        int invalidUris;
+        int beacons;
+        int rejected;
+        int expired;
+        int sightings;
+        int batches;
+        int subscribers;
+        int evicted;
+        int urlHits;
+        int urlMisses;
+        int joined;
+        int incomplete;
+        int captureErrors;
+        int ingestTime;
+        int advertisements;
+    };
+
+    static void onFrame(const HciFrame &frame, void *context);
+    static void onBeacon(const Sighting &last, uint64_t advertisements, void *context);
+
+    void registerMetrics(void);
+    void updateMetrics(bool beaconSeries);
+    void process(const HciFrame &frame);
+    void accept(const Sighting &sighting, uint64_t frameReceivedNs, uint64_t &stageNs);
+    void reportLatency(void);
+
+    void readInput(void);
+    void readHci(void);
+    void tick(void);
+    void countMalformedLines(void);
+
+    GatewayOptions options;
+    int epollFd;
+    int inputFd;
+    int timerFd;
+    int stopFd;
+    int scanFd;                 // commands the extended scan, or -1
+    bool inputPolled;           // a regular file, which epoll refuses
+    bool inputDone;
+    uint64_t latestUs;          // newest frame time, for expiry
+    uint64_t lastExpiryUs;
+    uint64_t receivedNs;        // of the frames being ingested, when traced
+    uint64_t lastLatencyReportMs;
+    HcidumpParser parser;
+    unsigned malformedCounted;  // of the parser's, in counters.malformed
+    CaptureWriter recorder;
+    ScanResponseJoiner continuations;
+    BeaconTracker beacons;
+    UrlTable urls;
+    Publisher output;
+    Stats counters;
+    std::unique_ptr<PipelineLatency> stageLatency;
+    MetricIds metricIds;
+    std::string beaconSamples;  // scratch for the per beacon series
+};
+
+#endif // URIBEACON_GATEWAY_H__
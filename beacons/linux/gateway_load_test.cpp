@@ -0,0 +1,228 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Load test for the gateway. A recorded `hcidump -t --raw` capture is fed
+// through a pipe as fast as the gateway reads it, with every advertisement
+// published, to simulated subscribers:
+//
+//   fast      read everything; must receive every batch, in order
+//   sluggish  sleep between batches; reported, may be evicted
+//   stalled   never read; must be evicted
+//
+// Stage latencies are traced and printed at the end.
+//
+//   gateway_load_test capture.txt [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gateway.h"
+#include "test_util.h"
+
+#define FAST_SUBSCRIBERS                (4)
+
+struct Subscriber {
+    int fd;
+    unsigned delayUs;           // per batch
+    uint64_t batches;
+    uint64_t records;
+    uint64_t outOfOrder;
+};
+
+static int connectSubscriber(const char *path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void receive(Subscriber *subscriber) {
+    std::vector<uint8_t> batch(SIGHTING_BATCH_MAX);
+    uint16_t expected = 0;
+
+    for (;;) {
+        ssize_t length = recv(subscriber->fd, batch.data(), batch.size(), 0);
+        if (length <= 0) {
+            break;
+        }
+        uint16_t sequence;
+        int count = readBatchHeader(batch.data(), length, &sequence);
+        if ((count < 0) || (sequence != expected)) {
+            subscriber->outOfOrder++;
+        }
+        expected = sequence + 1;
+        subscriber->batches++;
+        subscriber->records += (count > 0) ? count : 0;
+        if (subscriber->delayUs != 0) {
+            usleep(subscriber->delayUs);
+        }
+    }
+    close(subscriber->fd);
+}
+
+static void feed(int fd, const std::string *capture, int repeats) {
+    // Let the gateway accept the subscribers first.
+    usleep(100000);
+    for (int i = 0; i < repeats; i++) {
+        const char *data = capture->data();
+        size_t left = capture->size();
+        while (left > 0) {
+            ssize_t written = write(fd, data, left);
+            if (written <= 0) {
+                break;
+            }
+            data += written;
+            left -= written;
+        }
+    }
+    close(fd);
+}
+
+static bool readFile(const char *path, std::string &contents) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s capture.txt [repeats]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int repeats = (argc > 2) ? atoi(argv[2]) : 200;
+
+    std::string capture;
+    if (!readFile(argv[1], capture)) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    char directory[] = "/tmp/uribeacon_load_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    std::string socketPath = std::string(directory) + "/gateway.sock";
+
+    int input[2];
+    if (pipe(input) < 0) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+
+    GatewayOptions options;
+    options.socketPath = socketPath.c_str();
+    options.inputFd = input[0];
+    options.publishIntervalMs = 0;
+    options.flushIntervalMs = 10;
+    options.queueBatches = 8;
+    options.latencyReportMs = 3600000;
+    Gateway *gateway = new Gateway(options);
+    if (!gateway->start()) {
+        perror("gateway");
+        return EXIT_FAILURE;
+    }
+
+    Subscriber subscribers[FAST_SUBSCRIBERS + 2];
+    memset(subscribers, 0, sizeof(subscribers));
+    Subscriber &sluggish = subscribers[FAST_SUBSCRIBERS];
+    Subscriber &stalled = subscribers[FAST_SUBSCRIBERS + 1];
+    sluggish.delayUs = 1000;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < FAST_SUBSCRIBERS + 2; i++) {
+        subscribers[i].fd = connectSubscriber(options.socketPath);
+        if (&subscribers[i] != &stalled) {
+            readers.push_back(std::thread(receive, &subscribers[i]));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread feeder(feed, input[1], &capture, repeats);
+    gateway->run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    feeder.join();
+
+    Gateway::Stats stats = gateway->stats();
+    Publisher::Stats published = gateway->publisher().stats();
+    uint64_t queued = gateway->latency()->stage(LATENCY_QUEUE).count();
+    uint64_t batched = gateway->latency()->stage(LATENCY_BATCH).count();
+    // Closes the remaining subscriber sockets.
+    delete gateway;
+    // The stalled subscriber reads only once it has been dropped.
+    readers.push_back(std::thread(receive, &stalled));
+    for (size_t i = 0; i < readers.size(); i++) {
+        readers[i].join();
+    }
+    close(input[0]);
+    unlink(socketPath.c_str());
+    rmdir(directory);
+
+    // The feeder starts after a 100 ms pause.
+    seconds -= 0.1;
+    printf("input      %8.1f MB in %.2f s, %.1f MB/s\n",
+           capture.size() * repeats / 1e6, seconds, capture.size() * repeats / 1e6 / seconds);
+    printf("frames     %8llu  %10.0f /s, %llu malformed\n",
+           (unsigned long long)stats.frames, stats.frames / seconds,
+           (unsigned long long)stats.malformed);
+    printf("sightings  %8llu  %10.0f /s in %llu batches\n",
+           (unsigned long long)published.sightings, published.sightings / seconds,
+           (unsigned long long)published.batches);
+    printf("evicted    %8llu\n", (unsigned long long)published.evicted);
+    for (int i = 0; i < FAST_SUBSCRIBERS + 2; i++) {
+        const char *kind = (i < FAST_SUBSCRIBERS) ? "fast" :
+                           (&subscribers[i] == &sluggish) ? "sluggish" : "stalled";
+        printf("%-10s %8llu records in %llu batches%s\n", kind,
+               (unsigned long long)subscribers[i].records, (unsigned long long)subscribers[i].batches,
+               (subscribers[i].records < published.sightings) ? ", evicted" : "");
+    }
+
+    EXPECT_EQ(0, stats.malformed);
+    EXPECT_EQ(stats.frames, queued);
+    EXPECT_EQ(published.sightings, batched);
+    EXPECT_EQ(stats.uriBeacons, published.sightings);
+    for (int i = 0; i < FAST_SUBSCRIBERS; i++) {
+        EXPECT_EQ(published.sightings, subscribers[i].records);
+        EXPECT_EQ(0, subscribers[i].outOfOrder);
+    }
+    EXPECT_EQ(true, stalled.records < published.sightings);
+    EXPECT_EQ(true, published.evicted >= 1);
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
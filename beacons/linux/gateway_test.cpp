@@ -0,0 +1,726 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Unit tests for the gateway: hcidump parsing, advertising reports, sighting
+// decode, joining scan responses, the tracker, the batch format and
+// subscriber eviction.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dictionary.h"
+#include "extended_adv.h"
+#include "gateway.h"
+#include "hci.h"
+#include "joiner.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "sighting.h"
+#include "test_util.h"
+#include "tracker.h"
+
+// An LE Advertising Report for 01:02:03:04:05:06 advertising
+// http://uribeacon.org with flags 0x00, TX power -16 and RSSI -60.
+static const uint8_t URIBEACON_EVENT[] = {
+    0x04, 0x3E, 0x24, 0x02, 0x01,
+    0x03, 0x00, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x18,
+    0x02, 0x01, 0x06,
+    0x03, 0x03, 0xD8, 0xFE,
+    0x10, 0x16, 0xD8, 0xFE, 0x00, 0xF0,
+    0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08,
+    0xC4
+};
+
+// An LE Extended Advertising Report, as a Bluetooth 5 controller sent it,
+// for 01:02:03:04:05:06 advertising https://uribeacon.org/extended on the 1M
+// PHYs with flags 0x00, TX power -16 and RSSI -60. The 32 bytes of data do
+// not fit a legacy advertisement.
+static const uint8_t EXTENDED_EVENT[] = {
+    0x04, 0x3E, 0x3A, 0x0D, 0x01,
+    0x00, 0x00, 0x00, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+    0x01, 0x01, 0x00, 0x7F, 0xC4, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20,
+    0x02, 0x01, 0x06,
+    0x03, 0x03, 0xD8, 0xFE,
+    0x18, 0x16, 0xD8, 0xFE, 0x00, 0xF0,
+    0x03, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x01,
+    'e', 'x', 't', 'e', 'n', 'd', 'e', 'd'
+};
+
+static HciFrame makeFrame(const uint8_t *bytes, size_t length) {
+    HciFrame frame;
+    frame.timestampUs = 0;
+    frame.incoming = true;
+    frame.length = static_cast<uint16_t>(length);
+    memcpy(frame.bytes, bytes, length);
+    return frame;
+}
+
+static void collectFrame(const HciFrame &frame, void *context) {
+    static_cast<std::vector<HciFrame> *>(context)->push_back(frame);
+}
+
+static void testHcidumpParser(void) {
+    static const char text[] =
+        "HCI sniffer - Bluetooth packet analyzer ver 5.23\n"
+        "device: hci0 snap_len: 1500 filter: 0xffffffffffffffff\n"
+        "2015-03-04 14:00:00.000000 < 01 0C 20 02 01 00 \n"
+        "2015-03-04 14:00:01.250000 > 04 3E 24 02 01 03 00 06 05 04 03 02 01 18 02 01 06 03 03 D8 \n"
+        "  FE 10 16 D8 FE 00 F0 02 75 72 69 62 65 61 63 6F 6E 08 \r\n"
+        "  C4 \n"
+        "> 04 0E 04 01 0C 20 00\n"
+        "> 04 3E ZZ\n"
+        "> 04 0E";
+    std::vector<HciFrame> frames;
+    HcidumpParser parser;
+
+    // Odd sized chunks split lines and hex pairs.
+    for (size_t i = 0; i < sizeof(text) - 1; i += 7) {
+        size_t length = (sizeof(text) - 1 - i < 7) ? sizeof(text) - 1 - i : 7;
+        parser.feed(&text[i], length, collectFrame, &frames);
+    }
+    parser.finish(collectFrame, &frames);
+
+    EXPECT_EQ(4, frames.size());
+    EXPECT_EQ(1, parser.malformedLines());
+    if (frames.size() == 4) {
+        EXPECT_EQ(false, frames[0].incoming);
+        EXPECT_EQ(6, frames[0].length);
+        EXPECT_EQ(true, frames[1].incoming);
+        EXPECT_EQ(sizeof(URIBEACON_EVENT), frames[1].length);
+        EXPECT_EQ(0, memcmp(URIBEACON_EVENT, frames[1].bytes, sizeof(URIBEACON_EVENT)));
+        EXPECT_EQ(1250000, frames[1].timestampUs - frames[0].timestampUs);
+        EXPECT_EQ(0, frames[2].timestampUs);
+        EXPECT_EQ(7, frames[2].length);
+        EXPECT_EQ(2, frames[3].length);
+    }
+}
+
+static void testAdvertisingReports(void) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+
+    HciFrame frame = makeFrame(URIBEACON_EVENT, sizeof(URIBEACON_EVENT));
+    EXPECT_EQ(1, parseAdvertisingReports(frame, reports));
+    EXPECT_EQ(0x03, reports[0].eventType);
+    EXPECT_EQ(0x06, reports[0].address[0]);
+    EXPECT_EQ(0x18, reports[0].dataLength);
+    EXPECT_EQ(0x02, reports[0].data[0]);
+    EXPECT_EQ(-60, reports[0].rssi);
+
+    // Two reports in one event.
+    uint8_t two[5 + 2 * 11] = { 0x04, 0x3E, 2 + 2 * 11, 0x02, 0x02 };
+    for (int i = 0; i < 2; i++) {
+        uint8_t *report = &two[5 + i * 11];
+        report[0] = 0x00;
+        report[2] = static_cast<uint8_t>(i + 1);
+        report[8] = 1;
+        report[9] = 0xAA;
+        report[10] = static_cast<uint8_t>(-70 - i);
+    }
+    frame = makeFrame(two, sizeof(two));
+    EXPECT_EQ(2, parseAdvertisingReports(frame, reports));
+    EXPECT_EQ(2, reports[1].address[0]);
+    EXPECT_EQ(-71, reports[1].rssi);
+
+    // Truncated and foreign events.
+    frame = makeFrame(URIBEACON_EVENT, sizeof(URIBEACON_EVENT) - 1);
+    EXPECT_EQ(-1, parseAdvertisingReports(frame, reports));
+    two[2]--;
+    frame = makeFrame(two, sizeof(two) - 1);
+    EXPECT_EQ(-1, parseAdvertisingReports(frame, reports));
+    static const uint8_t complete[] = { 0x04, 0x0E, 0x04, 0x01, 0x0C, 0x20, 0x00 };
+    frame = makeFrame(complete, sizeof(complete));
+    EXPECT_EQ(0, parseAdvertisingReports(frame, reports));
+}
+
+static void testDecodeSighting(void) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    Sighting sighting;
+
+    HciFrame frame = makeFrame(URIBEACON_EVENT, sizeof(URIBEACON_EVENT));
+    parseAdvertisingReports(frame, reports);
+    EXPECT_EQ(true, decodeSighting(reports[0], 1234, sighting));
+    EXPECT_EQ(1234, sighting.timestampUs);
+    EXPECT_EQ(0x01, sighting.address[0]);
+    EXPECT_EQ(0x06, sighting.address[5]);
+    EXPECT_EQ(-60, sighting.rssi);
+    EXPECT_EQ(-16, sighting.txPower);
+    EXPECT_EQ(0x00, sighting.flags);
+    EXPECT_EQ(11, sighting.uriLength);
+    EXPECT_EQ(0x08, sighting.uri[10]);
+    EXPECT_EQ(1, sighting.count);
+    EXPECT_EQ(0, sighting.urlId);
+
+    // Other service data.
+    uint8_t bad[sizeof(URIBEACON_EVENT)];
+    memcpy(bad, URIBEACON_EVENT, sizeof(bad));
+    bad[23] = 0xAA;
+    frame = makeFrame(bad, sizeof(bad));
+    parseAdvertisingReports(frame, reports);
+    EXPECT_EQ(false, decodeSighting(reports[0], 0, sighting));
+
+    // The same data in a scan response.
+    frame = makeFrame(URIBEACON_EVENT, sizeof(URIBEACON_EVENT));
+    parseAdvertisingReports(frame, reports);
+    reports[0].eventType = HCI_SCAN_RSP;
+    EXPECT_EQ(false, decodeSighting(reports[0], 0, sighting));
+}
+
+static void testExtendedReports(void) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    Sighting sighting;
+    char text[URL_TEXT_MAX];
+
+    HciFrame frame = makeFrame(EXTENDED_EVENT, sizeof(EXTENDED_EVENT));
+    EXPECT_EQ(1, parseAdvertisingReports(frame, reports));
+    EXPECT_EQ(true, reports[0].extended);
+    EXPECT_EQ(HCI_ADV_NONCONN_IND, reports[0].eventType);
+    EXPECT_EQ(0x06, reports[0].address[0]);
+    EXPECT_EQ(32, reports[0].dataLength);
+    EXPECT_EQ(-60, reports[0].rssi);
+    EXPECT_EQ(true, decodeSighting(reports[0], 1234, sighting));
+    EXPECT_EQ(0x01, sighting.address[0]);
+    EXPECT_EQ(-16, sighting.txPower);
+    EXPECT_EQ(19, sighting.uriLength);
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode(sighting.uri, sighting.uriLength, text,
+                                                 sizeof(text)));
+    EXPECT_EQ(0, strcmp("https://uribeacon.org/extended", text));
+
+    // A legacy PDU reported in the extended event keeps to 18 bytes.
+    uint8_t legacy[sizeof(EXTENDED_EVENT)];
+    memcpy(legacy, EXTENDED_EVENT, sizeof(legacy));
+    legacy[5] = 0x13;           // legacy, scannable and connectable: ADV_IND
+    frame = makeFrame(legacy, sizeof(legacy));
+    EXPECT_EQ(1, parseAdvertisingReports(frame, reports));
+    EXPECT_EQ(false, reports[0].extended);
+    EXPECT_EQ(HCI_ADV_IND, reports[0].eventType);
+    EXPECT_EQ(false, decodeSighting(reports[0], 0, sighting));
+    legacy[5] = 0x1B;           // and its scan response
+    frame = makeFrame(legacy, sizeof(legacy));
+    parseAdvertisingReports(frame, reports);
+    EXPECT_EQ(HCI_SCAN_RSP, reports[0].eventType);
+
+    // Data that continues in a later event, or was truncated, is dropped.
+    for (uint8_t status = 1; status <= 2; status++) {
+        memcpy(legacy, EXTENDED_EVENT, sizeof(legacy));
+        legacy[5] = static_cast<uint8_t>(status << 5);
+        frame = makeFrame(legacy, sizeof(legacy));
+        EXPECT_EQ(0, parseAdvertisingReports(frame, reports));
+    }
+
+    // Truncated events.
+    frame = makeFrame(EXTENDED_EVENT, sizeof(EXTENDED_EVENT) - 1);
+    EXPECT_EQ(-1, parseAdvertisingReports(frame, reports));
+    memcpy(legacy, EXTENDED_EVENT, sizeof(legacy));
+    legacy[2] = 2 + 20;
+    frame = makeFrame(legacy, 3 + 2 + 20);
+    EXPECT_EQ(-1, parseAdvertisingReports(frame, reports));
+}
+
+// An advertising report event from address id, built like a controller's.
+static HciFrame makeReport(uint8_t id, uint8_t eventType, const uint8_t *data, uint8_t length,
+                           uint64_t timestampUs) {
+    AdvertisingReport report;
+    memset(&report, 0, sizeof(report));
+    report.eventType = eventType;
+    report.address[0] = id;
+    report.dataLength = length;
+    report.data = data;
+    report.rssi = -60;
+    HciFrame frame;
+    buildAdvertisingReport(report, timestampUs, frame);
+    return frame;
+}
+
+// A beacon advertising the first 18 bytes of a long URI and continuing it
+// in its scan response.
+struct ContinuedBeacon {
+    uint8_t uri[URIBEACON_URI_EXTENDED_MAX];
+    uint8_t uriLength;
+    uint8_t adv[URIBEACON_ADV_MAX];
+    uint8_t advLength;
+    uint8_t scan[URIBEACON_ADV_MAX];
+    uint8_t scanLength;
+
+    explicit ContinuedBeacon(const char *text) {
+        uribeacon_uri_encode(text, uri, sizeof(uri), &uriLength);
+        uribeacon_config_t config;
+        uribeacon_config_defaults(&config);
+        memcpy(config.uri, uri, URIBEACON_URI_MAX);
+        config.uri_length = URIBEACON_URI_MAX;
+        config.flags = URIBEACON_FLAG_URI_CONTINUED;
+        static const uint8_t flags[] = { 0x02, 0x01, 0x06 };
+        memcpy(adv, flags, sizeof(flags));
+        advLength = sizeof(flags) + uribeacon_frame_build(&config, &adv[sizeof(flags)],
+                                                          sizeof(adv) - sizeof(flags));
+        scanLength = uribeacon_scan_response_build(&uri[URIBEACON_URI_MAX],
+                                                   uriLength - URIBEACON_URI_MAX, scan,
+                                                   sizeof(scan));
+    }
+};
+
+static bool addFrame(ScanResponseJoiner &joiner, const HciFrame &frame, Sighting &out) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    EXPECT_EQ(1, parseAdvertisingReports(frame, reports));
+    return joiner.add(reports[0], frame.timestampUs, out);
+}
+
+static void testScanResponseJoin(void) {
+    static const char *URL = "https://example.com/events/2015/uribeacon";
+    ContinuedBeacon beacon(URL);
+    ScanResponseJoiner joiner(100, 2);
+    Sighting out;
+    char text[URL_TEXT_MAX];
+
+    EXPECT_EQ(true, beacon.uriLength > URIBEACON_URI_MAX);
+    EXPECT_EQ(true, beacon.scanLength > 0);
+
+    // Held until its scan response, which another beacon's does not match.
+    EXPECT_EQ(false, addFrame(joiner, makeReport(1, HCI_ADV_SCAN_IND, beacon.adv,
+                                                 beacon.advLength, 1000), out));
+    EXPECT_EQ(1, joiner.pending());
+    EXPECT_EQ(false, addFrame(joiner, makeReport(2, HCI_SCAN_RSP, beacon.scan,
+                                                 beacon.scanLength, 1100), out));
+    EXPECT_EQ(1, joiner.stats().unmatched);
+    EXPECT_EQ(true, addFrame(joiner, makeReport(1, HCI_SCAN_RSP, beacon.scan,
+                                                beacon.scanLength, 1200), out));
+    EXPECT_EQ(0, joiner.pending());
+    EXPECT_EQ(1, joiner.stats().joined);
+    EXPECT_EQ(1000, out.timestampUs);
+    EXPECT_EQ(beacon.uriLength, out.uriLength);
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_decode(out.uri, out.uriLength, text, sizeof(text)));
+    EXPECT_EQ(0, strcmp(URL, text));
+
+    // A URI that fits, and a scan response with no continuation, pass
+    // straight through.
+    EXPECT_EQ(true, addFrame(joiner, makeFrame(URIBEACON_EVENT, sizeof(URIBEACON_EVENT)), out));
+    static const uint8_t name[] = { 0x03, 0x09, 'u', 'b' };
+    EXPECT_EQ(false, addFrame(joiner, makeReport(1, HCI_SCAN_RSP, name, sizeof(name), 1300),
+                              out));
+    EXPECT_EQ(1, joiner.stats().unmatched);
+
+    // Under a passive scan the advertisement is released as is.
+    EXPECT_EQ(false, addFrame(joiner, makeReport(1, HCI_ADV_SCAN_IND, beacon.adv,
+                                                 beacon.advLength, 2000), out));
+    EXPECT_EQ(false, addFrame(joiner, makeReport(1, HCI_ADV_SCAN_IND, beacon.adv,
+                                                 beacon.advLength, 2050), out));
+    EXPECT_EQ(false, joiner.expire(101999, out));
+    EXPECT_EQ(true, joiner.expire(102000, out));
+    EXPECT_EQ(URIBEACON_URI_MAX, out.uriLength);
+    EXPECT_EQ(false, joiner.expire(102000, out));
+    EXPECT_EQ(1, joiner.stats().incomplete);
+
+    // The table is bounded; a beacon that finds it full is not held.
+    for (uint8_t id = 1; id <= 3; id++) {
+        bool passed = addFrame(joiner, makeReport(id, HCI_ADV_SCAN_IND, beacon.adv,
+                                                  beacon.advLength, 200000), out);
+        EXPECT_EQ(id == 3, passed);
+    }
+    EXPECT_EQ(1, joiner.stats().rejected);
+    EXPECT_EQ(2, joiner.pending());
+}
+
+static void collectUrlId(const Sighting &last, uint64_t advertisements, void *context) {
+    *static_cast<uint32_t *>(context) = last.urlId;
+}
+
+// The gateway publishes the whole URI from an advertisement and its scan
+// response in separate events.
+static void testGatewayJoinsScanResponse(void) {
+    static const char *URL = "http://www.example.org/a/rather/long/path";
+    ContinuedBeacon beacon(URL);
+    GatewayOptions options;
+    options.captureTimestamps = true;
+    Gateway gateway(options);
+
+    gateway.ingest(makeReport(9, HCI_ADV_SCAN_IND, beacon.adv, beacon.advLength, 1000));
+    EXPECT_EQ(0, gateway.tracker().size());
+    gateway.ingest(makeReport(9, HCI_SCAN_RSP, beacon.scan, beacon.scanLength, 1500));
+    EXPECT_EQ(1, gateway.tracker().size());
+    EXPECT_EQ(1, gateway.joiner().stats().joined);
+    EXPECT_EQ(1, gateway.stats().uriBeacons);
+
+    uint32_t urlId = 0;
+    gateway.tracker().visit(collectUrlId, &urlId);
+    const char *text = gateway.urlTable().text(urlId);
+    EXPECT_EQ(true, (text != NULL) && (std::string(text) == URL));
+}
+
+// An LE Extended Advertising Report event from address id carrying payload.
+static HciFrame makeExtendedReport(uint8_t id, const ExtendedPayload &payload,
+                                   uint64_t timestampUs) {
+    HciFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.timestampUs = timestampUs;
+    frame.incoming = true;
+    frame.length = static_cast<uint16_t>(5 + 24 + payload.length);
+    frame.bytes[0] = HCI_EVENT_PKT;
+    frame.bytes[1] = HCI_EV_LE_META;
+    frame.bytes[2] = static_cast<uint8_t>(frame.length - 3);
+    frame.bytes[3] = HCI_EV_LE_EXT_ADVERTISING_REPORT;
+    frame.bytes[4] = 1;
+    uint8_t *report = &frame.bytes[5];
+    report[3] = id;
+    report[9] = 0x01;
+    report[10] = 0x01;
+    report[12] = 0x7F;
+    report[13] = static_cast<uint8_t>(-55);
+    report[23] = payload.length;
+    memcpy(&report[24], payload.data, payload.length);
+    return frame;
+}
+
+// The gateway publishes a URI of EXTENDED_URI_MAX bytes from an extended
+// advertisement whole, in the batch record and the URL table.
+static void testGatewayExtendedUri(void) {
+    // The prefix encodes to 9 bytes, each letter after it to one.
+    std::string url = "https://example.com/";
+    while (url.size() < 20 + EXTENDED_URI_MAX - 9) {
+        url += 'a' + url.size() % 26;
+    }
+    uint8_t uri[EXTENDED_URI_MAX];
+    uint8_t uriLength;
+    EXPECT_EQ(URIBEACON_OK, uribeacon_uri_encode(url.c_str(), uri, sizeof(uri), &uriLength));
+    EXPECT_EQ(EXTENDED_URI_MAX, uriLength);
+    ExtendedPayload payload;
+    EXPECT_EQ(true, buildExtendedPayload(0x00, -20, uri, uriLength, payload));
+    EXPECT_EQ(false, buildExtendedPayload(0x00, -20, uri, 0, payload));
+
+    GatewayOptions options;
+    options.captureTimestamps = true;
+    Gateway gateway(options);
+    gateway.ingest(makeExtendedReport(4, payload, 1000));
+    EXPECT_EQ(1, gateway.stats().uriBeacons);
+    EXPECT_EQ(0, gateway.joiner().pending());
+    uint32_t urlId = 0;
+    gateway.tracker().visit(collectUrlId, &urlId);
+    const char *text = gateway.urlTable().text(urlId);
+    EXPECT_EQ(true, (text != NULL) && (url == text));
+
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    Sighting in;
+    Sighting out;
+    EXPECT_EQ(1, parseAdvertisingReports(makeExtendedReport(4, payload, 1000), reports));
+    EXPECT_EQ(true, decodeSighting(reports[0], 1000, in));
+    uint8_t record[SIGHTING_RECORD_SIZE + EXTENDED_URI_MAX];
+    EXPECT_EQ(SIGHTING_RECORD_SIZE + EXTENDED_URI_MAX - URIBEACON_URI_MAX,
+              sightingRecordSize(in));
+    writeSightingRecord(in, record);
+    EXPECT_EQ(sightingRecordSize(in), readSightingRecord(record, out));
+    EXPECT_EQ(true, samePayload(in, out));
+    EXPECT_EQ(EXTENDED_URI_MAX, out.uriLength);
+}
+
+// A gateway decodes URIs carrying the version of its dictionary, and drops
+// those carrying another, which would decode to the wrong text.
+static void testGatewayDictionary(void) {
+    Dictionary dictionary;
+    EXPECT_EQ(true, dictionary.parse("version 2\nevents.example.com/\nvenues/\n"));
+    static const char *URL = "https://events.example.com/venues/hall-b";
+    uint8_t uri[EXTENDED_URI_MAX];
+    uint8_t uriLength;
+    EXPECT_EQ(URIBEACON_OK,
+              uribeacon_uri_encode_dict(URL, dictionary.codes(), uri, sizeof(uri), &uriLength));
+    ExtendedPayload matching;
+    ExtendedPayload other;
+    EXPECT_EQ(true, buildExtendedPayload(URIBEACON_FLAGS_WITH_DICT(0x01, 2), -20, uri,
+                                         uriLength, matching));
+    EXPECT_EQ(true, buildExtendedPayload(URIBEACON_FLAGS_WITH_DICT(0x01, 3), -20, uri,
+                                         uriLength, other));
+
+    GatewayOptions options;
+    options.dictionary = dictionary.codes();
+    Gateway gateway(options);
+    gateway.ingest(makeExtendedReport(5, other, 1000));
+    EXPECT_EQ(0, gateway.stats().uriBeacons);
+    EXPECT_EQ(1, gateway.stats().invalidUris);
+    gateway.ingest(makeExtendedReport(5, matching, 2000));
+    EXPECT_EQ(1, gateway.stats().uriBeacons);
+    uint32_t urlId = 0;
+    gateway.tracker().visit(collectUrlId, &urlId);
+    const char *text = gateway.urlTable().text(urlId);
+    EXPECT_EQ(true, (text != NULL) && (std::string(text) == URL));
+
+    // Without a dictionary, any version is unknown.
+    Gateway plain((GatewayOptions()));
+    plain.ingest(makeExtendedReport(5, matching, 1000));
+    EXPECT_EQ(0, plain.stats().uriBeacons);
+    EXPECT_EQ(1, plain.stats().invalidUris);
+}
+
+// A live stream reports malformed lines while it runs, not only once the
+// input ends.
+static void testGatewayCountsMalformedLive(void) {
+    char directory[] = "/tmp/uribeacon_gateway_XXXXXX";
+    int input[2];
+    if ((mkdtemp(directory) == NULL) || (pipe(input) < 0)) {
+        perror("gateway test");
+        failures++;
+        return;
+    }
+    std::string socketPath = std::string(directory) + "/gateway.sock";
+    MetricsRegistry registry;
+    GatewayOptions options;
+    options.socketPath = socketPath.c_str();
+    options.inputFd = input[0];
+    options.flushIntervalMs = 10;
+    options.metrics = &registry;
+    Gateway gateway(options);
+    EXPECT_EQ(true, gateway.start());
+    std::thread runner(&Gateway::run, &gateway);
+
+    static const char LINES[] = "> 04 3E ZZ\n> 04 0E 04 01 0C 20 00\n";
+    EXPECT_EQ(sizeof(LINES) - 1, write(input[1], LINES, sizeof(LINES) - 1));
+    bool reported = false;
+    for (int i = 0; (i < 200) && !reported; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reported = registry.render().find("reason=\"malformed\"} 1") != std::string::npos;
+    }
+    EXPECT_EQ(true, reported);
+
+    close(input[1]);
+    runner.join();
+    EXPECT_EQ(1, gateway.stats().malformed);
+    close(input[0]);
+    unlink(socketPath.c_str());
+    rmdir(directory);
+}
+
+static Sighting makeSighting(uint8_t id, uint64_t timestampMs, int8_t rssi, uint8_t flags) {
+    Sighting sighting;
+    memset(&sighting, 0, sizeof(sighting));
+    sighting.timestampUs = timestampMs * 1000;
+    sighting.address[5] = id;
+    sighting.rssi = rssi;
+    sighting.smoothedRssi = rssi;
+    sighting.flags = flags;
+    sighting.uriLength = 1;
+    sighting.uri[0] = 0x02;
+    sighting.count = 1;
+    return sighting;
+}
+
+static void testTracker(void) {
+    BeaconTracker tracker(1000, 5000, 2);
+    Sighting out;
+
+    EXPECT_EQ(true, tracker.update(makeSighting(1, 0, -60, 0), out));
+    EXPECT_EQ(1, out.count);
+
+    // Repeats within the interval are folded in.
+    EXPECT_EQ(false, tracker.update(makeSighting(1, 100, -80, 0), out));
+    EXPECT_EQ(false, tracker.update(makeSighting(1, 200, -80, 0), out));
+
+    // A changed payload is published at once.
+    EXPECT_EQ(true, tracker.update(makeSighting(1, 300, -80, 1), out));
+    EXPECT_EQ(3, out.count);
+    EXPECT_EQ(-80, out.rssi);
+    EXPECT_EQ(-72, out.smoothedRssi);
+
+    EXPECT_EQ(false, tracker.update(makeSighting(1, 1299, -80, 1), out));
+    EXPECT_EQ(true, tracker.update(makeSighting(1, 1300, -80, 1), out));
+    EXPECT_EQ(2, out.count);
+
+    // The table is bounded.
+    EXPECT_EQ(true, tracker.update(makeSighting(2, 1400, -50, 0), out));
+    EXPECT_EQ(false, tracker.update(makeSighting(3, 1500, -50, 0), out));
+    EXPECT_EQ(1, tracker.rejected());
+
+    EXPECT_EQ(0, tracker.expire(6300000));
+    EXPECT_EQ(1, tracker.expire(6300001));
+    EXPECT_EQ(1, tracker.size());
+    EXPECT_EQ(true, tracker.update(makeSighting(3, 6400, -50, 0), out));
+}
+
+static void testBatchRoundTrip(void) {
+    // A short URI is held inline; a long one runs past the record.
+    static const uint8_t LONG_URI = 30;
+    uint8_t batch[SIGHTING_BATCH_HEADER_SIZE + 2 * SIGHTING_RECORD_SIZE + LONG_URI -
+                  URIBEACON_URI_MAX];
+    uint16_t sequence;
+    Sighting in = makeSighting(7, 1425477600000ull, -42, 0x01);
+    Sighting longIn = makeSighting(8, 1425477600000ull, -60, 0x02);
+    Sighting out;
+
+    in.txPower = -20;
+    in.smoothedRssi = -45;
+    in.count = 300;
+    in.urlId = 0x00020005;
+    longIn.uriLength = LONG_URI;
+    for (uint8_t i = 1; i < LONG_URI; i++) {
+        longIn.uri[i] = 'a' + i;
+    }
+    longIn.urlId = 0x00010006;
+    EXPECT_EQ(SIGHTING_RECORD_SIZE, sightingRecordSize(in));
+    writeBatchHeader(batch, 2, 0xBEEF);
+    writeSightingRecord(in, &batch[SIGHTING_BATCH_HEADER_SIZE]);
+    writeSightingRecord(longIn, &batch[SIGHTING_BATCH_HEADER_SIZE + SIGHTING_RECORD_SIZE]);
+
+    EXPECT_EQ(2, readBatchHeader(batch, sizeof(batch), &sequence));
+    EXPECT_EQ(0xBEEF, sequence);
+    size_t offset = SIGHTING_BATCH_HEADER_SIZE;
+    offset += readSightingRecord(&batch[offset], out);
+    EXPECT_EQ(in.timestampUs, out.timestampUs);
+    EXPECT_EQ(true, sameBeacon(in, out));
+    EXPECT_EQ(true, samePayload(in, out));
+    EXPECT_EQ(-42, out.rssi);
+    EXPECT_EQ(-45, out.smoothedRssi);
+    EXPECT_EQ(300, out.count);
+    EXPECT_EQ(0x00020005, out.urlId);
+    offset += readSightingRecord(&batch[offset], out);
+    EXPECT_EQ(sizeof(batch), offset);
+    EXPECT_EQ(true, sameBeacon(longIn, out));
+    EXPECT_EQ(true, samePayload(longIn, out));
+    EXPECT_EQ(0x00010006, out.urlId);
+
+    EXPECT_EQ(-1, readBatchHeader(batch, sizeof(batch) - 1, NULL));
+    EXPECT_EQ(-1, readBatchHeader(batch, SIGHTING_BATCH_HEADER_SIZE + SIGHTING_RECORD_SIZE, NULL));
+    // A URI length that runs past the batch.
+    batch[SIGHTING_BATCH_HEADER_SIZE + SIGHTING_RECORD_SIZE + 19] = LONG_URI + 1;
+    EXPECT_EQ(-1, readBatchHeader(batch, sizeof(batch), NULL));
+    batch[SIGHTING_BATCH_HEADER_SIZE + SIGHTING_RECORD_SIZE + 19] = LONG_URI;
+    batch[2] = SIGHTING_BATCH_VERSION + 1;
+    EXPECT_EQ(-1, readBatchHeader(batch, sizeof(batch), NULL));
+}
+
+static void testPublisherEvictsStalledSubscriber(void) {
+    static const int BATCHES = 200;
+    static const size_t RECORDS = 16;
+    int epollFd = epoll_create1(0);
+    int fast[2];
+    int stalled[2];
+    int sendBuffer = 4096;
+
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fast);
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, stalled);
+    setsockopt(stalled[0], SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+
+    {
+        Publisher publisher(epollFd, RECORDS, 4);
+        publisher.addSubscriber(fast[0]);
+        publisher.addSubscriber(stalled[0]);
+
+        int received = 0;
+        int outOfOrder = 0;
+        for (int i = 0; i < BATCHES; i++) {
+            for (size_t j = 0; j < RECORDS; j++) {
+                publisher.publish(makeSighting(1, i, -50, 0));
+            }
+            uint8_t batch[SIGHTING_BATCH_HEADER_SIZE + RECORDS * SIGHTING_RECORD_SIZE];
+            uint16_t sequence;
+            while (recv(fast[1], batch, sizeof(batch), MSG_DONTWAIT) > 0) {
+                if ((readBatchHeader(batch, sizeof(batch), &sequence) != static_cast<int>(RECORDS)) ||
+                    (sequence != received)) {
+                    outOfOrder++;
+                }
+                received++;
+            }
+        }
+
+        EXPECT_EQ(BATCHES, received);
+        EXPECT_EQ(0, outOfOrder);
+        EXPECT_EQ(BATCHES, publisher.stats().batches);
+        EXPECT_EQ(BATCHES * RECORDS, publisher.stats().sightings);
+        EXPECT_EQ(1, publisher.stats().evicted);
+        EXPECT_EQ(1, publisher.subscriberCount());
+        EXPECT_EQ(true, publisher.idle());
+    }
+
+    // Eviction closes the socket; the stalled subscriber reads what was
+    // sent and then the end of the stream.
+    int stalledBatches = 0;
+    uint8_t batch[SIGHTING_BATCH_HEADER_SIZE + RECORDS * SIGHTING_RECORD_SIZE];
+    while (recv(stalled[1], batch, sizeof(batch), 0) > 0) {
+        stalledBatches++;
+    }
+    EXPECT_EQ(true, (stalledBatches > 0) && (stalledBatches < BATCHES));
+
+    close(fast[1]);
+    close(stalled[1]);
+    close(epollFd);
+}
+
+// Batches stay within one SOCK_SEQPACKET message, and a subscriber whose
+// buffer cannot take one misses it but stays connected.
+static void testPublisherBoundsBatches(void) {
+    int epollFd = epoll_create1(0);
+    int small[2];
+    int sendBuffer = 4096;
+    static uint8_t batch[SIGHTING_BATCH_MAX];
+
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, small);
+    setsockopt(small[0], SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    {
+        Publisher publisher(epollFd, UINT16_MAX, 4);
+        publisher.addSubscriber(small[0]);
+        for (size_t i = 0; i < SIGHTING_BATCH_RECORDS_MAX; i++) {
+            publisher.publish(makeSighting(1, i, -50, 0));
+        }
+        EXPECT_EQ(1, publisher.stats().batches);
+        EXPECT_EQ(1, publisher.stats().oversized);
+        EXPECT_EQ(1, publisher.subscriberCount());
+
+        // Long URIs seal a batch by its size.
+        Sighting sighting = makeSighting(2, 0, -50, 0);
+        sighting.uriLength = SIGHTING_URI_MAX;
+        size_t fit = (SIGHTING_BATCH_MAX - SIGHTING_BATCH_HEADER_SIZE) / sightingRecordSize(sighting);
+        for (size_t i = 0; i <= fit; i++) {
+            publisher.publish(sighting);
+        }
+        EXPECT_EQ(2, publisher.stats().batches);
+        EXPECT_EQ(2, publisher.stats().oversized);
+
+        publisher.publish(makeSighting(3, 0, -50, 0));
+        publisher.flush();
+        EXPECT_EQ(3, publisher.stats().batches);
+        EXPECT_EQ(1, publisher.stats().sent);
+        EXPECT_EQ(1, publisher.subscriberCount());
+    }
+    // The long batch's last sighting and the short one arrive together.
+    ssize_t length = recv(small[1], batch, sizeof(batch), MSG_DONTWAIT);
+    EXPECT_EQ(2, readBatchHeader(batch, length, NULL));
+    EXPECT_EQ(0, recv(small[1], batch, sizeof(batch), MSG_DONTWAIT));
+
+    close(small[1]);
+    close(epollFd);
+}
+
+int main(int argc, char **argv) {
+    testHcidumpParser();
+    testAdvertisingReports();
+    testDecodeSighting();
+    testExtendedReports();
+    testScanResponseJoin();
+    testGatewayJoinsScanResponse();
+    testGatewayExtendedUri();
+    testGatewayDictionary();
+    testGatewayCountsMalformedLive();
+    testTracker();
+    testBatchRoundTrip();
+    testPublisherEvictsStalledSubscriber();
+    testPublisherBoundsBatches();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
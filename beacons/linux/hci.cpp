@@ -0,0 +1,346 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hci.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// From <bluetooth/bluetooth.h> and <bluetooth/hci.h>.
+#define AF_BLUETOOTH_                   (31)
+#define BTPROTO_HCI_                    (1)
+#define SOL_HCI_                        (0)
+#define HCI_FILTER_                     (2)
+#define HCI_CHANNEL_RAW_                (0)
+#define HCIDEVUP_                       _IOW('H', 201, int)
+
+struct sockaddr_hci_ {
+    sa_family_t family;
+    uint16_t device;
+    uint16_t channel;
+};
+
+struct hci_filter_ {
+    uint32_t typeMask;
+    uint32_t eventMask[2];
+    uint16_t opcode;
+};
+
+static int hexValue(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Parses the local time written by `hcidump -t`, "YYYY-MM-DD HH:MM:SS.uuuuuu".
+// Returns the number of characters consumed, or 0.
+static size_t parseTimestamp(const char *line, size_t length, uint64_t &timestampUs) {
+    static const size_t TIMESTAMP_LENGTH = 26;
+    struct tm tm;
+    unsigned micros;
+
+    if ((length < TIMESTAMP_LENGTH) || (line[4] != '-') || (line[13] != ':')) {
+        return 0;
+    }
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(line, "%4d-%2d-%2d %2d:%2d:%2d.%6u", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &micros) != 7) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    timestampUs = static_cast<uint64_t>(mktime(&tm)) * 1000000 + micros;
+    return TIMESTAMP_LENGTH;
+}
+
+HcidumpParser::HcidumpParser()
+    : havePending(false),
+      malformed(0) {
+}
+
+void HcidumpParser::feed(const char *text, size_t length,
+                         void (*onFrame)(const HciFrame &frame, void *context), void *context) {
+    const char *end = text + length;
+
+    while (text < end) {
+        const char *newline = static_cast<const char *>(memchr(text, '\n', end - text));
+        if (newline == NULL) {
+            partialLine.append(text, end - text);
+            return;
+        }
+        if (partialLine.empty()) {
+            parseLine(text, newline - text, onFrame, context);
+        } else {
+            partialLine.append(text, newline - text);
+            parseLine(partialLine.data(), partialLine.size(), onFrame, context);
+            partialLine.clear();
+        }
+        text = newline + 1;
+    }
+}
+
+void HcidumpParser::finish(void (*onFrame)(const HciFrame &frame, void *context), void *context) {
+    if (!partialLine.empty()) {
+        parseLine(partialLine.data(), partialLine.size(), onFrame, context);
+        partialLine.clear();
+    }
+    if (havePending) {
+        onFrame(pending, context);
+        havePending = false;
+    }
+}
+
+void HcidumpParser::parseLine(const char *line, size_t length,
+                              void (*onFrame)(const HciFrame &frame, void *context),
+                              void *context) {
+    const char *end = line + length;
+    uint64_t timestampUs = 0;
+
+    if ((line < end) && (line[0] >= '0') && (line[0] <= '9')) {
+        line += parseTimestamp(line, length, timestampUs);
+        while ((line < end) && (*line == ' ')) {
+            line++;
+        }
+    }
+
+    if ((line < end) && ((*line == '>') || (*line == '<'))) {
+        if (havePending) {
+            onFrame(pending, context);
+        }
+        havePending = true;
+        pending.timestampUs = timestampUs;
+        pending.incoming = (*line == '>');
+        pending.length = 0;
+        line++;
+    } else if ((line == end) || ((*line != ' ') && (*line != '\t')) || !havePending) {
+        // Banner, e.g. "HCI sniffer - Bluetooth packet analyzer ver 5.23"
+        return;
+    }
+
+    while (line < end) {
+        if ((*line == ' ') || (*line == '\t') || (*line == '\r')) {
+            line++;
+            continue;
+        }
+        int high = hexValue(line[0]);
+        int low = (line + 1 < end) ? hexValue(line[1]) : -1;
+        if ((high < 0) || (low < 0) || (pending.length == HCI_FRAME_MAX)) {
+            malformed++;
+            havePending = false;
+            return;
+        }
+        pending.bytes[pending.length++] = static_cast<uint8_t>((high << 4) | low);
+        line += 2;
+    }
+}
+
+// Extended report event type bits, and the data status in bits 5 and 6.
+#define EXT_ADV_CONNECTABLE             (0x0001)
+#define EXT_ADV_SCANNABLE               (0x0002)
+#define EXT_ADV_SCAN_RESPONSE           (0x0008)
+#define EXT_ADV_LEGACY                  (0x0010)
+#define EXT_ADV_DATA_STATUS             (0x0060)
+
+// The legacy event type of a legacy PDU reported in an extended report.
+static uint8_t legacyEventType(uint16_t eventType) {
+    if (eventType & EXT_ADV_SCAN_RESPONSE) {
+        return HCI_SCAN_RSP;
+    }
+    if (eventType & EXT_ADV_CONNECTABLE) {
+        return HCI_ADV_IND;
+    }
+    if (eventType & EXT_ADV_SCANNABLE) {
+        return HCI_ADV_SCAN_IND;
+    }
+    return HCI_ADV_NONCONN_IND;
+}
+
+static int parseLegacyReports(const uint8_t *bytes, size_t length, int count,
+                              AdvertisingReport reports[HCI_MAX_REPORTS]) {
+    // Reports are laid out one after another, as BlueZ reads them.
+    size_t offset = 5;
+    for (int i = 0; i < count; i++) {
+        AdvertisingReport &report = reports[i];
+        if (offset + 9 > length) {
+            return -1;
+        }
+        report.eventType = bytes[offset];
+        report.extended = false;
+        report.addressType = bytes[offset + 1];
+        memcpy(report.address, &bytes[offset + 2], sizeof(report.address));
+        report.dataLength = bytes[offset + 8];
+        offset += 9;
+        if (offset + report.dataLength + 1 > length) {
+            return -1;
+        }
+        report.data = &bytes[offset];
+        offset += report.dataLength;
+        report.rssi = static_cast<int8_t>(bytes[offset++]);
+    }
+    return count;
+}
+
+// Each extended report is 24 fixed bytes, the last the data length, then the
+// data: event type (2), address type, address (6), primary and secondary
+// PHY, SID, TX power, RSSI, periodic interval (2), direct address type and
+// direct address (6).
+static int parseExtendedReports(const uint8_t *bytes, size_t length, int count,
+                                AdvertisingReport reports[HCI_MAX_REPORTS]) {
+    size_t offset = 5;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (offset + 24 > length) {
+            return -1;
+        }
+        const uint8_t *fixed = &bytes[offset];
+        uint8_t dataLength = fixed[23];
+        offset += 24;
+        if (offset + dataLength > length) {
+            return -1;
+        }
+        uint16_t eventType = static_cast<uint16_t>(fixed[0] | (fixed[1] << 8));
+        if ((eventType & EXT_ADV_DATA_STATUS) != 0) {
+            offset += dataLength;
+            continue;
+        }
+        AdvertisingReport &report = reports[kept++];
+        report.eventType = legacyEventType(eventType);
+        report.extended = (eventType & EXT_ADV_LEGACY) == 0;
+        report.addressType = fixed[2];
+        memcpy(report.address, &fixed[3], sizeof(report.address));
+        report.rssi = static_cast<int8_t>(fixed[13]);
+        report.dataLength = dataLength;
+        report.data = &bytes[offset];
+        offset += dataLength;
+    }
+    return kept;
+}
+
+int parseAdvertisingReports(const HciFrame &frame, AdvertisingReport reports[HCI_MAX_REPORTS]) {
+    const uint8_t *bytes = frame.bytes;
+
+    if (!frame.incoming || (frame.length < 5) || (bytes[0] != HCI_EVENT_PKT) ||
+        (bytes[1] != HCI_EV_LE_META) ||
+        ((bytes[3] != HCI_EV_LE_ADVERTISING_REPORT) &&
+         (bytes[3] != HCI_EV_LE_EXT_ADVERTISING_REPORT))) {
+        return 0;
+    }
+    if (bytes[2] + 3 != frame.length) {
+        return -1;
+    }
+
+    int count = bytes[4];
+    if ((count == 0) || (count > HCI_MAX_REPORTS)) {
+        return -1;
+    }
+    if (bytes[3] == HCI_EV_LE_EXT_ADVERTISING_REPORT) {
+        return parseExtendedReports(bytes, frame.length, count, reports);
+    }
+    return parseLegacyReports(bytes, frame.length, count, reports);
+}
+
+void buildAdvertisingReport(const AdvertisingReport &report, uint64_t timestampUs, HciFrame &frame) {
+    uint8_t *bytes = frame.bytes;
+
+    frame.timestampUs = timestampUs;
+    frame.incoming = true;
+    frame.length = static_cast<uint16_t>(15 + report.dataLength);
+    bytes[0] = HCI_EVENT_PKT;
+    bytes[1] = HCI_EV_LE_META;
+    bytes[2] = static_cast<uint8_t>(frame.length - 3);
+    bytes[3] = HCI_EV_LE_ADVERTISING_REPORT;
+    bytes[4] = 1;
+    bytes[5] = report.eventType;
+    bytes[6] = report.addressType;
+    memcpy(&bytes[7], report.address, sizeof(report.address));
+    bytes[13] = report.dataLength;
+    memcpy(&bytes[14], report.data, report.dataLength);
+    bytes[14 + report.dataLength] = static_cast<uint8_t>(report.rssi);
+}
+
+// Opens a raw socket on hciN passing the events in eventMask.
+static int openRawSocket(int device, const uint32_t eventMask[2]) {
+    int fd = socket(AF_BLUETOOTH_, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI_);
+    if (fd < 0) {
+        return -1;
+    }
+
+    hci_filter_ filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.typeMask = 1u << HCI_EVENT_PKT;
+    filter.eventMask[0] = eventMask[0];
+    filter.eventMask[1] = eventMask[1];
+
+    sockaddr_hci_ address;
+    memset(&address, 0, sizeof(address));
+    address.family = AF_BLUETOOTH_;
+    address.device = static_cast<uint16_t>(device);
+    address.channel = HCI_CHANNEL_RAW_;
+
+    if ((setsockopt(fd, SOL_HCI_, HCI_FILTER_, &filter, sizeof(filter)) < 0) ||
+        (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int openHciSocket(int device) {
+    uint32_t eventMask[2] = { 0, 0 };
+    eventMask[HCI_EV_LE_META >> 5] |= 1u << (HCI_EV_LE_META & 31);
+    return openRawSocket(device, eventMask);
+}
+
+int openHciCommandSocket(int device) {
+    uint32_t eventMask[2] = { 0, 0 };
+    eventMask[HCI_EV_CMD_COMPLETE >> 5] |= 1u << (HCI_EV_CMD_COMPLETE & 31);
+    eventMask[HCI_EV_CMD_STATUS >> 5] |= 1u << (HCI_EV_CMD_STATUS & 31);
+    int fd = openRawSocket(device, eventMask);
+    if ((fd >= 0) && (ioctl(fd, HCIDEVUP_, device) < 0) && (errno != EALREADY)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+uint64_t wallClockUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t wallClockNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
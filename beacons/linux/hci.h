@@ -0,0 +1,130 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// HCI ingest: the `hcidump --raw` text format read by uribeacon_scan, LE
+// Advertising Report events and a raw HCI socket for live capture. Nothing
+// here needs the BlueZ headers.
+
+#ifndef URIBEACON_HCI_H__
+#define URIBEACON_HCI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// HCI packet indicators.
+#define HCI_COMMAND_PKT                 (0x01)
+#define HCI_EVENT_PKT                   (0x04)
+
+// Command Complete and Command Status events, which answer commands.
+#define HCI_EV_CMD_COMPLETE             (0x0E)
+#define HCI_EV_CMD_STATUS               (0x0F)
+
+// LE Meta event and the Advertising Report subevents.
+#define HCI_EV_LE_META                  (0x3E)
+#define HCI_EV_LE_ADVERTISING_REPORT    (0x02)
+#define HCI_EV_LE_EXT_ADVERTISING_REPORT (0x0D)
+
+// Advertising report event types.
+#define HCI_ADV_IND                     (0x00)
+#define HCI_ADV_SCAN_IND                (0x02)
+#define HCI_ADV_NONCONN_IND             (0x03)
+#define HCI_SCAN_RSP                    (0x04)
+
+// An event is at most the indicator, a two byte header and 255 bytes.
+#define HCI_FRAME_MAX                   (258)
+
+// The controller reports at most this many advertisements per event.
+#define HCI_MAX_REPORTS                 (25)
+
+// A captured HCI packet, starting with its packet indicator.
+struct HciFrame {
+    uint64_t timestampUs;       // capture time, 0 if the capture has none
+    bool incoming;              // controller to host
+    uint16_t length;
+    uint8_t bytes[HCI_FRAME_MAX];
+};
+
+// One report of an LE Advertising Report event. data points into the frame.
+// Extended reports have their event type mapped to the legacy one above.
+struct AdvertisingReport {
+    uint8_t eventType;
+    bool extended;              // from an LE Extended Advertising Report
+    uint8_t addressType;
+    uint8_t address[6];         // little endian, as on air
+    uint8_t dataLength;
+    const uint8_t *data;
+    int8_t rssi;
+};
+
+// Incremental parser for `hcidump --raw` output, with or without the -t
+// timestamps. A frame starts on a line beginning with '>' or '<' and
+// continues on the indented lines after it.
+class HcidumpParser {
+public:
+    HcidumpParser();
+
+    // Consumes length bytes of text. Each frame completed by the input is
+    // passed to onFrame(frame, context).
+    void feed(const char *text, size_t length,
+              void (*onFrame)(const HciFrame &frame, void *context), void *context);
+
+    // Flushes the last frame at the end of the input.
+    void finish(void (*onFrame)(const HciFrame &frame, void *context), void *context);
+
+    // Lines that could not be parsed, e.g. an oversized frame.
+    unsigned malformedLines(void) const {
+        return malformed;
+    }
+
+private:
+    void parseLine(const char *line, size_t length,
+                   void (*onFrame)(const HciFrame &frame, void *context), void *context);
+
+    std::string partialLine;
+    HciFrame pending;
+    bool havePending;
+    unsigned malformed;
+};
+
+// Splits an LE Advertising Report or LE Extended Advertising Report event into
+// its reports. Returns the number of reports, 0 for any other packet, or -1 if
+// the event is malformed. Extended reports whose data is truncated or
+// continues in a later event are dropped, as they carry no whole payload.
+int parseAdvertisingReports(const HciFrame &frame, AdvertisingReport reports[HCI_MAX_REPORTS]);
+
+// Builds an LE Advertising Report event carrying one report, as the
+// controller would send it, for tests and synthetic captures. The report's
+// data must fit the event.
+void buildAdvertisingReport(const AdvertisingReport &report, uint64_t timestampUs, HciFrame &frame);
+
+// Opens a raw HCI socket on hciN that receives LE Meta events. Scanning is
+// left to `hcitool lescan --duplicates`, as in uribeacon_scan. Returns the
+// socket or -1 with errno set.
+int openHciSocket(int device);
+
+// Opens a raw HCI socket on hciN for sending commands, which receives their
+// Command Complete and Command Status events. The device is brought up if it
+// is down, as `hciconfig hciN up` would. Returns the socket or -1 with errno
+// set.
+int openHciCommandSocket(int device);
+
+// Current wall clock time in microseconds.
+uint64_t wallClockUs(void);
+
+// And in nanoseconds, the resolution of kernel receive timestamps.
+uint64_t wallClockNs(void);
+
+#endif // URIBEACON_HCI_H__
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hci_transport.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t monotonicMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+FdHciTransport::FdHciTransport(int fd, unsigned timeoutMs)
+    : fd(fd),
+      timeoutMs(timeoutMs),
+      buffered(0) {
+}
+
+int FdHciTransport::command(uint16_t opcode, const uint8_t *params, uint8_t length) {
+    uint8_t packet[4 + 255];
+    packet[0] = HCI_COMMAND_PKT;
+    packet[1] = opcode & 0xFF;
+    packet[2] = opcode >> 8;
+    packet[3] = length;
+    memcpy(&packet[4], params, length);
+    if (!writeAll(packet, 4 + length)) {
+        return -1;
+    }
+
+    uint64_t deadlineMs = monotonicMs() + timeoutMs;
+    for (;;) {
+        // Take whole events off the front of the buffer.
+        while ((buffered >= 3) && (buffer[0] == HCI_EVENT_PKT) && (buffered >= 3u + buffer[2])) {
+            size_t size = 3 + buffer[2];
+            const uint8_t *event = &buffer[3];
+            int status = -1;
+            if ((buffer[1] == HCI_EV_CMD_COMPLETE) && (buffer[2] >= 4) &&
+                (event[1] == (opcode & 0xFF)) && (event[2] == (opcode >> 8))) {
+                status = event[3];
+            } else if ((buffer[1] == HCI_EV_CMD_STATUS) && (buffer[2] >= 4) &&
+                       (event[2] == (opcode & 0xFF)) && (event[3] == (opcode >> 8))) {
+                status = event[0];
+            }
+            buffered -= size;
+            memmove(buffer, &buffer[size], buffered);
+            if (status >= 0) {
+                return status;
+            }
+        }
+        if ((buffered > 0) && (buffer[0] != HCI_EVENT_PKT)) {
+            buffered = 0;
+            errno = EPROTO;
+            return -1;
+        }
+        if (!fill(deadlineMs)) {
+            return -1;
+        }
+    }
+}
+
+bool FdHciTransport::writeAll(const uint8_t *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                pollfd writable = { fd, POLLOUT, 0 };
+                int ready = poll(&writable, 1, static_cast<int>(timeoutMs));
+                if ((ready > 0) || ((ready < 0) && (errno == EINTR))) {
+                    continue;
+                }
+                if (ready == 0) {
+                    errno = ETIMEDOUT;
+                }
+            }
+            return false;
+        }
+        bytes += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool FdHciTransport::fill(uint64_t deadlineMs) {
+    for (;;) {
+        // Polled first so a blocking descriptor still times out.
+        uint64_t now = monotonicMs();
+        if (now >= deadlineMs) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+        pollfd readable = { fd, POLLIN, 0 };
+        int ready = poll(&readable, 1, static_cast<int>(deadlineMs - now));
+        if (ready <= 0) {
+            if ((ready < 0) && (errno != EINTR)) {
+                return false;
+            }
+            continue;
+        }
+
+        ssize_t count = read(fd, &buffer[buffered], sizeof(buffer) - buffered);
+        if (count > 0) {
+            buffered += static_cast<size_t>(count);
+            return true;
+        }
+        if (count == 0) {
+            errno = EPIPE;
+            return false;
+        }
+        if ((errno != EINTR) && (errno != EAGAIN)) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// HCI command transport. The advertiser sends its commands through
+// HciTransport, so the same code drives a raw HCI socket, a UART carrying
+// H4 packets, or a mock controller on a pty or socketpair in the tests.
+
+#ifndef URIBEACON_HCI_TRANSPORT_H__
+#define URIBEACON_HCI_TRANSPORT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hci.h"
+
+// Opcode group of the LE controller commands.
+#define HCI_OGF_LE_CTL                  (0x08)
+#define HCI_OPCODE(ogf, ocf)            (static_cast<uint16_t>(((ogf) << 10) | (ocf)))
+
+// How long a controller has to answer a command.
+#define HCI_COMMAND_TIMEOUT_MS          (1000)
+
+class HciTransport {
+public:
+    virtual ~HciTransport() {}
+
+    // Sends a command and waits for its Command Complete or Command Status
+    // event. Returns the status the controller answered with, 0 for success,
+    // or -1 with errno set if it could not be sent or was not answered.
+    virtual int command(uint16_t opcode, const uint8_t *params, uint8_t length) = 0;
+};
+
+// Speaks H4 over a file descriptor: a packet indicator before each packet,
+// with events read as a byte stream, so a socket that keeps packet
+// boundaries and a tty that does not are both handled. Events answering
+// other commands, and any other events, are skipped. The descriptor is not
+// owned.
+class FdHciTransport : public HciTransport {
+public:
+    explicit FdHciTransport(int fd, unsigned timeoutMs = HCI_COMMAND_TIMEOUT_MS);
+
+    // Fails with ETIMEDOUT if no answer arrives in time, EPROTO if the stream
+    // holds something other than events, and EPIPE if the other end closed.
+    int command(uint16_t opcode, const uint8_t *params, uint8_t length) override;
+
+private:
+    bool writeAll(const uint8_t *bytes, size_t length);
+    // Reads more of the stream until deadlineMs. Returns false with errno set.
+    bool fill(uint64_t deadlineMs);
+
+    int fd;
+    unsigned timeoutMs;
+    uint8_t buffer[2 * HCI_FRAME_MAX];
+    size_t buffered;
+};
+
+#endif // URIBEACON_HCI_TRANSPORT_H__
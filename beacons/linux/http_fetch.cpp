@@ -0,0 +1,338 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "http_fetch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+struct ParsedUrl {
+    bool secure;
+    std::string host;
+    std::string port;
+    std::string path;
+};
+
+static bool parseUrl(const std::string &url, ParsedUrl &parsed) {
+    size_t start;
+    if (strncasecmp(url.c_str(), "http://", 7) == 0) {
+        parsed.secure = false;
+        start = 7;
+    } else if (strncasecmp(url.c_str(), "https://", 8) == 0) {
+        parsed.secure = true;
+        start = 8;
+    } else {
+        return false;
+    }
+    size_t end = url.find_first_of("/?#", start);
+    std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    size_t colon = authority.rfind(':');
+    if ((colon != std::string::npos) && (authority.find(']', colon) == std::string::npos)) {
+        parsed.host = authority.substr(0, colon);
+        parsed.port = authority.substr(colon + 1);
+    } else {
+        parsed.host = authority;
+        parsed.port = parsed.secure ? "443" : "80";
+    }
+    if ((parsed.host.size() > 2) && (parsed.host[0] == '[')) {
+        parsed.host = parsed.host.substr(1, parsed.host.size() - 2);
+    }
+    parsed.path = (end == std::string::npos) ? "/" : url.substr(end);
+    size_t fragment = parsed.path.find('#');
+    if (fragment != std::string::npos) {
+        parsed.path.erase(fragment);
+    }
+    if (parsed.path.empty() || (parsed.path[0] != '/')) {
+        parsed.path.insert(0, "/");
+    }
+    return !parsed.host.empty();
+}
+
+// Resolves a redirect or link target against the URL it appeared in.
+static std::string resolveUrl(const std::string &base, const std::string &reference) {
+    if (reference.find("://") != std::string::npos) {
+        return reference;
+    }
+    size_t schemeEnd = base.find("://");
+    if (schemeEnd == std::string::npos) {
+        return reference;
+    }
+    if (reference.compare(0, 2, "//") == 0) {
+        return base.substr(0, schemeEnd + 1) + reference;
+    }
+    size_t pathStart = base.find('/', schemeEnd + 3);
+    std::string origin = base.substr(0, pathStart);
+    if (!reference.empty() && (reference[0] == '/')) {
+        return origin + reference;
+    }
+    std::string directory = "/";
+    if (pathStart != std::string::npos) {
+        std::string path = base.substr(pathStart, base.find_first_of("?#", pathStart) - pathStart);
+        directory = path.substr(0, path.rfind('/') + 1);
+    }
+    return origin + directory + reference;
+}
+
+static int connectTo(const std::string &host, const std::string &port, unsigned timeoutMs) {
+    addrinfo hints;
+    addrinfo *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return FETCH_ERR_RESOLVE;
+    }
+
+    int fd = FETCH_ERR_CONNECT;
+    for (addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+        int candidate = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                               address->ai_protocol);
+        if (candidate < 0) {
+            continue;
+        }
+        if ((connect(candidate, address->ai_addr, address->ai_addrlen) < 0) && (errno == EINPROGRESS)) {
+            pollfd waiting = { candidate, POLLOUT, 0 };
+            int error = ETIMEDOUT;
+            socklen_t length = sizeof(error);
+            if (poll(&waiting, 1, timeoutMs) == 1) {
+                getsockopt(candidate, SOL_SOCKET, SO_ERROR, &error, &length);
+            }
+            if (error != 0) {
+                close(candidate);
+                continue;
+            }
+        }
+        fcntl(candidate, F_SETFL, fcntl(candidate, F_GETFL) & ~O_NONBLOCK);
+        timeval timeout = { static_cast<time_t>(timeoutMs / 1000),
+                            static_cast<suseconds_t>((timeoutMs % 1000) * 1000) };
+        setsockopt(candidate, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(candidate, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        fd = candidate;
+        break;
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// One request. Returns the status, with the Location header and up to
+// maxBodyBytes of body.
+static int get(const std::string &url, const FetchOptions &options,
+               std::string &location, std::string &body) {
+    ParsedUrl parsed;
+    if (!parseUrl(url, parsed)) {
+        return FETCH_ERR_URL;
+    }
+    bool proxied = !options.proxyHost.empty();
+    if (parsed.secure && !proxied) {
+        return FETCH_ERR_UNSUPPORTED;
+    }
+
+    int fd = proxied ? connectTo(options.proxyHost, options.proxyPort, options.timeoutMs)
+                     : connectTo(parsed.host, parsed.port, options.timeoutMs);
+    if (fd < 0) {
+        return fd;
+    }
+
+    std::string request = "GET " + (proxied ? url : parsed.path) + " HTTP/1.0\r\n"
+                          "Host: " + parsed.host + "\r\n"
+                          "User-Agent: uribeacon-resolver\r\n"
+                          "Accept: text/html\r\n"
+                          "Connection: close\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        close(fd);
+        return FETCH_ERR_IO;
+    }
+
+    std::string response;
+    size_t headerEnd = std::string::npos;
+    char buffer[8192];
+    for (;;) {
+        ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+        if (length < 0) {
+            close(fd);
+            return FETCH_ERR_IO;
+        }
+        if (length == 0) {
+            break;
+        }
+        response.append(buffer, length);
+        if (headerEnd == std::string::npos) {
+            headerEnd = response.find("\r\n\r\n");
+        }
+        if ((headerEnd != std::string::npos) && (response.size() - headerEnd - 4 >= options.maxBodyBytes)) {
+            break;
+        }
+    }
+    close(fd);
+
+    int status;
+    if ((headerEnd == std::string::npos) || (sscanf(response.c_str(), "HTTP/%*d.%*d %d", &status) != 1)) {
+        return FETCH_ERR_PROTOCOL;
+    }
+    size_t line = response.find("\r\n");
+    while ((line != std::string::npos) && (line < headerEnd)) {
+        size_t next = response.find("\r\n", line + 2);
+        if (strncasecmp(&response[line + 2], "Location:", 9) == 0) {
+            location = response.substr(line + 11, next - line - 11);
+            size_t first = location.find_first_not_of(" \t");
+            location = (first == std::string::npos) ? "" : location.substr(first);
+        }
+        line = next;
+    }
+    body = response.substr(headerEnd + 4, options.maxBodyBytes);
+    return status;
+}
+
+PageMetadata fetchMetadata(const std::string &url, const FetchOptions &options) {
+    PageMetadata metadata;
+    std::string current = url;
+
+    for (unsigned redirects = 0;; redirects++) {
+        std::string location;
+        std::string body;
+        metadata.status = get(current, options, location, body);
+        bool redirect = (metadata.status == 301) || (metadata.status == 302) ||
+                        (metadata.status == 303) || (metadata.status == 307) ||
+                        (metadata.status == 308);
+        if (!redirect) {
+            if (metadata.status == 200) {
+                parseMetadata(body, current, metadata);
+            }
+            return metadata;
+        }
+        if (location.empty()) {
+            metadata.status = FETCH_ERR_PROTOCOL;
+            return metadata;
+        }
+        if (redirects == options.maxRedirects) {
+            metadata.status = FETCH_ERR_REDIRECTS;
+            return metadata;
+        }
+        current = resolveUrl(current, location);
+    }
+}
+
+static std::string lowerCase(const std::string &text) {
+    std::string lower(text);
+    for (size_t i = 0; i < lower.size(); i++) {
+        if ((lower[i] >= 'A') && (lower[i] <= 'Z')) {
+            lower[i] = lower[i] - 'A' + 'a';
+        }
+    }
+    return lower;
+}
+
+// Collapses whitespace and decodes the common character references.
+static std::string cleanText(const std::string &text) {
+    static const struct {
+        const char *name;
+        char value;
+    } entities[] = {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&#39;", '\'' },
+    };
+    std::string clean;
+    bool space = false;
+
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
+            space = !clean.empty();
+            continue;
+        }
+        if (space) {
+            clean += ' ';
+            space = false;
+        }
+        bool decoded = false;
+        if (c == '&') {
+            for (size_t j = 0; j < sizeof(entities) / sizeof(entities[0]); j++) {
+                size_t length = strlen(entities[j].name);
+                if (text.compare(i, length, entities[j].name) == 0) {
+                    clean += entities[j].value;
+                    i += length - 1;
+                    decoded = true;
+                    break;
+                }
+            }
+        }
+        if (!decoded) {
+            clean += c;
+        }
+    }
+    return clean;
+}
+
+// Value of attribute name in a lower cased tag, from the original tag.
+static std::string attribute(const std::string &tag, const std::string &lowerTag, const char *name) {
+    std::string key = std::string(" ") + name + "=";
+    size_t position = lowerTag.find(key);
+    if (position == std::string::npos) {
+        return "";
+    }
+    position += key.size();
+    if (position >= tag.size()) {
+        return "";
+    }
+    char quote = tag[position];
+    if ((quote == '"') || (quote == '\'')) {
+        size_t end = tag.find(quote, position + 1);
+        return tag.substr(position + 1, end == std::string::npos ? std::string::npos : end - position - 1);
+    }
+    size_t end = tag.find_first_of(" \t\r\n>", position);
+    return tag.substr(position, end == std::string::npos ? std::string::npos : end - position);
+}
+
+void parseMetadata(const std::string &html, const std::string &base, PageMetadata &metadata) {
+    std::string lower = lowerCase(html);
+
+    size_t title = lower.find("<title");
+    if (title != std::string::npos) {
+        size_t start = lower.find('>', title);
+        size_t end = (start == std::string::npos) ? start : lower.find("</title", start);
+        if (end != std::string::npos) {
+            metadata.title = cleanText(html.substr(start + 1, end - start - 1));
+        }
+    }
+
+    for (size_t link = lower.find("<link"); link != std::string::npos; link = lower.find("<link", link + 5)) {
+        size_t end = lower.find('>', link);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string tag = html.substr(link, end - link);
+        std::string lowerTag = lower.substr(link, end - link);
+        for (size_t i = 0; i < tag.size(); i++) {
+            // Attributes may be separated by any whitespace.
+            if ((tag[i] == '\t') || (tag[i] == '\r') || (tag[i] == '\n')) {
+                tag[i] = lowerTag[i] = ' ';
+            }
+        }
+        std::string rel = lowerCase(attribute(tag, lowerTag, "rel"));
+        std::string href = attribute(tag, lowerTag, "href");
+        if ((rel.find("icon") != std::string::npos) && !href.empty()) {
+            metadata.icon = resolveUrl(base, cleanText(href));
+            break;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Blocking fetch of a page's title and icon over plain HTTP/1.0.
+//
+// There is no TLS here. https:// URLs are fetched through an HTTP proxy that
+// accepts absolute URIs, such as a caching proxy or a metadata service in
+// front of the resolver; without one they fail with FETCH_ERR_UNSUPPORTED.
+
+#ifndef URIBEACON_HTTP_FETCH_H__
+#define URIBEACON_HTTP_FETCH_H__
+
+#include <string>
+
+// Errors reported in place of an HTTP status.
+#define FETCH_ERR_URL                   (-1)    // not an http(s) URL
+#define FETCH_ERR_UNSUPPORTED           (-2)    // https without a proxy
+#define FETCH_ERR_RESOLVE               (-3)
+#define FETCH_ERR_CONNECT               (-4)
+#define FETCH_ERR_IO                    (-5)    // timeout or reset
+#define FETCH_ERR_PROTOCOL              (-6)    // malformed response
+#define FETCH_ERR_REDIRECTS             (-7)
+
+struct FetchOptions {
+    std::string proxyHost;      // empty for direct connections
+    std::string proxyPort;
+    unsigned timeoutMs;
+    unsigned maxRedirects;
+    size_t maxBodyBytes;        // the head of the page holds the metadata
+
+    FetchOptions()
+        : timeoutMs(5000),
+          maxRedirects(3),
+          maxBodyBytes(65536) {
+    }
+};
+
+struct PageMetadata {
+    int status;                 // final HTTP status, or FETCH_ERR_*
+    std::string title;
+    std::string icon;           // absolute URL
+
+    PageMetadata()
+        : status(0) {
+    }
+};
+
+// Fetches url, following redirects, and extracts the metadata of a 200
+// response.
+PageMetadata fetchMetadata(const std::string &url, const FetchOptions &options);
+
+// Extracts <title> and the first <link rel="...icon..."> of an HTML page.
+// Relative icon URLs are resolved against base.
+void parseMetadata(const std::string &html, const std::string &base, PageMetadata &metadata);
+
+#endif // URIBEACON_HTTP_FETCH_H__
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "joiner.h"
+
+#include <string.h>
+
+ScanResponseJoiner::ScanResponseJoiner(uint32_t timeoutMs, size_t maxPending)
+    : timeoutUs(static_cast<uint64_t>(timeoutMs) * 1000),
+      maxPending(maxPending) {
+    memset(&counters, 0, sizeof(counters));
+}
+
+// The same key as the tracker's, from an address most significant byte first.
+uint64_t ScanResponseJoiner::key(uint8_t addressType, const uint8_t *address) {
+    uint64_t value = addressType;
+    for (int i = 0; i < 6; i++) {
+        value = (value << 8) | address[i];
+    }
+    return value;
+}
+
+bool ScanResponseJoiner::add(const AdvertisingReport &report, uint64_t timestampUs,
+                             Sighting &out) {
+    if (report.eventType == HCI_SCAN_RSP) {
+        uint8_t offset;
+        uint8_t length = uribeacon_continuation_find(report.data, report.dataLength, &offset);
+        if (length == 0) {
+            return false;
+        }
+        uint8_t address[6];
+        for (int i = 0; i < 6; i++) {
+            address[i] = report.address[5 - i];
+        }
+        auto found = held.find(key(report.addressType, address));
+        if (found == held.end()) {
+            counters.unmatched++;
+            return false;
+        }
+        out = found->second;
+        memcpy(&out.uri[out.uriLength], &report.data[offset], length);
+        out.uriLength += length;
+        held.erase(found);
+        counters.joined++;
+        return true;
+    }
+
+    if (!decodeSighting(report, timestampUs, out)) {
+        return false;
+    }
+    // An extended advertisement has room for the whole URI, so it is never
+    // held for a continuation.
+    if (((out.flags & URIBEACON_FLAG_URI_CONTINUED) == 0) || report.extended) {
+        return true;
+    }
+    uint64_t beaconKey = key(out.addressType, out.address);
+    auto found = held.find(beaconKey);
+    if (found != held.end()) {
+        // A repeat before the scan response: keep the latest, on the
+        // first one's clock.
+        uint64_t heldUs = found->second.timestampUs;
+        found->second = out;
+        found->second.timestampUs = heldUs;
+        return false;
+    }
+    if (held.size() >= maxPending) {
+        counters.rejected++;
+        return true;
+    }
+    held[beaconKey] = out;
+    Held entry = { beaconKey, timestampUs };
+    order.push_back(entry);
+    return false;
+}
+
+bool ScanResponseJoiner::expire(uint64_t nowUs, Sighting &out) {
+    while (!order.empty()) {
+        const Held &oldest = order.front();
+        auto found = held.find(oldest.key);
+        if ((found == held.end()) || (found->second.timestampUs != oldest.heldUs)) {
+            // Joined since, and perhaps held again.
+            order.pop_front();
+            continue;
+        }
+        // Replayed captures can step back in time; treat that as elapsed.
+        if ((nowUs >= oldest.heldUs) && (nowUs - oldest.heldUs < timeoutUs)) {
+            return false;
+        }
+        out = found->second;
+        held.erase(found);
+        order.pop_front();
+        counters.incomplete++;
+        return true;
+    }
+    return false;
+}
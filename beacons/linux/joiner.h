@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Joins URIs continued in the scan response.
+//
+// A beacon whose URI does not fit its advertisement sets
+// URIBEACON_FLAG_URI_CONTINUED and carries the rest in its scan response,
+// which an active scan reports right after the advertisement. The joiner
+// holds each flagged advertisement until the scan response from the same
+// address arrives, and passes on the sighting with the whole URI. Without
+// one within the timeout, as under a passive scan, the advertisement is
+// passed on with the URI it carries. Everything else passes straight
+// through.
+
+#ifndef URIBEACON_JOINER_H__
+#define URIBEACON_JOINER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <unordered_map>
+#include "hci.h"
+#include "sighting.h"
+
+class ScanResponseJoiner {
+public:
+    struct Stats {
+        uint64_t joined;        // advertisements completed by a scan response
+        uint64_t incomplete;    // held past the timeout and passed on as is
+        uint64_t rejected;      // passed on at once because the table was full
+        uint64_t unmatched;     // continuations with no advertisement held
+    };
+
+    // Advertisements are held for at most timeoutMs, and from at most
+    // maxPending beacons at once.
+    ScanResponseJoiner(uint32_t timeoutMs, size_t maxPending);
+
+    // Consumes one report. Returns true with the sighting in out when it
+    // completes one.
+    bool add(const AdvertisingReport &report, uint64_t timestampUs, Sighting &out);
+
+    // Releases the oldest advertisement held since before nowUs - timeout.
+    // Returns false when there is none; call until it does.
+    bool expire(uint64_t nowUs, Sighting &out);
+
+    size_t pending(void) const {
+        return held.size();
+    }
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+private:
+    struct Held {
+        uint64_t key;
+        uint64_t heldUs;
+    };
+
+    static uint64_t key(uint8_t addressType, const uint8_t *address);
+
+    uint64_t timeoutUs;
+    size_t maxPending;
+    std::unordered_map<uint64_t, Sighting> held;
+    std::deque<Held> order;     // oldest first; entries since joined are skipped
+    Stats counters;
+};
+
+#endif // URIBEACON_JOINER_H__
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency.h"
+
+#include <algorithm>
+
+// Values below 2 * SUB_BUCKETS are exact. Above that, the power of two of a
+// value picks a run of SUB_BUCKETS buckets and its next bits the bucket.
+#define SUB_BUCKETS                     (1u << LATENCY_SUB_BUCKET_BITS)
+#define BUCKET_COUNT                    (SUB_BUCKETS * (40 - LATENCY_SUB_BUCKET_BITS + 1))
+
+static const char *STAGE_NAMES[LATENCY_STAGES] = {
+    "queue", "decode", "dedup", "batch", "deliver", "end to end",
+};
+
+LatencyHistogram::LatencyHistogram()
+    : counts(BUCKET_COUNT, 0),
+      total(0),
+      largest(0) {
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < 2 * SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    int shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BUCKET_BITS;
+    return static_cast<size_t>(shift) * SUB_BUCKETS + static_cast<size_t>(value >> shift);
+}
+
+uint64_t LatencyHistogram::highestEquivalent(size_t index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+    uint64_t sub = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t valueNs, uint64_t count) {
+    valueNs = std::min<uint64_t>(valueNs, LATENCY_MAX_NS);
+    counts[bucketIndex(valueNs)] += count;
+    total += count;
+    largest = std::max(largest, valueNs);
+}
+
+void LatencyHistogram::reset(void) {
+    std::fill(counts.begin(), counts.end(), 0);
+    total = 0;
+    largest = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+    if (total == 0) {
+        return 0;
+    }
+    // The rank of the sample at percentile, counting from 1.
+    uint64_t rank = static_cast<uint64_t>(percentile / 100 * total + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(highestEquivalent(i), largest);
+        }
+    }
+    return largest;
+}
+
+void PipelineLatency::dump(FILE *out) const {
+    fprintf(out, "%-10s %10s %10s %10s %10s %10s  (us)\n",
+            "stage", "count", "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        const LatencyHistogram &histogram = stages[i];
+        fprintf(out, "%-10s %10llu %10.1f %10.1f %10.1f %10.1f\n", STAGE_NAMES[i],
+                (unsigned long long)histogram.count(), histogram.percentile(50) / 1e3,
+                histogram.percentile(99) / 1e3, histogram.percentile(99.9) / 1e3,
+                histogram.max() / 1e3);
+    }
+}
+
+void PipelineLatency::reset(void) {
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        stages[i].reset();
+    }
+}
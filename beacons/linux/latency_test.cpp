@@ -0,0 +1,174 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the latency histograms, whose percentiles must be within their
+// precision of the exact ones, and for the stages the gateway times.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "gateway.h"
+#include "latency.h"
+#include "test_util.h"
+
+static void testBuckets(void) {
+    // Small values are exact.
+    for (uint64_t value = 0; value < 128; value++) {
+        EXPECT_EQ(value, LatencyHistogram::highestEquivalent(LatencyHistogram::bucketIndex(value)));
+    }
+    // Every value falls in a bucket whose range holds it, within 1/64.
+    size_t previous = 0;
+    for (uint64_t value = 128; value < (1ull << 40); value += value / 97 + 1) {
+        size_t index = LatencyHistogram::bucketIndex(value);
+        uint64_t highest = LatencyHistogram::highestEquivalent(index);
+        if ((index < previous) || (highest < value) || (highest - value > value / 64)) {
+            fprintf(stderr, "value %llu: bucket %zu up to %llu\n", (unsigned long long)value, index,
+                    (unsigned long long)highest);
+            failures++;
+            break;
+        }
+        previous = index;
+    }
+    EXPECT_EQ(LatencyHistogram::bucketIndex(LATENCY_MAX_NS),
+              LatencyHistogram::bucketIndex(LatencyHistogram::highestEquivalent(
+                  LatencyHistogram::bucketIndex(LATENCY_MAX_NS))));
+}
+
+static void testPercentiles(void) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(0, histogram.percentile(50));
+
+    // Log-normal-ish latencies from 1 us to about 100 ms.
+    std::vector<uint64_t> values;
+    uint32_t seed = 7;
+    for (int i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t value = 1000ull << ((seed >> 8) % 17);
+        value += (seed >> 4) % value;
+        values.push_back(value);
+        histogram.record(value);
+    }
+    std::sort(values.begin(), values.end());
+    EXPECT_EQ(values.size(), histogram.count());
+    EXPECT_EQ(values.back(), histogram.max());
+
+    static const double PERCENTILES[] = { 1, 50, 90, 99, 99.9, 99.99, 100 };
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++) {
+        size_t rank = static_cast<size_t>(PERCENTILES[i] / 100 * values.size() + 0.5);
+        uint64_t exact = values[std::max<size_t>(rank, 1) - 1];
+        uint64_t reported = histogram.percentile(PERCENTILES[i]);
+        if ((reported < exact) || (reported - exact > exact / 64)) {
+            fprintf(stderr, "p%g: exact %llu, reported %llu\n", PERCENTILES[i],
+                    (unsigned long long)exact, (unsigned long long)reported);
+            failures++;
+        }
+    }
+
+    histogram.record(1ull << 50);
+    EXPECT_EQ(LATENCY_MAX_NS, histogram.max());
+    histogram.reset();
+    EXPECT_EQ(0, histogram.count());
+    histogram.record(5000, 10);
+    EXPECT_EQ(10, histogram.count());
+    EXPECT_EQ(5000, histogram.percentile(99.9));
+}
+
+// Every advertisement is timed through decode and dedup.
+static void testGatewayStages(void) {
+    static const uint8_t URIBEACON_EVENT[] = {
+        0x04, 0x3E, 0x24, 0x02, 0x01,
+        0x03, 0x00, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x18,
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0xD8, 0xFE,
+        0x10, 0x16, 0xD8, 0xFE, 0x00, 0xF0,
+        0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08,
+        0xC4
+    };
+    GatewayOptions options;
+    EXPECT_EQ(true, Gateway(options).latency() == NULL);
+    options.latencyReportMs = 1000;
+    Gateway gateway(options);
+
+    HciFrame frame;
+    frame.timestampUs = 0;
+    frame.incoming = true;
+    frame.length = sizeof(URIBEACON_EVENT);
+    memcpy(frame.bytes, URIBEACON_EVENT, sizeof(URIBEACON_EVENT));
+    gateway.ingest(frame);
+    gateway.ingest(frame);
+    frame.length = 3;
+    gateway.ingest(frame);
+
+    const PipelineLatency &latency = *gateway.latency();
+    EXPECT_EQ(3, latency.stage(LATENCY_QUEUE).count());
+    EXPECT_EQ(2, latency.stage(LATENCY_DECODE).count());
+    EXPECT_EQ(2, latency.stage(LATENCY_DEDUP).count());
+    // The first sighting waits in the open batch.
+    EXPECT_EQ(0, latency.stage(LATENCY_BATCH).count());
+}
+
+// A published sighting is timed once through batch, and once per
+// subscriber through deliver and end to end.
+static void testPublisherStages(void) {
+    PipelineLatency latency;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    Publisher publisher(epollFd, 16, 4);
+    int subscribers[2][2];
+    for (int i = 0; i < 2; i++) {
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, subscribers[i]);
+        publisher.addSubscriber(subscribers[i][0]);
+    }
+
+    Sighting sighting;
+    memset(&sighting, 0, sizeof(sighting));
+    publisher.publish(sighting);
+    publisher.traceLatency(&latency);
+    publisher.publish(sighting);
+    publisher.flush();
+    // The batch held an untraced sighting.
+    EXPECT_EQ(0, latency.stage(LATENCY_BATCH).count());
+
+    uint64_t receivedNs = wallClockNs() - 2000000;
+    publisher.publish(sighting, receivedNs);
+    publisher.publish(sighting, receivedNs);
+    publisher.publish(sighting, receivedNs);
+    publisher.flush();
+    EXPECT_EQ(3, latency.stage(LATENCY_BATCH).count());
+    EXPECT_EQ(6, latency.stage(LATENCY_DELIVER).count());
+    EXPECT_EQ(6, latency.stage(LATENCY_END_TO_END).count());
+    EXPECT_EQ(true, latency.stage(LATENCY_END_TO_END).percentile(50) >= 2000000);
+
+    for (int i = 0; i < 2; i++) {
+        close(subscribers[i][1]);
+    }
+    close(epollFd);
+}
+
+int main(int argc, char **argv) {
+    testBuckets();
+    testPercentiles();
+    testGatewayStages();
+    testPublisherStages();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metadata_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utility>
+
+#define HEADER_SIZE                     (64)
+#define RECORD_SIZE                     (512)
+#define NONE                            (static_cast<size_t>(-1))
+
+#define RECORD_EMPTY                    (0)
+#define RECORD_OK                       (1)
+#define RECORD_NEGATIVE                 (2)
+
+struct CacheHeader {
+    char magic[4];                      // "UBMC"
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;
+    uint8_t reserved[48];
+};
+
+// Host byte order; the file is not meant to move between machines.
+struct CacheRecord {
+    uint32_t checksum;                  // of everything but itself and lastUsed
+    uint8_t state;
+    uint8_t reserved;
+    int16_t status;
+    uint64_t expires;
+    uint64_t lastUsed;
+    char url[METADATA_CACHE_URL_MAX + 1];
+    char title[METADATA_CACHE_TITLE_MAX + 1];
+    char icon[METADATA_CACHE_ICON_MAX + 1];
+};
+
+static_assert(sizeof(CacheHeader) == HEADER_SIZE, "cache header layout");
+static_assert(sizeof(CacheRecord) == RECORD_SIZE, "cache record layout");
+
+static uint32_t fnv(uint32_t hash, const void *data, size_t length) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Touching a record on every hit only rewrites lastUsed, so it is left out.
+static uint32_t checksumOf(const CacheRecord &record) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&record);
+    uint32_t hash = fnv(2166136261u, bytes + 4, 12);
+    return fnv(hash, bytes + 24, RECORD_SIZE - 24);
+}
+
+MetadataCache::MetadataCache()
+    : map(NULL),
+      mapLength(0),
+      capacity(0),
+      head(NONE),
+      tail(NONE),
+      clock(0) {
+    memset(&counters, 0, sizeof(counters));
+}
+
+MetadataCache::~MetadataCache() {
+    if (map != NULL) {
+        munmap(map, mapLength);
+    }
+}
+
+CacheRecord *MetadataCache::record(size_t slot) const {
+    return reinterpret_cast<CacheRecord *>(map + HEADER_SIZE + slot * RECORD_SIZE);
+}
+
+bool MetadataCache::open(const std::string &path, size_t entries) {
+    if (entries == 0) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t length = HEADER_SIZE + entries * RECORD_SIZE;
+    int fd = -1;
+    bool fresh = true;
+
+    if (!path.empty()) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        struct stat info;
+        if ((fd < 0) || (fstat(fd, &info) < 0)) {
+            int error = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            errno = error;
+            return false;
+        }
+        CacheHeader header;
+        if ((static_cast<size_t>(info.st_size) == length) &&
+            (pread(fd, &header, sizeof(header), 0) == sizeof(header)) &&
+            (memcmp(header.magic, "UBMC", 4) == 0) && (header.version == METADATA_CACHE_VERSION) &&
+            (header.recordSize == RECORD_SIZE) && (header.capacity == entries)) {
+            fresh = false;
+        } else if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, length) < 0)) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return false;
+        }
+    }
+
+    void *mapped = (fd < 0) ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                            : mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    if (map != NULL) {
+        munmap(map, mapLength);
+    }
+    map = static_cast<uint8_t *>(mapped);
+    mapLength = length;
+    capacity = entries;
+
+    if (fresh) {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "UBMC", 4);
+        header.version = METADATA_CACHE_VERSION;
+        header.recordSize = RECORD_SIZE;
+        header.capacity = static_cast<uint32_t>(entries);
+        memcpy(map, &header, sizeof(header));
+    }
+
+    // Rebuild the index, and the LRU order from the persisted use counters.
+    index.clear();
+    freeSlots.clear();
+    prevs.assign(capacity, NONE);
+    nexts.assign(capacity, NONE);
+    head = tail = NONE;
+    clock = 0;
+    std::vector<std::pair<uint64_t, size_t> > used;
+    for (size_t slot = capacity; slot-- > 0;) {
+        CacheRecord *entry = record(slot);
+        if (entry->state == RECORD_EMPTY) {
+            freeSlots.push_back(slot);
+            continue;
+        }
+        if ((entry->checksum != checksumOf(*entry)) ||
+            (memchr(entry->url, 0, sizeof(entry->url)) == NULL) ||
+            !index.insert(std::make_pair(std::string(entry->url), slot)).second) {
+            memset(entry, 0, RECORD_SIZE);
+            freeSlots.push_back(slot);
+            counters.corrupt++;
+            continue;
+        }
+        used.push_back(std::make_pair(entry->lastUsed, slot));
+        clock = std::max(clock, entry->lastUsed);
+    }
+    std::sort(used.begin(), used.end());
+    for (size_t i = 0; i < used.size(); i++) {
+        pushFront(used[i].second);
+    }
+    return true;
+}
+
+void MetadataCache::unlink(size_t slot) {
+    if (prevs[slot] != NONE) {
+        nexts[prevs[slot]] = nexts[slot];
+    } else {
+        head = nexts[slot];
+    }
+    if (nexts[slot] != NONE) {
+        prevs[nexts[slot]] = prevs[slot];
+    } else {
+        tail = prevs[slot];
+    }
+    prevs[slot] = nexts[slot] = NONE;
+}
+
+void MetadataCache::pushFront(size_t slot) {
+    prevs[slot] = NONE;
+    nexts[slot] = head;
+    if (head != NONE) {
+        prevs[head] = slot;
+    } else {
+        tail = slot;
+    }
+    head = slot;
+}
+
+void MetadataCache::touch(size_t slot) {
+    record(slot)->lastUsed = ++clock;
+    if (head != slot) {
+        unlink(slot);
+        pushFront(slot);
+    }
+}
+
+int MetadataCache::lookup(const std::string &url, uint64_t nowS, PageMetadata &metadata) {
+    auto found = index.find(url);
+    if (found == index.end()) {
+        return METADATA_CACHE_MISS;
+    }
+    const CacheRecord *entry = record(found->second);
+    if (entry->expires <= nowS) {
+        counters.expired++;
+        return METADATA_CACHE_MISS;
+    }
+    touch(found->second);
+    metadata.status = entry->status;
+    metadata.title = entry->title;
+    metadata.icon = entry->icon;
+    return (entry->state == RECORD_OK) ? METADATA_CACHE_HIT : METADATA_CACHE_NEGATIVE;
+}
+
+bool MetadataCache::store(const std::string &url, const PageMetadata &metadata, uint64_t expiresS) {
+    if ((map == NULL) || (url.size() > METADATA_CACHE_URL_MAX)) {
+        return false;
+    }
+    size_t slot;
+    auto found = index.find(url);
+    if (found != index.end()) {
+        slot = found->second;
+    } else if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        index[url] = slot;
+        pushFront(slot);
+    } else {
+        slot = tail;
+        index.erase(record(slot)->url);
+        index[url] = slot;
+        counters.evictions++;
+    }
+
+    // Clear the state first, so a crash part way leaves an empty record or
+    // one whose checksum fails.
+    CacheRecord *entry = record(slot);
+    entry->state = RECORD_EMPTY;
+    CacheRecord updated;
+    memset(&updated, 0, sizeof(updated));
+    updated.state = (metadata.status == 200) ? RECORD_OK : RECORD_NEGATIVE;
+    updated.status = static_cast<int16_t>(metadata.status);
+    updated.expires = expiresS;
+    memcpy(updated.url, url.data(), url.size());
+    size_t titleLength = metadata.title.size();
+    if (titleLength > METADATA_CACHE_TITLE_MAX) {
+        // Cut at a UTF-8 character boundary.
+        titleLength = METADATA_CACHE_TITLE_MAX;
+        while ((titleLength > 0) && ((metadata.title[titleLength] & 0xC0) == 0x80)) {
+            titleLength--;
+        }
+    }
+    memcpy(updated.title, metadata.title.data(), titleLength);
+    if (metadata.icon.size() <= METADATA_CACHE_ICON_MAX) {
+        memcpy(updated.icon, metadata.icon.data(), metadata.icon.size());
+    }
+    updated.checksum = checksumOf(updated);
+    memcpy(reinterpret_cast<uint8_t *>(entry) + 8, reinterpret_cast<uint8_t *>(&updated) + 8,
+           RECORD_SIZE - 8);
+    entry->status = updated.status;
+    entry->checksum = updated.checksum;
+    entry->state = updated.state;
+
+    touch(slot);
+    counters.stores++;
+    return true;
+}
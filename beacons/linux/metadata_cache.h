@@ -0,0 +1,103 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Page metadata cache in a memory mapped file.
+//
+// The file is a 64 byte header followed by a fixed number of 512 byte
+// records, so the cache survives restarts and costs no allocation per entry.
+// Each record carries an expiry time; failed fetches are stored as negative
+// records so that a dead URL is not fetched again on every sighting. When
+// the cache is full the least recently used record is replaced.
+//
+// The index and the LRU order live in memory and are rebuilt from the
+// records on open. A record whose checksum does not match, such as one torn
+// by a crash, is dropped. A file with another layout is reinitialized.
+//
+// Not thread safe.
+
+#ifndef URIBEACON_METADATA_CACHE_H__
+#define URIBEACON_METADATA_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "http_fetch.h"
+
+#define METADATA_CACHE_VERSION          (1)
+#define METADATA_CACHE_URL_MAX          (159)   // longer URLs are not cached
+#define METADATA_CACHE_TITLE_MAX        (127)   // longer titles are truncated
+#define METADATA_CACHE_ICON_MAX         (199)   // longer icon URLs are dropped
+
+// Lookup results.
+#define METADATA_CACHE_MISS             (0)     // absent or expired
+#define METADATA_CACHE_HIT              (1)
+#define METADATA_CACHE_NEGATIVE         (2)     // a cached failure
+
+struct CacheRecord;
+
+class MetadataCache {
+public:
+    struct Stats {
+        uint64_t stores;
+        uint64_t evictions;
+        uint64_t expired;       // lookups that found a stale record
+        uint64_t corrupt;       // records dropped on open
+    };
+
+    MetadataCache();
+    ~MetadataCache();
+
+    // Maps path, creating or reinitializing it to hold capacity records. An
+    // empty path keeps the cache in anonymous memory. Returns false with
+    // errno set.
+    bool open(const std::string &path, size_t capacity);
+
+    // Looks up url at nowS, filling metadata on a hit or a negative hit.
+    int lookup(const std::string &url, uint64_t nowS, PageMetadata &metadata);
+
+    // Stores metadata for url until expiresS. Returns false if url is too
+    // long to cache.
+    bool store(const std::string &url, const PageMetadata &metadata, uint64_t expiresS);
+
+    size_t size(void) const {
+        return index.size();
+    }
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+private:
+    CacheRecord *record(size_t slot) const;
+    void touch(size_t slot);
+    void unlink(size_t slot);
+    void pushFront(size_t slot);
+
+    uint8_t *map;
+    size_t mapLength;
+    size_t capacity;
+    std::unordered_map<std::string, size_t> index;
+    std::vector<size_t> freeSlots;
+    std::vector<size_t> prevs;          // LRU list, most recent first
+    std::vector<size_t> nexts;
+    size_t head;
+    size_t tail;
+    uint64_t clock;                     // use counter, persisted per record
+    Stats counters;
+};
+
+#endif // URIBEACON_METADATA_CACHE_H__
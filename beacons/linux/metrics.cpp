@@ -0,0 +1,379 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+// How long a scraper may take to send its request.
+#define REQUEST_TIMEOUT_MS              (2000)
+#define REQUEST_MAX                     (4096)
+
+static std::atomic<uint64_t> nextSerial(1);
+
+thread_local MetricsRegistry::ThreadShard MetricsRegistry::threadShard = { 0, NULL };
+
+MetricsRegistry::MetricsRegistry()
+    : serial(nextSerial++),
+      slotsUsed(0) {
+}
+
+MetricsRegistry::~MetricsRegistry() {
+}
+
+int MetricsRegistry::define(Type type, const char *name, const char *help, const char *labels,
+                            size_t slots) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (slotsUsed + slots > METRICS_SLOTS_MAX) {
+        return -1;
+    }
+    Metric metric;
+    metric.type = type;
+    metric.name = name;
+    metric.help = help;
+    metric.labels = labels;
+    metric.slot = slotsUsed;
+    metric.scale = 1.0;
+    metrics.push_back(metric);
+    slotsUsed += slots;
+    return static_cast<int>(metrics.size() - 1);
+}
+
+int MetricsRegistry::counter(const char *name, const char *help, const char *labels) {
+    return define(COUNTER, name, help, labels, 1);
+}
+
+int MetricsRegistry::gauge(const char *name, const char *help, const char *labels) {
+    return define(GAUGE, name, help, labels, 1);
+}
+
+int MetricsRegistry::histogram(const char *name, const char *help,
+                               const std::vector<uint64_t> &bounds, double scale) {
+    // A slot per bound, one for +Inf and one for the sum.
+    int id = define(HISTOGRAM, name, help, "", bounds.size() + 2);
+    if (id >= 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        metrics.back().bounds = bounds;
+        metrics.back().scale = scale;
+    }
+    return id;
+}
+
+int MetricsRegistry::family(const char *name, const char *help, const char *type) {
+    return define(FAMILY, name, help, type, 0);
+}
+
+void MetricsRegistry::observe(int id, uint64_t value) {
+    const Metric &metric = metrics[id];
+    size_t bucket = std::lower_bound(metric.bounds.begin(), metric.bounds.end(), value) -
+                    metric.bounds.begin();
+    Shard *shard = localShard();
+    bump(shard->slots[metric.slot + bucket], 1);
+    bump(shard->slots[metric.slot + metric.bounds.size() + 1], value);
+}
+
+void MetricsRegistry::setSamples(int id, const std::string &lines) {
+    std::lock_guard<std::mutex> guard(lock);
+    metrics[id].samples = lines;
+}
+
+MetricsRegistry::Shard *MetricsRegistry::addShard(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::thread::id self = std::this_thread::get_id();
+    Shard *shard = NULL;
+    for (size_t i = 0; i < owners.size(); i++) {
+        if (owners[i].first == self) {
+            shard = owners[i].second;
+        }
+    }
+    if (shard == NULL) {
+        shards.push_back(std::unique_ptr<Shard>(new Shard()));
+        shard = shards.back().get();
+        for (size_t i = 0; i < METRICS_SLOTS_MAX; i++) {
+            shard->slots[i].store(0, std::memory_order_relaxed);
+        }
+        owners.push_back(std::make_pair(self, shard));
+    }
+    threadShard.registry = serial;
+    threadShard.shard = shard;
+    return shard;
+}
+
+uint64_t MetricsRegistry::sum(size_t slot) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        total += shards[i]->slots[slot].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+static void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string &out, const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        out.append(line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+    }
+}
+
+std::string MetricsRegistry::render(void) const {
+    static const char *TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+    std::lock_guard<std::mutex> guard(lock);
+    std::string out;
+
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const Metric &metric = metrics[i];
+        if ((i == 0) || (metric.name != metrics[i - 1].name)) {
+            appendf(out, "# HELP %s %s\n# TYPE %s %s\n", metric.name.c_str(), metric.help.c_str(),
+                    metric.name.c_str(),
+                    metric.type == FAMILY ? metric.labels.c_str() : TYPE_NAMES[metric.type]);
+        }
+        switch (metric.type) {
+        case COUNTER:
+        case GAUGE:
+            appendf(out, "%s%s%s%s %llu\n", metric.name.c_str(), metric.labels.empty() ? "" : "{",
+                    metric.labels.c_str(), metric.labels.empty() ? "" : "}",
+                    (unsigned long long)sum(metric.slot));
+            break;
+        case HISTOGRAM: {
+            uint64_t count = 0;
+            for (size_t j = 0; j <= metric.bounds.size(); j++) {
+                count += sum(metric.slot + j);
+                if (j < metric.bounds.size()) {
+                    appendf(out, "%s_bucket{le=\"%.9g\"} %llu\n", metric.name.c_str(),
+                            metric.bounds[j] * metric.scale, (unsigned long long)count);
+                } else {
+                    appendf(out, "%s_bucket{le=\"+Inf\"} %llu\n", metric.name.c_str(),
+                            (unsigned long long)count);
+                }
+            }
+            appendf(out, "%s_sum %.9g\n%s_count %llu\n", metric.name.c_str(),
+                    sum(metric.slot + metric.bounds.size() + 1) * metric.scale,
+                    metric.name.c_str(), (unsigned long long)count);
+            break;
+        }
+        case FAMILY:
+            out += metric.samples;
+            break;
+        }
+    }
+    return out;
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry &registry)
+    : registry(registry),
+      listener(-1),
+      stopFd(-1),
+      served(0) {
+}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+static int listenTcp(const std::string &host, const std::string &port) {
+    addrinfo hints;
+    addrinfo *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if (status != 0) {
+        errno = (status == EAI_SYSTEM) ? errno : EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *address = addresses; (address != NULL) && (fd < 0); address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if ((bind(fd, address->ai_addr, address->ai_addrlen) < 0) || (listen(fd, 16) < 0)) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+static int listenUnix(const char *path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if ((bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) ||
+        (listen(fd, 16) < 0)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+bool MetricsServer::start(const char *address) {
+    if (strchr(address, '/') != NULL) {
+        listener = listenUnix(address);
+        path = address;
+    } else {
+        std::string text = address;
+        size_t colon = text.rfind(':');
+        if (colon == std::string::npos) {
+            listener = listenTcp("127.0.0.1", text);
+        } else {
+            listener = listenTcp(text.substr(0, colon), text.substr(colon + 1));
+        }
+    }
+    if (listener < 0) {
+        path.clear();
+        return false;
+    }
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0) {
+        int error = errno;
+        stop();
+        errno = error;
+        return false;
+    }
+    thread = std::thread(&MetricsServer::serve, this);
+    return true;
+}
+
+void MetricsServer::stop(void) {
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        if (write(stopFd, &one, sizeof(one)) < 0) {
+            // The thread is already stopping.
+        }
+        thread.join();
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+        stopFd = -1;
+    }
+    if (listener >= 0) {
+        close(listener);
+        listener = -1;
+    }
+    if (!path.empty()) {
+        unlink(path.c_str());
+        path.clear();
+    }
+}
+
+void MetricsServer::serve(void) {
+    for (;;) {
+        pollfd fds[2] = { { listener, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            answer(fd);
+            close(fd);
+        }
+    }
+}
+
+// One request per connection, answered and closed. The request is read up
+// to the end of its headers; only its request line matters.
+void MetricsServer::answer(int fd) {
+    timeval timeout;
+    timeout.tv_sec = REQUEST_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (REQUEST_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while ((request.find("\r\n\r\n") == std::string::npos) &&
+           (request.find("\n\n") == std::string::npos) && (request.size() < REQUEST_MAX)) {
+        ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+        if (length <= 0) {
+            return;
+        }
+        request.append(buffer, length);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if ((request.compare(0, 13, "GET /metrics ") == 0) || (request.compare(0, 6, "GET / ") == 0)) {
+        body = registry.render();
+        served++;
+    } else if (request.compare(0, 4, "GET ") == 0) {
+        status = "404 Not Found";
+        body = "Try /metrics\n";
+    } else {
+        status = "405 Method Not Allowed";
+    }
+
+    char header[256];
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.0 %s\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n",
+                          status.c_str(), body.size());
+    std::string response(header, length);
+    response += body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return;
+        }
+        sent += written;
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Counters, gauges and histograms in the Prometheus text format.
+//
+// Metrics are registered by name before they are updated. Every thread that
+// updates them writes its own shard of slots, with relaxed atomic loads and
+// stores and no lock, so an update costs about as much as incrementing a
+// plain integer and threads never share a cache line. A scrape sums the
+// shards. MetricsServer serves scrapes from a thread of its own, so a slow
+// scraper never holds up the thread being measured.
+
+#ifndef URIBEACON_METRICS_H__
+#define URIBEACON_METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Slots in each thread's shard: one per counter or gauge, and one per
+// bucket plus two per histogram.
+#define METRICS_SLOTS_MAX               (1024)
+
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    // Registration returns the id to update the metric with, or -1 if the
+    // slots ran out. labels is empty or a label set such as
+    // `stage="decode"`; metrics sharing a name must be registered together.
+    int counter(const char *name, const char *help, const char *labels = "");
+    int gauge(const char *name, const char *help, const char *labels = "");
+
+    // Bucket upper bounds are in the unit observe() is called with, and are
+    // multiplied by scale in the output, e.g. 1e-9 to observe nanoseconds
+    // and report seconds.
+    int histogram(const char *name, const char *help, const std::vector<uint64_t> &bounds,
+                  double scale = 1.0);
+
+    // A family whose samples are rendered by the caller, such as one series
+    // per beacon, replaced as a whole by setSamples().
+    int family(const char *name, const char *help, const char *type);
+
+    void add(int id, uint64_t value = 1) {
+        bump(localShard()->slots[metrics[id].slot], value);
+    }
+
+    // For gauges, and counters kept elsewhere and copied in. A metric that
+    // is set should be set from one thread only.
+    void set(int id, uint64_t value) {
+        localShard()->slots[metrics[id].slot].store(value, std::memory_order_relaxed);
+    }
+
+    void observe(int id, uint64_t value);
+
+    // Sample lines for a family, each ending in a newline.
+    void setSamples(int id, const std::string &lines);
+
+    // The exposition text of every metric.
+    std::string render(void) const;
+
+private:
+    enum Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+        FAMILY,
+    };
+
+    struct Metric {
+        Type type;
+        std::string name;
+        std::string help;
+        std::string labels;
+        size_t slot;
+        std::vector<uint64_t> bounds;
+        double scale;
+        std::string samples;    // of a family
+    };
+
+    struct Shard {
+        std::atomic<uint64_t> slots[METRICS_SLOTS_MAX];
+    };
+
+    // Only the owning thread writes a slot, so no read-modify-write is needed.
+    static void bump(std::atomic<uint64_t> &slot, uint64_t value) {
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    Shard *localShard(void) {
+        if (threadShard.registry != serial) {
+            return addShard();
+        }
+        return threadShard.shard;
+    }
+
+    // The shard of the registry the thread updated last.
+    struct ThreadShard {
+        uint64_t registry;
+        Shard *shard;
+    };
+
+    int define(Type type, const char *name, const char *help, const char *labels, size_t slots);
+    Shard *addShard(void);
+    uint64_t sum(size_t slot) const;
+
+    static thread_local ThreadShard threadShard;
+
+    uint64_t serial;            // unique to this registry, never reused
+    mutable std::mutex lock;
+    std::vector<Metric> metrics;
+    size_t slotsUsed;
+    // Shards live as long as the registry; a thread that exits keeps its
+    // counts.
+    std::vector<std::unique_ptr<Shard> > shards;
+    std::vector<std::pair<std::thread::id, Shard *> > owners;
+};
+
+// Serves GET /metrics over HTTP/1.0 on a local TCP port or a UNIX socket.
+class MetricsServer {
+public:
+    explicit MetricsServer(const MetricsRegistry &registry);
+    ~MetricsServer();
+
+    // address is a port, served on 127.0.0.1, host:port, or a path with a
+    // slash in it for a UNIX socket, replacing any socket there. Returns false with errno set.
+    bool start(const char *address);
+
+    void stop(void);
+
+    // Scrapes served so far.
+    uint64_t scrapes(void) const {
+        return served.load();
+    }
+
+private:
+    void serve(void);
+    void answer(int fd);
+
+    const MetricsRegistry &registry;
+    int listener;
+    int stopFd;
+    std::string path;
+    std::thread thread;
+    std::atomic<uint64_t> served;
+};
+
+#endif // URIBEACON_METRICS_H__
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the metrics registry and server, and the gateway's metrics.
+//
+//   metrics_test capture.txt
+//   metrics_test --bench capture.txt
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gateway.h"
+#include "metrics.h"
+#include "test_util.h"
+
+#define EXPECT_LINE(text, line)                                             \
+    do {                                                                    \
+        if (std::string(text).find(std::string(line) + "\n") == std::string::npos) { \
+            fprintf(stderr, "%s:%d: missing \"%s\"\n", __FILE__, __LINE__, line); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static size_t occurrences(const std::string &text, const char *needle) {
+    size_t count = 0;
+    for (size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + 1)) {
+        count++;
+    }
+    return count;
+}
+
+static void testCountersSumThreads(void) {
+    static const int THREADS = 4;
+    static const int INCREMENTS = 100000;
+    MetricsRegistry registry;
+    int frames = registry.counter("frames_total", "Frames.");
+    int good = registry.counter("results_total", "Results.", "result=\"good\"");
+    int bad = registry.counter("results_total", "Results.", "result=\"bad\"");
+    int depth = registry.gauge("queue_depth", "Queue depth.");
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; i++) {
+        threads.push_back(std::thread([&registry, frames, good, bad]() {
+            for (int j = 0; j < INCREMENTS; j++) {
+                registry.add(frames);
+                registry.add((j % 4 == 0) ? bad : good);
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    registry.set(depth, 7);
+    registry.set(depth, 5);
+
+    std::string text = registry.render();
+    EXPECT_LINE(text, "# HELP frames_total Frames.");
+    EXPECT_LINE(text, "# TYPE frames_total counter");
+    EXPECT_LINE(text, "frames_total 400000");
+    EXPECT_LINE(text, "results_total{result=\"good\"} 300000");
+    EXPECT_LINE(text, "results_total{result=\"bad\"} 100000");
+    EXPECT_EQ(1, occurrences(text, "# TYPE results_total counter"));
+    EXPECT_LINE(text, "# TYPE queue_depth gauge");
+    EXPECT_LINE(text, "queue_depth 5");
+}
+
+static void testHistogram(void) {
+    MetricsRegistry registry;
+    std::vector<uint64_t> bounds;
+    bounds.push_back(1000);
+    bounds.push_back(10000);
+    int latency = registry.histogram("latency_seconds", "Latency.", bounds, 1e-9);
+    registry.observe(latency, 500);
+    registry.observe(latency, 1000);
+    registry.observe(latency, 5000);
+    registry.observe(latency, 20000);
+
+    std::string text = registry.render();
+    EXPECT_LINE(text, "# TYPE latency_seconds histogram");
+    EXPECT_LINE(text, "latency_seconds_bucket{le=\"1e-06\"} 2");
+    EXPECT_LINE(text, "latency_seconds_bucket{le=\"1e-05\"} 3");
+    EXPECT_LINE(text, "latency_seconds_bucket{le=\"+Inf\"} 4");
+    EXPECT_LINE(text, "latency_seconds_sum 2.65e-05");
+    EXPECT_LINE(text, "latency_seconds_count 4");
+}
+
+static void testFamily(void) {
+    MetricsRegistry registry;
+    int beacons = registry.family("beacon_total", "Per beacon.", "counter");
+    registry.setSamples(beacons, "beacon_total{id=\"1\"} 3\n");
+    registry.setSamples(beacons, "beacon_total{id=\"2\"} 4\n");
+    std::string text = registry.render();
+    EXPECT_LINE(text, "# TYPE beacon_total counter");
+    EXPECT_LINE(text, "beacon_total{id=\"2\"} 4");
+    EXPECT_EQ(0, occurrences(text, "id=\"1\""));
+}
+
+static std::string request(const char *path, const char *text) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if (write(fd, text, strlen(text)) < 0) {
+        perror("write");
+    }
+    std::string response;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        response.append(buffer, length);
+    }
+    close(fd);
+    return response;
+}
+
+static void testServer(const std::string &directory) {
+    std::string path = directory + "/metrics.sock";
+    MetricsRegistry registry;
+    registry.add(registry.counter("frames_total", "Frames."), 3);
+    MetricsServer server(registry);
+    EXPECT_EQ(true, server.start(path.c_str()));
+
+    std::string response = request(path.c_str(), "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+    EXPECT_EQ(0, response.compare(0, 15, "HTTP/1.0 200 OK"));
+    EXPECT_EQ(true, response.find("Content-Type: text/plain; version=0.0.4\r\n") != std::string::npos);
+    EXPECT_LINE(response, "frames_total 3");
+    response = request(path.c_str(), "GET /favicon.ico HTTP/1.0\r\n\r\n");
+    EXPECT_EQ(0, response.compare(0, 12, "HTTP/1.0 404"));
+    EXPECT_EQ(1, server.scrapes());
+
+    server.stop();
+    EXPECT_EQ(-1, access(path.c_str(), F_OK));
+}
+
+static std::string metricValue(const std::string &text, const char *name) {
+    size_t at = text.find(std::string("\n") + name + " ");
+    if (at == std::string::npos) {
+        return "";
+    }
+    at += strlen(name) + 2;
+    return text.substr(at, text.find('\n', at) - at);
+}
+
+// The gateway's counters, copied into the registry, match its own.
+static void testGatewayMetrics(const std::string &directory, const char *capture) {
+    std::string socketPath = directory + "/gateway.sock";
+    MetricsRegistry registry;
+    GatewayOptions options;
+    options.socketPath = socketPath.c_str();
+    options.inputFd = open(capture, O_RDONLY | O_CLOEXEC);
+    options.captureTimestamps = true;
+    options.metrics = &registry;
+    if (options.inputFd < 0) {
+        perror(capture);
+        exit(EXIT_FAILURE);
+    }
+
+    Gateway gateway(options);
+    EXPECT_EQ(true, gateway.start());
+    gateway.run();
+    close(options.inputFd);
+
+    std::string text = registry.render();
+    const Gateway::Stats &stats = gateway.stats();
+    EXPECT_EQ(stats.frames, atoll(metricValue(text, "uribeacon_frames_total").c_str()));
+    EXPECT_EQ(stats.reports, atoll(metricValue(text, "uribeacon_reports_total").c_str()));
+    EXPECT_EQ(stats.uriBeacons, atoll(metricValue(text, "uribeacon_uribeacons_total").c_str()));
+    EXPECT_EQ(gateway.publisher().stats().sightings,
+              atoll(metricValue(text, "uribeacon_sightings_published_total").c_str()));
+    EXPECT_EQ(gateway.tracker().size(), atoll(metricValue(text, "uribeacon_beacons").c_str()));
+    EXPECT_EQ(gateway.tracker().size(), occurrences(text, "uribeacon_beacon_advertisements_total{"));
+    EXPECT_EQ((stats.frames + GATEWAY_INGEST_SAMPLE_INTERVAL - 1) / GATEWAY_INGEST_SAMPLE_INTERVAL,
+              atoll(metricValue(text, "uribeacon_ingest_seconds_count").c_str()));
+}
+
+static bool readFile(const char *path, std::string &contents) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+static void collectFrame(const HciFrame &frame, void *context) {
+    static_cast<std::vector<HciFrame> *>(context)->push_back(frame);
+}
+
+// Times one pass of the frames through ingest(), the gateway's hot path.
+static double ingestPass(Gateway &gateway, const std::vector<HciFrame> &frames) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames.size(); i++) {
+        gateway.ingest(frames[i]);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Measures what metrics cost the gateway's hot path: passes of the capture
+// through two gateways, one with metrics, alternating, best pass of each.
+// Scrapes run on the server's thread meanwhile.
+static int runBenchmark(const std::string &directory, const char *capture) {
+    static const int PASSES = 2000;
+    std::string contents;
+    if (!readFile(capture, contents)) {
+        perror(capture);
+        return EXIT_FAILURE;
+    }
+    std::vector<HciFrame> frames;
+    HcidumpParser parser;
+    parser.feed(contents.data(), contents.size(), collectFrame, &frames);
+    parser.finish(collectFrame, &frames);
+
+    std::string metricsPath = directory + "/metrics.sock";
+    MetricsRegistry registry;
+    MetricsServer server(registry);
+    server.start(metricsPath.c_str());
+    GatewayOptions options;
+    options.captureTimestamps = true;
+    Gateway plain(options);
+    options.metrics = &registry;
+    Gateway measured(options);
+
+    std::atomic<bool> done(false);
+    std::thread scraper([&]() {
+        while (!done) {
+            request(metricsPath.c_str(), "GET /metrics HTTP/1.0\r\n\r\n");
+            usleep(10000);
+        }
+    });
+    double best[2] = { 1e9, 1e9 };
+    for (int pass = 0; pass < PASSES; pass++) {
+        // Alternate which goes first, as the second of a pair runs warmer.
+        for (int i = 0; i < 2; i++) {
+            int which = (pass + i) % 2;
+            best[which] = std::min(best[which], ingestPass(which ? measured : plain, frames));
+        }
+    }
+    done = true;
+    scraper.join();
+
+    int counter = registry.counter("bench_total", "Bench.");
+    static const int ADDS = 100000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ADDS; i++) {
+        registry.add(counter);
+    }
+    double addNs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() *
+                   1e9 / ADDS;
+
+    printf("ingest without metrics %7.1f ns/frame\n", best[0] * 1e9 / frames.size());
+    printf("ingest with metrics    %7.1f ns/frame\n", best[1] * 1e9 / frames.size());
+    printf("overhead               %7.2f %% (budget 1 %%), %llu scrapes, %.2f ns per counter add\n",
+           (best[1] / best[0] - 1) * 100, (unsigned long long)server.scrapes(), addNs);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    char directory[] = "/tmp/uribeacon_metrics_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+
+    if ((argc > 2) && (strcmp(argv[1], "--bench") == 0)) {
+        status = runBenchmark(directory, argv[2]);
+    } else {
+        testCountersSumThreads();
+        testHistogram();
+        testFamily();
+        testServer(directory);
+        if (argc > 1) {
+            testGatewayMetrics(directory, argv[1]);
+        }
+        if (failures == 0) {
+            printf("All tests passed\n");
+        }
+        status = failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    rmdir(directory);
+    return status;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "provisioner.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+// Whether another try may succeed where this one failed.
+static bool retryable(ConfigStatus status, uint8_t attError) {
+    switch (status) {
+    case CONFIG_ERR_TIMEOUT:
+    case CONFIG_ERR_LINK:
+    case CONFIG_ERR_MALFORMED:
+    case CONFIG_ERR_VERIFY:
+        return true;
+    case CONFIG_ERR_ATT:
+        // A wrong key stays wrong.
+        return attError != ATT_ERR_INSUFFICIENT_AUTHORIZATION;
+    default:
+        return false;
+    }
+}
+
+Provisioner::Provisioner(ProvisionTransport &transport, const ProvisionOptions &options)
+    : transport(transport),
+      options(options),
+      slots(std::max(options.connections, 1u)),
+      finished(0) {
+    memset(&counts, 0, sizeof(counts));
+    for (size_t i = 0; i < slots.size(); i++) {
+        slots[i].state = SLOT_IDLE;
+        slots[i].job = 0;
+        slots[i].connectDeadline = 0;
+        slots[i].bearer.reset(new SlotBearer(transport, static_cast<int>(i)));
+    }
+}
+
+void Provisioner::add(const std::string &target, const ConfigRequest &request) {
+    ProvisionResult result;
+    result.target = target;
+    result.status = CONFIG_OK;
+    memset(&result.report, 0, sizeof(result.report));
+    result.linkError = 0;
+    result.attempts = 0;
+    result.firstNs = 0;
+    result.doneNs = 0;
+    Pending entry = { results.size(), 0 };
+    results.push_back(result);
+    requests.push_back(request);
+    pending.push_back(entry);
+}
+
+void Provisioner::start(uint64_t nowNs) {
+    counts.startNs = nowNs;
+    fill(nowNs);
+}
+
+void Provisioner::connected(int slot, uint64_t nowNs) {
+    Slot &entry = slots[slot];
+    if (entry.state != SLOT_CONNECTING) {
+        return;
+    }
+    entry.state = SLOT_ACTIVE;
+    entry.client.reset(new ConfigClient(*entry.bearer, requests[entry.job]));
+    entry.client->start(nowNs);
+    check(slot, nowNs);
+    fill(nowNs);
+}
+
+void Provisioner::linkFailed(int slot, int error, uint64_t nowNs) {
+    if (slots[slot].state == SLOT_IDLE) {
+        return;
+    }
+    if (slots[slot].state == SLOT_CONNECTING) {
+        counts.connectFailures++;
+    }
+    transport.close(slot);
+    endAttempt(slot, CONFIG_ERR_LINK, error, nowNs);
+    fill(nowNs);
+}
+
+void Provisioner::receive(int slot, const uint8_t *pdu, size_t length, uint64_t nowNs) {
+    if (slots[slot].state != SLOT_ACTIVE) {
+        return;
+    }
+    slots[slot].client->receive(pdu, length, nowNs);
+    check(slot, nowNs);
+    fill(nowNs);
+}
+
+void Provisioner::tick(uint64_t nowNs) {
+    for (size_t i = 0; i < slots.size(); i++) {
+        Slot &entry = slots[i];
+        int slot = static_cast<int>(i);
+        if ((entry.state == SLOT_CONNECTING) && (nowNs >= entry.connectDeadline)) {
+            counts.connectFailures++;
+            transport.close(slot);
+            endAttempt(slot, CONFIG_ERR_TIMEOUT, ETIMEDOUT, nowNs);
+        } else if (entry.state == SLOT_ACTIVE) {
+            entry.client->tick(nowNs);
+            check(slot, nowNs);
+        }
+    }
+    fill(nowNs);
+}
+
+uint64_t Provisioner::deadlineNs(void) const {
+    uint64_t deadline = 0;
+    bool idle = false;
+    for (size_t i = 0; i < slots.size(); i++) {
+        const Slot &entry = slots[i];
+        uint64_t next = 0;
+        if (entry.state == SLOT_CONNECTING) {
+            next = entry.connectDeadline;
+        } else if (entry.state == SLOT_ACTIVE) {
+            next = entry.client->deadlineNs();
+        } else {
+            idle = true;
+        }
+        if ((next != 0) && ((deadline == 0) || (next < deadline))) {
+            deadline = next;
+        }
+    }
+    // Only a retry that has a slot to go to is waited for.
+    for (size_t i = 0; idle && (i < pending.size()); i++) {
+        uint64_t next = std::max<uint64_t>(pending[i].notBeforeNs, 1);
+        if ((deadline == 0) || (next < deadline)) {
+            deadline = next;
+        }
+    }
+    return deadline;
+}
+
+void Provisioner::fill(uint64_t nowNs) {
+    for (size_t i = 0; i < slots.size(); i++) {
+        while (slots[i].state == SLOT_IDLE) {
+            std::deque<Pending>::iterator next = pending.begin();
+            while ((next != pending.end()) && (next->notBeforeNs > nowNs)) {
+                ++next;
+            }
+            if (next == pending.end()) {
+                return;
+            }
+            size_t job = next->job;
+            pending.erase(next);
+
+            ProvisionResult &result = results[job];
+            if (result.attempts++ == 0) {
+                result.firstNs = nowNs;
+            }
+            counts.attempts++;
+            Slot &entry = slots[i];
+            entry.state = SLOT_CONNECTING;
+            entry.job = job;
+            entry.connectDeadline = nowNs + options.connectTimeoutMs * 1000000ull;
+            int slot = static_cast<int>(i);
+            if (!transport.open(slot, result.target)) {
+                counts.connectFailures++;
+                endAttempt(slot, CONFIG_ERR_LINK, errno, nowNs);
+            }
+        }
+    }
+}
+
+void Provisioner::check(int slot, uint64_t nowNs) {
+    Slot &entry = slots[slot];
+    if ((entry.state != SLOT_ACTIVE) || !entry.client->done()) {
+        return;
+    }
+    // Disconnecting commits the writes.
+    transport.close(slot);
+    endAttempt(slot, entry.client->report().status, entry.client->report().linkError, nowNs);
+}
+
+void Provisioner::endAttempt(int slot, ConfigStatus status, int linkError, uint64_t nowNs) {
+    Slot &entry = slots[slot];
+    ProvisionResult &result = results[entry.job];
+    if (entry.client) {
+        result.report = entry.client->report();
+    }
+    result.status = status;
+    result.linkError = linkError;
+    result.doneNs = nowNs;
+
+    if ((status != CONFIG_OK) && retryable(status, result.report.attError) &&
+        (result.attempts <= options.retries)) {
+        Pending retry = { entry.job, nowNs + options.retryDelayMs * 1000000ull };
+        pending.push_back(retry);
+        counts.retries++;
+    } else {
+        finished++;
+        if (status == CONFIG_OK) {
+            counts.succeeded++;
+            if (requests[entry.job].write) {
+                counts.writes += result.report.writes;
+                counts.writesAvoided += result.report.writesAvoided;
+                counts.unchanged += (result.report.writes == 0);
+            }
+        } else {
+            counts.failed++;
+        }
+        counts.doneNs = nowNs;
+    }
+    entry.state = SLOT_IDLE;
+    entry.client.reset();
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Provisions many beacons at once, for rollouts of thousands.
+//
+// A station can hold several LE connections, so the provisioner keeps up
+// to ProvisionOptions::connections beacons in progress, each with its own
+// ConfigClient: while one beacon answers a request, the others are being
+// connected, unlocked, written and locked. Each beacon's steps stay in
+// order on its own link. A pass that fails in a way another try may fix (a
+// timeout, a dropped link, a refused request) is tried again after
+// retryDelayMs, behind the beacons still waiting, up to retries more
+// times. Passes that cannot succeed, on a beacon without the service or
+// locked with another key, are not retried.
+//
+// Like the client, the provisioner is a state machine. A ProvisionTransport
+// opens, carries and closes the link of each slot; whatever reads the links
+// passes PDUs to receive() and calls tick(), over sockets or simulated
+// links.
+
+#ifndef URIBEACON_PROVISIONER_H__
+#define URIBEACON_PROVISIONER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "att.h"
+#include "config_client.h"
+
+#define PROVISION_CONNECTIONS           (4)
+#define PROVISION_RETRIES               (2)
+#define PROVISION_RETRY_DELAY_MS        (1000)
+#define PROVISION_CONNECT_TIMEOUT_MS    (5000)
+
+struct ProvisionOptions {
+    unsigned connections;       // beacons in progress at once
+    unsigned retries;           // more tries after the first
+    uint32_t retryDelayMs;
+    uint32_t connectTimeoutMs;
+
+    ProvisionOptions()
+        : connections(PROVISION_CONNECTIONS),
+          retries(PROVISION_RETRIES),
+          retryDelayMs(PROVISION_RETRY_DELAY_MS),
+          connectTimeoutMs(PROVISION_CONNECT_TIMEOUT_MS) {
+    }
+};
+
+// Opens the link of a slot to a target, such as a beacon address.
+class ProvisionTransport {
+public:
+    virtual ~ProvisionTransport() {}
+
+    // Starts connecting. The transport calls Provisioner::connected() or
+    // linkFailed() for the slot when it knows. Returns false with errno set
+    // if it cannot even start.
+    virtual bool open(int slot, const std::string &target) = 0;
+
+    // Sends one PDU on a connected slot. Returns false with errno set.
+    virtual bool send(int slot, const uint8_t *pdu, size_t length) = 0;
+
+    // Disconnects the slot, connected or not. No call about it follows.
+    virtual void close(int slot) = 0;
+};
+
+struct ProvisionResult {
+    std::string target;
+    ConfigStatus status;        // of the last try
+    ConfigReport report;        // of the last try that connected
+    int linkError;              // errno, if the last try failed to connect
+    unsigned attempts;
+    uint64_t firstNs;           // when the first try started
+    uint64_t doneNs;            // and the last ended
+};
+
+class Provisioner {
+public:
+    struct Stats {
+        uint64_t succeeded;
+        uint64_t failed;
+        uint64_t attempts;
+        uint64_t retries;
+        uint64_t connectFailures;
+        // Of beacons written: writes sent and avoided by sync passes, and
+        // beacons found as wanted, which were not written or committed.
+        uint64_t writes;
+        uint64_t writesAvoided;
+        uint64_t unchanged;
+        uint64_t startNs;
+        uint64_t doneNs;        // when the last beacon finished
+    };
+
+    Provisioner(ProvisionTransport &transport, const ProvisionOptions &options);
+
+    // Queues a beacon. Beacons are started in the order they are added.
+    void add(const std::string &target, const ConfigRequest &request);
+
+    void start(uint64_t nowNs);
+
+    // From the transport, the slot's link is up or failed.
+    void connected(int slot, uint64_t nowNs);
+    void linkFailed(int slot, int error, uint64_t nowNs);
+
+    // A PDU on the slot's link.
+    void receive(int slot, const uint8_t *pdu, size_t length, uint64_t nowNs);
+
+    // Times out connects and requests, and starts retries that are due.
+    void tick(uint64_t nowNs);
+
+    bool done(void) const {
+        return finished == results.size();
+    }
+
+    // When tick() next has something to do, or 0 if nothing is waiting.
+    uint64_t deadlineNs(void) const;
+
+    // In the order the beacons were added.
+    const std::vector<ProvisionResult> &beacons(void) const {
+        return results;
+    }
+
+    const Stats &stats(void) const {
+        return counts;
+    }
+
+private:
+    enum SlotState {
+        SLOT_IDLE,
+        SLOT_CONNECTING,
+        SLOT_ACTIVE,
+    };
+
+    // Hands the client's PDUs to the transport, tagged with the slot.
+    class SlotBearer : public AttBearer {
+    public:
+        SlotBearer(ProvisionTransport &transport, int slot)
+            : transport(transport),
+              slot(slot) {
+        }
+
+        bool send(const uint8_t *pdu, size_t length) override {
+            return transport.send(slot, pdu, length);
+        }
+
+    private:
+        ProvisionTransport &transport;
+        int slot;
+    };
+
+    struct Slot {
+        SlotState state;
+        size_t job;
+        uint64_t connectDeadline;
+        std::unique_ptr<SlotBearer> bearer;
+        std::unique_ptr<ConfigClient> client;
+    };
+
+    struct Pending {
+        size_t job;
+        uint64_t notBeforeNs;
+    };
+
+    void fill(uint64_t nowNs);
+    // Ends the slot's pass once its client is done.
+    void check(int slot, uint64_t nowNs);
+    void endAttempt(int slot, ConfigStatus status, int linkError, uint64_t nowNs);
+
+    ProvisionTransport &transport;
+    ProvisionOptions options;
+    std::vector<ConfigRequest> requests;
+    std::vector<ProvisionResult> results;
+    std::deque<Pending> pending;
+    std::vector<Slot> slots;
+    size_t finished;
+    Stats counts;
+};
+
+#endif // URIBEACON_PROVISIONER_H__
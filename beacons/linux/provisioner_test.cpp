@@ -0,0 +1,257 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests for the provisioner against fleets of simulated beacons: that
+// concurrent links multiply throughput, that transient failures are
+// retried and permanent ones are not, and that every beacon ends up
+// written, committed and locked as asked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config_sim.h"
+#include "provisioner.h"
+#include "test_util.h"
+
+#define LATENCY_NS                      (15000000ull)
+#define CONNECT_NS                      (100000000ull)
+
+static const uint8_t KEY[URIBEACON_LOCK_CODE_SIZE] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+static ConfigRequest writeRequest(void) {
+    ConfigRequest request;
+    request.write = true;
+    uribeacon_config_t &config = request.config;
+    uribeacon_uri_encode("https://example.com/fleet", config.uri, URIBEACON_URI_MAX,
+                         &config.uri_length);
+    config.tx_power_mode = URIBEACON_TX_POWER_MODE_MEDIUM;
+    for (int i = 0; i < URIBEACON_TX_POWER_MODES; i++) {
+        config.adv_tx_power_levels[i] = static_cast<int8_t>(-20 + 6 * i);
+    }
+    config.period = 250;
+    return request;
+}
+
+// A fleet of beacons, every third one v1, provisioned over K links.
+struct Fleet {
+    SimulatedNetwork network;
+    SimulatedTransport transport;
+    std::vector<std::unique_ptr<SimulatedBeacon> > beacons;
+    Provisioner provisioner;
+
+    Fleet(size_t count, const ProvisionOptions &options)
+        : transport(network, LATENCY_NS, CONNECT_NS),
+          provisioner(transport, options) {
+        transport.attach(&provisioner);
+        for (size_t i = 0; i < count; i++) {
+            ConfigProtocol protocol = (i % 3 == 2) ? CONFIG_PROTOCOL_V1 : CONFIG_PROTOCOL_V2;
+            beacons.push_back(std::unique_ptr<SimulatedBeacon>(new SimulatedBeacon(protocol)));
+            transport.addBeacon(name(i), beacons.back().get());
+        }
+    }
+
+    static std::string name(size_t i) {
+        char text[32];
+        snprintf(text, sizeof(text), "beacon-%zu", i);
+        return text;
+    }
+
+    uint64_t run(void) {
+        provisioner.start(network.now());
+        runSimulated(network, provisioner);
+        return provisioner.stats().doneNs - provisioner.stats().startNs;
+    }
+};
+
+static void testThroughput(void) {
+    static const size_t COUNT = 300;
+    ConfigRequest request = writeRequest();
+    uint64_t elapsedNs[2];
+    static const unsigned CONNECTIONS[2] = { 1, 8 };
+    for (int run = 0; run < 2; run++) {
+        ProvisionOptions options;
+        options.connections = CONNECTIONS[run];
+        Fleet fleet(COUNT, options);
+        for (size_t i = 0; i < COUNT; i++) {
+            fleet.provisioner.add(Fleet::name(i), request);
+        }
+        elapsedNs[run] = fleet.run();
+
+        const Provisioner::Stats &stats = fleet.provisioner.stats();
+        EXPECT_EQ(COUNT, stats.succeeded);
+        EXPECT_EQ(0, stats.failed);
+        EXPECT_EQ(COUNT, stats.attempts);
+        size_t written = 0;
+        for (size_t i = 0; i < COUNT; i++) {
+            const SimulatedBeacon &beacon = *fleet.beacons[i];
+            written += (beacon.stats().nvmCommits == 1);
+            if (beacon.protocol() == CONFIG_PROTOCOL_V2) {
+                written -= (beacon.config().period != 250);
+            }
+            EXPECT_EQ(1, fleet.provisioner.beacons()[i].attempts);
+        }
+        EXPECT_EQ(COUNT, written);
+    }
+    // Beacons do not wait on each other, so eight links take an eighth of
+    // the time, less the tail of the last few.
+    if (elapsedNs[1] * 7 > elapsedNs[0]) {
+        fprintf(stderr, "8 links took %.1f s, 1 link %.1f s\n", elapsedNs[1] / 1e9,
+                elapsedNs[0] / 1e9);
+        failures++;
+    }
+}
+
+static void testRetries(void) {
+    ProvisionOptions options;
+    options.connections = 3;
+    options.retries = 2;
+    options.retryDelayMs = 500;
+    options.connectTimeoutMs = 2000;
+    Fleet fleet(5, options);
+    ConfigRequest request = writeRequest();
+    request.timeoutMs = 1000;
+
+    // Refused once, then connects.
+    fleet.transport.failConnects(Fleet::name(0), 1);
+    // Loses a request, and times out.
+    fleet.beacons[1]->dropPdus(1);
+    // Locked with a key the station does not have.
+    uint8_t otherKey[URIBEACON_LOCK_CODE_SIZE];
+    memset(otherKey, 0x99, sizeof(otherKey));
+    fleet.beacons[3]->lock(otherKey);
+    request.haveKey = true;
+    memcpy(request.key, KEY, sizeof(KEY));
+
+    for (size_t i = 0; i < 5; i++) {
+        fleet.provisioner.add(Fleet::name(i), request);
+    }
+    // Not in range at all.
+    fleet.provisioner.add("absent", request);
+    fleet.run();
+
+    const std::vector<ProvisionResult> &results = fleet.provisioner.beacons();
+    EXPECT_EQ(CONFIG_OK, results[0].status);
+    EXPECT_EQ(2, results[0].attempts);
+    EXPECT_EQ(CONFIG_OK, results[1].status);
+    EXPECT_EQ(2, results[1].attempts);
+    EXPECT_EQ(CONFIG_OK, results[2].status);
+    EXPECT_EQ(1, results[2].attempts);
+    EXPECT_EQ(CONFIG_ERR_ATT, results[3].status);
+    EXPECT_EQ(ATT_ERR_INSUFFICIENT_AUTHORIZATION, results[3].report.attError);
+    EXPECT_EQ(1, results[3].attempts);
+    EXPECT_EQ(0, fleet.beacons[3]->stats().writes);
+    EXPECT_EQ(CONFIG_OK, results[4].status);
+    EXPECT_EQ(CONFIG_ERR_TIMEOUT, results[5].status);
+    EXPECT_EQ(3, results[5].attempts);
+
+    const Provisioner::Stats &stats = fleet.provisioner.stats();
+    EXPECT_EQ(4, stats.succeeded);
+    EXPECT_EQ(2, stats.failed);
+    EXPECT_EQ(4, stats.retries);
+    EXPECT_EQ(4, stats.connectFailures);
+    // The retry of the timed out beacon waited its delay behind the others.
+    EXPECT_EQ(true, results[1].doneNs - results[1].firstNs >
+                        (request.timeoutMs + options.retryDelayMs) * 1000000ull);
+    EXPECT_EQ(1, fleet.beacons[1]->stats().nvmCommits);
+}
+
+// Unlocks each beacon with the station's key, writes it and locks it
+// again with a new code.
+static void testRelock(void) {
+    ProvisionOptions options;
+    options.connections = 4;
+    Fleet fleet(6, options);
+    ConfigRequest request = writeRequest();
+    request.haveKey = true;
+    memcpy(request.key, KEY, sizeof(KEY));
+    request.config.lock_state = 1;
+    memset(request.config.lock_code, 0x5A, sizeof(request.config.lock_code));
+    for (size_t i = 0; i < 6; i++) {
+        if (fleet.beacons[i]->protocol() == CONFIG_PROTOCOL_V2) {
+            fleet.beacons[i]->lock(KEY);
+        }
+        fleet.provisioner.add(Fleet::name(i), request);
+    }
+    fleet.run();
+    EXPECT_EQ(6, fleet.provisioner.stats().succeeded);
+    for (size_t i = 0; i < 6; i++) {
+        const SimulatedBeacon &beacon = *fleet.beacons[i];
+        if (beacon.protocol() == CONFIG_PROTOCOL_V2) {
+            EXPECT_EQ(1, beacon.config().lock_state);
+            EXPECT_EQ(0x5A, beacon.config().lock_code[0]);
+            EXPECT_EQ(250, beacon.config().period);
+        }
+    }
+}
+
+// Provisioned again in sync, only beacons that changed are written.
+static void testSync(void) {
+    static const size_t COUNT = 30;
+    ProvisionOptions options;
+    Fleet fleet(COUNT, options);
+    ConfigRequest request = writeRequest();
+    for (size_t i = 0; i < COUNT; i++) {
+        SimulatedBeacon &beacon = *fleet.beacons[i];
+        if (i % 5 != 0) {
+            SimulatedNetwork network;
+            SimulatedLink link(network, beacon, LATENCY_NS);
+            ConfigClient client(link, request);
+            link.attach(&client);
+            client.start(network.now());
+            while (network.step()) {
+            }
+            link.close();
+        }
+        if (beacon.protocol() == CONFIG_PROTOCOL_V2) {
+            beacon.setReadMultiple(true);
+        }
+    }
+    request.sync = true;
+    for (size_t i = 0; i < COUNT; i++) {
+        fleet.provisioner.add(Fleet::name(i), request);
+    }
+    fleet.run();
+
+    const Provisioner::Stats &stats = fleet.provisioner.stats();
+    EXPECT_EQ(COUNT, stats.succeeded);
+    EXPECT_EQ(COUNT - COUNT / 5, stats.unchanged);
+    size_t commits = 0;
+    for (size_t i = 0; i < COUNT; i++) {
+        commits += fleet.beacons[i]->stats().nvmCommits;
+    }
+    // One from the setup for each beacon written then, one now for the rest.
+    EXPECT_EQ(COUNT, commits);
+    // Four v2 beacons took four writes, their flags already being 0, and
+    // two v1 beacons two.
+    EXPECT_EQ(4 * 4 + 2 * 2, stats.writes);
+    EXPECT_EQ(4 * 1 + 16 * 5 + 8 * 2, stats.writesAvoided);
+}
+
+int main(int argc, char **argv) {
+    testThroughput();
+    testRetries();
+    testRelock();
+    testSync();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "publisher.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+Publisher::Publisher(int epollFd, size_t maxBatchRecords, size_t maxQueuedBatches)
+    : epollFd(epollFd),
+      listener(-1),
+      maxBatchRecords(maxBatchRecords),
+      maxQueuedBatches(maxQueuedBatches),
+      openCount(0),
+      latency(NULL),
+      sequence(0) {
+    if (this->maxBatchRecords == 0) {
+        this->maxBatchRecords = 1;
+    } else if (this->maxBatchRecords > SIGHTING_BATCH_RECORDS_MAX) {
+        this->maxBatchRecords = SIGHTING_BATCH_RECORDS_MAX;
+    }
+    memset(&counters, 0, sizeof(counters));
+    open.reserve(SIGHTING_BATCH_MAX);
+}
+
+Publisher::~Publisher() {
+    while (!subscribers.empty()) {
+        remove(subscribers.begin()->first);
+    }
+    if (listener >= 0) {
+        close(listener);
+        unlink(path.c_str());
+    }
+}
+
+bool Publisher::listen(const char *socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    unlink(socketPath);
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if ((bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) ||
+        (::listen(fd, 16) < 0) ||
+        (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+    listener = fd;
+    path = socketPath;
+    return true;
+}
+
+void Publisher::acceptSubscribers(void) {
+    for (;;) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        addSubscriber(fd);
+    }
+}
+
+void Publisher::addSubscriber(int fd) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return;
+    }
+    Subscriber &subscriber = subscribers[fd];
+    subscriber.waitingForOutput = false;
+    counters.accepted++;
+}
+
+bool Publisher::handleEvents(int fd, uint32_t events) {
+    auto found = subscribers.find(fd);
+    if (found == subscribers.end()) {
+        return false;
+    }
+    // Subscribers only read; anything else from them is a hang up.
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        counters.disconnected++;
+        remove(fd);
+        return true;
+    }
+    if (events & EPOLLOUT) {
+        send(fd, found->second);
+    }
+    return true;
+}
+
+void Publisher::traceLatency(PipelineLatency *trace) {
+    latency = trace;
+}
+
+void Publisher::publish(const Sighting &sighting, uint64_t receivedNs) {
+    size_t size = sightingRecordSize(sighting);
+    if ((openCount != 0) && (open.size() + size > SIGHTING_BATCH_MAX)) {
+        flush();
+    }
+    if (openCount == 0) {
+        open.resize(SIGHTING_BATCH_HEADER_SIZE);
+        openReceivedNs.clear();
+        openPublishedNs.clear();
+    }
+    if (latency != NULL) {
+        uint64_t nowNs = wallClockNs();
+        openReceivedNs.push_back(receivedNs != 0 ? receivedNs : nowNs);
+        openPublishedNs.push_back(nowNs);
+    }
+    size_t offset = open.size();
+    open.resize(offset + size);
+    writeSightingRecord(sighting, &open[offset]);
+    openCount++;
+    counters.sightings++;
+    if (openCount == maxBatchRecords) {
+        flush();
+    }
+}
+
+void Publisher::flush(void) {
+    if (openCount == 0) {
+        return;
+    }
+    writeBatchHeader(&open[0], static_cast<uint16_t>(openCount), sequence++);
+    std::shared_ptr<SealedBatch> sealed = std::make_shared<SealedBatch>();
+    sealed->bytes = open;
+    sealed->sealedNs = 0;
+    // Sightings published before tracing started are not traced.
+    if ((latency != NULL) && (openPublishedNs.size() == openCount)) {
+        sealed->sealedNs = wallClockNs();
+        for (size_t i = 0; i < openCount; i++) {
+            latency->record(LATENCY_BATCH, sealed->sealedNs - openPublishedNs[i]);
+        }
+        sealed->receivedNs.swap(openReceivedNs);
+    }
+    Batch batch = sealed;
+    openCount = 0;
+    counters.batches++;
+
+    for (auto it = subscribers.begin(); it != subscribers.end();) {
+        int fd = it->first;
+        Subscriber &subscriber = it->second;
+        ++it;
+        if (subscriber.queue.size() == maxQueuedBatches) {
+            counters.evicted++;
+            remove(fd);
+            continue;
+        }
+        subscriber.queue.push_back(batch);
+        if (!subscriber.waitingForOutput) {
+            send(fd, subscriber);
+        }
+    }
+}
+
+bool Publisher::idle(void) const {
+    for (auto it = subscribers.begin(); it != subscribers.end(); ++it) {
+        if (!it->second.queue.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Publisher::send(int fd, Subscriber &subscriber) {
+    while (!subscriber.queue.empty()) {
+        const SealedBatch &batch = *subscriber.queue.front();
+        // A SOCK_SEQPACKET send is all or nothing.
+        if (::send(fd, batch.bytes.data(), batch.bytes.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                watchOutput(fd, subscriber, true);
+            } else if (errno == EMSGSIZE) {
+                // The subscriber shrank its buffer below the batch; it misses
+                // this one but is still connected.
+                counters.oversized++;
+                subscriber.queue.pop_front();
+                continue;
+            } else {
+                counters.disconnected++;
+                remove(fd);
+            }
+            return;
+        }
+        if ((latency != NULL) && (batch.sealedNs != 0)) {
+            uint64_t sentNs = wallClockNs();
+            latency->record(LATENCY_DELIVER, sentNs - batch.sealedNs, batch.receivedNs.size());
+            for (size_t i = 0; i < batch.receivedNs.size(); i++) {
+                latency->record(LATENCY_END_TO_END, sentNs - batch.receivedNs[i]);
+            }
+        }
+        subscriber.queue.pop_front();
+        counters.sent++;
+    }
+    watchOutput(fd, subscriber, false);
+}
+
+void Publisher::watchOutput(int fd, Subscriber &subscriber, bool enable) {
+    if (subscriber.waitingForOutput == enable) {
+        return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLRDHUP;
+    if (enable) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+    subscriber.waitingForOutput = enable;
+}
+
+void Publisher::remove(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    subscribers.erase(fd);
+}
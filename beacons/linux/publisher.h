@@ -0,0 +1,127 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Publishes sighting batches to local subscribers over a SOCK_SEQPACKET UNIX
+// socket.
+//
+// Sightings are appended to an open batch, which is sealed when it has
+// maxBatchRecords or the next record would take it past SIGHTING_BATCH_MAX
+// bytes, or when the gateway flushes it. A sealed batch is shared by every
+// subscriber's queue. Each queue holds at most maxQueuedBatches; a subscriber
+// that falls that far behind is evicted rather than allowed to hold up the
+// gateway or the other subscribers.
+
+#ifndef URIBEACON_PUBLISHER_H__
+#define URIBEACON_PUBLISHER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "latency.h"
+#include "sighting.h"
+
+class Publisher {
+public:
+    struct Stats {
+        uint64_t sightings;
+        uint64_t batches;
+        uint64_t sent;          // batches delivered, summed over subscribers
+        uint64_t accepted;
+        uint64_t evicted;
+        uint64_t disconnected;
+        uint64_t oversized;     // batches a subscriber's send buffer could not hold
+    };
+
+    // Subscriber sockets are registered with epollFd. maxBatchRecords is at
+    // most SIGHTING_BATCH_RECORDS_MAX.
+    Publisher(int epollFd, size_t maxBatchRecords, size_t maxQueuedBatches);
+    ~Publisher();
+
+    // Listens on path, replacing a stale socket. Returns false with errno set.
+    bool listen(const char *path);
+
+    int listenFd(void) const {
+        return listener;
+    }
+
+    // Accepts a pending subscriber. Also used by tests with a connected
+    // socket of their own.
+    void acceptSubscribers(void);
+    void addSubscriber(int fd);
+
+    // Handles epoll events on a subscriber socket. Returns false if fd is not
+    // a subscriber.
+    bool handleEvents(int fd, uint32_t events);
+
+    // Appends a sighting to the open batch, sealing it when full. receivedNs
+    // is when its advertisement arrived, for latency tracing.
+    void publish(const Sighting &sighting, uint64_t receivedNs = 0);
+
+    // Seals the open batch, if any, and starts sending it.
+    void flush(void);
+
+    // True when every subscriber queue is empty.
+    bool idle(void) const;
+
+    size_t subscriberCount(void) const {
+        return subscribers.size();
+    }
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+    // Records the batch, deliver and end to end stages in latency, or stops
+    // if it is NULL.
+    void traceLatency(PipelineLatency *latency);
+
+private:
+    struct SealedBatch {
+        std::vector<uint8_t> bytes;
+        uint64_t sealedNs;                  // when traced
+        std::vector<uint64_t> receivedNs;   // of each record, when traced
+    };
+
+    typedef std::shared_ptr<const SealedBatch> Batch;
+
+    struct Subscriber {
+        std::deque<Batch> queue;
+        bool waitingForOutput;  // EPOLLOUT registered
+    };
+
+    void send(int fd, Subscriber &subscriber);
+    void remove(int fd);
+    void watchOutput(int fd, Subscriber &subscriber, bool enable);
+
+    int epollFd;
+    int listener;
+    std::string path;
+    size_t maxBatchRecords;
+    size_t maxQueuedBatches;
+    std::vector<uint8_t> open;
+    size_t openCount;
+    std::vector<uint64_t> openReceivedNs;
+    std::vector<uint64_t> openPublishedNs;
+    PipelineLatency *latency;
+    uint16_t sequence;
+    std::map<int, Subscriber> subscribers;
+    Stats counters;
+};
+
+#endif // URIBEACON_PUBLISHER_H__
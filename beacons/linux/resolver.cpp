@@ -0,0 +1,183 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resolver.h"
+
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+static uint64_t wallClockS(void) {
+    return static_cast<uint64_t>(time(NULL));
+}
+
+static uint64_t monotonicUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+MetadataResolver::MetadataResolver(const ResolverOptions &options)
+    : options(options),
+      active(0),
+      stopping(false),
+      latencies(RESOLVER_LATENCY_SAMPLES, 0),
+      latencyCount(0) {
+    if (this->options.clock == NULL) {
+        this->options.clock = wallClockS;
+    }
+    if (this->options.concurrency == 0) {
+        this->options.concurrency = 1;
+    }
+    memset(&counters, 0, sizeof(counters));
+}
+
+MetadataResolver::~MetadataResolver() {
+    drain();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+bool MetadataResolver::start(void) {
+    if (!cache.open(options.cachePath, options.cacheEntries)) {
+        return false;
+    }
+    for (unsigned i = 0; i < options.concurrency; i++) {
+        workers.push_back(std::thread(&MetadataResolver::work, this));
+    }
+    return true;
+}
+
+uint64_t MetadataResolver::now(void) const {
+    return options.clock();
+}
+
+// Called with the lock held.
+void MetadataResolver::recordLatency(uint64_t startUs) {
+    uint64_t elapsed = monotonicUs() - startUs;
+    latencies[latencyCount++ % RESOLVER_LATENCY_SAMPLES] =
+        static_cast<uint32_t>(std::min<uint64_t>(elapsed, UINT32_MAX));
+}
+
+void MetadataResolver::resolve(const std::string &url, Callback callback, void *context) {
+    Waiter waiter = { callback, context, monotonicUs() };
+    PageMetadata metadata;
+
+    std::unique_lock<std::mutex> guard(lock);
+    counters.requests++;
+    int result = cache.lookup(url, now(), metadata);
+    if (result != METADATA_CACHE_MISS) {
+        if (result == METADATA_CACHE_HIT) {
+            counters.hits++;
+        } else {
+            counters.negativeHits++;
+        }
+        recordLatency(waiter.startUs);
+        guard.unlock();
+        callback(url, metadata, context);
+        return;
+    }
+
+    auto found = pending.find(url);
+    if (found != pending.end()) {
+        counters.coalesced++;
+        found->second.push_back(waiter);
+        return;
+    }
+    pending[url].push_back(waiter);
+    queue.push_back(url);
+    guard.unlock();
+    queued.notify_one();
+}
+
+void MetadataResolver::work(void) {
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;) {
+        while (queue.empty() && !stopping) {
+            queued.wait(guard);
+        }
+        if (queue.empty()) {
+            return;
+        }
+        std::string url = queue.front();
+        queue.pop_front();
+        counters.fetches++;
+        active++;
+        counters.peakFetches = std::max(counters.peakFetches, active);
+        guard.unlock();
+
+        PageMetadata metadata = fetchMetadata(url, options.fetch);
+
+        guard.lock();
+        bool ok = metadata.status == 200;
+        if (!ok) {
+            counters.failures++;
+        }
+        cache.store(url, metadata, now() + (ok ? options.ttlS : options.negativeTtlS));
+        std::vector<Waiter> waiters;
+        waiters.swap(pending[url]);
+        pending.erase(url);
+        for (size_t i = 0; i < waiters.size(); i++) {
+            recordLatency(waiters[i].startUs);
+        }
+        guard.unlock();
+
+        for (size_t i = 0; i < waiters.size(); i++) {
+            waiters[i].callback(url, metadata, waiters[i].context);
+        }
+
+        guard.lock();
+        active--;
+        if (pending.empty() && (active == 0)) {
+            answered.notify_all();
+        }
+    }
+}
+
+void MetadataResolver::drain(void) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!pending.empty() || (active != 0)) {
+        answered.wait(guard);
+    }
+}
+
+MetadataResolver::Stats MetadataResolver::stats(void) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+uint64_t MetadataResolver::latencyPercentile(double percentile) const {
+    std::vector<uint32_t> samples;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t count = std::min<size_t>(latencyCount, RESOLVER_LATENCY_SAMPLES);
+        samples.assign(latencies.begin(), latencies.begin() + count);
+    }
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(percentile / 100 * samples.size());
+    rank = std::min(rank, samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
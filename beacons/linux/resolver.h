@@ -0,0 +1,122 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Asynchronous page metadata resolver.
+//
+// resolve() answers from the cache when it can. Otherwise the URL is queued
+// for one of a fixed number of worker threads, which bounds the fetches in
+// flight. Requests for a URL that is already queued or being fetched join
+// that fetch instead of starting another, so a venue full of beacons
+// advertising one URL costs one fetch. Results, failures included, are
+// cached; see metadata_cache.h.
+
+#ifndef URIBEACON_RESOLVER_H__
+#define URIBEACON_RESOLVER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "http_fetch.h"
+#include "metadata_cache.h"
+
+// Latency samples kept for the percentiles.
+#define RESOLVER_LATENCY_SAMPLES        (65536)
+
+struct ResolverOptions {
+    std::string cachePath;      // empty to cache in memory only
+    size_t cacheEntries;
+    unsigned concurrency;       // fetches in flight
+    unsigned ttlS;
+    unsigned negativeTtlS;      // for 404s and unreachable hosts
+    FetchOptions fetch;
+    uint64_t (*clock)(void);    // wall clock seconds, for expiry
+
+    ResolverOptions()
+        : cacheEntries(4096),
+          concurrency(8),
+          ttlS(86400),
+          negativeTtlS(300),
+          clock(NULL) {
+    }
+};
+
+class MetadataResolver {
+public:
+    struct Stats {
+        uint64_t requests;
+        uint64_t hits;
+        uint64_t negativeHits;
+        uint64_t fetches;
+        uint64_t coalesced;     // requests that joined a pending fetch
+        uint64_t failures;      // fetches without a 200
+        unsigned peakFetches;   // most fetches in flight at once
+    };
+
+    // Called once per resolve(), from the caller's thread on a cache hit and
+    // from a worker thread otherwise.
+    typedef void (*Callback)(const std::string &url, const PageMetadata &metadata, void *context);
+
+    explicit MetadataResolver(const ResolverOptions &options);
+
+    // Waits for pending requests, then stops the workers.
+    ~MetadataResolver();
+
+    // Opens the cache and starts the workers. Returns false with errno set.
+    bool start(void);
+
+    void resolve(const std::string &url, Callback callback, void *context);
+
+    // Waits until every request made so far has been answered.
+    void drain(void);
+
+    Stats stats(void) const;
+
+    // Latency from resolve() to the callback, in microseconds, at
+    // percentile (0, 100], over the most recent requests.
+    uint64_t latencyPercentile(double percentile) const;
+
+private:
+    struct Waiter {
+        Callback callback;
+        void *context;
+        uint64_t startUs;
+    };
+
+    void work(void);
+    uint64_t now(void) const;
+    void recordLatency(uint64_t startUs);
+
+    ResolverOptions options;
+    MetadataCache cache;
+    mutable std::mutex lock;
+    std::condition_variable queued;
+    std::condition_variable answered;
+    std::deque<std::string> queue;
+    std::unordered_map<std::string, std::vector<Waiter> > pending;
+    std::vector<std::thread> workers;
+    unsigned active;
+    bool stopping;
+    std::vector<uint32_t> latencies;    // ring of samples
+    size_t latencyCount;
+    Stats counters;
+};
+
+#endif // URIBEACON_RESOLVER_H__
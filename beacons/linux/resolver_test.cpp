@@ -0,0 +1,451 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests and benchmark for the metadata resolver, against a stand-in HTTP
+// server on the loopback interface.
+//
+//   resolver_test               run the tests
+//   resolver_test --bench       hit rate and latency for a skewed workload
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "http_fetch.h"
+#include "metadata_cache.h"
+#include "resolver.h"
+#include "test_util.h"
+
+#define EXPECT_STREQ(expected, actual)                                      \
+    do {                                                                    \
+        std::string e = (expected), a = (actual);                           \
+        if (e != a) {                                                       \
+            fprintf(stderr, "%s:%d: expected %s == \"%s\", got \"%s\"\n",   \
+                    __FILE__, __LINE__, #actual, e.c_str(), a.c_str());     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// Serves a few fixed pages, each connection on its own thread:
+//
+//   /page      a page with a title and a relative icon
+//   /slow/...  the same after delayMs
+//   /moved     a redirect to /page
+//   /loop      a redirect to itself
+//   anything else is a 404
+class StandInServer {
+public:
+    std::atomic<unsigned> delayMs;
+
+    StandInServer()
+        : delayMs(0),
+          connections(0),
+          peak(0) {
+        listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if ((bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) ||
+            (::listen(listener, 128) < 0) ||
+            (getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) < 0)) {
+            perror("stand-in server");
+            exit(EXIT_FAILURE);
+        }
+        port = ntohs(address.sin_port);
+        acceptor = std::thread(&StandInServer::run, this);
+    }
+
+    ~StandInServer() {
+        shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        close(listener);
+        while (connections != 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::string url(const char *path) const {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    unsigned hits(const std::string &path) {
+        std::lock_guard<std::mutex> guard(lock);
+        return requests[path];
+    }
+
+    unsigned peakConnections(void) const {
+        return peak;
+    }
+
+private:
+    void run(void) {
+        for (;;) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            unsigned now = ++connections;
+            unsigned seen = peak;
+            while ((now > seen) && !peak.compare_exchange_weak(seen, now)) {
+            }
+            std::thread(&StandInServer::serve, this, fd).detach();
+        }
+    }
+
+    void serve(int fd) {
+        std::string request;
+        char buffer[1024];
+        ssize_t length;
+        while ((request.find("\r\n\r\n") == std::string::npos) &&
+               ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)) {
+            request.append(buffer, length);
+        }
+        size_t start = request.find(' ') + 1;
+        std::string path = request.substr(start, request.find(' ', start) - start);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            requests[path]++;
+        }
+
+        std::string response;
+        if ((path == "/page") || (path.compare(0, 6, "/slow/") == 0)) {
+            if (path != "/page") {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            }
+            std::string body = "<html><head>\n<TITLE>  Uri&amp;Beacon\n  page </TITLE>\n"
+                               "<link rel=\"stylesheet\" href=\"a.css\">\n"
+                               "<link\trel='shortcut icon' href=img/icon.png>\n</head></html>";
+            response = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n" + body;
+        } else if (path == "/moved") {
+            response = "HTTP/1.1 302 Found\r\nLocation: /page\r\n\r\n";
+        } else if (path == "/loop") {
+            response = "HTTP/1.1 301 Moved Permanently\r\nlocation:  /loop\r\n\r\n";
+        } else {
+            response = "HTTP/1.1 404 Not Found\r\n\r\nnot here";
+        }
+        // Done before replying, so a client's next request cannot be
+        // counted as overlapping this one.
+        connections--;
+        send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        close(fd);
+    }
+
+    int listener;
+    unsigned short port;
+    std::thread acceptor;
+    std::atomic<unsigned> connections;
+    std::atomic<unsigned> peak;
+    std::mutex lock;
+    std::map<std::string, unsigned> requests;
+};
+
+// Counts callbacks and keeps the last result.
+struct Answers {
+    std::mutex lock;
+    unsigned count;
+    PageMetadata last;
+
+    Answers()
+        : count(0) {
+    }
+};
+
+static void onAnswer(const std::string &url, const PageMetadata &metadata, void *context) {
+    Answers *answers = static_cast<Answers *>(context);
+    std::lock_guard<std::mutex> guard(answers->lock);
+    answers->count++;
+    answers->last = metadata;
+}
+
+static uint64_t fakeNowS = 1000;
+
+static uint64_t fakeClock(void) {
+    return fakeNowS;
+}
+
+static void testParseMetadata(void) {
+    PageMetadata metadata;
+    parseMetadata("<head><title>A &lt;b&gt;</title><LINK HREF=\"/i.ico\" REL=\"icon\"></head>",
+                  "http://example.com/a/b?c", metadata);
+    EXPECT_STREQ("A <b>", metadata.title);
+    EXPECT_STREQ("http://example.com/i.ico", metadata.icon);
+
+    PageMetadata relative;
+    parseMetadata("<link rel=icon href=x.png>", "http://example.com/a/b", relative);
+    EXPECT_STREQ("", relative.title);
+    EXPECT_STREQ("http://example.com/a/x.png", relative.icon);
+
+    PageMetadata schemeRelative;
+    parseMetadata("<link rel=\"apple-touch-icon\" href=\"//cdn.example.com/t.png\">",
+                  "https://example.com", schemeRelative);
+    EXPECT_STREQ("https://cdn.example.com/t.png", schemeRelative.icon);
+}
+
+static void testFetch(StandInServer &server) {
+    FetchOptions options;
+    PageMetadata page = fetchMetadata(server.url("/page"), options);
+    EXPECT_EQ(200, page.status);
+    EXPECT_STREQ("Uri&Beacon page", page.title);
+    EXPECT_STREQ(server.url("/img/icon.png"), page.icon);
+
+    PageMetadata moved = fetchMetadata(server.url("/moved"), options);
+    EXPECT_EQ(200, moved.status);
+    EXPECT_STREQ("Uri&Beacon page", moved.title);
+
+    EXPECT_EQ(404, fetchMetadata(server.url("/missing"), options).status);
+    EXPECT_EQ(FETCH_ERR_REDIRECTS, fetchMetadata(server.url("/loop"), options).status);
+    EXPECT_EQ(4, server.hits("/loop"));
+    EXPECT_EQ(FETCH_ERR_UNSUPPORTED, fetchMetadata("https://127.0.0.1/", options).status);
+    EXPECT_EQ(FETCH_ERR_URL, fetchMetadata("ftp://127.0.0.1/", options).status);
+
+    // Through a proxy the request line carries the absolute URL.
+    options.proxyHost = "127.0.0.1";
+    options.proxyPort = server.url("").substr(17);
+    EXPECT_EQ(404, fetchMetadata("https://example.com/page", options).status);
+    EXPECT_EQ(1, server.hits("https://example.com/page"));
+}
+
+static void testCoalescing(StandInServer &server) {
+    ResolverOptions options;
+    options.concurrency = 4;
+    MetadataResolver resolver(options);
+    EXPECT_EQ(true, resolver.start());
+    Answers answers;
+
+    server.delayMs = 100;
+    for (int i = 0; i < 50; i++) {
+        resolver.resolve(server.url("/slow/one"), onAnswer, &answers);
+    }
+    resolver.drain();
+    server.delayMs = 0;
+
+    EXPECT_EQ(50, answers.count);
+    EXPECT_EQ(1, server.hits("/slow/one"));
+    EXPECT_EQ(1, resolver.stats().fetches);
+    EXPECT_EQ(49, resolver.stats().coalesced);
+    EXPECT_STREQ("Uri&Beacon page", answers.last.title);
+
+    // Now cached.
+    resolver.resolve(server.url("/slow/one"), onAnswer, &answers);
+    EXPECT_EQ(51, answers.count);
+    EXPECT_EQ(1, resolver.stats().hits);
+    EXPECT_EQ(1, server.hits("/slow/one"));
+}
+
+static void testConcurrencyBound(StandInServer &server) {
+    ResolverOptions options;
+    options.concurrency = 3;
+    MetadataResolver resolver(options);
+    EXPECT_EQ(true, resolver.start());
+    Answers answers;
+
+    server.delayMs = 20;
+    for (int i = 0; i < 12; i++) {
+        resolver.resolve(server.url(("/slow/bound" + std::to_string(i)).c_str()), onAnswer, &answers);
+    }
+    resolver.drain();
+    server.delayMs = 0;
+
+    EXPECT_EQ(12, answers.count);
+    EXPECT_EQ(12, resolver.stats().fetches);
+    EXPECT_EQ(3, resolver.stats().peakFetches);
+    EXPECT_EQ(true, server.peakConnections() <= 3);
+}
+
+static void testNegativeCachingAndExpiry(StandInServer &server) {
+    ResolverOptions options;
+    options.clock = fakeClock;
+    options.ttlS = 100;
+    options.negativeTtlS = 10;
+    MetadataResolver resolver(options);
+    EXPECT_EQ(true, resolver.start());
+    Answers answers;
+
+    resolver.resolve(server.url("/gone"), onAnswer, &answers);
+    resolver.drain();
+    EXPECT_EQ(404, answers.last.status);
+    resolver.resolve(server.url("/gone"), onAnswer, &answers);
+    EXPECT_EQ(404, answers.last.status);
+    EXPECT_EQ(1, resolver.stats().negativeHits);
+    EXPECT_EQ(1, server.hits("/gone"));
+
+    resolver.resolve(server.url("/page"), onAnswer, &answers);
+    resolver.drain();
+    unsigned pageFetches = server.hits("/page");
+
+    // The failure expires long before the page.
+    fakeNowS += 10;
+    resolver.resolve(server.url("/gone"), onAnswer, &answers);
+    resolver.resolve(server.url("/page"), onAnswer, &answers);
+    resolver.drain();
+    EXPECT_EQ(2, server.hits("/gone"));
+    EXPECT_EQ(pageFetches, server.hits("/page"));
+
+    fakeNowS += 90;
+    resolver.resolve(server.url("/page"), onAnswer, &answers);
+    resolver.drain();
+    EXPECT_EQ(pageFetches + 1, server.hits("/page"));
+    EXPECT_EQ(6, answers.count);
+}
+
+static void testCachePersistsAndEvicts(void) {
+    char path[] = "/tmp/metadata_cache_testXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    PageMetadata page;
+    page.status = 200;
+    page.title = "Title";
+    page.icon = "http://example.com/icon.png";
+    PageMetadata found;
+
+    {
+        MetadataCache cache;
+        EXPECT_EQ(true, cache.open(path, 3));
+        EXPECT_EQ(true, cache.store("http://a", page, 100));
+        EXPECT_EQ(true, cache.store("http://b", page, 100));
+        EXPECT_EQ(true, cache.store("http://c", page, 100));
+        // a becomes the most recently used, so b goes first.
+        EXPECT_EQ(METADATA_CACHE_HIT, cache.lookup("http://a", 50, found));
+        EXPECT_EQ(false, cache.store(std::string(METADATA_CACHE_URL_MAX + 1, 'x'), page, 100));
+    }
+    {
+        MetadataCache cache;
+        EXPECT_EQ(true, cache.open(path, 3));
+        EXPECT_EQ(3, cache.size());
+        EXPECT_EQ(METADATA_CACHE_HIT, cache.lookup("http://c", 50, found));
+        EXPECT_STREQ("Title", found.title);
+        EXPECT_STREQ("http://example.com/icon.png", found.icon);
+        EXPECT_EQ(METADATA_CACHE_MISS, cache.lookup("http://c", 100, found));
+
+        PageMetadata missing;
+        missing.status = FETCH_ERR_CONNECT;
+        EXPECT_EQ(true, cache.store("http://d", missing, 100));
+        EXPECT_EQ(1, cache.stats().evictions);
+        EXPECT_EQ(METADATA_CACHE_MISS, cache.lookup("http://b", 50, found));
+        EXPECT_EQ(METADATA_CACHE_NEGATIVE, cache.lookup("http://d", 50, found));
+        EXPECT_EQ(FETCH_ERR_CONNECT, found.status);
+    }
+
+    // A damaged record is dropped, the rest survive.
+    fd = open(path, O_RDWR);
+    char garbage = 'Z';
+    for (off_t offset = 64 + 24; offset < 64 + 3 * 512; offset += 512) {
+        char byte;
+        if ((pread(fd, &byte, 1, offset) == 1) && (byte == 'h') &&
+            (pread(fd, &byte, 1, offset + 7) == 1) && (byte == 'a')) {
+            EXPECT_EQ(1, pwrite(fd, &garbage, 1, offset + 7));
+        }
+    }
+    close(fd);
+    {
+        MetadataCache cache;
+        EXPECT_EQ(true, cache.open(path, 3));
+        EXPECT_EQ(1, cache.stats().corrupt);
+        EXPECT_EQ(2, cache.size());
+        EXPECT_EQ(METADATA_CACHE_MISS, cache.lookup("http://a", 50, found));
+        EXPECT_EQ(METADATA_CACHE_NEGATIVE, cache.lookup("http://d", 50, found));
+    }
+
+    // Another capacity starts over.
+    {
+        MetadataCache cache;
+        EXPECT_EQ(true, cache.open(path, 4));
+        EXPECT_EQ(0, cache.size());
+    }
+    unlink(path);
+}
+
+// A venue's worth of beacons: a few popular URLs and a long tail, requested
+// at a steady rate as their sightings arrive. The first pass starts with an
+// empty cache; the second shows the steady state.
+static int runBenchmark(void) {
+    static const int REQUESTS = RESOLVER_LATENCY_SAMPLES;    // a pass fills the window
+    static const int URLS = 2000;
+    static const int BURST = 100;       // per millisecond
+    StandInServer server;
+    server.delayMs = 5;
+    ResolverOptions options;
+    MetadataResolver resolver(options);
+    if (!resolver.start()) {
+        perror("resolver");
+        return EXIT_FAILURE;
+    }
+    Answers answers;
+    printf("%d requests for %d URLs per pass, concurrency %u, origin latency %u ms\n",
+           REQUESTS, URLS, options.concurrency, static_cast<unsigned>(server.delayMs));
+
+    MetadataResolver::Stats before = resolver.stats();
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t seed = 1;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REQUESTS; i++) {
+            seed = seed * 1103515245 + 12345;
+            // Roughly Zipf: the cube of a uniform variable favours low ids.
+            double uniform = ((seed >> 8) & 0xFFFF) / 65536.0;
+            int id = static_cast<int>(uniform * uniform * uniform * URLS);
+            resolver.resolve(server.url(("/slow/" + std::to_string(id)).c_str()), onAnswer, &answers);
+            if ((i % BURST) == BURST - 1) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        resolver.drain();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        MetadataResolver::Stats stats = resolver.stats();
+        uint64_t hits = stats.hits + stats.negativeHits - before.hits - before.negativeHits;
+        uint64_t coalesced = stats.coalesced - before.coalesced;
+        printf("%s: %.2f s, hit rate %.1f%% (%llu hits, %llu coalesced, %llu fetches), "
+               "latency p50 %llu us, p99 %llu us, p99.9 %llu us\n",
+               pass == 0 ? "cold" : "warm", seconds, 100.0 * (hits + coalesced) / REQUESTS,
+               (unsigned long long)hits, (unsigned long long)coalesced,
+               (unsigned long long)(stats.fetches - before.fetches),
+               (unsigned long long)resolver.latencyPercentile(50),
+               (unsigned long long)resolver.latencyPercentile(99),
+               (unsigned long long)resolver.latencyPercentile(99.9));
+        before = stats;
+    }
+    return answers.count == 2 * REQUESTS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    if ((argc > 1) && (strcmp(argv[1], "--bench") == 0)) {
+        return runBenchmark();
+    }
+
+    StandInServer server;
+    testParseMetadata();
+    testFetch(server);
+    testCoalescing(server);
+    testConcurrencyBound(server);
+    testNegativeCachingAndExpiry(server);
+    testCachePersistsAndEvicts();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
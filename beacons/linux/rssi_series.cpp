@@ -0,0 +1,264 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rssi_series.h"
+
+// A sample is at most a ten byte and a two byte varint.
+#define SAMPLE_BYTES_MAX                (12)
+
+// Larger gaps between samples would overflow the delta-of-delta.
+#define DELTA_MAX                       (static_cast<uint64_t>(1) << 62)
+
+static inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static inline uint8_t *putVarint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(value);
+    return p;
+}
+
+// Returns the byte after the varint, or NULL if it runs past end.
+static inline const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint64_t &value) {
+    if ((p < end) && (*p < 0x80)) {
+        value = *p;
+        return p + 1;
+    }
+    value = 0;
+    for (unsigned shift = 0; (p < end) && (shift < 64); shift += 7) {
+        uint8_t byte = *p++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static void put64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+RssiSeriesWriter::RssiSeriesWriter(size_t blockSamples)
+    : blockSamples(blockSamples),
+      blockStart(0),
+      count(0),
+      total(0),
+      firstMs(0),
+      previousMs(0),
+      previousDelta(0),
+      firstRssi(0),
+      previousRssi(0),
+      minRssi(0),
+      maxRssi(0) {
+    if (this->blockSamples == 0) {
+        this->blockSamples = 1;
+    } else if (this->blockSamples > RSSI_SERIES_BLOCK_SAMPLES_MAX) {
+        this->blockSamples = RSSI_SERIES_BLOCK_SAMPLES_MAX;
+    }
+}
+
+bool RssiSeriesWriter::append(uint64_t timestampMs, int8_t rssi) {
+    if ((total > 0) && ((timestampMs < previousMs) || (timestampMs - previousMs >= DELTA_MAX))) {
+        return false;
+    }
+    if (count == blockSamples) {
+        seal();
+    }
+    total++;
+
+    if (count == 0) {
+        blockStart = output.size();
+        output.resize(blockStart + RSSI_SERIES_HEADER_SIZE);
+        count = 1;
+        firstMs = previousMs = timestampMs;
+        previousDelta = 0;
+        firstRssi = previousRssi = minRssi = maxRssi = rssi;
+        return true;
+    }
+
+    int64_t delta = static_cast<int64_t>(timestampMs - previousMs);
+    size_t end = output.size();
+    output.resize(end + SAMPLE_BYTES_MAX);
+    uint8_t *p = &output[end];
+    p = putVarint(p, zigzag(delta - previousDelta));
+    p = putVarint(p, zigzag(rssi - previousRssi));
+    output.resize(p - &output[0]);
+
+    count++;
+    previousMs = timestampMs;
+    previousDelta = delta;
+    previousRssi = rssi;
+    if (rssi < minRssi) {
+        minRssi = rssi;
+    } else if (rssi > maxRssi) {
+        maxRssi = rssi;
+    }
+    return true;
+}
+
+void RssiSeriesWriter::patchHeader(void) {
+    uint8_t *header = &output[blockStart];
+    header[0] = RSSI_SERIES_MAGIC_0;
+    header[1] = RSSI_SERIES_MAGIC_1;
+    header[2] = RSSI_SERIES_VERSION;
+    header[3] = 0;
+    put16(&header[4], static_cast<uint16_t>(count));
+    put16(&header[6], static_cast<uint16_t>(output.size() - blockStart - RSSI_SERIES_HEADER_SIZE));
+    put64(&header[8], firstMs);
+    put64(&header[16], previousMs);
+    header[24] = static_cast<uint8_t>(minRssi);
+    header[25] = static_cast<uint8_t>(maxRssi);
+    header[26] = static_cast<uint8_t>(firstRssi);
+    header[27] = 0;
+}
+
+void RssiSeriesWriter::seal(void) {
+    if (count > 0) {
+        patchHeader();
+        count = 0;
+    }
+}
+
+const std::vector<uint8_t> &RssiSeriesWriter::data(void) {
+    if (count > 0) {
+        patchHeader();
+    }
+    return output;
+}
+
+RssiSeriesReader::RssiSeriesReader(const uint8_t *data, size_t length)
+    : data(data),
+      length(length),
+      offset(0) {
+}
+
+int RssiSeriesReader::next(RssiBlock &block) {
+    if (offset == length) {
+        return 0;
+    }
+    const uint8_t *header = &data[offset];
+    if ((length - offset < RSSI_SERIES_HEADER_SIZE) || (header[0] != RSSI_SERIES_MAGIC_0) ||
+        (header[1] != RSSI_SERIES_MAGIC_1) || (header[2] != RSSI_SERIES_VERSION)) {
+        return -1;
+    }
+    block.count = get16(&header[4]);
+    block.payloadLength = get16(&header[6]);
+    block.firstMs = get64(&header[8]);
+    block.lastMs = get64(&header[16]);
+    block.minRssi = static_cast<int8_t>(header[24]);
+    block.maxRssi = static_cast<int8_t>(header[25]);
+    block.firstRssi = static_cast<int8_t>(header[26]);
+    block.payload = &header[RSSI_SERIES_HEADER_SIZE];
+    if ((block.count == 0) || (block.count > RSSI_SERIES_BLOCK_SAMPLES_MAX) ||
+        (block.payloadLength > length - offset - RSSI_SERIES_HEADER_SIZE) ||
+        (block.lastMs < block.firstMs)) {
+        return -1;
+    }
+    offset += RSSI_SERIES_HEADER_SIZE + block.payloadLength;
+    return 1;
+}
+
+int RssiSeriesReader::decode(const RssiBlock &block, RssiSample *samples) {
+    const uint8_t *p = block.payload;
+    const uint8_t *end = block.payload + block.payloadLength;
+    uint64_t timestamp = block.firstMs;
+    int64_t delta = 0;
+    int rssi = block.firstRssi;
+
+    samples[0].timestampMs = timestamp;
+    samples[0].rssi = block.firstRssi;
+    for (unsigned i = 1; i < block.count; i++) {
+        uint64_t value;
+        p = getVarint(p, end, value);
+        if (p == NULL) {
+            return -1;
+        }
+        delta += unzigzag(value);
+        timestamp += delta;
+        p = getVarint(p, end, value);
+        if (p == NULL) {
+            return -1;
+        }
+        rssi += static_cast<int>(unzigzag(value));
+        if ((rssi < INT8_MIN) || (rssi > INT8_MAX)) {
+            return -1;
+        }
+        samples[i].timestampMs = timestamp;
+        samples[i].rssi = static_cast<int8_t>(rssi);
+    }
+    if ((p != end) || (timestamp != block.lastMs)) {
+        return -1;
+    }
+    return block.count;
+}
+
+int findRssiSamples(const uint8_t *data, size_t length, uint64_t fromMs, uint64_t toMs,
+                    int8_t minRssi, std::vector<RssiSample> &matches) {
+    RssiSeriesReader reader(data, length);
+    RssiBlock block;
+    RssiSample samples[RSSI_SERIES_BLOCK_SAMPLES_MAX];
+    int decoded = 0;
+    int result;
+
+    while ((result = reader.next(block)) == 1) {
+        if (block.firstMs > toMs) {
+            break;
+        }
+        if ((block.lastMs < fromMs) || (block.maxRssi < minRssi)) {
+            continue;
+        }
+        int count = RssiSeriesReader::decode(block, samples);
+        if (count < 0) {
+            return -1;
+        }
+        decoded++;
+        for (int i = 0; i < count; i++) {
+            if ((samples[i].timestampMs >= fromMs) && (samples[i].timestampMs <= toMs) &&
+                (samples[i].rssi >= minRssi)) {
+                matches.push_back(samples[i]);
+            }
+        }
+    }
+    return result < 0 ? -1 : decoded;
+}
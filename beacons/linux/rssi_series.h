@@ -0,0 +1,130 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Compressed RSSI time series for one beacon.
+//
+// A series is a sequence of self-contained blocks of up to a few thousand
+// (timestamp, RSSI) samples. Beacons advertise at a nearly fixed period, so
+// each timestamp is stored as the change in the interval since the previous
+// sample, and each RSSI as the change from the previous RSSI, both as
+// zig-zag varints. A steady beacon costs two bytes a sample instead of nine.
+// The block header carries the time span and RSSI range, so queries skip
+// blocks without decoding them. All integers are little endian.
+//
+//   Block header
+//    0  magic 'R' 'T'
+//    2  version
+//    3  reserved, 0
+//    4  sample count (2)
+//    6  payload length (2)
+//    8  first timestamp, ms since the epoch (8)
+//   16  last timestamp (8)
+//   24  lowest RSSI
+//   25  highest RSSI
+//   26  first RSSI
+//   27  reserved, 0
+//   28  payload: per sample after the first, the zig-zag varint of the
+//       timestamp delta-of-delta, then the zig-zag varint of the RSSI delta
+
+#ifndef URIBEACON_RSSI_SERIES_H__
+#define URIBEACON_RSSI_SERIES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define RSSI_SERIES_MAGIC_0             ('R')
+#define RSSI_SERIES_MAGIC_1             ('T')
+#define RSSI_SERIES_VERSION             (1)
+#define RSSI_SERIES_HEADER_SIZE         (28)
+#define RSSI_SERIES_BLOCK_SAMPLES       (1024)
+#define RSSI_SERIES_BLOCK_SAMPLES_MAX   (4096)
+
+struct RssiSample {
+    uint64_t timestampMs;
+    int8_t rssi;
+};
+
+// A block header as read back, with its payload.
+struct RssiBlock {
+    uint16_t count;
+    int8_t minRssi;
+    int8_t maxRssi;
+    int8_t firstRssi;
+    uint64_t firstMs;
+    uint64_t lastMs;
+    const uint8_t *payload;
+    uint16_t payloadLength;
+};
+
+class RssiSeriesWriter {
+public:
+    explicit RssiSeriesWriter(size_t blockSamples = RSSI_SERIES_BLOCK_SAMPLES);
+
+    // Appends a sample. Returns false if it is older than the previous one.
+    bool append(uint64_t timestampMs, int8_t rssi);
+
+    // Ends the open block; the next sample starts another.
+    void seal(void);
+
+    // The encoded series, including the open block.
+    const std::vector<uint8_t> &data(void);
+
+    size_t samples(void) const {
+        return total;
+    }
+
+private:
+    void patchHeader(void);
+
+    std::vector<uint8_t> output;
+    size_t blockSamples;
+    size_t blockStart;          // offset of the open block's header
+    size_t count;               // samples in the open block, 0 if none
+    size_t total;
+    uint64_t firstMs;
+    uint64_t previousMs;
+    int64_t previousDelta;
+    int8_t firstRssi;
+    int8_t previousRssi;
+    int8_t minRssi;
+    int8_t maxRssi;
+};
+
+class RssiSeriesReader {
+public:
+    RssiSeriesReader(const uint8_t *data, size_t length);
+
+    // Reads the next block header. Returns 1, 0 at the end of the series or
+    // -1 if it is malformed.
+    int next(RssiBlock &block);
+
+    // Decodes a block into count samples. Returns the count, or -1 if the
+    // payload is malformed.
+    static int decode(const RssiBlock &block, RssiSample *samples);
+
+private:
+    const uint8_t *data;
+    size_t length;
+    size_t offset;
+};
+
+// Appends the samples in [fromMs, toMs] with an RSSI of at least minRssi to
+// matches, skipping blocks whose header rules them out. Returns the number
+// of blocks decoded, or -1 if the series is malformed.
+int findRssiSamples(const uint8_t *data, size_t length, uint64_t fromMs, uint64_t toMs,
+                    int8_t minRssi, std::vector<RssiSample> &matches);
+
+#endif // URIBEACON_RSSI_SERIES_H__
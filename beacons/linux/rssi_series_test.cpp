@@ -0,0 +1,302 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests and benchmark for the compressed RSSI time series.
+//
+//   rssi_series_test                        run the tests
+//   rssi_series_test --bench capture.txt    size and speed, synthetic and
+//                                           recorded
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <vector>
+#include "hci.h"
+#include "rssi_series.h"
+#include "test_util.h"
+
+// Size of a plain (timestamp, RSSI) pair, packed.
+#define RAW_SAMPLE_BYTES                (9)
+
+static uint32_t seed = 1;
+
+static uint32_t nextRandom(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// A beacon advertising every periodMs plus the 0-10 ms random delay the
+// link layer adds, with an RSSI wandering around -70.
+static std::vector<RssiSample> syntheticTrace(size_t length, unsigned periodMs) {
+    std::vector<RssiSample> samples(length);
+    uint64_t scheduled = 1425477600000ull;
+    int level = -70;
+
+    for (size_t i = 0; i < length; i++) {
+        scheduled += periodMs;
+        level += static_cast<int>(nextRandom() % 3) - 1;
+        level = level < -95 ? -95 : (level > -45 ? -45 : level);
+        samples[i].timestampMs = scheduled + nextRandom() % 11;
+        samples[i].rssi = static_cast<int8_t>(level + static_cast<int>(nextRandom() % 7) - 3);
+        if ((i > 0) && (samples[i].timestampMs < samples[i - 1].timestampMs)) {
+            samples[i].timestampMs = samples[i - 1].timestampMs;
+        }
+    }
+    return samples;
+}
+
+static std::vector<RssiSample> decodeAll(const std::vector<uint8_t> &data, int *blocks) {
+    std::vector<RssiSample> samples;
+    RssiSeriesReader reader(data.data(), data.size());
+    RssiBlock block;
+    RssiSample decoded[RSSI_SERIES_BLOCK_SAMPLES_MAX];
+    int result;
+
+    *blocks = 0;
+    while ((result = reader.next(block)) == 1) {
+        int count = RssiSeriesReader::decode(block, decoded);
+        if (count < 0) {
+            *blocks = -1;
+            return samples;
+        }
+        samples.insert(samples.end(), decoded, decoded + count);
+        (*blocks)++;
+    }
+    if (result < 0) {
+        *blocks = -1;
+    }
+    return samples;
+}
+
+static bool sameSamples(const std::vector<RssiSample> &a, const std::vector<RssiSample> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if ((a[i].timestampMs != b[i].timestampMs) || (a[i].rssi != b[i].rssi)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testRoundTrip(void) {
+    std::vector<RssiSample> trace = syntheticTrace(10000, 100);
+    RssiSeriesWriter writer(1000);
+    for (size_t i = 0; i < trace.size(); i++) {
+        EXPECT_EQ(true, writer.append(trace[i].timestampMs, trace[i].rssi));
+    }
+    int blocks;
+    std::vector<RssiSample> decoded = decodeAll(writer.data(), &blocks);
+    EXPECT_EQ(10, blocks);
+    EXPECT_EQ(true, sameSamples(trace, decoded));
+    // Jitter of up to 10 ms and RSSI steps of a few dB fit a byte each.
+    EXPECT_EQ(true, writer.data().size() < trace.size() * 2 + 10 * RSSI_SERIES_HEADER_SIZE);
+}
+
+static void testExtremes(void) {
+    static const RssiSample trace[] = {
+        { 0, -128 }, { 0, 127 }, { 1ull << 40, -128 }, { (1ull << 40) + 1, 0 },
+        { (1ull << 40) + 1, 127 }, { (1ull << 61), -1 }, { (1ull << 61) + 5, -128 },
+    };
+    RssiSeriesWriter writer(4);
+    std::vector<RssiSample> expected(trace, trace + sizeof(trace) / sizeof(trace[0]));
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(true, writer.append(expected[i].timestampMs, expected[i].rssi));
+    }
+    EXPECT_EQ(false, writer.append((1ull << 61) + 4, 0));
+    EXPECT_EQ(false, writer.append((1ull << 63) + (1ull << 62), 0));
+    EXPECT_EQ(expected.size(), writer.samples());
+
+    int blocks;
+    EXPECT_EQ(true, sameSamples(expected, decodeAll(writer.data(), &blocks)));
+    EXPECT_EQ(2, blocks);
+
+    // The open block is readable, and appending after reading carries on.
+    EXPECT_EQ(true, writer.append((1ull << 61) + 6, 5));
+    expected.push_back(RssiSample());
+    expected.back().timestampMs = (1ull << 61) + 6;
+    expected.back().rssi = 5;
+    EXPECT_EQ(true, sameSamples(expected, decodeAll(writer.data(), &blocks)));
+    EXPECT_EQ(2, blocks);
+}
+
+static void testBlockSkipping(void) {
+    RssiSeriesWriter writer(100);
+    for (int i = 0; i < 1000; i++) {
+        // Only the samples of the sixth block are stronger than -60 dBm.
+        int8_t rssi = (i >= 500) && (i < 600) ? -50 : -80;
+        writer.append(1000 + i * 100, rssi);
+    }
+    const std::vector<uint8_t> &data = writer.data();
+    std::vector<RssiSample> matches;
+
+    EXPECT_EQ(1, findRssiSamples(data.data(), data.size(), 0, UINT64_MAX, -60, matches));
+    EXPECT_EQ(100, matches.size());
+    EXPECT_EQ(1000 + 500 * 100, matches[0].timestampMs);
+
+    matches.clear();
+    EXPECT_EQ(2, findRssiSamples(data.data(), data.size(), 1000 + 250 * 100, 1000 + 349 * 100,
+                                 INT8_MIN, matches));
+    EXPECT_EQ(100, matches.size());
+
+    matches.clear();
+    EXPECT_EQ(0, findRssiSamples(data.data(), data.size(), 0, 999, INT8_MIN, matches));
+    EXPECT_EQ(0, matches.size());
+}
+
+static void testMalformed(void) {
+    RssiSeriesWriter writer(10);
+    std::vector<RssiSample> trace = syntheticTrace(25, 1000);
+    for (size_t i = 0; i < trace.size(); i++) {
+        writer.append(trace[i].timestampMs, trace[i].rssi);
+    }
+    std::vector<uint8_t> data = writer.data();
+    int blocks;
+
+    std::vector<uint8_t> truncated(data.begin(), data.end() - 1);
+    decodeAll(truncated, &blocks);
+    EXPECT_EQ(-1, blocks);
+
+    std::vector<uint8_t> badMagic(data);
+    badMagic[0] = 'X';
+    decodeAll(badMagic, &blocks);
+    EXPECT_EQ(-1, blocks);
+
+    // A payload that ends early leaves the last timestamp unmatched.
+    std::vector<uint8_t> shortPayload(data);
+    shortPayload[6]--;
+    decodeAll(shortPayload, &blocks);
+    EXPECT_EQ(-1, blocks);
+
+    std::vector<RssiSample> matches;
+    EXPECT_EQ(-1, findRssiSamples(truncated.data(), truncated.size(), 0, UINT64_MAX, INT8_MIN,
+                                  matches));
+}
+
+struct Traces {
+    std::map<uint64_t, std::vector<RssiSample> > beacons;
+};
+
+static void collectTraces(const HciFrame &frame, void *context) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    int count = parseAdvertisingReports(frame, reports);
+    for (int i = 0; i < count; i++) {
+        uint64_t key = 0;
+        for (int j = 0; j < 6; j++) {
+            key = (key << 8) | reports[i].address[j];
+        }
+        RssiSample sample = { frame.timestampUs / 1000, reports[i].rssi };
+        static_cast<Traces *>(context)->beacons[key].push_back(sample);
+    }
+}
+
+static void measure(const char *name, const std::vector<std::vector<RssiSample> > &traces) {
+    static const int PASSES = 5;
+    size_t samples = 0;
+    size_t bytes = 0;
+    uint64_t checksum = 0;
+    std::vector<RssiSeriesWriter> writers;
+
+    double encodeSeconds = 1e9;
+    for (int pass = 0; pass < PASSES; pass++) {
+        writers.assign(traces.size(), RssiSeriesWriter());
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < traces.size(); t++) {
+            for (size_t i = 0; i < traces[t].size(); i++) {
+                writers[t].append(traces[t][i].timestampMs, traces[t][i].rssi);
+            }
+        }
+        encodeSeconds = std::min(encodeSeconds, std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start).count());
+    }
+    for (size_t t = 0; t < traces.size(); t++) {
+        samples += traces[t].size();
+        bytes += writers[t].data().size();
+    }
+
+    double decodeSeconds = 1e9;
+    RssiSample decoded[RSSI_SERIES_BLOCK_SAMPLES_MAX];
+    for (int pass = 0; pass < PASSES; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < writers.size(); t++) {
+            const std::vector<uint8_t> &data = writers[t].data();
+            RssiSeriesReader reader(data.data(), data.size());
+            RssiBlock block;
+            while (reader.next(block) == 1) {
+                int count = RssiSeriesReader::decode(block, decoded);
+                checksum += decoded[count - 1].timestampMs + decoded[count / 2].rssi;
+            }
+        }
+        decodeSeconds = std::min(decodeSeconds, std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start).count());
+    }
+
+    double rawBytes = static_cast<double>(samples) * sizeof(RssiSample);
+    printf("%-10s %10zu samples %6.2f bytes/sample, %5.2fx smaller than %d byte pairs\n"
+           "%-10s encode %6.2f GB/s, decode %6.2f GB/s of %zu byte samples (checksum %llu)\n",
+           name, samples, static_cast<double>(bytes) / samples,
+           static_cast<double>(samples) * RAW_SAMPLE_BYTES / bytes, RAW_SAMPLE_BYTES,
+           "", rawBytes / encodeSeconds / 1e9, rawBytes / decodeSeconds / 1e9, sizeof(RssiSample),
+           (unsigned long long)checksum);
+}
+
+static int runBenchmark(const char *path) {
+    std::vector<std::vector<RssiSample> > synthetic;
+    for (int i = 0; i < 64; i++) {
+        synthetic.push_back(syntheticTrace(200000, i % 2 == 0 ? 100 : 1000));
+    }
+    measure("synthetic", synthetic);
+
+    Traces recorded;
+    HcidumpParser parser;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        parser.feed(buffer, length, collectTraces, &recorded);
+    }
+    parser.finish(collectTraces, &recorded);
+    fclose(file);
+
+    std::vector<std::vector<RssiSample> > traces;
+    for (auto it = recorded.beacons.begin(); it != recorded.beacons.end(); ++it) {
+        traces.push_back(it->second);
+    }
+    measure("recorded", traces);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if ((argc > 2) && (strcmp(argv[1], "--bench") == 0)) {
+        return runBenchmark(argv[2]);
+    }
+
+    testRoundTrip();
+    testExtremes();
+    testBlockSkipping();
+    testMalformed();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sighting.h"
+
+#include <string.h>
+
+#define AD_TYPE_SERVICE_DATA            (0x16)
+
+bool decodeSighting(const AdvertisingReport &report, uint64_t timestampUs, Sighting &sighting) {
+    const uint8_t *data = report.data;
+    uint8_t offset = 0;
+
+    // A scan response's service data continues a URI; it is no frame.
+    if (report.eventType == HCI_SCAN_RSP) {
+        return false;
+    }
+
+    while (offset < report.dataLength) {
+        uint8_t field = data[offset];
+        if ((field == 0) || (field > report.dataLength - offset - 1)) {
+            return false;
+        }
+        // Service data: UUID, flags, TX power and URI.
+        const uint8_t *ad = &data[offset + 1];
+        if ((ad[0] == AD_TYPE_SERVICE_DATA) && (field >= 1 + URIBEACON_SERVICE_DATA_HDR_SIZE) &&
+            (ad[1] == (URIBEACON_SERVICE_UUID & 0xFF)) &&
+            (ad[2] == (URIBEACON_SERVICE_UUID >> 8))) {
+            uint8_t uriLength = field - 1 - URIBEACON_SERVICE_DATA_HDR_SIZE;
+            if (uriLength > (report.extended ? SIGHTING_URI_MAX : URIBEACON_URI_MAX)) {
+                return false;
+            }
+            sighting.timestampUs = timestampUs;
+            for (int i = 0; i < 6; i++) {
+                sighting.address[i] = report.address[5 - i];
+            }
+            sighting.addressType = report.addressType;
+            sighting.rssi = report.rssi;
+            sighting.smoothedRssi = report.rssi;
+            sighting.txPower = static_cast<int8_t>(ad[4]);
+            sighting.flags = ad[3];
+            sighting.uriLength = uriLength;
+            memcpy(sighting.uri, &ad[5], uriLength);
+            memset(&sighting.uri[uriLength], 0, SIGHTING_URI_MAX - uriLength);
+            sighting.count = 1;
+            sighting.urlId = 0;
+            return true;
+        }
+        offset += field + 1;
+    }
+    return false;
+}
+
+bool sameBeacon(const Sighting &a, const Sighting &b) {
+    return (a.addressType == b.addressType) &&
+           (memcmp(a.address, b.address, sizeof(a.address)) == 0);
+}
+
+bool samePayload(const Sighting &a, const Sighting &b) {
+    return (a.flags == b.flags) && (a.txPower == b.txPower) && (a.uriLength == b.uriLength) &&
+           (memcmp(a.uri, b.uri, a.uriLength) == 0);
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+void writeBatchHeader(uint8_t *header, uint16_t count, uint16_t sequence) {
+    header[0] = SIGHTING_BATCH_MAGIC_0;
+    header[1] = SIGHTING_BATCH_MAGIC_1;
+    header[2] = SIGHTING_BATCH_VERSION;
+    header[3] = SIGHTING_RECORD_SIZE;
+    put16(&header[4], count);
+    put16(&header[6], sequence);
+}
+
+// Bytes of a URI of length past the record's inline part.
+static size_t uriTail(uint8_t length) {
+    return (length > URIBEACON_URI_MAX) ? length - URIBEACON_URI_MAX : 0;
+}
+
+size_t sightingRecordSize(const Sighting &sighting) {
+    return SIGHTING_RECORD_SIZE + uriTail(sighting.uriLength);
+}
+
+void writeSightingRecord(const Sighting &sighting, uint8_t *record) {
+    size_t tail = uriTail(sighting.uriLength);
+
+
+    for (int i = 0; i < 8; i++) {
+        record[i] = (sighting.timestampUs >> (8 * i)) & 0xFF;
+    }
+    memcpy(&record[8], sighting.address, 6);
+    record[14] = sighting.addressType;
+    record[15] = static_cast<uint8_t>(sighting.rssi);
+    record[16] = static_cast<uint8_t>(sighting.smoothedRssi);
+    record[17] = static_cast<uint8_t>(sighting.txPower);
+    record[18] = sighting.flags;
+    record[19] = sighting.uriLength;
+    memset(&record[20], 0, URIBEACON_URI_MAX);
+    memcpy(&record[20], sighting.uri, sighting.uriLength - tail);
+    put16(&record[38], sighting.count);
+    put16(&record[40], sighting.urlId & 0xFFFF);
+    put16(&record[42], sighting.urlId >> 16);
+    memcpy(&record[SIGHTING_RECORD_SIZE], &sighting.uri[URIBEACON_URI_MAX], tail);
+}
+
+int readBatchHeader(const uint8_t *batch, size_t length, uint16_t *sequence) {
+    if ((length < SIGHTING_BATCH_HEADER_SIZE) || (batch[0] != SIGHTING_BATCH_MAGIC_0) ||
+        (batch[1] != SIGHTING_BATCH_MAGIC_1) || (batch[2] != SIGHTING_BATCH_VERSION) ||
+        (batch[3] != SIGHTING_RECORD_SIZE)) {
+        return -1;
+    }
+    uint16_t count = get16(&batch[4]);
+    size_t offset = SIGHTING_BATCH_HEADER_SIZE;
+    for (uint16_t i = 0; i < count; i++) {
+        if ((length - offset < SIGHTING_RECORD_SIZE) || (batch[offset + 19] > SIGHTING_URI_MAX)) {
+            return -1;
+        }
+        offset += SIGHTING_RECORD_SIZE + uriTail(batch[offset + 19]);
+        if (offset > length) {
+            return -1;
+        }
+    }
+    if (offset != length) {
+        return -1;
+    }
+    if (sequence != NULL) {
+        *sequence = get16(&batch[6]);
+    }
+    return count;
+}
+
+size_t readSightingRecord(const uint8_t *record, Sighting &sighting) {
+    sighting.timestampUs = 0;
+    for (int i = 7; i >= 0; i--) {
+        sighting.timestampUs = (sighting.timestampUs << 8) | record[i];
+    }
+    memcpy(sighting.address, &record[8], 6);
+    sighting.addressType = record[14];
+    sighting.rssi = static_cast<int8_t>(record[15]);
+    sighting.smoothedRssi = static_cast<int8_t>(record[16]);
+    sighting.txPower = static_cast<int8_t>(record[17]);
+    sighting.flags = record[18];
+    sighting.uriLength =
+        record[19] <= SIGHTING_URI_MAX ? record[19] : SIGHTING_URI_MAX;
+    size_t tail = uriTail(sighting.uriLength);
+    memset(sighting.uri, 0, SIGHTING_URI_MAX);
+    memcpy(sighting.uri, &record[20], URIBEACON_URI_MAX);
+    memcpy(&sighting.uri[URIBEACON_URI_MAX], &record[SIGHTING_RECORD_SIZE], tail);
+    sighting.count = get16(&record[38]);
+    sighting.urlId = get16(&record[40]) | (static_cast<uint32_t>(get16(&record[42])) << 16);
+    return SIGHTING_RECORD_SIZE + tail;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// UriBeacon sightings and the binary batch format the gateway publishes.
+//
+// A batch is one SOCK_SEQPACKET message: an 8 byte header followed by count
+// records. All integers are little endian. A record is 44 bytes, followed by
+// the rest of its URI when that is longer than the 18 bytes held inline.
+//
+//   Header                          Record
+//    0  magic 'U' 'S'                0  timestamp, us since the epoch (8)
+//    2  version                      8  address, most significant byte first (6)
+//    3  record size, without URI    14  address type
+//    4  record count (2)            15  RSSI of the last advertisement
+//    6  batch sequence number,      16  smoothed RSSI
+//       wrapping (2)                17  TX power
+//                                   18  UriBeacon flags
+//                                   19  encoded URI length
+//                                   20  encoded URI, first 18 bytes,
+//                                       zero padded (18)
+//                                   38  advertisements folded in (2)
+//                                   40  URL id (4)
+//                                   44  rest of the encoded URI, if
+//                                       longer than 18 bytes
+//
+// The URI is left encoded; uribeacon_uri_decode() in beacons/core expands it.
+// It is longer than 18 bytes when the beacon continued it in its scan
+// response (see joiner.h) or sent it in an extended advertisement. Those are
+// rare, so the common record stays compact.
+// The URL id is the gateway's interned id for the encoded URI (see
+// url_table.h), so subscribers can cache the text by id.
+
+#ifndef URIBEACON_SIGHTING_H__
+#define URIBEACON_SIGHTING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hci.h"
+#include "uribeacon_core.h"
+
+#define SIGHTING_BATCH_MAGIC_0          ('U')
+#define SIGHTING_BATCH_MAGIC_1          ('S')
+#define SIGHTING_BATCH_VERSION          (5)
+#define SIGHTING_BATCH_HEADER_SIZE      (8)
+// A record without the URI past the first URIBEACON_URI_MAX bytes.
+#define SIGHTING_RECORD_SIZE            (44)
+// Largest batch. A SOCK_SEQPACKET message longer than the socket's send
+// buffer, 212992 bytes by default, fails with EMSGSIZE, so batches are kept
+// well under it and subscribers receive into a buffer of this size.
+#define SIGHTING_BATCH_MAX              (65536)
+// Most records a batch holds; long URIs may seal it sooner.
+#define SIGHTING_BATCH_RECORDS_MAX \
+    ((SIGHTING_BATCH_MAX - SIGHTING_BATCH_HEADER_SIZE) / SIGHTING_RECORD_SIZE)
+
+// Longest encoded URI a sighting carries, from an extended advertisement.
+#define SIGHTING_URI_MAX                (200)
+
+struct Sighting {
+    uint64_t timestampUs;
+    uint8_t address[6];         // most significant byte first
+    uint8_t addressType;
+    int8_t rssi;
+    int8_t smoothedRssi;
+    int8_t txPower;
+    uint8_t flags;
+    uint8_t uriLength;
+    uint8_t uri[SIGHTING_URI_MAX];
+    uint16_t count;
+    uint32_t urlId;
+};
+
+// Extracts a sighting from an advertisement carrying UriBeacon service data;
+// scan responses are left to the joiner. The URI may run past 18 bytes only in
+// an extended report. smoothedRssi is the RSSI, count is 1 and urlId is 0.
+// The URI is not decoded here; UrlTable::intern() validates each distinct URI
+// once.
+bool decodeSighting(const AdvertisingReport &report, uint64_t timestampUs, Sighting &sighting);
+
+// Same beacon: address and address type.
+bool sameBeacon(const Sighting &a, const Sighting &b);
+
+// Same advertised content: flags, TX power and URI.
+bool samePayload(const Sighting &a, const Sighting &b);
+
+void writeBatchHeader(uint8_t *header, uint16_t count, uint16_t sequence);
+
+// Bytes of the record of sighting, which writeSightingRecord() fills.
+size_t sightingRecordSize(const Sighting &sighting);
+void writeSightingRecord(const Sighting &sighting, uint8_t *record);
+
+// Validates a received batch, and that its records fill it exactly. Returns
+// the record count, or -1.
+int readBatchHeader(const uint8_t *batch, size_t length, uint16_t *sequence);
+
+// Reads a record of a batch readBatchHeader() accepted. Returns its size, the
+// offset of the next record.
+size_t readSightingRecord(const uint8_t *record, Sighting &sighting);
+
+#endif // URIBEACON_SIGHTING_H__
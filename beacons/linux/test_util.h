@@ -0,0 +1,36 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Checks shared by the unit tests. Each test is one translation unit with its
+// own failure count, and main() exits non-zero if it is not 0.
+
+#ifndef URIBEACON_TEST_UTIL_H__
+#define URIBEACON_TEST_UTIL_H__
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define EXPECT_EQ(expected, actual)                                         \
+    do {                                                                    \
+        long long e = (expected), a = (actual);                             \
+        if (e != a) {                                                       \
+            fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n",       \
+                    __FILE__, __LINE__, #actual, e, a);                     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#endif // URIBEACON_TEST_UTIL_H__
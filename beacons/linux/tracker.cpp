@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tracker.h"
+
+// Weight of a new advertisement in the smoothed RSSI.
+#define RSSI_SMOOTHING_DIVISOR          (4)
+
+BeaconTracker::BeaconTracker(uint32_t publishIntervalMs, uint32_t expiryMs, size_t maxBeacons)
+    : publishIntervalUs(static_cast<uint64_t>(publishIntervalMs) * 1000),
+      expiryUs(static_cast<uint64_t>(expiryMs) * 1000),
+      maxBeacons(maxBeacons),
+      rejectedCount(0) {
+}
+
+uint64_t BeaconTracker::key(const Sighting &sighting) {
+    uint64_t value = sighting.addressType;
+    for (int i = 0; i < 6; i++) {
+        value = (value << 8) | sighting.address[i];
+    }
+    return value;
+}
+
+bool BeaconTracker::update(const Sighting &sighting, Sighting &out) {
+    uint64_t beaconKey = key(sighting);
+    auto found = beacons.find(beaconKey);
+
+    if (found == beacons.end()) {
+        if (beacons.size() >= maxBeacons) {
+            rejectedCount++;
+            return false;
+        }
+        Beacon &beacon = beacons[beaconKey];
+        beacon.last = sighting;
+        beacon.publishedUs = sighting.timestampUs;
+        beacon.advertisements = 1;
+        beacon.rssiQ4 = sighting.rssi * 16;
+        beacon.pending = 0;
+        out = sighting;
+        return true;
+    }
+
+    Beacon &beacon = found->second;
+    bool payloadChanged = !samePayload(beacon.last, sighting);
+    beacon.rssiQ4 += (sighting.rssi * 16 - beacon.rssiQ4) / RSSI_SMOOTHING_DIVISOR;
+    beacon.last = sighting;
+    beacon.advertisements++;
+    if (beacon.pending < UINT16_MAX) {
+        beacon.pending++;
+    }
+
+    // Replayed captures can step back in time; treat that as elapsed.
+    uint64_t now = sighting.timestampUs;
+    if (!payloadChanged && (now >= beacon.publishedUs) &&
+        (now - beacon.publishedUs < publishIntervalUs)) {
+        return false;
+    }
+    out = sighting;
+    out.smoothedRssi = static_cast<int8_t>((beacon.rssiQ4 + (beacon.rssiQ4 >= 0 ? 8 : -8)) / 16);
+    out.count = beacon.pending;
+    beacon.publishedUs = now;
+    beacon.pending = 0;
+    return true;
+}
+
+size_t BeaconTracker::expire(uint64_t nowUs) {
+    size_t removed = 0;
+
+    for (auto it = beacons.begin(); it != beacons.end();) {
+        if (it->second.last.timestampUs + expiryUs < nowUs) {
+            it = beacons.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+void BeaconTracker::visit(BeaconCallback onBeacon, void *context) const {
+    for (auto it = beacons.begin(); it != beacons.end(); ++it) {
+        onBeacon(it->second.last, it->second.advertisements, context);
+    }
+}
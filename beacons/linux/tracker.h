@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Per-beacon deduplication and RSSI smoothing.
+//
+// `hcitool lescan --duplicates` reports every advertisement. The tracker
+// folds repeats of an unchanged payload into one sighting per publish
+// interval, carrying an exponentially smoothed RSSI and the number of
+// advertisements folded in. A changed payload is published at once.
+
+#ifndef URIBEACON_TRACKER_H__
+#define URIBEACON_TRACKER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include "sighting.h"
+
+class BeaconTracker {
+public:
+    // The latest advertisement of a beacon, and how many it has sent.
+    typedef void (*BeaconCallback)(const Sighting &last, uint64_t advertisements, void *context);
+
+    // publishIntervalMs of 0 publishes every advertisement. Beacons silent
+    // for expiryMs are forgotten by expire(). At most maxBeacons are tracked.
+    BeaconTracker(uint32_t publishIntervalMs, uint32_t expiryMs, size_t maxBeacons);
+
+    // Folds a decoded advertisement into its beacon. Returns true when a
+    // sighting is due, with the smoothed sighting in out.
+    bool update(const Sighting &sighting, Sighting &out);
+
+    // Forgets beacons not heard since nowUs - expiry. Returns how many.
+    size_t expire(uint64_t nowUs);
+
+    size_t size(void) const {
+        return beacons.size();
+    }
+
+    void visit(BeaconCallback onBeacon, void *context) const;
+
+    // New beacons turned away because the table was full.
+    uint64_t rejected(void) const {
+        return rejectedCount;
+    }
+
+private:
+    struct Beacon {
+        Sighting last;
+        uint64_t publishedUs;
+        uint64_t advertisements;
+        int32_t rssiQ4;         // smoothed RSSI in 1/16 dBm
+        uint16_t pending;       // advertisements since the last sighting
+    };
+
+    static uint64_t key(const Sighting &sighting);
+
+    uint64_t publishIntervalUs;
+    uint64_t expiryUs;
+    size_t maxBeacons;
+    uint64_t rejectedCount;
+    std::unordered_map<uint64_t, Beacon> beacons;
+};
+
+#endif // URIBEACON_TRACKER_H__
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_advertise - advertise UriBeacons from a Bluetooth 4.0 controller
+//
+//   sudo uribeacon_advertise -u goo.gl/JXiEID
+//   sudo uribeacon_advertise -i hci1 -t -20 -u https://uribeacon.org
+//   sudo uribeacon_advertise -u example.com/a -u example.com/b -r 500 -j 50
+//   uribeacon_advertise -D /dev/ttyUSB0 -u uribeacon.org
+//   sudo uribeacon_advertise -x -u https://example.com/a/much/longer/path
+//   sudo uribeacon_advertise -k venues.dict -u https://events.example.com/venues/hall-b
+//
+// URIs without a scheme are advertised as http://. With one URI the
+// controller is left advertising it, as the script this replaces did. With
+// several, they are rotated until interrupted and advertising stops on exit.
+// With -x a Bluetooth 5 controller advertises each URI, of up to
+// EXTENDED_URI_MAX encoded bytes, in an extended advertising set of its own,
+// all at once, and is left advertising them. With -k the URIs are encoded with
+// a deployment dictionary, whose version goes in the top four bits of the
+// flags, so -f can only set the low four.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "advertiser.h"
+#include "dictionary.h"
+#include "extended_adv.h"
+
+static Advertiser *advertiser = NULL;
+
+static void onSignal(int signal) {
+    if (advertiser != NULL) {
+        advertiser->stop();
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -u URI    URI to advertise, repeated to rotate (default goo.gl/JXiEID)\n"
+            "  -f FLAGS  UriBeacon flags in hex (default 00)\n"
+            "  -k FILE   encode URIs with a deployment dictionary\n"
+            "  -t DBM    TX power at 0 m (default 0)\n"
+            "  -i hciN   controller (default hci0)\n"
+            "  -D PATH   H4 controller on a tty instead, already at its baud rate\n"
+            "  -n MS     advertising interval (default %u)\n"
+            "  -r MS     time each URI is advertised (default 1000)\n"
+            "  -j MS     move each rotation up to MS either way (default 0)\n"
+            "  -s SEED   seed of the jitter\n"
+            "  -x        extended advertising, one set per URI, for URIs up to %u bytes\n"
+            "  -v        print statistics on exit\n",
+            name, ADVERTISER_INTERVAL_MIN_MS, EXTENDED_URI_MAX);
+}
+
+// Opens a tty for H4 in raw mode.
+static int openUart(const char *path) {
+    int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    AdvertiserOptions options;
+    std::vector<std::string> uris;
+    unsigned long flags = 0;
+    long txPower = 0;
+    int device = 0;
+    const char *uartPath = NULL;
+    const char *dictionaryPath = NULL;
+    bool extended = false;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:f:k:t:i:D:n:r:j:s:xvh")) != -1) {
+        switch (opt) {
+        case 'u':
+            uris.push_back(optarg);
+            break;
+        case 'f':
+            flags = strtoul(optarg, NULL, 16);
+            break;
+        case 'k':
+            dictionaryPath = optarg;
+            break;
+        case 't':
+            txPower = strtol(optarg, NULL, 0);
+            break;
+        case 'i':
+            device = atoi(strncmp(optarg, "hci", 3) == 0 ? optarg + 3 : optarg);
+            break;
+        case 'D':
+            uartPath = optarg;
+            break;
+        case 'n':
+            options.intervalMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            options.rotationMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            options.jitterMs = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            options.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'x':
+            extended = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((optind < argc) || (flags > 0xFF) || (txPower < -100) || (txPower > 20)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (uris.empty()) {
+        uris.push_back("goo.gl/JXiEID");
+    }
+    Dictionary dictionary;
+    const uribeacon_dict_t *codes = NULL;
+    if (dictionaryPath != NULL) {
+        if (flags > 0x0F) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (!dictionary.load(dictionaryPath)) {
+            perror(dictionaryPath);
+            return EXIT_FAILURE;
+        }
+        codes = dictionary.codes();
+        flags = URIBEACON_FLAGS_WITH_DICT(flags, dictionary.version());
+    }
+
+    std::vector<AdvertisingPayload> payloads;
+    std::vector<ExtendedPayload> extendedPayloads;
+    for (size_t i = 0; i < uris.size(); i++) {
+        if (uris[i].find(':') == std::string::npos) {
+            uris[i] = "http://" + uris[i];
+        }
+        if (extended) {
+            uint8_t uri[EXTENDED_URI_MAX];
+            uint8_t uriLength;
+            ExtendedPayload payload;
+            if ((uribeacon_uri_encode_dict(uris[i].c_str(), codes, uri, sizeof(uri),
+                                           &uriLength) != URIBEACON_OK) ||
+                !buildExtendedPayload(static_cast<uint8_t>(flags), static_cast<int8_t>(txPower),
+                                      uri, uriLength, payload)) {
+                fprintf(stderr, "%s: cannot be advertised\n", uris[i].c_str());
+                return EXIT_FAILURE;
+            }
+            extendedPayloads.push_back(payload);
+            printf("URI:       %s\n", uris[i].c_str());
+            continue;
+        }
+        uribeacon_config_t config;
+        uribeacon_config_defaults(&config);
+        config.flags = static_cast<uint8_t>(flags);
+        config.adv_tx_power_levels[config.tx_power_mode] = static_cast<int8_t>(txPower);
+        AdvertisingPayload payload;
+        if ((uribeacon_uri_encode_dict(uris[i].c_str(), codes, config.uri, URIBEACON_URI_MAX,
+                                       &config.uri_length) != URIBEACON_OK) ||
+            !buildAdvertisingPayload(config, payload)) {
+            fprintf(stderr, "%s: cannot be advertised\n", uris[i].c_str());
+            return EXIT_FAILURE;
+        }
+        payloads.push_back(payload);
+        printf("URI:       %s\n", uris[i].c_str());
+    }
+    printf("FLAGS:     %02lx\n", flags);
+    printf("TX_POWER:  %ld\n", txPower);
+    if (uartPath != NULL) {
+        printf("DEVICE:    %s\n", uartPath);
+    } else {
+        printf("DEVICE:    hci%d\n", device);
+    }
+
+    int fd = (uartPath != NULL) ? openUart(uartPath) : openHciCommandSocket(device);
+    if (fd < 0) {
+        perror(uartPath != NULL ? uartPath : "uribeacon_advertise");
+        return EXIT_FAILURE;
+    }
+    FdHciTransport transport(fd);
+    if (extended) {
+        ExtendedAdvertiser sets(transport, options.intervalMs);
+        for (size_t i = 0; i < extendedPayloads.size(); i++) {
+            sets.addPayload(extendedPayloads[i]);
+        }
+        bool started = sets.start();
+        if (!started) {
+            perror("uribeacon_advertise");
+        }
+        close(fd);
+        return started ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    Advertiser instance(transport, options);
+    for (size_t i = 0; i < payloads.size(); i++) {
+        instance.addPayload(payloads[i]);
+    }
+    if (!instance.start()) {
+        perror("uribeacon_advertise");
+        return EXIT_FAILURE;
+    }
+    if (payloads.size() == 1) {
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+    advertiser = &instance;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    bool stopped = instance.run();
+    advertiser = NULL;
+    if (!stopped) {
+        perror("uribeacon_advertise");
+    }
+
+    if (verbose) {
+        const Advertiser::Stats &stats = instance.stats();
+        fprintf(stderr, "rotations %llu, refused %llu, late %llu, latest %llu us\n",
+                (unsigned long long)stats.rotations, (unsigned long long)stats.failures,
+                (unsigned long long)stats.late, (unsigned long long)stats.maxLateUs);
+    }
+    close(fd);
+    return stopped ? EXIT_SUCCESS : EXIT_FAILURE;
+}
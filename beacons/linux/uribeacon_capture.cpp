@@ -0,0 +1,467 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_capture - query indexed captures
+//
+//   uribeacon_capture query [-f FROM] [-t TO] [-a ADDRESS] [-k FILE] capture.ubc
+//   uribeacon_capture convert capture.txt capture.ubc
+//   uribeacon_capture recover capture.ubc
+//   uribeacon_capture bench [-s MB] capture.ubc
+//
+// Times are seconds since the epoch, "YYYY-MM-DD HH:MM[:SS]", or "HH:MM[:SS]"
+// on the day the capture starts, in local time.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "capture.h"
+#include "dictionary.h"
+#include "sighting.h"
+#include "url_table.h"
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: uribeacon_capture query [-f FROM] [-t TO] [-a ADDRESS] [-k FILE] capture.ubc\n"
+            "       uribeacon_capture convert capture.txt capture.ubc\n"
+            "       uribeacon_capture recover capture.ubc\n"
+            "       uribeacon_capture bench [-s MB] capture.ubc\n");
+}
+
+// Parses a time for a capture starting at firstUs. Returns false if the
+// text is not a time.
+static bool parseTime(const char *text, uint64_t firstUs, uint64_t &timeUs) {
+    char *end;
+    unsigned long long seconds = strtoull(text, &end, 10);
+    if ((*end == '\0') && (end != text)) {
+        timeUs = seconds * 1000000;
+        return true;
+    }
+
+    struct tm tm;
+    time_t first = static_cast<time_t>(firstUs / 1000000);
+    localtime_r(&first, &tm);
+    tm.tm_sec = 0;
+    const char *rest = strptime(text, "%Y-%m-%d %H:%M", &tm);
+    if (rest == NULL) {
+        // A failed match may have set fields before it stopped.
+        localtime_r(&first, &tm);
+        tm.tm_sec = 0;
+        rest = strptime(text, "%H:%M", &tm);
+    }
+    if ((rest != NULL) && (*rest == ':')) {
+        rest = strptime(rest, ":%S", &tm);
+    }
+    if ((rest == NULL) || (*rest != '\0')) {
+        return false;
+    }
+    tm.tm_isdst = -1;
+    timeUs = static_cast<uint64_t>(mktime(&tm)) * 1000000;
+    return true;
+}
+
+static bool parseAddress(const char *text, uint8_t address[6]) {
+    unsigned bytes[6];
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &bytes[0], &bytes[1], &bytes[2],
+               &bytes[3], &bytes[4], &bytes[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        address[i] = static_cast<uint8_t>(bytes[i]);
+    }
+    return true;
+}
+
+static void formatTime(uint64_t timeUs, char *text, size_t size) {
+    time_t seconds = static_cast<time_t>(timeUs / 1000000);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    size_t length = strftime(text, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(text + length, size - length, ".%03u", static_cast<unsigned>(timeUs / 1000 % 1000));
+}
+
+struct DeviceSummary {
+    uint64_t reports;
+    uint64_t firstUs;
+    uint64_t lastUs;
+    int8_t minRssi;
+    int8_t maxRssi;
+    uint32_t urlId;
+};
+
+struct Query {
+    UrlTable urls;
+    std::map<uint64_t, DeviceSummary> devices;      // address and type
+    bool listFrames;
+
+    explicit Query(const uribeacon_dict_t *dictionary)
+        : urls(URL_TABLE_CAPACITY_MAX, dictionary),
+          listFrames(false) {
+    }
+};
+
+static void summarize(const HciFrame &frame, void *context) {
+    Query *query = static_cast<Query *>(context);
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    int count = parseAdvertisingReports(frame, reports);
+
+    for (int i = 0; i < count; i++) {
+        Sighting sighting;
+        uint32_t urlId = 0;
+        if (decodeSighting(reports[i], frame.timestampUs, sighting)) {
+            urlId = query->urls.intern(sighting);
+        }
+        if (query->listFrames) {
+            char time[32];
+            formatTime(frame.timestampUs, time, sizeof(time));
+            const char *url = query->urls.text(urlId);
+            printf("%s rssi %4d %s\n", time, reports[i].rssi, url != NULL ? url : "-");
+            continue;
+        }
+        uint64_t key = 0;
+        for (int j = 5; j >= 0; j--) {
+            key = (key << 8) | reports[i].address[j];
+        }
+        key = (key << 8) | reports[i].addressType;
+        auto found = query->devices.find(key);
+        if (found == query->devices.end()) {
+            DeviceSummary summary = { 0, frame.timestampUs, frame.timestampUs,
+                                      reports[i].rssi, reports[i].rssi, 0 };
+            found = query->devices.insert(std::make_pair(key, summary)).first;
+        }
+        DeviceSummary &summary = found->second;
+        summary.reports++;
+        summary.lastUs = frame.timestampUs;
+        summary.minRssi = std::min(summary.minRssi, reports[i].rssi);
+        summary.maxRssi = std::max(summary.maxRssi, reports[i].rssi);
+        if (urlId != 0) {
+            summary.urlId = urlId;
+        }
+    }
+}
+
+// Sightings of URIs encoded with a dictionary other than -k's are left
+// undecoded, and counted here.
+static void reportSkipped(const UrlTable &urls) {
+    if (urls.stats().otherDictionary != 0) {
+        fprintf(stderr, "%llu sightings skipped, encoded with another dictionary\n",
+                (unsigned long long)urls.stats().otherDictionary);
+    }
+}
+
+static int runQuery(int argc, char **argv) {
+    const char *from = NULL;
+    const char *to = NULL;
+    const char *device = NULL;
+    Dictionary dictionary;
+    const uribeacon_dict_t *codes = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:a:k:")) != -1) {
+        switch (opt) {
+        case 'f':
+            from = optarg;
+            break;
+        case 't':
+            to = optarg;
+            break;
+        case 'a':
+            device = optarg;
+            break;
+        case 'k':
+            if (!dictionary.load(optarg)) {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            codes = dictionary.codes();
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    CaptureReader reader;
+    if (!reader.open(argv[optind])) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t fromUs = 0;
+    uint64_t toUs = UINT64_MAX;
+    uint8_t address[6];
+    if (((from != NULL) && !parseTime(from, reader.firstUs(), fromUs)) ||
+        ((to != NULL) && !parseTime(to, reader.firstUs(), toUs)) ||
+        ((device != NULL) && !parseAddress(device, address))) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (!reader.indexed()) {
+        fprintf(stderr, "%s has no index, scanning\n", argv[optind]);
+    }
+
+    Query query(codes);
+    if (device != NULL) {
+        query.listFrames = true;
+        reader.scanDevice(address, fromUs, toUs, summarize, &query);
+        reportSkipped(query.urls);
+        return EXIT_SUCCESS;
+    }
+    reader.scanRange(fromUs, toUs, summarize, &query);
+    for (auto it = query.devices.begin(); it != query.devices.end(); ++it) {
+        const DeviceSummary &summary = it->second;
+        char first[32];
+        char last[32];
+        formatTime(summary.firstUs, first, sizeof(first));
+        formatTime(summary.lastUs, last, sizeof(last));
+        const char *url = query.urls.text(summary.urlId);
+        uint64_t key = it->first;
+        printf("%02X:%02X:%02X:%02X:%02X:%02X %u %6llu reports %s - %s rssi %4d..%4d %s\n",
+               (unsigned)(key >> 48) & 0xFF, (unsigned)(key >> 40) & 0xFF,
+               (unsigned)(key >> 32) & 0xFF, (unsigned)(key >> 24) & 0xFF,
+               (unsigned)(key >> 16) & 0xFF, (unsigned)(key >> 8) & 0xFF,
+               (unsigned)key & 0xFF, (unsigned long long)summary.reports, first, last,
+               summary.minRssi, summary.maxRssi, url != NULL ? url : "-");
+    }
+    reportSkipped(query.urls);
+    return EXIT_SUCCESS;
+}
+
+static void record(const HciFrame &frame, void *context) {
+    CaptureWriter *writer = static_cast<CaptureWriter *>(context);
+    writer->write(frame, frame.timestampUs);
+}
+
+// `hcidump -t --raw` text to an indexed capture.
+static int runConvert(int argc, char **argv) {
+    if (argc != 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    FILE *input = fopen(argv[1], "rb");
+    if (input == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    CaptureWriter writer;
+    if (!writer.open(argv[2])) {
+        perror(argv[2]);
+        fclose(input);
+        return EXIT_FAILURE;
+    }
+    HcidumpParser parser;
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        parser.feed(buffer, length, record, &writer);
+    }
+    parser.finish(record, &writer);
+    fclose(input);
+    uint64_t frames = writer.frames();
+    if (!writer.close()) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    printf("%llu frames\n", (unsigned long long)frames);
+    return EXIT_SUCCESS;
+}
+
+static int runRecover(int argc, char **argv) {
+    if (argc != 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (!recoverCapture(argv[1])) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void countFrame(const HciFrame &frame, void *context) {
+    (*static_cast<uint64_t *>(context))++;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t nextRandom(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// A day at a busy venue: about two hundred devices in range at a time, each
+// staying for some minutes, a quarter of them UriBeacons.
+static bool writeSyntheticCapture(const char *path, uint64_t bytes, uint64_t startUs,
+                                  uint64_t durationUs, uint8_t hotAddress[6]) {
+    static const unsigned ACTIVE = 200;
+    static const unsigned FRAME_BYTES = CAPTURE_RECORD_HEADER_SIZE + 15 + 27;
+    uint64_t frames = bytes / FRAME_BYTES;
+    uint64_t stayFrames = frames / (durationUs / 300000000);    // five minutes
+    std::vector<uint32_t> active(ACTIVE);
+    uint32_t nextDevice = 0;
+    for (unsigned i = 0; i < ACTIVE; i++) {
+        active[i] = nextDevice++;
+    }
+
+    CaptureWriter writer;
+    if (!writer.open(path)) {
+        return false;
+    }
+    uint8_t data[27] = {
+        0x02, 0x01, 0x06, 0x03, 0x03, 0xD8, 0xFE,
+        0x13, 0x16, 0xD8, 0xFE, 0x00, 0xEE, 0x02,
+        'b', 'e', 'a', 'c', 'o', 'n', '-', '0', '0', '0', '0', '0', 0x07,
+    };
+    AdvertisingReport report;
+    HciFrame frame;
+    report.eventType = 0;
+    report.addressType = 1;
+    report.dataLength = sizeof(data);
+    report.data = data;
+
+    for (uint64_t i = 0; i < frames; i++) {
+        if (nextRandom() % (stayFrames / ACTIVE + 1) == 0) {
+            active[nextRandom() % ACTIVE] = nextDevice++;
+        }
+        uint32_t device = active[nextRandom() % ACTIVE];
+        for (int j = 0; j < 4; j++) {
+            report.address[j] = (device >> (8 * j)) & 0xFF;
+        }
+        report.address[4] = 0x5E;
+        report.address[5] = 0xC0;
+        data[7] = (device % 4 == 0) ? 0x13 : 0x03;
+        data[8] = (device % 4 == 0) ? 0x16 : 0xFF;
+        for (int j = 0; j < 5; j++) {
+            data[25 - j] = '0' + (device >> (j * 3)) % 8;
+        }
+        report.rssi = static_cast<int8_t>(-50 - nextRandom() % 45);
+        buildAdvertisingReport(report, startUs + durationUs * i / frames, frame);
+        if (!writer.write(frame, frame.timestampUs)) {
+            return false;
+        }
+        if (i == frames / 2) {
+            for (int j = 0; j < 6; j++) {
+                hotAddress[j] = report.address[5 - j];
+            }
+        }
+    }
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    bool ok = writer.close() && (fd >= 0) && (fdatasync(fd) == 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ok;
+}
+
+// Times one query from a cold page cache.
+static void timeQuery(const char *path, const char *name, bool useIndex, const uint8_t *address,
+                      uint64_t fromUs, uint64_t toUs) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    CaptureReader reader;
+    if (!reader.open(path, useIndex)) {
+        perror(path);
+        return;
+    }
+    uint64_t matches = 0;
+    uint64_t read = (address != NULL) ? reader.scanDevice(address, fromUs, toUs, countFrame, &matches)
+                                      : reader.scanRange(fromUs, toUs, countFrame, &matches);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-34s %-8s %9.3f ms %10llu frames read %8llu matched\n", name,
+           useIndex ? "indexed" : "scan", seconds * 1e3,
+           (unsigned long long)read, (unsigned long long)matches);
+}
+
+static int runBench(int argc, char **argv) {
+    uint64_t megabytes = 2048;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt != 's') {
+            usage();
+            return EXIT_FAILURE;
+        }
+        megabytes = strtoull(optarg, NULL, 0);
+    }
+    if ((optind + 1 != argc) || (megabytes == 0)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const char *path = argv[optind];
+
+    // One day from 2015-03-04 00:00 UTC.
+    static const uint64_t START_US = 1425427200ull * 1000000;
+    static const uint64_t DAY_US = 86400ull * 1000000;
+    uint8_t hot[6];
+    auto start = std::chrono::steady_clock::now();
+    if (!writeSyntheticCapture(path, megabytes << 20, START_US, DAY_US, hot)) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CaptureReader reader;
+    if (!reader.open(path)) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    printf("wrote %llu MB in %.1f s (%.0f MB/s), %zu buckets, %zu devices\n",
+           (unsigned long long)megabytes, seconds, megabytes / seconds,
+           reader.bucketCount(), reader.deviceCount());
+
+    uint64_t middle = START_US + DAY_US / 2;
+    uint64_t fiveMinutes = 300ull * 1000000;
+    timeQuery(path, "five minutes", true, NULL, middle, middle + fiveMinutes);
+    timeQuery(path, "five minutes", false, NULL, middle, middle + fiveMinutes);
+    timeQuery(path, "one device, whole day", true, hot, 0, UINT64_MAX);
+    timeQuery(path, "one device, whole day", false, hot, 0, UINT64_MAX);
+    timeQuery(path, "one device, five minutes", true, hot, middle - fiveMinutes / 2,
+              middle + fiveMinutes / 2);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const char *command = argv[1];
+    if (strcmp(command, "query") == 0) {
+        return runQuery(argc - 1, argv + 1);
+    } else if (strcmp(command, "convert") == 0) {
+        return runConvert(argc - 1, argv + 1);
+    } else if (strcmp(command, "recover") == 0) {
+        return runRecover(argc - 1, argv + 1);
+    } else if (strcmp(command, "bench") == 0) {
+        return runBench(argc - 1, argv + 1);
+    }
+    usage();
+    return EXIT_FAILURE;
+}
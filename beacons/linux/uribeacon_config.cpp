@@ -0,0 +1,387 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_config - read or provision UriBeacons over their config service
+//
+//   sudo uribeacon_config C4:12:34:56:78:9A
+//   sudo uribeacon_config -u https://uribeacon.org -p 500 C4:12:34:56:78:9A D2:...
+//   sudo uribeacon_config -k 000102030405060708090a0b0c0d0e0f -u example.com C4:...
+//   sudo uribeacon_config -K 6 -R 3 -u example.com $(cat rollout.txt)
+//   sudo uribeacon_config -s -K 6 -u example.com $(cat rollout.txt)
+//   uribeacon_config -S v1 -N 2000 -K 8 -u example.com
+//
+// Beacons, each in its config mode, are configured up to -K at a time and
+// the time each took is printed. -S runs the same passes against simulated
+// beacons, to see what the protocol costs at a given link latency.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config_client.h"
+#include "config_sim.h"
+#include "provisioner.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] ADDRESS...\n"
+            "  -u URI    write this URI, and the other fields as given or their defaults\n"
+            "  -f FLAGS  UriBeacon flags in hex (default 00)\n"
+            "  -m MODE   TX power mode, 0 lowest to 3 high (default 1)\n"
+            "  -t LEVELS advertised power levels, four dBm values \"-22,-14,-6,2\"\n"
+            "  -p MS     beacon period (default %u)\n"
+            "  -k KEY    unlock a locked beacon with 32 hex digits\n"
+            "  -L KEY    lock the beacon with 32 hex digits once written\n"
+            "  -s        sync: write only the fields that differ\n"
+            "  -r        the addresses are random addresses\n"
+            "  -T MS     response timeout (default %u)\n"
+            "  -K COUNT  beacons configured at once (default %u)\n"
+            "  -R COUNT  tries after a failed one (default %u)\n"
+            "  -S v1|v2  configure simulated beacons instead of addresses\n"
+            "  -N COUNT  simulated beacons (default 1)\n"
+            "  -l MS     one way latency of simulated links (default 15)\n"
+            "  -c MS     time to connect a simulated link (default 100)\n",
+            name, URIBEACON_PERIOD_DEFAULT, CONFIG_TIMEOUT_MS, PROVISION_CONNECTIONS,
+            PROVISION_RETRIES);
+}
+
+static uint64_t monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+static bool parseKey(const char *text, uint8_t key[URIBEACON_LOCK_CODE_SIZE]) {
+    if (strlen(text) != 2 * URIBEACON_LOCK_CODE_SIZE) {
+        return false;
+    }
+    for (int i = 0; i < URIBEACON_LOCK_CODE_SIZE; i++) {
+        char digits[3] = { text[2 * i], text[2 * i + 1], 0 };
+        char *end;
+        key[i] = static_cast<uint8_t>(strtoul(digits, &end, 16));
+        if (*end != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parseAddress(const char *text, uint8_t address[6]) {
+    unsigned int bytes[6];
+    char extra;
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3],
+               &bytes[4], &bytes[5], &extra) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        address[i] = static_cast<uint8_t>(bytes[i]);
+    }
+    return true;
+}
+
+// Links over LE L2CAP sockets, connected without blocking and read from
+// one epoll set, with the slot as the event data.
+class SocketTransport : public ProvisionTransport {
+public:
+    explicit SocketTransport(bool randomAddress)
+        : randomAddress(randomAddress),
+          epollFd(epoll_create1(EPOLL_CLOEXEC)),
+          provisioner(NULL) {
+    }
+
+    ~SocketTransport() {
+        for (size_t i = 0; i < fds.size(); i++) {
+            close(static_cast<int>(i));
+        }
+        ::close(epollFd);
+    }
+
+    void attach(Provisioner *provisioner) {
+        this->provisioner = provisioner;
+    }
+
+    bool open(int slot, const std::string &target) override {
+        if (static_cast<size_t>(slot) >= fds.size()) {
+            fds.resize(slot + 1, -1);
+            connecting.resize(slot + 1, false);
+        }
+        uint8_t address[6];
+        if (!parseAddress(target.c_str(), address)) {
+            errno = EINVAL;
+            return false;
+        }
+        int fd = connectAtt(address, randomAddress, true);
+        if (fd < 0) {
+            return false;
+        }
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLOUT;
+        event.data.u32 = static_cast<uint32_t>(slot);
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        fds[slot] = fd;
+        connecting[slot] = true;
+        return true;
+    }
+
+    bool send(int slot, const uint8_t *pdu, size_t length) override {
+        return SocketAttBearer(fds[slot]).send(pdu, length);
+    }
+
+    void close(int slot) override {
+        if (fds[slot] >= 0) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fds[slot], NULL);
+            ::close(fds[slot]);
+            fds[slot] = -1;
+        }
+    }
+
+    // Runs the started provisioner until it is done.
+    void run(void) {
+        while (!provisioner->done()) {
+            uint64_t now = monotonicNs();
+            uint64_t deadline = provisioner->deadlineNs();
+            int timeoutMs = -1;
+            if (deadline != 0) {
+                timeoutMs = (deadline > now) ? static_cast<int>((deadline - now) / 1000000 + 1) : 0;
+            }
+            struct epoll_event events[16];
+            int ready = epoll_wait(epollFd, events, 16, timeoutMs);
+            for (int i = 0; i < ready; i++) {
+                // An earlier event may have closed the slot.
+                int slot = static_cast<int>(events[i].data.u32);
+                if (fds[slot] >= 0) {
+                    onReady(slot);
+                }
+            }
+            provisioner->tick(monotonicNs());
+        }
+    }
+
+private:
+    void onReady(int slot) {
+        int fd = fds[slot];
+        if (connecting[slot]) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            connecting[slot] = false;
+            if (error != 0) {
+                provisioner->linkFailed(slot, error, monotonicNs());
+                return;
+            }
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = static_cast<uint32_t>(slot);
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+            provisioner->connected(slot, monotonicNs());
+            return;
+        }
+        uint8_t pdu[ATT_DEFAULT_MTU];
+        ssize_t length = recv(fd, pdu, sizeof(pdu), MSG_DONTWAIT);
+        if (length > 0) {
+            provisioner->receive(slot, pdu, static_cast<size_t>(length), monotonicNs());
+        } else if ((length == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+            provisioner->linkFailed(slot, (length == 0) ? ECONNRESET : errno, monotonicNs());
+        }
+    }
+
+    bool randomAddress;
+    int epollFd;
+    Provisioner *provisioner;
+    std::vector<int> fds;
+    std::vector<bool> connecting;
+};
+
+static void printResult(const ProvisionResult &result, bool write) {
+    const ConfigReport &report = result.report;
+    printf("%-17s %-2s  %-22s %u tries  discover %7.1f  read %7.1f  write %7.1f  total %7.1f ms"
+           "  %u requests  %u commands  %u writes\n",
+           result.target.c_str(), configProtocolName(report.protocol),
+           configStatusName(result.status), result.attempts, report.discoverNs / 1e6,
+           report.readNs / 1e6, report.writeNs / 1e6, (result.doneNs - result.firstNs) / 1e6,
+           report.requests, report.commands, report.writes);
+    if (result.status == CONFIG_ERR_ATT) {
+        printf("  ATT error 0x%02x\n", report.attError);
+    } else if ((result.status == CONFIG_ERR_LINK) && (result.linkError != 0)) {
+        printf("  %s\n", strerror(result.linkError));
+    }
+    if (write || (result.status != CONFIG_OK)) {
+        return;
+    }
+    const uribeacon_config_t &found = report.found;
+    char uri[256];
+    if (uribeacon_uri_decode(found.uri, found.uri_length, uri, sizeof(uri)) != URIBEACON_OK) {
+        strcpy(uri, "?");
+    }
+    printf("  uri %s  flags %02x  mode %u  levels %d,%d,%d,%d  period %u%s\n", uri, found.flags,
+           found.tx_power_mode, found.adv_tx_power_levels[0], found.adv_tx_power_levels[1],
+           found.adv_tx_power_levels[2], found.adv_tx_power_levels[3], found.period,
+           found.lock_state ? "  locked" : "");
+}
+
+int main(int argc, char **argv) {
+    ConfigRequest request;
+    uribeacon_config_t &config = request.config;
+    ProvisionOptions options;
+    ConfigProtocol simulated = CONFIG_PROTOCOL_NONE;
+    unsigned long count = 1;
+    unsigned long latencyMs = 15;
+    unsigned long connectMs = 100;
+    bool randomAddress = false;
+    bool valid = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:f:m:t:p:k:L:srT:K:R:S:N:l:c:h")) != -1) {
+        switch (opt) {
+        case 'u': {
+            std::string uri = optarg;
+            if (uri.find(':') == std::string::npos) {
+                uri = "http://" + uri;
+            }
+            valid &= (uribeacon_uri_encode(uri.c_str(), config.uri, URIBEACON_URI_MAX,
+                                           &config.uri_length) == URIBEACON_OK);
+            request.write = true;
+            break;
+        }
+        case 'f':
+            config.flags = static_cast<uint8_t>(strtoul(optarg, NULL, 16));
+            break;
+        case 'm':
+            config.tx_power_mode = static_cast<uint8_t>(strtoul(optarg, NULL, 0));
+            break;
+        case 't': {
+            int levels[URIBEACON_TX_POWER_MODES];
+            valid &= (sscanf(optarg, "%d,%d,%d,%d", &levels[0], &levels[1], &levels[2],
+                             &levels[3]) == URIBEACON_TX_POWER_MODES);
+            for (int i = 0; i < URIBEACON_TX_POWER_MODES; i++) {
+                config.adv_tx_power_levels[i] = static_cast<int8_t>(levels[i]);
+            }
+            break;
+        }
+        case 'p':
+            config.period = static_cast<uint16_t>(strtoul(optarg, NULL, 0));
+            break;
+        case 'k':
+            valid &= parseKey(optarg, request.key);
+            request.haveKey = true;
+            break;
+        case 'L':
+            valid &= parseKey(optarg, config.lock_code);
+            config.lock_state = 1;
+            break;
+        case 's':
+            request.sync = true;
+            break;
+        case 'r':
+            randomAddress = true;
+            break;
+        case 'T':
+            request.timeoutMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'K':
+            options.connections = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            options.retries = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            if (strcmp(optarg, "v1") == 0) {
+                simulated = CONFIG_PROTOCOL_V1;
+            } else if (strcmp(optarg, "v2") == 0) {
+                simulated = CONFIG_PROTOCOL_V2;
+            } else {
+                valid = false;
+            }
+            break;
+        case 'N':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            latencyMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            connectMs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    bool haveAddresses = (optind < argc);
+    if (!valid || (options.connections == 0) ||
+        (haveAddresses == (simulated != CONFIG_PROTOCOL_NONE))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (request.write && (uribeacon_config_validate(&config) != URIBEACON_OK)) {
+        fprintf(stderr, "invalid configuration\n");
+        return EXIT_FAILURE;
+    }
+
+    SimulatedNetwork network;
+    std::vector<std::unique_ptr<SimulatedBeacon> > beacons;
+    SimulatedTransport simulatedTransport(network, latencyMs * 1000000ull,
+                                          connectMs * 1000000ull);
+    SocketTransport socketTransport(randomAddress);
+    ProvisionTransport &transport = (simulated != CONFIG_PROTOCOL_NONE)
+        ? static_cast<ProvisionTransport &>(simulatedTransport)
+        : static_cast<ProvisionTransport &>(socketTransport);
+    Provisioner provisioner(transport, options);
+
+    if (simulated != CONFIG_PROTOCOL_NONE) {
+        simulatedTransport.attach(&provisioner);
+        for (unsigned long i = 0; i < count; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "simulated-%lu", i + 1);
+            beacons.push_back(std::unique_ptr<SimulatedBeacon>(new SimulatedBeacon(simulated)));
+            simulatedTransport.addBeacon(name, beacons.back().get());
+            provisioner.add(name, request);
+        }
+        provisioner.start(network.now());
+        runSimulated(network, provisioner);
+    } else {
+        socketTransport.attach(&provisioner);
+        for (int i = optind; i < argc; i++) {
+            provisioner.add(argv[i], request);
+        }
+        provisioner.start(monotonicNs());
+        socketTransport.run();
+    }
+
+    for (size_t i = 0; i < provisioner.beacons().size(); i++) {
+        printResult(provisioner.beacons()[i], request.write);
+    }
+    const Provisioner::Stats &stats = provisioner.stats();
+    uint64_t elapsedNs = stats.doneNs - stats.startNs;
+    printf("%llu configured, %llu failed, %llu retries in %.1f s, %.1f per minute\n",
+           (unsigned long long)stats.succeeded, (unsigned long long)stats.failed,
+           (unsigned long long)stats.retries, elapsedNs / 1e9,
+           (elapsedNs > 0) ? stats.succeeded * 60e9 / elapsedNs : 0.0);
+    if (request.sync) {
+        printf("%llu writes, %llu avoided; %llu beacons unchanged, not committed to NVM\n",
+               (unsigned long long)stats.writes, (unsigned long long)stats.writesAvoided,
+               (unsigned long long)stats.unchanged);
+    }
+    return (stats.failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
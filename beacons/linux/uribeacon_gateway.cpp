@@ -0,0 +1,203 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_gateway - publish UriBeacon sightings to local subscribers
+//
+//   sudo hcitool lescan --duplicates >/dev/null &
+//   sudo hcidump --raw | uribeacon_gateway
+//   sudo uribeacon_gateway -d 0
+//   sudo uribeacon_gateway -d 0 -w scan.ubc
+//   sudo uribeacon_gateway -d 0 -m 9101
+//   sudo uribeacon_gateway -d 0 -l 10
+//   uribeacon_gateway -t < capture.txt
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dictionary.h"
+#include "gateway.h"
+
+static Gateway *gateway = NULL;
+
+static void onSignal(int signal) {
+    if (gateway != NULL) {
+        gateway->stop();
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] [capture]\n"
+            "Reads `hcidump --raw` text from capture or stdin, or hciN with -d.\n"
+            "  -d N      read LE advertising reports from hciN\n"
+            "  -x        run an extended scan on hciN, for URIs in extended advertisements\n"
+            "  -s PATH   subscriber socket (default /tmp/uribeacon.sock)\n"
+            "  -t        use the `hcidump -t` timestamps of a capture\n"
+            "  -p MS     publish an unchanged beacon at most every MS (default 1000)\n"
+            "  -e MS     forget beacons silent for MS (default 30000)\n"
+            "  -j MS     wait MS for a scan response continuing a URI (default 100)\n"
+            "  -f MS     flush batches every MS (default 50)\n"
+            "  -b N      records per batch, at most 1489 (default 256)\n"
+            "  -q N      batches queued per subscriber before eviction (default 64)\n"
+            "  -u N      distinct URLs kept decoded (default 4096)\n"
+            "  -k FILE   decode URIs with a deployment dictionary\n"
+            "  -w FILE   record the input to an indexed capture\n"
+            "  -m ADDR   serve Prometheus metrics on a port, host:port or socket path\n"
+            "  -l S      print per stage latency percentiles every S seconds\n"
+            "  -v        print statistics on exit\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    GatewayOptions options;
+    const char *metricsAddress = NULL;
+    const char *dictionaryPath = NULL;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:xs:tp:e:j:f:b:q:u:k:w:m:l:vh")) != -1) {
+        switch (opt) {
+        case 'd':
+            options.inputFd = -1;
+            options.hciDevice = atoi(optarg);
+            break;
+        case 'x':
+            options.extendedScan = true;
+            break;
+        case 's':
+            options.socketPath = optarg;
+            break;
+        case 't':
+            options.captureTimestamps = true;
+            break;
+        case 'p':
+            options.publishIntervalMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            options.expiryMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            options.joinTimeoutMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            options.flushIntervalMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            options.batchRecords = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            options.queueBatches = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            options.urlCapacity = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            dictionaryPath = optarg;
+            break;
+        case 'w':
+            options.capturePath = optarg;
+            break;
+        case 'm':
+            metricsAddress = optarg;
+            break;
+        case 'l':
+            options.latencyReportMs = strtoul(optarg, NULL, 0) * 1000;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((options.flushIntervalMs == 0) || (options.batchRecords == 0) ||
+        (options.batchRecords > SIGHTING_BATCH_RECORDS_MAX) || (options.queueBatches == 0) ||
+        (options.urlCapacity == 0) || (options.urlCapacity > URL_TABLE_CAPACITY_MAX)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (optind < argc) {
+        options.inputFd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+        if (options.inputFd < 0) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Dictionary dictionary;
+    if (dictionaryPath != NULL) {
+        if (!dictionary.load(dictionaryPath)) {
+            perror(dictionaryPath);
+            return EXIT_FAILURE;
+        }
+        options.dictionary = dictionary.codes();
+    }
+
+    MetricsRegistry metrics;
+    MetricsServer metricsServer(metrics);
+    if (metricsAddress != NULL) {
+        options.metrics = &metrics;
+        if (!metricsServer.start(metricsAddress)) {
+            perror(metricsAddress);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Gateway instance(options);
+    if (!instance.start()) {
+        perror("uribeacon_gateway");
+        return EXIT_FAILURE;
+    }
+    gateway = &instance;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    instance.run();
+    gateway = NULL;
+
+    if (verbose) {
+        const Gateway::Stats &stats = instance.stats();
+        const Publisher::Stats &published = instance.publisher().stats();
+        const UrlTable::Stats &urls = instance.urlTable().stats();
+        const ScanResponseJoiner::Stats &joins = instance.joiner().stats();
+        fprintf(stderr,
+                "frames %llu, reports %llu, malformed %llu, uribeacons %llu, beacons %zu\n"
+                "continued uris %llu joined, %llu incomplete, %llu unmatched\n"
+                "urls %zu, decoded %llu, hits %llu, invalid %llu, evicted %llu\n"
+                "sightings %llu in %llu batches, subscribers %llu, evicted %llu, oversized %llu\n",
+                (unsigned long long)stats.frames, (unsigned long long)stats.reports,
+                (unsigned long long)stats.malformed, (unsigned long long)stats.uriBeacons,
+                instance.tracker().size(),
+                (unsigned long long)joins.joined, (unsigned long long)joins.incomplete,
+                (unsigned long long)joins.unmatched,
+                instance.urlTable().size(), (unsigned long long)urls.misses,
+                (unsigned long long)urls.hits, (unsigned long long)urls.invalid,
+                (unsigned long long)urls.evictions,
+                (unsigned long long)published.sightings, (unsigned long long)published.batches,
+                (unsigned long long)published.accepted, (unsigned long long)published.evicted,
+                (unsigned long long)published.oversized);
+    }
+    return EXIT_SUCCESS;
+}
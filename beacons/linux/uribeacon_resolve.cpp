@@ -0,0 +1,166 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_resolve - print the title and icon of each URL seen by
+// uribeacon_gateway
+//
+//   uribeacon_resolve [options] [socket]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include "dictionary.h"
+#include "resolver.h"
+#include "sighting.h"
+#include "url_table.h"
+
+static std::mutex output;
+
+static void onResolved(const std::string &url, const PageMetadata &metadata, void *context) {
+    std::lock_guard<std::mutex> guard(output);
+    printf("%s %d \"%s\" %s\n", url.c_str(), metadata.status, metadata.title.c_str(),
+           metadata.icon.empty() ? "-" : metadata.icon.c_str());
+    fflush(stdout);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] [socket]\n"
+            "  -c PATH   metadata cache file (default in memory)\n"
+            "  -n N      cache entries (default 4096)\n"
+            "  -j N      fetches in flight (default 8)\n"
+            "  -u N      distinct URLs remembered (default 4096)\n"
+            "  -k FILE   decode URIs with a deployment dictionary\n"
+            "  -x HOST:PORT  HTTP proxy, needed for https URLs\n"
+            "  -v        print statistics on exit\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    ResolverOptions options;
+    size_t urlCapacity = 4096;
+    Dictionary dictionary;
+    const uribeacon_dict_t *codes = NULL;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:j:u:k:x:vh")) != -1) {
+        switch (opt) {
+        case 'c':
+            options.cachePath = optarg;
+            break;
+        case 'n':
+            options.cacheEntries = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            options.concurrency = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            urlCapacity = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            if (!dictionary.load(optarg)) {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            codes = dictionary.codes();
+            break;
+        case 'x': {
+            const char *colon = strrchr(optarg, ':');
+            if (colon == NULL) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.fetch.proxyHost.assign(optarg, colon - optarg);
+            options.fetch.proxyPort = colon + 1;
+            break;
+        }
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((urlCapacity == 0) || (urlCapacity > URL_TABLE_CAPACITY_MAX)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *path = (optind < argc) ? argv[optind] : "/tmp/uribeacon.sock";
+    static uint8_t batch[SIGHTING_BATCH_MAX];
+    UrlTable urls(urlCapacity, codes);
+
+    MetadataResolver resolver(options);
+    if (!resolver.start()) {
+        perror(options.cachePath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    for (;;) {
+        ssize_t length = recv(fd, batch, sizeof(batch), 0);
+        if (length <= 0) {
+            break;
+        }
+        int count = readBatchHeader(batch, length, NULL);
+        size_t offset = SIGHTING_BATCH_HEADER_SIZE;
+        for (int i = 0; i < count; i++) {
+            Sighting sighting;
+            offset += readSightingRecord(&batch[offset], sighting);
+            // Only a URL's first sighting is looked up; the table remembers
+            // the rest.
+            uint64_t misses = urls.stats().misses;
+            uint32_t id = urls.intern(sighting);
+            if ((id != 0) && (urls.stats().misses != misses)) {
+                resolver.resolve(urls.text(id), onResolved, NULL);
+            }
+        }
+    }
+    close(fd);
+    resolver.drain();
+    if (urls.stats().otherDictionary != 0) {
+        fprintf(stderr, "%llu sightings skipped, encoded with another dictionary\n",
+                (unsigned long long)urls.stats().otherDictionary);
+    }
+
+    if (verbose) {
+        MetadataResolver::Stats stats = resolver.stats();
+        fprintf(stderr,
+                "requests %llu, hits %llu, negative %llu, coalesced %llu, fetches %llu, failures %llu\n"
+                "latency p50 %llu us, p99 %llu us\n",
+                (unsigned long long)stats.requests, (unsigned long long)stats.hits,
+                (unsigned long long)stats.negativeHits, (unsigned long long)stats.coalesced,
+                (unsigned long long)stats.fetches, (unsigned long long)stats.failures,
+                (unsigned long long)resolver.latencyPercentile(50),
+                (unsigned long long)resolver.latencyPercentile(99));
+    }
+    return EXIT_SUCCESS;
+}
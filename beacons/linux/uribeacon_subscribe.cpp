@@ -0,0 +1,107 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_subscribe - print the sightings published by uribeacon_gateway
+//
+//   uribeacon_subscribe [-k FILE] [socket]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "dictionary.h"
+#include "sighting.h"
+#include "url_table.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] [socket]\n"
+            "  -k FILE   decode URIs with a deployment dictionary\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    Dictionary dictionary;
+    const uribeacon_dict_t *codes = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:h")) != -1) {
+        switch (opt) {
+        case 'k':
+            if (!dictionary.load(optarg)) {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            codes = dictionary.codes();
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const char *path = (optind < argc) ? argv[optind] : "/tmp/uribeacon.sock";
+    static uint8_t batch[SIGHTING_BATCH_MAX];
+    UrlTable urls(1024, codes);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    for (;;) {
+        ssize_t length = recv(fd, batch, sizeof(batch), 0);
+        if (length <= 0) {
+            break;
+        }
+        int count = readBatchHeader(batch, length, NULL);
+        if (count < 0) {
+            fprintf(stderr, "malformed batch of %zd bytes\n", length);
+            continue;
+        }
+        size_t offset = SIGHTING_BATCH_HEADER_SIZE;
+        for (int i = 0; i < count; i++) {
+            Sighting sighting;
+            offset += readSightingRecord(&batch[offset], sighting);
+            uint64_t skipped = urls.stats().otherDictionary;
+            const char *uri = urls.text(urls.intern(sighting));
+            if (urls.stats().otherDictionary != skipped) {
+                continue;
+            }
+            if (uri == NULL) {
+                uri = "?";
+            }
+            printf("%02X:%02X:%02X:%02X:%02X:%02X rssi %4d avg %4d tx %4d flags %02X x%-3u %s\n",
+                   sighting.address[0], sighting.address[1], sighting.address[2],
+                   sighting.address[3], sighting.address[4], sighting.address[5],
+                   sighting.rssi, sighting.smoothedRssi, sighting.txPower, sighting.flags,
+                   sighting.count, uri);
+        }
+        fflush(stdout);
+    }
+    close(fd);
+    if (urls.stats().otherDictionary != 0) {
+        fprintf(stderr, "%llu sightings skipped, encoded with another dictionary\n",
+                (unsigned long long)urls.stats().otherDictionary);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_trace - decode a CSR beacon's event trace
+//
+//   uribeacon_trace trace.bin
+//   uribeacon_trace uart.log
+//   uribeacon_trace -l uart.log
+//
+// Takes the URIBEACON_TRACE characteristic's value as read, in binary or as
+// hex, or a UART log with the TRACE lines the firmware writes before a
+// panic, and prints the events oldest first. -l prints the log messages of a
+// UART log instead. With no FILE, or "-", reads stdin.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "event_trace.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-l] [FILE]\n"
+            "  -l        print the LOG messages of a UART log\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    bool log = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lh")) != -1) {
+        switch (opt) {
+        case 'l':
+            log = true;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *path = ((optind < argc) && (strcmp(argv[optind], "-") != 0)) ? argv[optind] : NULL;
+    FILE *input = (path != NULL) ? fopen(path, "rb") : stdin;
+    if (input == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        text.append(buffer, length);
+    }
+    if (ferror(input)) {
+        perror(path != NULL ? path : "stdin");
+        return EXIT_FAILURE;
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    if (log) {
+        fputs(formatUartLog(text).c_str(), stdout);
+        return EXIT_SUCCESS;
+    }
+
+    EventTrace trace;
+    std::vector<uint8_t> data(text.begin(), text.end());
+    if (!decodeEventTrace(data.data(), data.size(), trace) &&
+        (!parseEventTraceHex(text, data) ||
+         !decodeEventTrace(data.data(), data.size(), trace))) {
+        fprintf(stderr, "%s: not an event trace\n", path != NULL ? path : "stdin");
+        return EXIT_FAILURE;
+    }
+    fputs(formatEventTrace(trace).c_str(), stdout);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// uribeacon_train - learn a deployment dictionary from a list of URLs
+//
+//   uribeacon_train urls.txt > venues.dict
+//   uribeacon_train -V 2 -o venues.dict -j 8 urls.txt more-urls.txt
+//
+// Reads URLs one a line, writes the dictionary for uribeacon_advertise -k and
+// uribeacon_gateway -k, and reports on stderr how the URLs encode with it
+// compared with the built-in codes alone.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "dict_trainer.h"
+#include "dictionary.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] FILE...\n"
+            "  -V N      dictionary version, 1 to %u (default 1)\n"
+            "  -o FILE   write the dictionary to FILE (default stdout)\n"
+            "  -j N      threads (default one per CPU)\n"
+            "  -c N      candidate substrings kept (default %u)\n"
+            "  -w N      bytes a URL too long to advertise costs (default %u)\n",
+            name, URIBEACON_DICT_VERSION_MAX, DICT_TRAINER_CANDIDATES, URIBEACON_URI_MAX);
+}
+
+int main(int argc, char **argv) {
+    DictTrainerOptions options;
+    const char *outputPath = NULL;
+    unsigned long version = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "V:o:j:c:w:h")) != -1) {
+        switch (opt) {
+        case 'V':
+            version = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'j':
+            options.threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            options.candidates = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            options.fitWeight = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((optind == argc) || (version < 1) || (version > URIBEACON_DICT_VERSION_MAX)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    options.version = static_cast<uint8_t>(version);
+
+    DictTrainer trainer(options);
+    for (int i = optind; i < argc; i++) {
+        if (!trainer.load(argv[i])) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    Dictionary dictionary;
+    DictTrainerReport report;
+    if (!trainer.train(dictionary, report)) {
+        fprintf(stderr, "%s: no URLs to train on\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string text = dictionary.format();
+    FILE *output = (outputPath != NULL) ? fopen(outputPath, "w") : stdout;
+    if ((output == NULL) || (fwrite(text.data(), 1, text.size(), output) != text.size()) ||
+        (fflush(output) != 0)) {
+        perror(outputPath != NULL ? outputPath : "stdout");
+        return EXIT_FAILURE;
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    double urls = static_cast<double>(report.urls);
+    fprintf(stderr, "urls       %llu, %llu skipped\n", (unsigned long long)report.urls,
+            (unsigned long long)trainer.skipped());
+    fprintf(stderr, "entries    %zu\n", dictionary.size());
+    fprintf(stderr, "fit        %llu built-in, %llu trained, %lld more\n",
+            (unsigned long long)report.fitBuiltIn, (unsigned long long)report.fitTrained,
+            (long long)report.fitTrained - (long long)report.fitBuiltIn);
+    fprintf(stderr, "bytes/url  %.2f built-in, %.2f trained, %.2f saved\n",
+            report.bytesBuiltIn / urls, report.bytesTrained / urls,
+            (report.bytesBuiltIn - report.bytesTrained) / urls);
+    return EXIT_SUCCESS;
+}
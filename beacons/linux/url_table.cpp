@@ -0,0 +1,176 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "url_table.h"
+
+#include <string.h>
+
+UrlTable::UrlTable(size_t capacity, const uribeacon_dict_t *dictionary)
+    : count(0),
+      hand(0),
+      dictionary(dictionary) {
+    if (capacity == 0) {
+        capacity = 1;
+    } else if (capacity > URL_TABLE_CAPACITY_MAX) {
+        capacity = URL_TABLE_CAPACITY_MAX;
+    }
+    entries.resize(capacity);
+
+    // At most half full, so probe sequences stay short.
+    size_t size = 1;
+    while (size < 2 * capacity) {
+        size <<= 1;
+    }
+    slots.assign(size, 0);
+    mask = size - 1;
+    memset(&counters, 0, sizeof(counters));
+}
+
+// FNV-1a over the length and the bytes.
+uint32_t UrlTable::hashOf(const uint8_t *uri, uint8_t length) {
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ length) * 16777619u;
+    for (uint8_t i = 0; i < length; i++) {
+        hash = (hash ^ uri[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t UrlTable::findSlot(uint32_t hash, const uint8_t *uri, uint8_t length) const {
+    size_t slot = hash & mask;
+
+    for (;;) {
+        uint16_t index = slots[slot];
+        if (index == 0) {
+            return slot;
+        }
+        const Entry &entry = entries[index - 1];
+        if ((entry.hash == hash) && (entry.length == length) &&
+            (memcmp(entry.uri, uri, length) == 0)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+uint32_t UrlTable::intern(const uint8_t *uri, uint8_t length) {
+    if (length > SIGHTING_URI_MAX) {
+        counters.invalid++;
+        return 0;
+    }
+    uint32_t hash = hashOf(uri, length);
+    size_t slot = findSlot(hash, uri, length);
+    if (slots[slot] != 0) {
+        Entry &entry = entries[slots[slot] - 1];
+        entry.referenced = true;
+        counters.hits++;
+        return (static_cast<uint32_t>(entry.generation) << 16) | (slots[slot] - 1);
+    }
+
+    char text[URL_TEXT_MAX];
+    if (uribeacon_uri_decode_dict(uri, length, dictionary, text, sizeof(text)) != URIBEACON_OK) {
+        counters.invalid++;
+        return 0;
+    }
+
+    // Entries fill in order and are only freed to be reused at once.
+    size_t index = count;
+    if (count == entries.size()) {
+        index = victim();
+        unlink(index);
+        counters.evictions++;
+        slot = findSlot(hash, uri, length);
+    } else {
+        count++;
+    }
+
+    Entry &entry = entries[index];
+    entry.hash = hash;
+    entry.generation++;
+    if (entry.generation == 0) {
+        entry.generation = 1;
+    }
+    entry.used = true;
+    entry.referenced = true;
+    entry.length = length;
+    memcpy(entry.uri, uri, length);
+    entry.text.assign(text);
+    slots[slot] = static_cast<uint16_t>(index + 1);
+    counters.misses++;
+    return (static_cast<uint32_t>(entry.generation) << 16) | index;
+}
+
+uint32_t UrlTable::intern(const Sighting &sighting) {
+    // A URI encoded with another dictionary, or one not loaded, would
+    // decode to the wrong text.
+    uint8_t version = URIBEACON_FLAGS_DICT_VERSION(sighting.flags);
+    uint8_t loaded = (dictionary != NULL) ? dictionary->version : 0;
+    if ((version != 0) && (version != loaded)) {
+        counters.otherDictionary++;
+        return 0;
+    }
+    return intern(sighting.uri, sighting.uriLength);
+}
+
+const char *UrlTable::text(uint32_t id) const {
+    size_t index = id & 0xFFFF;
+    if (index >= entries.size()) {
+        return NULL;
+    }
+    const Entry &entry = entries[index];
+    if (!entry.used || (entry.generation != (id >> 16))) {
+        return NULL;
+    }
+    return entry.text.c_str();
+}
+
+size_t UrlTable::victim(void) {
+    for (;;) {
+        Entry &entry = entries[hand];
+        size_t index = hand;
+        hand = (hand + 1) % entries.size();
+        if (!entry.referenced) {
+            return index;
+        }
+        entry.referenced = false;
+    }
+}
+
+// Removes an entry from the slots, shifting later members of its probe
+// sequence back so lookups need no tombstones.
+void UrlTable::unlink(size_t index) {
+    Entry &entry = entries[index];
+    size_t hole = findSlot(entry.hash, entry.uri, entry.length);
+    size_t slot = hole;
+
+    slots[hole] = 0;
+    entry.used = false;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        if (slots[slot] == 0) {
+            return;
+        }
+        size_t home = entries[slots[slot] - 1].hash & mask;
+        // Leave it if its home lies cyclically in (hole, slot].
+        bool stays = (hole <= slot) ? ((home > hole) && (home <= slot))
+                                    : ((home > hole) || (home <= slot));
+        if (!stays) {
+            slots[hole] = slots[slot];
+            slots[slot] = 0;
+            hole = slot;
+        }
+    }
+}
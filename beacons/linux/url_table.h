@@ -0,0 +1,110 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Interned URL table.
+//
+// Many beacons advertise the same few URLs. The table maps each distinct
+// encoded URI to a 32-bit id and decodes it to text once, on first sight;
+// later sightings of the same bytes cost a hash lookup. Entries are
+// allocated up front; the text is kept out of line at its decoded length,
+// and an evicted entry's buffer is reused by the next URL. When the table is
+// full the least recently used entry is evicted, approximated with the CLOCK
+// algorithm.
+//
+// An id is the entry's slot in the low 16 bits and the slot's generation in
+// the high 16 bits, so an evicted URL's id is not handed out again until its
+// slot has been reused 65535 times. Id 0 is never used.
+
+#ifndef URIBEACON_URL_TABLE_H__
+#define URIBEACON_URL_TABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sighting.h"
+#include "uribeacon_core.h"
+
+// Longest decoded URI: a scheme and every byte expanding to a dictionary
+// entry of the longest length, which is longer than any fixed expansion.
+#define URL_TEXT_MAX                    (16 + SIGHTING_URI_MAX * URIBEACON_DICT_ENTRY_MAX)
+
+// Most entries a table can hold, given 16 bits of slot in an id.
+#define URL_TABLE_CAPACITY_MAX          (65535)
+
+class UrlTable {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;        // decoded and inserted
+        uint64_t invalid;       // did not decode
+        uint64_t otherDictionary;   // encoded with a dictionary not loaded
+        uint64_t evictions;
+    };
+
+    // URIs are decoded with dictionary when it is not NULL; it must outlive
+    // the table.
+    explicit UrlTable(size_t capacity, const uribeacon_dict_t *dictionary = NULL);
+
+    // Returns the id of an encoded URI, decoding it on first sight, or 0 if
+    // it is not a valid UriBeacon URI.
+    uint32_t intern(const uint8_t *uri, uint8_t length);
+
+    // As intern() for a sighting's URI, but 0 without decoding it if its
+    // flags carry a dictionary version other than the table's.
+    uint32_t intern(const Sighting &sighting);
+
+    // The text of id, or NULL once it has been evicted.
+    const char *text(uint32_t id) const;
+
+    size_t size(void) const {
+        return count;
+    }
+
+    size_t capacity(void) const {
+        return entries.size();
+    }
+
+    const Stats &stats(void) const {
+        return counters;
+    }
+
+private:
+    struct Entry {
+        uint32_t hash;
+        uint16_t generation;
+        bool used;
+        bool referenced;        // CLOCK bit
+        uint8_t length;
+        uint8_t uri[SIGHTING_URI_MAX];
+        std::string text;
+    };
+
+    static uint32_t hashOf(const uint8_t *uri, uint8_t length);
+
+    size_t findSlot(uint32_t hash, const uint8_t *uri, uint8_t length) const;
+    size_t victim(void);
+    void unlink(size_t entry);
+
+    std::vector<Entry> entries;
+    std::vector<uint16_t> slots;    // open addressing, entry index + 1
+    size_t mask;
+    size_t count;
+    size_t hand;
+    const uribeacon_dict_t *dictionary;
+    Stats counters;
+};
+
+#endif // URIBEACON_URL_TABLE_H__
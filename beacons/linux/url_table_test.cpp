@@ -0,0 +1,326 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Tests and benchmark for the interned URL table.
+//
+//   url_table_test                          run the tests
+//   url_table_test --bench capture.txt      CPU and allocations per sighting
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "dictionary.h"
+#include "hci.h"
+#include "sighting.h"
+#include "test_util.h"
+#include "url_table.h"
+
+// Counts heap allocations for the benchmark.
+static unsigned long long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+// http://uribeacon.org
+static const uint8_t URIBEACON_ORG[] = { 0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08 };
+
+static void testInternDecodesOnce(void) {
+    UrlTable table(8);
+
+    uint32_t id = table.intern(URIBEACON_ORG, sizeof(URIBEACON_ORG));
+    EXPECT_EQ(true, id != 0);
+    EXPECT_EQ(id, table.intern(URIBEACON_ORG, sizeof(URIBEACON_ORG)));
+    EXPECT_EQ(id, table.intern(URIBEACON_ORG, sizeof(URIBEACON_ORG)));
+    EXPECT_EQ(0, strcmp("http://uribeacon.org", table.text(id)));
+    EXPECT_EQ(1, table.stats().misses);
+    EXPECT_EQ(2, table.stats().hits);
+    EXPECT_EQ(1, table.size());
+
+    // A prefix of the same bytes is a different URL.
+    uint32_t prefix = table.intern(URIBEACON_ORG, sizeof(URIBEACON_ORG) - 1);
+    EXPECT_EQ(true, (prefix != 0) && (prefix != id));
+    EXPECT_EQ(0, strcmp("http://uribeacon", table.text(prefix)));
+}
+
+static void testInvalidUris(void) {
+    UrlTable table(8);
+    static const uint8_t unknownScheme[] = { 0x20, 'a' };
+    static const uint8_t shortUuid[] = { 0x04, 0x01, 0x02 };
+    uint8_t tooLong[SIGHTING_URI_MAX + 1];
+    memset(tooLong, 'a', sizeof(tooLong));
+    tooLong[0] = 0x02;
+
+    EXPECT_EQ(0, table.intern(unknownScheme, sizeof(unknownScheme)));
+    EXPECT_EQ(0, table.intern(shortUuid, sizeof(shortUuid)));
+    EXPECT_EQ(0, table.intern(tooLong, sizeof(tooLong)));
+    EXPECT_EQ(3, table.stats().invalid);
+    EXPECT_EQ(0, table.size());
+    EXPECT_EQ(true, table.text(0) == NULL);
+}
+
+static void testDictionary(void) {
+    Dictionary dictionary;
+    EXPECT_EQ(true, dictionary.parse("# venues\n"
+                                     "version 3\n"
+                                     "\n"
+                                     "events.example.com/\r\n"
+                                     "venues/\n"));
+    EXPECT_EQ(3, dictionary.version());
+    EXPECT_EQ(2, dictionary.size());
+    EXPECT_EQ(true, dictionary.format() == "version 3\nevents.example.com/\nvenues/\n");
+
+    // Rejected dictionaries leave the loaded one alone.
+    Dictionary copy;
+    EXPECT_EQ(true, copy.parse(dictionary.format()));
+    EXPECT_EQ(false, copy.parse("events.example.com/\n"));
+    EXPECT_EQ(false, copy.parse("version 16\na\n"));
+    EXPECT_EQ(false, copy.parse("version 1\nhas space\n"));
+    EXPECT_EQ(false, copy.parse("version 1\n" + std::string(URIBEACON_DICT_ENTRY_MAX + 1, 'a')));
+    std::string tooMany = "version 1\n";
+    for (int i = 0; i <= URIBEACON_DICT_SIZE; i++) {
+        tooMany += static_cast<char>('a' + i);
+        tooMany += '\n';
+    }
+    EXPECT_EQ(false, copy.parse(tooMany));
+    EXPECT_EQ(3, copy.version());
+    EXPECT_EQ(2, copy.size());
+
+    // https://events.example.com/venues/hall-b
+    static const uint8_t encoded[] = { 0x03, 0x0E, 0x0F, 'h', 'a', 'l', 'l', '-', 'b' };
+    uint8_t uri[URIBEACON_URI_MAX];
+    uint8_t length;
+    EXPECT_EQ(URIBEACON_OK,
+              uribeacon_uri_encode_dict("https://events.example.com/venues/hall-b",
+                                        dictionary.codes(), uri, sizeof(uri), &length));
+    EXPECT_EQ(sizeof(encoded), length);
+    EXPECT_EQ(0, memcmp(encoded, uri, sizeof(encoded)));
+
+    UrlTable table(8, dictionary.codes());
+    uint32_t id = table.intern(encoded, sizeof(encoded));
+    EXPECT_EQ(true, id != 0);
+    EXPECT_EQ(0, strcmp("https://events.example.com/venues/hall-b", table.text(id)));
+
+    // Without the dictionary the codes are reserved and passed through.
+    UrlTable plain(8);
+    uint32_t raw = plain.intern(encoded, sizeof(encoded));
+    EXPECT_EQ(true, raw != 0);
+    EXPECT_EQ(0, strcmp("https://\x0e\x0fhall-b", plain.text(raw)));
+
+    // A sighting's flags must carry the table's dictionary version, if any.
+    Sighting sighting;
+    memset(&sighting, 0, sizeof(sighting));
+    memcpy(sighting.uri, encoded, sizeof(encoded));
+    sighting.uriLength = sizeof(encoded);
+    sighting.flags = URIBEACON_FLAGS_WITH_DICT(0, 3);
+    EXPECT_EQ(id, table.intern(sighting));
+    EXPECT_EQ(0, plain.intern(sighting));
+    sighting.flags = URIBEACON_FLAGS_WITH_DICT(0, 4);
+    EXPECT_EQ(0, table.intern(sighting));
+    EXPECT_EQ(1, table.stats().otherDictionary);
+    EXPECT_EQ(1, plain.stats().otherDictionary);
+    EXPECT_EQ(0, table.stats().invalid);
+    sighting.flags = 0;
+    EXPECT_EQ(raw, plain.intern(sighting));
+
+    // The longest URI a sighting carries, every byte a longest entry.
+    Dictionary longest;
+    EXPECT_EQ(true, longest.parse("version 1\n" + std::string(URIBEACON_DICT_ENTRY_MAX, 'a')));
+    uint8_t extended[SIGHTING_URI_MAX];
+    extended[0] = 0x02;
+    memset(&extended[1], URIBEACON_DICT_CODE_FIRST, sizeof(extended) - 1);
+    UrlTable longTable(8, longest.codes());
+    uint32_t longId = longTable.intern(extended, sizeof(extended));
+    EXPECT_EQ(true, longId != 0);
+    EXPECT_EQ(strlen("http://") + (SIGHTING_URI_MAX - 1) * URIBEACON_DICT_ENTRY_MAX,
+              strlen(longTable.text(longId)));
+}
+
+static void testEvictionKeepsRecentlyUsed(void) {
+    UrlTable table(4);
+    uint8_t uri[] = { 0x02, 'a' };
+    uint32_t ids[6];
+
+    for (int i = 0; i < 4; i++) {
+        uri[1] = static_cast<uint8_t>('a' + i);
+        ids[i] = table.intern(uri, sizeof(uri));
+    }
+    // The CLOCK hand clears every bit on its first sweep, so only URLs used
+    // again after that survive the next eviction.
+    uri[1] = 'e';
+    ids[4] = table.intern(uri, sizeof(uri));
+    EXPECT_EQ(1, table.stats().evictions);
+    EXPECT_EQ(true, table.text(ids[0]) == NULL);
+
+    uri[1] = 'c';
+    EXPECT_EQ(ids[2], table.intern(uri, sizeof(uri)));
+    uri[1] = 'f';
+    ids[5] = table.intern(uri, sizeof(uri));
+    EXPECT_EQ(true, table.text(ids[1]) == NULL);
+    EXPECT_EQ(0, strcmp("http://c", table.text(ids[2])));
+    EXPECT_EQ(4, table.size());
+
+    // A reused slot gets a new generation, so the old id stays dead.
+    EXPECT_EQ(ids[0] & 0xFFFF, ids[4] & 0xFFFF);
+    EXPECT_EQ(true, ids[0] != ids[4]);
+    EXPECT_EQ(0, strcmp("http://e", table.text(ids[4])));
+}
+
+// Compares the table against a map through many evictions, which exercises
+// the backward shift deletion.
+static void testChurnMatchesReference(void) {
+    UrlTable table(64);
+    std::map<std::string, uint32_t> live;
+    uint32_t seed = 1;
+    int mismatches = 0;
+
+    for (int i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t uri[4] = { 0x02, 'a', 'a', 'a' };
+        unsigned value = (seed >> 8) % 300;
+        uri[1] = static_cast<uint8_t>('a' + value % 26);
+        uri[2] = static_cast<uint8_t>('a' + value / 26);
+        std::string key(reinterpret_cast<char *>(uri), sizeof(uri));
+
+        uint32_t id = table.intern(uri, sizeof(uri));
+        auto found = live.find(key);
+        if ((found != live.end()) && (table.text(found->second) != NULL) && (found->second != id)) {
+            mismatches++;
+        }
+        live[key] = id;
+
+        char expected[16];
+        snprintf(expected, sizeof(expected), "http://%c%ca", uri[1], uri[2]);
+        if ((table.text(id) == NULL) || (strcmp(expected, table.text(id)) != 0)) {
+            mismatches++;
+        }
+    }
+    EXPECT_EQ(0, mismatches);
+    EXPECT_EQ(64, table.size());
+    EXPECT_EQ(100000, table.stats().hits + table.stats().misses);
+    EXPECT_EQ(table.stats().misses - 64, table.stats().evictions);
+}
+
+static void collectSightings(const HciFrame &frame, void *context) {
+    AdvertisingReport reports[HCI_MAX_REPORTS];
+    int count = parseAdvertisingReports(frame, reports);
+    for (int i = 0; i < count; i++) {
+        Sighting sighting;
+        if (decodeSighting(reports[i], 0, sighting)) {
+            static_cast<std::vector<Sighting> *>(context)->push_back(sighting);
+        }
+    }
+}
+
+static void report(const char *name, double seconds, unsigned long long allocs, size_t sightings) {
+    printf("%-28s %8.1f ns/sighting %6.2f allocations/sighting\n",
+           name, seconds * 1e9 / sightings, static_cast<double>(allocs) / sightings);
+}
+
+// Compares expanding the URI of every sighting to text, as uribeacon_scan's
+// get_uri() does, with interning.
+static int runBenchmark(const char *path) {
+    static const int PASSES = 2000;
+    std::vector<Sighting> sightings;
+    HcidumpParser parser;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        parser.feed(buffer, length, collectSightings, &sightings);
+    }
+    parser.finish(collectSightings, &sightings);
+    fclose(file);
+
+    size_t total = sightings.size() * PASSES;
+    unsigned long long checksum = 0;
+
+    unsigned long long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < sightings.size(); i++) {
+            char text[URL_TEXT_MAX];
+            uribeacon_uri_decode(sightings[i].uri, sightings[i].uriLength, text, sizeof(text));
+            std::string uri(text);
+            checksum += uri.size();
+        }
+    }
+    report("string per sighting", std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - start).count(), allocations - before, total);
+
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < sightings.size(); i++) {
+            char text[URL_TEXT_MAX];
+            uribeacon_uri_decode(sightings[i].uri, sightings[i].uriLength, text, sizeof(text));
+            checksum += text[0];
+        }
+    }
+    report("decode per sighting", std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - start).count(), allocations - before, total);
+
+    UrlTable table(4096);
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < sightings.size(); i++) {
+            checksum += table.intern(sightings[i].uri, sightings[i].uriLength);
+        }
+    }
+    report("interned", std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - start).count(), allocations - before, total);
+
+    printf("%zu sightings x %d passes, %zu distinct URLs, %llu decodes (checksum %llu)\n",
+           sightings.size(), PASSES, table.size(),
+           (unsigned long long)table.stats().misses, checksum);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if ((argc > 2) && (strcmp(argv[1], "--bench") == 0)) {
+        return runBenchmark(argv[2]);
+    }
+
+    testInternDecodesOnce();
+    testInvalidUris();
+    testDictionary();
+    testEvictionKeepsRecentlyUsed();
+    testChurnMatchesReference();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Recording host mock of BLE_API BLEDevice.
+//
+// Advertising parameters and payloads are staged like in BLE_API and copied
+// to the simulated radio by startAdvertising(). setAdvertisingData() updates
+// the radio directly while advertising, along with the staged scan response,
+// as the nRF51 stack does. Every call
+// is counted so tests can assert how much work a transition costs.
+
+#ifndef HOST_BLE_DEVICE_H__
+#define HOST_BLE_DEVICE_H__
+
+#include <stdint.h>
+#include "Gap.h"
+#include "GapAdvertisingData.h"
+#include "GapAdvertisingParams.h"
+
+class BLEDevice {
+public:
+    BLEDevice();
+
+    ble_error_t init(void);
+    ble_error_t shutdown(void);
+
+    void onTimeout(Gap::EventCallback_t callback);
+    void onConnection(Gap::ConnectionEventCallback_t callback);
+    void onDisconnection(Gap::DisconnectionEventCallback_t callback);
+
+    void setAdvertisingType(GapAdvertisingParams::AdvertisingType advType);
+    void setAdvertisingInterval(uint16_t interval);
+    void setAdvertisingTimeout(uint16_t timeout);
+    void setAdvertisingParams(const GapAdvertisingParams &newParams);
+    const GapAdvertisingParams &getAdvertisingParams(void) const;
+
+    ble_error_t accumulateAdvertisingPayload(uint8_t flags);
+    ble_error_t accumulateAdvertisingPayload(GapAdvertisingData::Appearance app);
+    ble_error_t accumulateAdvertisingPayload(GapAdvertisingData::DataType type,
+                                             const uint8_t *data, uint8_t len);
+    ble_error_t setAdvertisingData(const GapAdvertisingData &newPayload);
+    const GapAdvertisingData &getAdvertisingData(void) const;
+    void clearAdvertisingPayload(void);
+
+    ble_error_t accumulateScanResponse(GapAdvertisingData::DataType type,
+                                       const uint8_t *data, uint8_t len);
+    void clearScanResponse(void);
+
+    ble_error_t startAdvertising(void);
+    ble_error_t stopAdvertising(void);
+
+    Gap::GapState_t getGapState(void) const;
+
+    ble_error_t setDeviceName(const uint8_t *deviceName);
+    ble_error_t setTxPower(int8_t txPower);
+
+    // Calls waitForEventHook, which drives the test scenario.
+    void waitForEvent(void);
+
+    // Host mock bookkeeping, not part of BLE_API.
+
+    struct CallCounts {
+        unsigned init;
+        unsigned shutdown;
+        unsigned setAdvertisingParams;
+        unsigned accumulateAdvertisingPayload;
+        unsigned setAdvertisingData;
+        unsigned clearAdvertisingPayload;
+        unsigned accumulateScanResponse;
+        unsigned startAdvertising;
+        unsigned stopAdvertising;
+        unsigned setDeviceName;
+        unsigned setTxPower;
+
+        unsigned total(void) const;
+    };
+
+    // What the radio is actually sending.
+    struct Radio {
+        bool                 advertising;
+        bool                 connected;
+        GapAdvertisingParams params;
+        GapAdvertisingData   payload;
+        GapAdvertisingData   scanResponse;
+        int8_t               txPower;
+    };
+
+    CallCounts calls;
+    Radio      radio;
+
+    // Number of times the radio went from advertising to silent because of
+    // stopAdvertising() or shutdown().
+    unsigned silentGaps;
+
+    void (*waitForEventHook)(void);
+
+    void fireTimeout(void);
+    void fireConnection(void);
+    void fireDisconnection(void);
+    void resetCallCounts(void);
+
+private:
+    GapAdvertisingParams advParams;
+    GapAdvertisingData   advPayload;
+    GapAdvertisingData   scanResponse;
+
+    Gap::EventCallback_t              timeoutCallback;
+    Gap::ConnectionEventCallback_t    connectionCallback;
+    Gap::DisconnectionEventCallback_t disconnectionCallback;
+};
+
+#endif // HOST_BLE_DEVICE_H__
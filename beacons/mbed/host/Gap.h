@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host mock of the BLE_API Gap types used by main.cpp.
+
+#ifndef HOST_GAP_H__
+#define HOST_GAP_H__
+
+#include <stdint.h>
+
+class Gap {
+public:
+    typedef uint16_t Handle_t;
+    typedef uint8_t address_t[6];
+
+    enum addr_type_t {
+        ADDR_TYPE_PUBLIC = 0,
+        ADDR_TYPE_RANDOM_STATIC
+    };
+
+    enum DisconnectionReason_t {
+        REMOTE_USER_TERMINATED_CONNECTION = 0x13,
+        LOCAL_CONNECTION_TERMINATED       = 0x16
+    };
+
+    struct ConnectionParams_t {
+        uint16_t minConnectionInterval;
+        uint16_t maxConnectionInterval;
+        uint16_t slaveLatency;
+        uint16_t connectionSupervisionTimeout;
+    };
+
+    struct GapState_t {
+        unsigned advertising : 1;
+        unsigned connected   : 1;
+    };
+
+    typedef void (*EventCallback_t)(void);
+    typedef void (*ConnectionEventCallback_t)(Handle_t,
+                                              addr_type_t peerAddrType,
+                                              const address_t peerAddr,
+                                              const ConnectionParams_t *);
+    typedef void (*DisconnectionEventCallback_t)(Handle_t, DisconnectionReason_t);
+
+    static const unsigned UNIT_0_625_MS = 625;
+
+    static uint16_t MSEC_TO_ADVERTISEMENT_DURATION_UNITS(uint32_t durationInMillis) {
+        return (durationInMillis * 1000) / UNIT_0_625_MS;
+    }
+};
+
+#endif // HOST_GAP_H__
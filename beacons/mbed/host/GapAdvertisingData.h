@@ -0,0 +1,104 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host mock of BLE_API GapAdvertisingData, with the same payload encoding.
+
+#ifndef HOST_GAP_ADVERTISING_DATA_H__
+#define HOST_GAP_ADVERTISING_DATA_H__
+
+#include <stdint.h>
+#include <string.h>
+
+enum ble_error_t {
+    BLE_ERROR_NONE = 0,
+    BLE_ERROR_BUFFER_OVERFLOW = 1
+};
+
+#define GAP_ADVERTISING_DATA_MAX_PAYLOAD (31)
+
+class GapAdvertisingData {
+public:
+    enum DataType {
+        FLAGS                            = 0x01,
+        COMPLETE_LIST_16BIT_SERVICE_IDS  = 0x03,
+        COMPLETE_LIST_128BIT_SERVICE_IDS = 0x07,
+        COMPLETE_LOCAL_NAME              = 0x09,
+        TX_POWER_LEVEL                   = 0x0A,
+        SERVICE_DATA                     = 0x16,
+        APPEARANCE                       = 0x19
+    };
+
+    enum Flags {
+        LE_LIMITED_DISCOVERABLE = 0x01,
+        LE_GENERAL_DISCOVERABLE = 0x02,
+        BREDR_NOT_SUPPORTED     = 0x04
+    };
+
+    enum Appearance {
+        UNKNOWN     = 0,
+        GENERIC_TAG = 512
+    };
+
+    GapAdvertisingData() : payloadLen(0) {
+        memset(payload, 0, sizeof(payload));
+    }
+
+    ble_error_t addData(DataType advDataType, const uint8_t *data, uint8_t len) {
+        if (payloadLen + len + 2 > GAP_ADVERTISING_DATA_MAX_PAYLOAD) {
+            return BLE_ERROR_BUFFER_OVERFLOW;
+        }
+        payload[payloadLen++] = len + 1;
+        payload[payloadLen++] = advDataType;
+        memcpy(&payload[payloadLen], data, len);
+        payloadLen += len;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t addAppearance(Appearance appearance) {
+        uint8_t value[2] = {
+            static_cast<uint8_t>(appearance & 0xFF),
+            static_cast<uint8_t>(appearance >> 8)
+        };
+        return addData(APPEARANCE, value, sizeof(value));
+    }
+
+    ble_error_t addFlags(uint8_t flags) {
+        return addData(FLAGS, &flags, 1);
+    }
+
+    ble_error_t addTxPower(int8_t txPower) {
+        return addData(TX_POWER_LEVEL, reinterpret_cast<uint8_t *>(&txPower), 1);
+    }
+
+    void clear(void) {
+        memset(payload, 0, sizeof(payload));
+        payloadLen = 0;
+    }
+
+    const uint8_t *getPayload(void) const {
+        return payload;
+    }
+
+    uint8_t getPayloadLen(void) const {
+        return payloadLen;
+    }
+
+private:
+    uint8_t payload[GAP_ADVERTISING_DATA_MAX_PAYLOAD];
+    uint8_t payloadLen;
+};
+
+#endif // HOST_GAP_ADVERTISING_DATA_H__
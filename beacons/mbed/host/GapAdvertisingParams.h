@@ -0,0 +1,69 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host mock of BLE_API GapAdvertisingParams.
+
+#ifndef HOST_GAP_ADVERTISING_PARAMS_H__
+#define HOST_GAP_ADVERTISING_PARAMS_H__
+
+#include <stdint.h>
+
+class GapAdvertisingParams {
+public:
+    enum AdvertisingType {
+        ADV_CONNECTABLE_UNDIRECTED,
+        ADV_CONNECTABLE_DIRECTED,
+        ADV_SCANNABLE_UNDIRECTED,
+        ADV_NON_CONNECTABLE_UNDIRECTED
+    };
+
+    GapAdvertisingParams(AdvertisingType advType = ADV_CONNECTABLE_UNDIRECTED,
+                         uint16_t interval = 0,
+                         uint16_t timeout = 0)
+        : advType(advType), interval(interval), timeout(timeout) {
+    }
+
+    AdvertisingType getAdvertisingType(void) const {
+        return advType;
+    }
+
+    uint16_t getInterval(void) const {
+        return interval;
+    }
+
+    uint16_t getTimeout(void) const {
+        return timeout;
+    }
+
+    void setAdvertisingType(AdvertisingType newAdvType) {
+        advType = newAdvType;
+    }
+
+    void setInterval(uint16_t newInterval) {
+        interval = newInterval;
+    }
+
+    void setTimeout(uint16_t newTimeout) {
+        timeout = newTimeout;
+    }
+
+private:
+    AdvertisingType advType;
+    uint16_t        interval;
+    uint16_t        timeout;
+};
+
+#endif // HOST_GAP_ADVERTISING_PARAMS_H__
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Host mock of BLE_API URIBeaconConfigService. The GATT side is not
+// simulated; tests change the configuration through params directly.
+
+#ifndef HOST_URI_BEACON_CONFIG_SERVICE_H__
+#define HOST_URI_BEACON_CONFIG_SERVICE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include "BLEDevice.h"
+
+static const uint8_t UUID_URI_BEACON_SERVICE[] = {
+    0xee, 0x0c, 0x20, 0x80, 0x87, 0x86, 0x40, 0xba,
+    0xab, 0x96, 0x99, 0xb9, 0x1a, 0xc9, 0x81, 0xd8
+};
+
+static const uint8_t BEACON_UUID[] = {0xD8, 0xFE};
+
+class URIBeaconConfigService {
+public:
+    static const unsigned URI_DATA_MAX = 18;
+    typedef uint8_t UriData_t[URI_DATA_MAX];
+
+    static const unsigned LOCK_CODE_SIZE = 16;
+    typedef uint8_t Lock_t[LOCK_CODE_SIZE];
+
+    enum TXPowerModes_t {
+        TX_POWER_MODE_LOWEST,
+        TX_POWER_MODE_LOW,
+        TX_POWER_MODE_MEDIUM,
+        TX_POWER_MODE_HIGH,
+        NUM_POWER_MODES
+    };
+    typedef int8_t PowerLevels_t[NUM_POWER_MODES];
+
+    static const uint16_t DEFAULT_BEACON_PERIOD = 1000;
+
+    struct Params_t {
+        Lock_t        lock;
+        uint8_t       uriDataLength;
+        UriData_t     uriData;
+        uint8_t       flags;
+        PowerLevels_t advPowerLevels;
+        uint8_t       txPowerMode;
+        uint16_t      beaconPeriod;
+    };
+
+    URIBeaconConfigService(BLEDevice &bleIn,
+                           Params_t &paramsIn,
+                           bool resetToDefaultsFlag,
+                           UriData_t defaultUriDataIn,
+                           int defaultUriDataLengthIn,
+                           PowerLevels_t &defaultAdvPowerLevelsIn)
+        : params(paramsIn), initSucceeded(true) {
+        if (defaultUriDataLengthIn > static_cast<int>(URI_DATA_MAX)) {
+            initSucceeded = false;
+            return;
+        }
+        if (resetToDefaultsFlag) {
+            memset(&params, 0, sizeof(params));
+            memcpy(params.uriData, defaultUriDataIn, defaultUriDataLengthIn);
+            params.uriDataLength = defaultUriDataLengthIn;
+            memcpy(params.advPowerLevels, defaultAdvPowerLevelsIn, sizeof(PowerLevels_t));
+            params.txPowerMode = TX_POWER_MODE_LOW;
+            params.beaconPeriod = DEFAULT_BEACON_PERIOD;
+        }
+    }
+
+    bool configuredSuccessfully(void) const {
+        return initSucceeded;
+    }
+
+    Params_t &params;
+
+private:
+    bool initSucceeded;
+};
+
+#endif // HOST_URI_BEACON_CONFIG_SERVICE_H__
@@ -0,0 +1,424 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Conformance runner for the native UriBeacon encoders and decoders.
+//
+// Loads the URL <-> scanRecord vectors the Android library tests use
+// (android-uribeacon/uribeacon-library/src/androidTest/assets/testdata.json)
+// and checks each of them against:
+//
+//   core encode    uribeacon_uri_encode() + uribeacon_frame_build()
+//   core decode    uribeacon_frame_check() + uribeacon_uri_decode()
+//   mbed payload   startAdvertisingUriBeacon() in main.cpp, through the
+//                  BLE_API mocks; the CSR firmware builds its frame with the
+//                  core frame builder
+//
+//   uribeacon_conformance testdata.json               check the vectors
+//   uribeacon_conformance testdata.json --bench [N]   then run the corpus N
+//                                                     times through the core
+//                                                     and N/10 times through
+//                                                     the mbed payload path
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+#include "BLEDevice.h"
+#include "URIBeaconConfigService.h"
+#include "pstorage.h"
+#include "uribeacon_core.h"
+
+// From main.cpp
+extern BLEDevice ble;
+extern URIBeaconConfigService::Params_t params;
+void startAdvertisingUriBeacon();
+
+// Just enough JSON for testdata.json: objects, arrays, strings without
+// unicode escapes, integers, true, false and null.
+struct JsonValue {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type;
+    long number;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    JsonValue() : type(NUL), number(0) {}
+
+    const JsonValue *get(const char *key) const {
+        for (size_t i = 0; i < members.size(); i++) {
+            if (members[i].first == key) {
+                return &members[i].second;
+            }
+        }
+        return NULL;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string &textIn) : text(textIn), pos(0) {}
+
+    bool parse(JsonValue *value) {
+        return parseValue(value) && (skipSpace(), pos == text.size());
+    }
+
+private:
+    const std::string &text;
+    size_t pos;
+
+    void skipSpace(void) {
+        while ((pos < text.size()) && isspace(static_cast<unsigned char>(text[pos]))) {
+            pos++;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if ((pos < text.size()) && (text[pos] == c)) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool literal(const char *word) {
+        size_t length = strlen(word);
+        if (text.compare(pos, length, word) == 0) {
+            pos += length;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseString(std::string *out) {
+        if (!consume('"')) {
+            return false;
+        }
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c == '\\') {
+                if (pos == text.size()) {
+                    return false;
+                }
+                c = text[pos++];
+                switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case '"': case '\\': case '/': break;
+                default: return false;
+                }
+            }
+            out->push_back(c);
+        }
+        return false;
+    }
+
+    bool parseValue(JsonValue *value) {
+        skipSpace();
+        if (pos == text.size()) {
+            return false;
+        }
+        char c = text[pos];
+        if (c == '{') {
+            value->type = JsonValue::OBJECT;
+            pos++;
+            if (consume('}')) {
+                return true;
+            }
+            do {
+                std::pair<std::string, JsonValue> member;
+                if (!parseString(&member.first) || !consume(':') ||
+                    !parseValue(&member.second)) {
+                    return false;
+                }
+                value->members.push_back(member);
+            } while (consume(','));
+            return consume('}');
+        }
+        if (c == '[') {
+            value->type = JsonValue::ARRAY;
+            pos++;
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                value->items.push_back(JsonValue());
+                if (!parseValue(&value->items.back())) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        }
+        if (c == '"') {
+            value->type = JsonValue::STRING;
+            return parseString(&value->string);
+        }
+        if ((c == '-') || isdigit(static_cast<unsigned char>(c))) {
+            char *end;
+            value->type = JsonValue::NUMBER;
+            value->number = strtol(text.c_str() + pos, &end, 10);
+            pos = end - text.c_str();
+            return true;
+        }
+        if (literal("null")) {
+            value->type = JsonValue::NUL;
+            return true;
+        }
+        if (literal("true")) {
+            value->type = JsonValue::BOOL;
+            value->number = 1;
+            return true;
+        }
+        if (literal("false")) {
+            value->type = JsonValue::BOOL;
+            return true;
+        }
+        return false;
+    }
+};
+
+// One URL <-> scanRecord vector. A URL that cannot be advertised has no
+// scanRecord.
+struct Vector {
+    std::string url;
+    int tx;
+    int flags;
+    bool encodable;
+    std::vector<uint8_t> scanRecord;
+};
+
+static bool loadVectors(const char *path, std::vector<Vector> *vectors) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, n);
+    }
+    fclose(file);
+
+    JsonValue root;
+    if (!JsonParser(text).parse(&root)) {
+        fprintf(stderr, "%s: malformed JSON\n", path);
+        return false;
+    }
+    const JsonValue *tests = root.get("test-data");
+    if ((tests == NULL) || (tests->type != JsonValue::ARRAY)) {
+        fprintf(stderr, "%s: no test-data array\n", path);
+        return false;
+    }
+    for (size_t i = 0; i < tests->items.size(); i++) {
+        const JsonValue &test = tests->items[i];
+        const JsonValue *url = test.get("url");
+        const JsonValue *tx = test.get("tx");
+        const JsonValue *flags = test.get("flags");
+        const JsonValue *scanRecord = test.get("scanRecord");
+        if ((url == NULL) || (url->type != JsonValue::STRING) || (scanRecord == NULL)) {
+            fprintf(stderr, "%s: test %zu: missing url or scanRecord\n", path, i);
+            return false;
+        }
+
+        Vector vector;
+        vector.url = url->string;
+        // Defaults as in UriBeaconTest.java
+        vector.tx = tx ? static_cast<int>(tx->number) : 20;
+        vector.flags = flags ? static_cast<int>(flags->number) : 0;
+        vector.encodable = scanRecord->type == JsonValue::ARRAY;
+        // Integers are bytes, strings are their characters.
+        for (size_t j = 0; j < scanRecord->items.size(); j++) {
+            const JsonValue &item = scanRecord->items[j];
+            if (item.type == JsonValue::NUMBER) {
+                vector.scanRecord.push_back(static_cast<uint8_t>(item.number));
+            } else {
+                vector.scanRecord.insert(vector.scanRecord.end(),
+                                         item.string.begin(), item.string.end());
+            }
+        }
+        vectors->push_back(vector);
+    }
+    return true;
+}
+
+static int failures = 0;
+
+static void fail(const Vector &vector, const char *check, const char *detail) {
+    fprintf(stderr, "%-12s %s: %s\n", check, vector.url.c_str(), detail);
+    failures++;
+}
+
+static void configFromVector(const Vector &vector, const uint8_t *uri, uint8_t uriLength,
+                             uribeacon_config_t *config) {
+    uribeacon_config_defaults(config);
+    memcpy(config->uri, uri, uriLength);
+    config->uri_length = uriLength;
+    config->flags = vector.flags;
+    config->adv_tx_power_levels[config->tx_power_mode] = vector.tx;
+}
+
+// Returns the length of the frame built, or 0 if the URL was rejected.
+static uint8_t coreEncode(const Vector &vector, uint8_t *frame) {
+    uint8_t uri[URIBEACON_URI_MAX];
+    uint8_t uriLength;
+    if (uribeacon_uri_encode(vector.url.c_str(), uri, sizeof(uri), &uriLength) != URIBEACON_OK) {
+        return 0;
+    }
+    uribeacon_config_t config;
+    configFromVector(vector, uri, uriLength, &config);
+    return uribeacon_frame_build(&config, frame, URIBEACON_FRAME_MAX);
+}
+
+static bool coreDecode(const Vector &vector, char *url, size_t size) {
+    const std::vector<uint8_t> &record = vector.scanRecord;
+    // UUID list (4), service data length and type (2), UUID, flags and TX (4)
+    static const size_t URI_OFFSET = 10;
+    if ((uribeacon_frame_check(record.data(), record.size()) != URIBEACON_OK) ||
+        (record.size() < URI_OFFSET) || (record[5] != 0x16)) {
+        return false;
+    }
+    return uribeacon_uri_decode(&record[URI_OFFSET], record.size() - URI_OFFSET,
+                                url, size) == URIBEACON_OK;
+}
+
+// Returns the UriBeacon frame advertised by main.cpp, without the Flags AD.
+static std::vector<uint8_t> mbedEncode(const Vector &vector) {
+    uint8_t uri[URIBEACON_URI_MAX];
+    uint8_t uriLength;
+    uribeacon_uri_encode(vector.url.c_str(), uri, sizeof(uri), &uriLength);
+
+    memset(&params, 0, sizeof(params));
+    memcpy(params.uriData, uri, uriLength);
+    params.uriDataLength = uriLength;
+    params.flags = vector.flags;
+    params.txPowerMode = URIBeaconConfigService::TX_POWER_MODE_LOW;
+    params.advPowerLevels[params.txPowerMode] = vector.tx;
+    params.beaconPeriod = URIBeaconConfigService::DEFAULT_BEACON_PERIOD;
+    startAdvertisingUriBeacon();
+
+    const uint8_t *payload = ble.radio.payload.getPayload();
+    uint8_t length = ble.radio.payload.getPayloadLen();
+    if ((length < URIBEACON_ADV_FLAGS_SIZE) || (payload[1] != GapAdvertisingData::FLAGS)) {
+        return std::vector<uint8_t>();
+    }
+    return std::vector<uint8_t>(payload + URIBEACON_ADV_FLAGS_SIZE, payload + length);
+}
+
+static bool sameUrl(const Vector &vector, const char *url) {
+    // urn:uuid: is decoded in lower case.
+    if (vector.url.compare(0, 9, "urn:uuid:") == 0) {
+        return strcasecmp(vector.url.c_str(), url) == 0;
+    }
+    return vector.url == url;
+}
+
+static void checkVector(const Vector &vector) {
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    uint8_t frameLength = coreEncode(vector, frame);
+    if (!vector.encodable) {
+        if (frameLength != 0) {
+            fail(vector, "core encode", "accepted a URL with no scanRecord");
+        }
+        return;
+    }
+    if ((frameLength != vector.scanRecord.size()) ||
+        (memcmp(frame, vector.scanRecord.data(), frameLength) != 0)) {
+        fail(vector, "core encode", "frame differs from scanRecord");
+    }
+
+    char url[128];
+    if (!coreDecode(vector, url, sizeof(url))) {
+        fail(vector, "core decode", "scanRecord rejected");
+    } else if (!sameUrl(vector, url)) {
+        fail(vector, "core decode", url);
+    }
+
+    if (mbedEncode(vector) != vector.scanRecord) {
+        fail(vector, "mbed payload", "payload differs from scanRecord");
+    }
+}
+
+static void benchmark(const std::vector<Vector> &vectors, long passes) {
+    uint8_t frame[URIBEACON_FRAME_MAX];
+    char url[128];
+    unsigned sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < vectors.size(); i++) {
+            sink += coreEncode(vectors[i], frame);
+            if (vectors[i].encodable) {
+                sink += coreDecode(vectors[i], url, sizeof(url));
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-14s %10ld vectors %10.0f vectors/s\n", "core",
+           passes * static_cast<long>(vectors.size()), passes * vectors.size() / seconds);
+
+    passes /= 10;
+    long encoded = 0;
+    start = std::chrono::steady_clock::now();
+    for (long pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < vectors.size(); i++) {
+            if (vectors[i].encodable) {
+                sink += mbedEncode(vectors[i]).size();
+                encoded++;
+            }
+        }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-14s %10ld vectors %10.0f vectors/s\n", "mbed payload", encoded, encoded / seconds);
+
+    if (sink == 0) {
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s testdata.json [--bench [passes]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::vector<Vector> vectors;
+    if (!loadVectors(argv[1], &vectors)) {
+        return EXIT_FAILURE;
+    }
+
+    pstorageMock.erase();
+    for (size_t i = 0; i < vectors.size(); i++) {
+        checkVector(vectors[i]);
+    }
+    printf("%zu vectors, %d failures\n", vectors.size(), failures);
+    if (failures != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if ((argc > 2) && (strcmp(argv[2], "--bench") == 0)) {
+        benchmark(vectors, (argc > 3) ? atol(argv[3]) : 1000000);
+    }
+    return EXIT_SUCCESS;
+}
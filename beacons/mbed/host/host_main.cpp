@@ -0,0 +1,331 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Host test and benchmark driver for the mbed UriBeacon firmware.
+//
+// main.cpp is compiled with its main() renamed to uriBeaconMain(). The first
+// ble.waitForEvent() call hands control to runScenario(), which drives the
+// firmware through the recorded BLE_API mock and exits.
+//
+//   uribeacon_host           run the tests
+//   uribeacon_host --bench   run the transition microbenchmark
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BLEDevice.h"
+#include "URIBeaconConfigService.h"
+#include "pstorage.h"
+
+// From main.cpp
+extern BLEDevice ble;
+extern URIBeaconConfigService *uriBeaconConfig;
+extern unsigned flashOpsAvoided;
+extern uint8_t uriContinuation[];
+extern uint8_t uriContinuationLength;
+bool pstorageLoad(void);
+int uriBeaconMain(void);
+
+static bool runBenchmark = false;
+static int failures = 0;
+
+#define EXPECT_EQ(expected, actual)                                         \
+    do {                                                                    \
+        long long e = (expected), a = (actual);                             \
+        if (e != a) {                                                       \
+            fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n",       \
+                    __FILE__, __LINE__, #actual, e, a);                     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void expectPayload(const uint8_t *expected, size_t expectedLen,
+                          const GapAdvertisingData &actual, int line) {
+    if ((expectedLen != actual.getPayloadLen()) ||
+        (memcmp(expected, actual.getPayload(), expectedLen) != 0)) {
+        fprintf(stderr, "%s:%d: advertising payload mismatch\n  expected:", __FILE__, line);
+        for (size_t i = 0; i < expectedLen; i++) {
+            fprintf(stderr, " %02x", expected[i]);
+        }
+        fprintf(stderr, "\n  actual:  ");
+        for (size_t i = 0; i < actual.getPayloadLen(); i++) {
+            fprintf(stderr, " %02x", actual.getPayload()[i]);
+        }
+        fprintf(stderr, "\n");
+        failures++;
+    }
+}
+
+#define EXPECT_PAYLOAD(expected, actual) \
+    expectPayload(expected, sizeof(expected), actual, __LINE__)
+
+static void testBootAdvertisesConfigService(void) {
+    uint8_t expected[3 + 2 + sizeof(UUID_URI_BEACON_SERVICE) + 4] = {
+        0x02, 0x01, 0x06,
+        0x11, 0x07
+    };
+    for (unsigned i = 0; i < sizeof(UUID_URI_BEACON_SERVICE); i++) {
+        expected[5 + i] = UUID_URI_BEACON_SERVICE[sizeof(UUID_URI_BEACON_SERVICE) - i - 1];
+    }
+    uint8_t *appearance = &expected[5 + sizeof(UUID_URI_BEACON_SERVICE)];
+    appearance[0] = 0x03;
+    appearance[1] = 0x19;
+    appearance[2] = 0x00;
+    appearance[3] = 0x02;
+
+    EXPECT_EQ(true, ble.radio.advertising);
+    EXPECT_EQ(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED,
+              ble.radio.params.getAdvertisingType());
+    EXPECT_EQ(60, ble.radio.params.getTimeout());
+    EXPECT_EQ(1600, ble.radio.params.getInterval());
+    EXPECT_PAYLOAD(expected, ble.radio.payload);
+}
+
+static void testTimeoutStartsUriBeacon(void) {
+    const uint8_t expected[] = {
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0xD8, 0xFE,
+        0x10, 0x16, 0xD8, 0xFE,
+        0x00,                   // flags
+        0xFC,                   // TX_POWER_MODE_LOW: -4 dBm
+        0x02, 'u', 'r', 'i', 'b', 'e', 'a', 'c', 'o', 'n', 0x08
+    };
+
+    ble.resetCallCounts();
+    pstorageMock.resetCounts();
+    ble.fireTimeout();
+
+    EXPECT_EQ(true, ble.radio.advertising);
+    EXPECT_EQ(GapAdvertisingParams::ADV_NON_CONNECTABLE_UNDIRECTED,
+              ble.radio.params.getAdvertisingType());
+    EXPECT_EQ(0, ble.radio.params.getTimeout());
+    EXPECT_EQ(1600, ble.radio.params.getInterval());
+    EXPECT_EQ(-4, ble.radio.txPower);
+    EXPECT_PAYLOAD(expected, ble.radio.payload);
+
+    // The stack is reconfigured, not restarted.
+    EXPECT_EQ(0, ble.calls.shutdown);
+    EXPECT_EQ(0, ble.calls.init);
+    EXPECT_EQ(1, ble.calls.startAdvertising);
+
+    // First save after an erase stores the whole record.
+    EXPECT_EQ(1, pstorageMock.storeCount);
+    EXPECT_EQ(0, pstorageMock.updateCount);
+}
+
+static void testUnchangedConfigSkipsFlash(void) {
+    unsigned avoided = flashOpsAvoided;
+
+    pstorageMock.resetCounts();
+    ble.fireDisconnection();
+
+    EXPECT_EQ(0, pstorageMock.storeCount);
+    EXPECT_EQ(0, pstorageMock.updateCount);
+    EXPECT_EQ(avoided + 1, flashOpsAvoided);
+}
+
+static void testChangedConfigUpdatesDirtyWords(void) {
+    // Offset of flags in the uribeacon_core record. It shares the last two
+    // words with the CRC.
+    static const unsigned FLAGS_OFFSET = 51;
+
+    uriBeaconConfig->params.flags = 0x01;
+
+    pstorageMock.resetCounts();
+    ble.fireDisconnection();
+
+    EXPECT_EQ(0, pstorageMock.storeCount);
+    EXPECT_EQ(1, pstorageMock.updateCount);
+    EXPECT_EQ(8, pstorageMock.bytesWritten);
+    EXPECT_EQ(0x01, pstorageMock.flash[FLAGS_OFFSET]);
+
+    uriBeaconConfig->params.flags = 0x00;
+    ble.fireDisconnection();
+}
+
+static void testPayloadChangeKeepsAdvertising(void) {
+    // Still beaconing from the previous test.
+    uriBeaconConfig->params.flags = 0x01;
+    uriBeaconConfig->params.txPowerMode = URIBeaconConfigService::TX_POWER_MODE_HIGH;
+
+    ble.resetCallCounts();
+    ble.fireDisconnection();
+
+    EXPECT_EQ(true, ble.radio.advertising);
+    EXPECT_EQ(0, ble.silentGaps);
+    EXPECT_EQ(0, ble.calls.stopAdvertising);
+    EXPECT_EQ(0, ble.calls.startAdvertising);
+    EXPECT_EQ(0, ble.calls.setAdvertisingParams);
+    EXPECT_EQ(1, ble.calls.setAdvertisingData);
+    EXPECT_EQ(10, ble.radio.txPower);
+    EXPECT_EQ(0x01, ble.radio.payload.getPayload()[11]);
+    EXPECT_EQ(10, ble.radio.payload.getPayload()[12]);
+}
+
+static void testPeriodChangeRestartsAdvertisingOnce(void) {
+    uriBeaconConfig->params.beaconPeriod = 500;
+
+    ble.resetCallCounts();
+    ble.fireDisconnection();
+
+    EXPECT_EQ(true, ble.radio.advertising);
+    EXPECT_EQ(1, ble.silentGaps);
+    EXPECT_EQ(1, ble.calls.stopAdvertising);
+    EXPECT_EQ(1, ble.calls.startAdvertising);
+    EXPECT_EQ(800, ble.radio.params.getInterval());
+}
+
+static void testUriContinuationInScanResponse(void) {
+    static const uint8_t continuation[] = {'/', 'l', 'o', 'n', 'g', 'e', 'r'};
+    const uint8_t expected[] = {
+        0x0A, 0x16, 0xD8, 0xFE, '/', 'l', 'o', 'n', 'g', 'e', 'r'
+    };
+    // Offset of the continuation after the uribeacon_core record.
+    static const unsigned CONTINUATION_OFFSET = 56;
+
+    memcpy(uriContinuation, continuation, sizeof(continuation));
+    uriContinuationLength = sizeof(continuation);
+    pstorageMock.resetCounts();
+    ble.fireDisconnection();
+
+    EXPECT_EQ(true, ble.radio.advertising);
+    EXPECT_EQ(GapAdvertisingParams::ADV_SCANNABLE_UNDIRECTED,
+              ble.radio.params.getAdvertisingType());
+    // Flagged as continued, but stored with the flags as configured.
+    EXPECT_EQ(0x03, ble.radio.payload.getPayload()[11]);
+    EXPECT_PAYLOAD(expected, ble.radio.scanResponse);
+    EXPECT_EQ(1, pstorageMock.updateCount);
+    EXPECT_EQ(0x01, pstorageMock.flash[51]);
+    EXPECT_EQ(sizeof(continuation), pstorageMock.flash[CONTINUATION_OFFSET]);
+    EXPECT_EQ('/', pstorageMock.flash[CONTINUATION_OFFSET + 1]);
+
+    // A new continuation is swapped in while advertising.
+    uriContinuation[0] = '_';
+    ble.resetCallCounts();
+    ble.fireDisconnection();
+    EXPECT_EQ(0, ble.calls.stopAdvertising);
+    EXPECT_EQ('_', ble.radio.scanResponse.getPayload()[4]);
+
+    // Without one the beacon is no longer scannable.
+    uriContinuationLength = 0;
+    ble.fireDisconnection();
+    EXPECT_EQ(GapAdvertisingParams::ADV_NON_CONNECTABLE_UNDIRECTED,
+              ble.radio.params.getAdvertisingType());
+    EXPECT_EQ(0x01, ble.radio.payload.getPayload()[11]);
+    EXPECT_EQ(0, ble.radio.scanResponse.getPayloadLen());
+    EXPECT_EQ(0, pstorageMock.flash[CONTINUATION_OFFSET]);
+}
+
+static void testOldImageIsReplaced(void) {
+    // Firmware before the uribeacon_core record stored a magic and Params_t.
+    static const uint32_t OLD_MAGIC = 0x1BEAC000;
+    URIBeaconConfigService::Params_t config = uriBeaconConfig->params;
+
+    pstorageMock.erase();
+    memcpy(&pstorageMock.flash[0], &OLD_MAGIC, sizeof(OLD_MAGIC));
+    memcpy(&pstorageMock.flash[sizeof(OLD_MAGIC)], &config, sizeof(config));
+    EXPECT_EQ(false, pstorageLoad());
+
+    uriBeaconConfig->params = config;
+    uriBeaconConfig->params.flags = 0x01;
+    pstorageMock.resetCounts();
+    ble.fireDisconnection();
+
+    // Storing would only clear bits of the old image.
+    EXPECT_EQ(0, pstorageMock.storeCount);
+    EXPECT_EQ(1, pstorageMock.updateCount);
+    memset(&uriBeaconConfig->params, 0, sizeof(config));
+    EXPECT_EQ(true, pstorageLoad());
+    EXPECT_EQ(0x01, uriBeaconConfig->params.flags);
+    EXPECT_EQ(config.uriDataLength, uriBeaconConfig->params.uriDataLength);
+    EXPECT_EQ(0, memcmp(config.uriData, uriBeaconConfig->params.uriData, config.uriDataLength));
+}
+
+static void runTests(void) {
+    testBootAdvertisesConfigService();
+    testTimeoutStartsUriBeacon();
+    testUnchangedConfigSkipsFlash();
+    testChangedConfigUpdatesDirtyWords();
+    testPayloadChangeKeepsAdvertising();
+    testPeriodChangeRestartsAdvertisingOnce();
+    testUriContinuationInScanResponse();
+    testOldImageIsReplaced();
+
+    if (failures == 0) {
+        printf("All tests passed\n");
+    }
+    exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Times the firmware side of repeated mode transitions. The mock stack does
+// no radio work, so this measures the CPU cost of building and applying the
+// new configuration plus the number of stack calls and radio gaps.
+static void benchmarkTransition(const char *name, bool changePayload, bool changePeriod) {
+    static const int ITERATIONS = 200000;
+
+    ble.fireTimeout();
+    ble.resetCallCounts();
+    pstorageMock.resetCounts();
+    unsigned avoided = flashOpsAvoided;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (changePayload) {
+            uriBeaconConfig->params.flags = i & 1;
+        }
+        if (changePeriod) {
+            uriBeaconConfig->params.beaconPeriod = (i & 1) ? 500 : 1000;
+        }
+        ble.fireDisconnection();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double nsPerTransition =
+        std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+
+    printf("%-24s %8.1f ns/transition %6.2f stack calls/transition %6.2f radio gaps/transition\n",
+           name, nsPerTransition,
+           static_cast<double>(ble.calls.total()) / ITERATIONS,
+           static_cast<double>(ble.silentGaps) / ITERATIONS);
+    printf("%-24s %8.2f flash ops/transition %6.2f flash bytes/transition %6.2f flash ops avoided/transition\n",
+           "",
+           static_cast<double>(pstorageMock.storeCount + pstorageMock.updateCount) / ITERATIONS,
+           static_cast<double>(pstorageMock.bytesWritten) / ITERATIONS,
+           static_cast<double>(flashOpsAvoided - avoided) / ITERATIONS);
+}
+
+static void runBenchmarks(void) {
+    benchmarkTransition("unchanged config", false, false);
+    benchmarkTransition("payload swap", true, false);
+    benchmarkTransition("payload + period change", true, true);
+    exit(EXIT_SUCCESS);
+}
+
+static void runScenario(void) {
+    // Only the first wait hands over control.
+    ble.waitForEventHook = NULL;
+    if (runBenchmark) {
+        runBenchmarks();
+    } else {
+        runTests();
+    }
+}
+
+int main(int argc, char **argv) {
+    runBenchmark = (argc > 1) && (strcmp(argv[1], "--bench") == 0);
+
+    pstorageMock.erase();
+    ble.waitForEventHook = runScenario;
+    return uriBeaconMain();
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host mock of the parts of the mbed SDK used by main.cpp.
+
+#ifndef HOST_MBED_H__
+#define HOST_MBED_H__
+
+#include <stdint.h>
+#include <string.h>
+
+enum PinName {
+    LED1,
+    LED2
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : pin(pin), value(0) {
+    }
+
+    DigitalOut &operator=(int newValue) {
+        value = newValue;
+        return *this;
+    }
+
+    operator int() const {
+        return value;
+    }
+
+private:
+    PinName pin;
+    int value;
+};
+
+// Delays are not simulated.
+void wait(float seconds);
+
+// Reports the error and aborts, like the mbed runtime halts the target.
+void error(const char *format, ...);
+
+#endif // HOST_MBED_H__
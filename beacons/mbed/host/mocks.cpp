@@ -0,0 +1,300 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Implementation of the host mocks for the mbed SDK, BLE_API and pstorage.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <nrf_error.h>
+#include "mbed.h"
+#include "BLEDevice.h"
+#include "pstorage.h"
+
+void wait(float seconds) {
+}
+
+void error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    abort();
+}
+
+unsigned BLEDevice::CallCounts::total(void) const {
+    return init + shutdown + setAdvertisingParams +
+           accumulateAdvertisingPayload + setAdvertisingData +
+           clearAdvertisingPayload + accumulateScanResponse +
+           startAdvertising + stopAdvertising + setDeviceName + setTxPower;
+}
+
+BLEDevice::BLEDevice()
+    : silentGaps(0),
+      waitForEventHook(NULL),
+      timeoutCallback(NULL),
+      connectionCallback(NULL),
+      disconnectionCallback(NULL) {
+    resetCallCounts();
+    radio.advertising = false;
+    radio.connected = false;
+    radio.txPower = 0;
+}
+
+ble_error_t BLEDevice::init(void) {
+    calls.init++;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t BLEDevice::shutdown(void) {
+    calls.shutdown++;
+    if (radio.advertising) {
+        silentGaps++;
+    }
+    radio.advertising = false;
+    radio.connected = false;
+    advParams = GapAdvertisingParams();
+    advPayload.clear();
+    scanResponse.clear();
+    return BLE_ERROR_NONE;
+}
+
+void BLEDevice::onTimeout(Gap::EventCallback_t callback) {
+    timeoutCallback = callback;
+}
+
+void BLEDevice::onConnection(Gap::ConnectionEventCallback_t callback) {
+    connectionCallback = callback;
+}
+
+void BLEDevice::onDisconnection(Gap::DisconnectionEventCallback_t callback) {
+    disconnectionCallback = callback;
+}
+
+void BLEDevice::setAdvertisingType(GapAdvertisingParams::AdvertisingType advType) {
+    calls.setAdvertisingParams++;
+    advParams.setAdvertisingType(advType);
+}
+
+void BLEDevice::setAdvertisingInterval(uint16_t interval) {
+    calls.setAdvertisingParams++;
+    advParams.setInterval(interval);
+}
+
+void BLEDevice::setAdvertisingTimeout(uint16_t timeout) {
+    calls.setAdvertisingParams++;
+    advParams.setTimeout(timeout);
+}
+
+void BLEDevice::setAdvertisingParams(const GapAdvertisingParams &newParams) {
+    calls.setAdvertisingParams++;
+    advParams = newParams;
+}
+
+const GapAdvertisingParams &BLEDevice::getAdvertisingParams(void) const {
+    return advParams;
+}
+
+ble_error_t BLEDevice::accumulateAdvertisingPayload(uint8_t flags) {
+    calls.accumulateAdvertisingPayload++;
+    return advPayload.addFlags(flags);
+}
+
+ble_error_t BLEDevice::accumulateAdvertisingPayload(GapAdvertisingData::Appearance app) {
+    calls.accumulateAdvertisingPayload++;
+    return advPayload.addAppearance(app);
+}
+
+ble_error_t BLEDevice::accumulateAdvertisingPayload(GapAdvertisingData::DataType type,
+                                                    const uint8_t *data, uint8_t len) {
+    calls.accumulateAdvertisingPayload++;
+    return advPayload.addData(type, data, len);
+}
+
+ble_error_t BLEDevice::setAdvertisingData(const GapAdvertisingData &newPayload) {
+    calls.setAdvertisingData++;
+    advPayload = newPayload;
+    if (radio.advertising) {
+        radio.payload = advPayload;
+        radio.scanResponse = scanResponse;
+    }
+    return BLE_ERROR_NONE;
+}
+
+const GapAdvertisingData &BLEDevice::getAdvertisingData(void) const {
+    return advPayload;
+}
+
+void BLEDevice::clearAdvertisingPayload(void) {
+    calls.clearAdvertisingPayload++;
+    advPayload.clear();
+}
+
+ble_error_t BLEDevice::accumulateScanResponse(GapAdvertisingData::DataType type,
+                                              const uint8_t *data, uint8_t len) {
+    calls.accumulateScanResponse++;
+    return scanResponse.addData(type, data, len);
+}
+
+void BLEDevice::clearScanResponse(void) {
+    scanResponse.clear();
+}
+
+ble_error_t BLEDevice::startAdvertising(void) {
+    calls.startAdvertising++;
+    radio.advertising = true;
+    radio.params = advParams;
+    radio.payload = advPayload;
+    radio.scanResponse = scanResponse;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t BLEDevice::stopAdvertising(void) {
+    calls.stopAdvertising++;
+    if (radio.advertising) {
+        silentGaps++;
+    }
+    radio.advertising = false;
+    return BLE_ERROR_NONE;
+}
+
+Gap::GapState_t BLEDevice::getGapState(void) const {
+    Gap::GapState_t state;
+    state.advertising = radio.advertising;
+    state.connected = radio.connected;
+    return state;
+}
+
+ble_error_t BLEDevice::setDeviceName(const uint8_t *deviceName) {
+    calls.setDeviceName++;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t BLEDevice::setTxPower(int8_t txPower) {
+    calls.setTxPower++;
+    radio.txPower = txPower;
+    return BLE_ERROR_NONE;
+}
+
+void BLEDevice::waitForEvent(void) {
+    if (waitForEventHook != NULL) {
+        waitForEventHook();
+    }
+}
+
+void BLEDevice::fireTimeout(void) {
+    radio.advertising = false;
+    if (timeoutCallback != NULL) {
+        timeoutCallback();
+    }
+}
+
+void BLEDevice::fireConnection(void) {
+    static const Gap::address_t peerAddr = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+    Gap::ConnectionParams_t params = {6, 6, 0, 400};
+
+    radio.advertising = false;
+    radio.connected = true;
+    if (connectionCallback != NULL) {
+        connectionCallback(1, Gap::ADDR_TYPE_RANDOM_STATIC, peerAddr, &params);
+    }
+}
+
+void BLEDevice::fireDisconnection(void) {
+    radio.connected = false;
+    if (disconnectionCallback != NULL) {
+        disconnectionCallback(1, Gap::REMOTE_USER_TERMINATED_CONNECTION);
+    }
+}
+
+void BLEDevice::resetCallCounts(void) {
+    memset(&calls, 0, sizeof(calls));
+    silentGaps = 0;
+}
+
+PstorageMock pstorageMock;
+
+void PstorageMock::erase(void) {
+    memset(flash, 0xFF, sizeof(flash));
+}
+
+void PstorageMock::resetCounts(void) {
+    storeCount = 0;
+    updateCount = 0;
+    bytesWritten = 0;
+}
+
+uint32_t pstorage_init(void) {
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_register(pstorage_module_param_t *p_module_param,
+                           pstorage_handle_t *p_block_id) {
+    if (p_module_param->block_size * p_module_param->block_count > PSTORAGE_MOCK_FLASH_SIZE) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    pstorageMock.blockSize = p_module_param->block_size;
+    p_block_id->module_id = 0;
+    p_block_id->block_id = 0;
+    return NRF_SUCCESS;
+}
+
+static uint32_t pstorageCheck(pstorage_handle_t *p_handle,
+                              pstorage_size_t size, pstorage_size_t offset) {
+    if ((size == 0) || (size % 4 != 0) || (offset % 4 != 0)) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (p_handle->block_id + offset + size > pstorageMock.blockSize) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_load(uint8_t *p_dest, pstorage_handle_t *p_src,
+                       pstorage_size_t size, pstorage_size_t offset) {
+    uint32_t err = pstorageCheck(p_src, size, offset);
+    if (err == NRF_SUCCESS) {
+        memcpy(p_dest, &pstorageMock.flash[p_src->block_id + offset], size);
+    }
+    return err;
+}
+
+uint32_t pstorage_store(pstorage_handle_t *p_dest, uint8_t *p_src,
+                        pstorage_size_t size, pstorage_size_t offset) {
+    uint32_t err = pstorageCheck(p_dest, size, offset);
+    if (err == NRF_SUCCESS) {
+        // Programming can only clear bits of erased flash.
+        uint8_t *flash = &pstorageMock.flash[p_dest->block_id + offset];
+        for (pstorage_size_t i = 0; i < size; i++) {
+            flash[i] &= p_src[i];
+        }
+        pstorageMock.storeCount++;
+        pstorageMock.bytesWritten += size;
+    }
+    return err;
+}
+
+uint32_t pstorage_update(pstorage_handle_t *p_dest, uint8_t *p_src,
+                         pstorage_size_t size, pstorage_size_t offset) {
+    uint32_t err = pstorageCheck(p_dest, size, offset);
+    if (err == NRF_SUCCESS) {
+        memcpy(&pstorageMock.flash[p_dest->block_id + offset], p_src, size);
+        pstorageMock.updateCount++;
+        pstorageMock.bytesWritten += size;
+    }
+    return err;
+}
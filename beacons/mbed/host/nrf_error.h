@@ -0,0 +1,27 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host mock of the Nordic error codes used by main.cpp.
+
+#ifndef HOST_NRF_ERROR_H__
+#define HOST_NRF_ERROR_H__
+
+#define NRF_SUCCESS                 (0)
+#define NRF_ERROR_INVALID_STATE     (8)
+#define NRF_ERROR_INVALID_LENGTH    (9)
+#define NRF_ERROR_INVALID_ADDR      (16)
+
+#endif // HOST_NRF_ERROR_H__
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Host mock of the Nordic pstorage module, backed by a RAM flash image.
+// Like the real module it rejects sizes and offsets that are not word
+// aligned, and it counts the operations that would have touched flash.
+
+#ifndef HOST_PSTORAGE_H__
+#define HOST_PSTORAGE_H__
+
+#include <stdint.h>
+
+typedef uint32_t pstorage_size_t;
+
+typedef struct {
+    uint32_t module_id;
+    uint32_t block_id;
+} pstorage_handle_t;
+
+typedef void (*pstorage_ntf_cb_t)(pstorage_handle_t *p_handle,
+                                  uint8_t            op_code,
+                                  uint32_t           result,
+                                  uint8_t *          p_data,
+                                  uint32_t           data_len);
+
+typedef struct {
+    pstorage_ntf_cb_t cb;
+    pstorage_size_t   block_size;
+    pstorage_size_t   block_count;
+} pstorage_module_param_t;
+
+uint32_t pstorage_init(void);
+uint32_t pstorage_register(pstorage_module_param_t *p_module_param,
+                           pstorage_handle_t *p_block_id);
+uint32_t pstorage_load(uint8_t *p_dest, pstorage_handle_t *p_src,
+                       pstorage_size_t size, pstorage_size_t offset);
+uint32_t pstorage_store(pstorage_handle_t *p_dest, uint8_t *p_src,
+                        pstorage_size_t size, pstorage_size_t offset);
+uint32_t pstorage_update(pstorage_handle_t *p_dest, uint8_t *p_src,
+                         pstorage_size_t size, pstorage_size_t offset);
+
+// Host mock bookkeeping, not part of the Nordic API.
+
+#define PSTORAGE_MOCK_FLASH_SIZE (1024)
+
+struct PstorageMock {
+    uint8_t  flash[PSTORAGE_MOCK_FLASH_SIZE];
+    uint32_t blockSize;
+    unsigned storeCount;
+    unsigned updateCount;
+    unsigned bytesWritten;
+
+    void erase(void);
+    void resetCounts(void);
+};
+
+extern PstorageMock pstorageMock;
+
+#endif // HOST_PSTORAGE_H__
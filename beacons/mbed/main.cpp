@@ -23,12 +23,14 @@
 #include "DFUService.h"
 #include "pstorage.h"
 #include "DeviceInformationService.h"
+#include "uribeacon_core.h"
 
-// Struct to hold persistent data across power cycles
+// Struct to hold persistent data across power cycles, in the shared
+// uribeacon_core record format, followed by the URI continuation.
 struct PersistentData_t {
-    uint32_t magic;
-    URIBeaconConfigService::Params_t params;
-    uint8_t pad[4];
+    uint8_t record[URIBEACON_RECORD_SIZE];
+    uint8_t continuationLength;
+    uint8_t continuation[URIBEACON_CONTINUATION_MAX];
 } __attribute__ ((aligned (4)));
 
 static const int PERSISTENT_DATA_ALIGNED_SIZE = sizeof(PersistentData_t);
@@ -36,10 +38,12 @@ static const int PERSISTENT_DATA_ALIGNED_SIZE = sizeof(PersistentData_t);
 static const int ADVERTISING_TIMEOUT_SECONDS = 60;
 // Advertising interval for config service.
 static const int ADVERTISING_INTERVAL_MSEC = 1000;
-// Maximum size of service data in ADV packets
-static const int SERVICE_DATA_MAX = 31;
-// Magic that identifies persistent storage
-static const uint32_t MAGIC = 0x1BEAC000;
+// Continuation advertised with the default URI, e.g. -DURI_CONTINUATION='"/x"'.
+// BLE_API's config service has no characteristic for it, so this is the only
+// way to set one on the target; it is used until a configuration is stored.
+#ifndef URI_CONTINUATION
+#define URI_CONTINUATION ""
+#endif
 // Values for ADV packets related to firmware levels
 static URIBeaconConfigService::PowerLevels_t  defaultAdvPowerLevels = {-20, -4, 0, 10};
 // Values for setTxPower() indexed by power mode.
@@ -48,7 +52,28 @@ static const int8_t firmwarePowerLevels[] = {-20, -4, 0, 10};
 BLEDevice ble;
 URIBeaconConfigService *uriBeaconConfig;
 pstorage_handle_t pstorageHandle;
+// Configuration edited by the config service.
+URIBeaconConfigService::Params_t params;
 PersistentData_t  persistentData;
+// Image of persistentData as last committed to flash, used to skip or narrow
+// the next write. Only meaningful once committedDataValid is set.
+PersistentData_t  committedData;
+bool committedDataValid = false;
+// True if the block was erased when loaded. Storing only clears bits, so
+// anything else, such as the image of older firmware, must be updated.
+bool committedDataBlank = false;
+// Flash operations skipped because persistentData had not changed.
+unsigned flashOpsAvoided = 0;
+// The rest of a URI longer than the config service holds, advertised in the
+// scan response when not empty. Starts as URI_CONTINUATION and is persisted
+// with the configuration.
+uint8_t uriContinuation[URIBEACON_CONTINUATION_MAX];
+uint8_t uriContinuationLength = 0;
+
+// UriBeacon payloads are double buffered: the next one is built in the back
+// buffer while the radio keeps sending the front one, then they are swapped.
+GapAdvertisingData uriBeaconPayloads[2];
+int activeUriBeaconPayload = 0;
 
 /* LEDs for indication */
 DigitalOut  connectionStateLed(LED1);
@@ -72,7 +97,33 @@ void pstorageNotificationCallback(pstorage_handle_t *p_handle,
     /* APP_ERROR_CHECK(result); */
 }
 
-void pstorageLoad() {
+// Converts between the config service parameters and the shared core
+// configuration. mbed has no radio level table and keeps the lock state in
+// the service.
+void paramsToConfig(const URIBeaconConfigService::Params_t &from, uribeacon_config_t *to) {
+    uribeacon_config_defaults(to);
+    memcpy(to->lock_code, from.lock, sizeof(to->lock_code));
+    to->uri_length = from.uriDataLength;
+    memcpy(to->uri, from.uriData, sizeof(to->uri));
+    to->flags = from.flags;
+    memcpy(to->adv_tx_power_levels, from.advPowerLevels, sizeof(to->adv_tx_power_levels));
+    memcpy(to->radio_tx_power_levels, firmwarePowerLevels, sizeof(to->radio_tx_power_levels));
+    to->tx_power_mode = from.txPowerMode;
+    to->period = uribeacon_period_clamp(from.beaconPeriod);
+}
+
+void configToParams(const uribeacon_config_t &from, URIBeaconConfigService::Params_t *to) {
+    memcpy(to->lock, from.lock_code, sizeof(to->lock));
+    to->uriDataLength = from.uri_length;
+    memcpy(to->uriData, from.uri, sizeof(to->uriData));
+    to->flags = from.flags;
+    memcpy(to->advPowerLevels, from.adv_tx_power_levels, sizeof(to->advPowerLevels));
+    to->txPowerMode = from.tx_power_mode;
+    to->beaconPeriod = from.period;
+}
+
+// Returns true if a valid configuration was restored into params.
+bool pstorageLoad() {
     pstorage_init();
     pstorage_module_param_t pstorageParams = {
         .cb          = pstorageNotificationCallback,
@@ -85,22 +136,75 @@ void pstorageLoad() {
         // On failure zero out and let the service reset to defaults
         memset(&persistentData, 0, sizeof(PersistentData_t));
     }
+    memcpy(&committedData, &persistentData, sizeof(PersistentData_t));
+    const uint8_t *loaded = reinterpret_cast<const uint8_t *>(&persistentData);
+    committedDataBlank = true;
+    for (size_t i = 0; i < sizeof(PersistentData_t); i++) {
+        if (loaded[i] != 0xFF) {
+            committedDataBlank = false;
+            break;
+        }
+    }
+
+    uribeacon_config_t config;
+    committedDataValid =
+        uribeacon_record_read(&config, persistentData.record) == URIBEACON_OK;
+    if (committedDataValid) {
+        configToParams(config, &params);
+        if (persistentData.continuationLength <= URIBEACON_CONTINUATION_MAX) {
+            uriContinuationLength = persistentData.continuationLength;
+            memcpy(uriContinuation, persistentData.continuation, uriContinuationLength);
+        }
+    }
+    return committedDataValid;
 }
 
 
-void pstorageSave() {
-    if (persistentData.magic != MAGIC) {
-        persistentData.magic = MAGIC;
-        pstorage_store(&pstorageHandle,
-                       reinterpret_cast<uint8_t *>(&persistentData),
-                       sizeof(PersistentData_t),
-                       0 /* offset */);
+// Writes config to flash if it differs from the committed image. An update
+// only covers the span of words from the first to the last dirty one.
+void pstorageSave(const uribeacon_config_t &config) {
+    uribeacon_record_write(&config, persistentData.record);
+    persistentData.continuationLength = uriContinuationLength;
+    memset(persistentData.continuation, 0, sizeof(persistentData.continuation));
+    memcpy(persistentData.continuation, uriContinuation, uriContinuationLength);
+    if (!committedDataValid) {
+        committedDataValid = true;
+        if (committedDataBlank) {
+            committedDataBlank = false;
+            pstorage_store(&pstorageHandle,
+                           reinterpret_cast<uint8_t *>(&persistentData),
+                           sizeof(PersistentData_t),
+                           0 /* offset */);
+        } else {
+            pstorage_update(&pstorageHandle,
+                            reinterpret_cast<uint8_t *>(&persistentData),
+                            sizeof(PersistentData_t),
+                            0 /* offset */);
+        }
     } else {
+        const uint32_t *current = reinterpret_cast<const uint32_t *>(&persistentData);
+        const uint32_t *committed = reinterpret_cast<const uint32_t *>(&committedData);
+        const int words = sizeof(PersistentData_t) / sizeof(uint32_t);
+
+        int first = 0;
+        while ((first < words) && (current[first] == committed[first])) {
+            first++;
+        }
+        if (first == words) {
+            flashOpsAvoided++;
+            return;
+        }
+        int last = words - 1;
+        while (current[last] == committed[last]) {
+            last--;
+        }
+
         pstorage_update(&pstorageHandle,
-                        reinterpret_cast<uint8_t *>(&persistentData),
-                        sizeof(PersistentData_t),
-                        0 /* offset */);
+                        reinterpret_cast<uint8_t *>(&persistentData) + first * sizeof(uint32_t),
+                        (last - first + 1) * sizeof(uint32_t),
+                        first * sizeof(uint32_t) /* offset */);
     }
+    memcpy(&committedData, &persistentData, sizeof(PersistentData_t));
 }
 
 void startAdvertisingUriBeaconConfig() {
@@ -148,60 +252,90 @@ void startAdvertisingUriBeaconConfig() {
 }
 
 
+// Reconfigures advertising in place. The BLE stack, the GATT services and the
+// config service stay up; the config service is unreachable once advertising
+// is non-connectable. Advertising is only stopped when the parameters change.
 void startAdvertisingUriBeacon() {
-    uint8_t serviceData[SERVICE_DATA_MAX];
-    int serviceDataLen = 0;
+    uint8_t serviceData[URIBEACON_SERVICE_DATA_MAX];
+    uint8_t scanResponse[URIBEACON_ADV_MAX];
 
     advertisingStateLed = 1;
     connectionStateLed = 1;
 
-    ble.shutdown();
-    ble.init();
-
     // Fields from the Service
-    int beaconPeriod = persistentData.params.beaconPeriod;
-    int txPowerMode = persistentData.params.txPowerMode;
-    int uriDataLength = persistentData.params.uriDataLength;
-    URIBeaconConfigService::UriData_t &uriData = persistentData.params.uriData;
-    URIBeaconConfigService::PowerLevels_t &advPowerLevels =
-        persistentData.params.advPowerLevels;
-    uint8_t flags = persistentData.params.flags;
-
-    pstorageSave();
-
-    delete uriBeaconConfig;
-    uriBeaconConfig = NULL;
-
-    ble.clearAdvertisingPayload();
-    ble.setTxPower(firmwarePowerLevels[txPowerMode]);
+    uribeacon_config_t config;
+    paramsToConfig(params, &config);
+
+    // A continuation is offered to scanners that ask for it, and flagged in
+    // the advertised data only.
+    uribeacon_config_t advertised = config;
+    int scanResponseLen = uribeacon_scan_response_build(
+        uriContinuation, uriContinuationLength, scanResponse, sizeof(scanResponse));
+    if (scanResponseLen > 0) {
+        advertised.flags |= URIBEACON_FLAG_URI_CONTINUED;
+    }
+    int serviceDataLen =
+        uribeacon_service_data_build(&advertised, serviceData, sizeof(serviceData));
+    if (serviceDataLen == 0) {
+        error("invalid UriBeacon configuration");
+    }
+    int beaconPeriod = config.period;
+    int txPowerMode = config.tx_power_mode;
 
-    ble.setAdvertisingType(
-        GapAdvertisingParams::ADV_NON_CONNECTABLE_UNDIRECTED);
+    pstorageSave(config);
 
-    ble.setAdvertisingInterval(
-        Gap::MSEC_TO_ADVERTISEMENT_DURATION_UNITS(beaconPeriod));
+    GapAdvertisingData &payload = uriBeaconPayloads[activeUriBeaconPayload ^ 1];
+    payload.clear();
 
-    ble.accumulateAdvertisingPayload(
+    payload.addFlags(
         GapAdvertisingData::BREDR_NOT_SUPPORTED |
         GapAdvertisingData::LE_GENERAL_DISCOVERABLE);
 
-    ble.accumulateAdvertisingPayload(
+    payload.addData(
         GapAdvertisingData::COMPLETE_LIST_16BIT_SERVICE_IDS, BEACON_UUID,
         sizeof(BEACON_UUID));
 
-    serviceData[serviceDataLen++] = BEACON_UUID[0];
-    serviceData[serviceDataLen++] = BEACON_UUID[1];
-    serviceData[serviceDataLen++] = flags;
-    serviceData[serviceDataLen++] = advPowerLevels[txPowerMode];
-    for (int j=0; j < uriDataLength; j++) {
-        serviceData[serviceDataLen++] = uriData[j];
-    }
-
-    ble.accumulateAdvertisingPayload(
+    payload.addData(
         GapAdvertisingData::SERVICE_DATA,
         serviceData, serviceDataLen);
 
-    ble.startAdvertising();
+    // The scan response goes out with the next payload.
+    ble.clearScanResponse();
+    if (scanResponseLen > 0) {
+        ble.accumulateScanResponse(
+            GapAdvertisingData::SERVICE_DATA,
+            &scanResponse[2], scanResponseLen - 2);
+    }
+
+    // No timeout: the config mode timeout must not carry over.
+    GapAdvertisingParams advertisingParams(
+        (scanResponseLen > 0) ? GapAdvertisingParams::ADV_SCANNABLE_UNDIRECTED
+                              : GapAdvertisingParams::ADV_NON_CONNECTABLE_UNDIRECTED,
+        Gap::MSEC_TO_ADVERTISEMENT_DURATION_UNITS(beaconPeriod),
+        0 /* timeout */);
+    const GapAdvertisingParams &currentParams = ble.getAdvertisingParams();
+    bool paramsChanged =
+        (currentParams.getAdvertisingType() != advertisingParams.getAdvertisingType()) ||
+        (currentParams.getInterval() != advertisingParams.getInterval()) ||
+        (currentParams.getTimeout() != advertisingParams.getTimeout());
+    bool advertising = ble.getGapState().advertising;
+
+    // The stack only accepts new parameters while advertising is stopped; a
+    // payload alone is swapped while advertising continues.
+    if (advertising && paramsChanged) {
+        ble.stopAdvertising();
+        advertising = false;
+    }
+    ble.setTxPower(firmwarePowerLevels[txPowerMode]);
+    if (paramsChanged) {
+        ble.setAdvertisingParams(advertisingParams);
+    }
+    ble.setAdvertisingData(payload);
+    activeUriBeaconPayload ^= 1;
+
+    if (!advertising) {
+        ble.startAdvertising();
+    }
 }
 
 // After advertising timeout, stop config and switch to UriBeacon
@@ -246,10 +380,17 @@ int main(void) {
     // Advertising timeout
     ble.onTimeout(timeout);
 
-    pstorageLoad();
-    bool resetToDefaults = persistentData.magic != MAGIC;
+    bool resetToDefaults = !pstorageLoad();
+    if (resetToDefaults) {
+        static const char defaultContinuation[] = URI_CONTINUATION;
+        if (sizeof(defaultContinuation) - 1 > URIBEACON_CONTINUATION_MAX) {
+            error("failed to accommodate URI continuation");
+        }
+        uriContinuationLength = sizeof(defaultContinuation) - 1;
+        memcpy(uriContinuation, defaultContinuation, uriContinuationLength);
+    }
     uriBeaconConfig = new URIBeaconConfigService(
-        ble, persistentData.params, resetToDefaults,
+        ble, params, resetToDefaults,
         uriData, uriDataLength, defaultAdvPowerLevels);
     if (!uriBeaconConfig->configuredSuccessfully()) {
         error("failed to accommodate URI");
@@ -71,6 +71,7 @@ typedef union
 flash_db_t           *p_flash_db;
 static pstorage_handle_t    pstorage_block_id;
 static flash_db_t adv_flash;
+static bool       adv_flash_dirty = false;   // adv_flash changed since it was last queued for flash
 
 /**@brief Connect event handler.
  *
@@ -93,12 +94,17 @@ static void on_disconnect(ble_evt_t * p_ble_evt)
   conn_handle = BLE_CONN_HANDLE_INVALID;
 }
 
-void wait_for_flash_and_reset(void)
+void wait_for_flash(void)
 {
   uint32_t err_code;
 
   err_code = pstorage_access_wait();
   APP_ERROR_CHECK(err_code);
+}
+
+void wait_for_flash_and_reset(void)
+{
+  wait_for_flash();
 
   NVIC_SystemReset();
 }
@@ -124,8 +130,9 @@ static void uri_update_adv_len() {
     &set_data_len, &set_data_value);  
 }
 
-/**@brief Update data size characteristic
+/**@brief Queue the adv data for writing to flash
  *
+ * @details Does not wait for the flash operations to complete, use wait_for_flash() for that.
  */
 static void flash_adv_data() {
     uint32_t err_code;
@@ -137,9 +144,19 @@ static void flash_adv_data() {
   
     err_code = pstorage_store(&pstorage_block_id, (uint8_t *)&adv_flash, sizeof(flash_db_t), 0);
     APP_ERROR_CHECK(err_code);
+}
 
-    err_code = pstorage_access_wait();
-    APP_ERROR_CHECK(err_code);
+/**@brief Commit written adv data to flash
+ *
+ * @details Called when the beacon changes mode, which it does when the config client
+ *          disconnects, so writes to both data characteristics in one connection are batched
+ *          into a single clear and store.
+ */
+void ble_uri_flash_commit(void) {
+  if (adv_flash_dirty) {
+    adv_flash_dirty = false;
+    flash_adv_data();
+  }
 }
 
 /**@brief Write event handler.
@@ -158,7 +175,7 @@ static void on_write(ble_evt_t * p_ble_evt)
     adv_flash.data.adv_data_len = p_evt_write->len;
 
     uri_update_adv_len();
-    flash_adv_data();
+    adv_flash_dirty = true;
   }
 
   if ((p_evt_write->handle == beacon_data_2_char_handles.value_handle) &&
@@ -168,7 +185,7 @@ static void on_write(ble_evt_t * p_ble_evt)
     adv_flash.data.adv_data_len = APP_ADV_DATA_1_LEN+p_evt_write->len;
 
     uri_update_adv_len();
-    flash_adv_data();
+    adv_flash_dirty = true;
   }
 }
 
@@ -36,6 +36,8 @@ void ble_uri_on_ble_evt(ble_evt_t * p_ble_evt);
 
 void get_adv_data (uint8_t* app_adv_data, uint8_t* app_adv_data_len);
 uint8_t get_uuid_type (void);
+void ble_uri_flash_commit(void);
+void wait_for_flash(void);
 void wait_for_flash_and_reset(void);
 void ble_uri_storage_init(void);
 
@@ -23,11 +23,14 @@
 #include "ble_advdata.h"
 #include "nordic_common.h"
 #include "softdevice_handler.h"
+#include "app_scheduler.h"
+#include "app_util_platform.h"
 #include "app_gpiote.h"
 #include "app_timer.h"
 #include "app_button.h"
 #include "pca20006.h"
 #include "ble_uri.h"
+#include "uribeacon_core.h"
 #include "nrf_soc.h"
 
 #define LED_R_MSK  (1UL << LED_RED)
@@ -89,9 +92,14 @@ typedef enum {
 static ble_gap_sec_params_t m_sec_params;                               /**< Security requirements for this application. */
 static ble_gap_adv_params_t m_adv_params;                               /**< Parameters to be passed to the stack when starting advertising. */
 static uint16_t             m_conn_handle = BLE_CONN_HANDLE_INVALID;    /**< Handle of the current connection. */
+static bool                 m_config_services_initialized = false;      /**< Config mode GATT services are added once per SoftDevice enable. */
+static uint8_t              m_sched_queue_depth = 0;                    /**< Events put on the scheduler queue and not yet executed. */
+static uint8_t              m_sched_queue_max_depth = 0;                /**< High-water mark of m_sched_queue_depth, for sizing SCHED_QUEUE_SIZE (inspect with the debugger). */
 
 static uint8_t adv_flags[ADV_FLAGS_LEN] = {0x02, 0x01, 0x04};
 
+static void beacon_mode_set(beacon_mode_t mode);
+
 /**@brief Function for error handling, which is called when an error has occurred.
  *
  * @warning This handler is an example only and does not fit a final product. You need to analyze
@@ -154,8 +162,10 @@ static void leds_init(void)
  *
  * @details Encodes the required advertising data and passes it to the stack.
  *          Also builds a structure to be passed to the stack when starting advertising.
+ *
+ * @return  true if there is something to advertise in the given mode.
  */
-static void advertising_init(beacon_mode_t mode)
+static bool advertising_init(beacon_mode_t mode)
 {
   if (mode == beacon_mode_normal) {
     // in normal mode, get the adv_data to create an ADV packet
@@ -165,8 +175,10 @@ static void advertising_init(beacon_mode_t mode)
     memcpy(adv_data, adv_flags, ADV_FLAGS_LEN);
     get_adv_data(&adv_data[ADV_FLAGS_LEN], &adv_data_len); 
     
-    // data_len is 0 for uninitialized tags
-    if ((adv_data_len > 0) && (adv_data_len <= APP_ADV_DATA_MAX_LEN)) {
+    // data_len is 0 for uninitialized tags. The stack rejects malformed AD
+    // structures, so a bad write must not get as far as APP_ERROR_CHECK.
+    if ((adv_data_len > 0) &&
+        (uribeacon_frame_check(&adv_data[ADV_FLAGS_LEN], adv_data_len) == URIBEACON_OK)) {
       uint32_t err_code;
 
       err_code = sd_ble_gap_adv_data_set(adv_data, adv_data_len+ADV_FLAGS_LEN, NULL, NULL);
@@ -180,7 +192,9 @@ static void advertising_init(beacon_mode_t mode)
       m_adv_params.fp          = BLE_GAP_ADV_FP_ANY;
       m_adv_params.interval    = NON_CONNECTABLE_ADV_INTERVAL;
       m_adv_params.timeout     = APP_CFG_NON_CONN_ADV_TIMEOUT;
+      return true;
     }
+    return false;
   }
   else if (mode == beacon_mode_config)
   {
@@ -214,11 +228,13 @@ static void advertising_init(beacon_mode_t mode)
     m_adv_params.fp          = BLE_GAP_ADV_FP_ANY;
     m_adv_params.interval    = APP_ADV_INTERVAL;
     m_adv_params.timeout     = APP_ADV_TIMEOUT_IN_SECONDS;
+    return true;
   }
   else
   {
     APP_ERROR_CHECK_BOOL(false);
   }
+  return false;
 }
 
 /**@brief Function for starting advertising.
@@ -231,6 +247,75 @@ static void advertising_start(void)
   APP_ERROR_CHECK(err_code);
 }
 
+/**@brief Function for stopping advertising.
+ *
+ * @details Advertising may already have stopped on its own (e.g. after a timeout or a
+ *          connection), which the SoftDevice reports as an invalid state.
+ */
+static void advertising_stop(void)
+{
+  uint32_t err_code;
+
+  err_code = sd_ble_gap_adv_stop();
+  if (err_code != NRF_ERROR_INVALID_STATE) {
+    APP_ERROR_CHECK(err_code);
+  }
+}
+
+/**@brief Function for putting an event on the scheduler queue while tracking the queue depth.
+ *
+ * @details May be called from interrupt context. Every handler of an event put through this
+ *          function must call sched_event_done().
+ */
+static uint32_t sched_event_put(void * p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+  uint32_t err_code;
+
+  CRITICAL_REGION_ENTER();
+  err_code = app_sched_event_put(p_event_data, event_size, handler);
+  if (err_code == NRF_SUCCESS) {
+    m_sched_queue_depth++;
+    if (m_sched_queue_depth > m_sched_queue_max_depth) {
+      m_sched_queue_max_depth = m_sched_queue_depth;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+
+  return err_code;
+}
+
+/**@brief Function for marking an event put by sched_event_put() as executed.
+ */
+static void sched_event_done(void)
+{
+  CRITICAL_REGION_ENTER();
+  m_sched_queue_depth--;
+  CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for pulling the pending SoftDevice events in the main loop.
+ *
+ * @details Executed by the scheduler, which was given the event by softdevice_evt_sched_put().
+ */
+static void softdevice_evt_sched_handler(void * p_event_data, uint16_t event_size)
+{
+  UNUSED_PARAMETER(p_event_data);
+  UNUSED_PARAMETER(event_size);
+
+  sched_event_done();
+  intern_softdevice_events_execute();
+}
+
+/**@brief Function for deferring SoftDevice event processing to the main loop.
+ *
+ * @details Called from the SoftDevice event interrupt, so BLE and system event handlers
+ *          (including everything that touches flash) run from app_sched_execute().
+ */
+static uint32_t softdevice_evt_sched_put(void)
+{
+  return sched_event_put(NULL, 0, softdevice_evt_sched_handler);
+}
+
 /**@brief Function for the Power manager.
  */
 static void power_manage(void)
@@ -241,10 +326,18 @@ static void power_manage(void)
 
 /**@brief Function for handeling button presses.
  */
-static void button_handler(uint8_t pin_no)
+static void button_sched_handler(void * p_event_data, uint16_t event_size)
 {
+  uint8_t pin_no = *(uint8_t *)p_event_data;
+
+  UNUSED_PARAMETER(event_size);
+
+  sched_event_done();
   if(pin_no == CONFIG_MODE_BUTTON_PIN) {
-      wait_for_flash_and_reset();
+      // Already serving a config client, nothing to switch to.
+      if (m_conn_handle == BLE_CONN_HANDLE_INVALID) {
+          beacon_mode_set(beacon_mode_config);
+      }
   }
   else if (pin_no == BOOTLOADER_BUTTON_PIN) {
       wait_for_flash_and_reset();
@@ -254,6 +347,19 @@ static void button_handler(uint8_t pin_no)
   }
 }
 
+/**@brief Function for deferring a button event to the main loop.
+ *
+ * @details Called from the app_button interrupt. The module could put the event on the
+ *          scheduler itself, but going through sched_event_put() counts it in the queue depth.
+ */
+static void button_handler(uint8_t pin_no)
+{
+  uint32_t err_code;
+
+  err_code = sched_event_put(&pin_no, sizeof(pin_no), button_sched_handler);
+  APP_ERROR_CHECK(err_code);
+}
+
 /**@brief Function for initializing the app_button module.
  */
 static void buttons_init(void)
@@ -266,7 +372,7 @@ static void buttons_init(void)
     {BOOTLOADER_BUTTON_PIN, false, BUTTON_PULL, button_handler}
   };
 
-  APP_BUTTON_INIT(buttons, sizeof(buttons) / sizeof(buttons[0]), BUTTON_DETECTION_DELAY, true);
+  APP_BUTTON_INIT(buttons, sizeof(buttons) / sizeof(buttons[0]), BUTTON_DETECTION_DELAY, false);
 }
 
 
@@ -378,7 +484,7 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
 
     case BLE_GAP_EVT_DISCONNECTED:
       m_conn_handle = BLE_CONN_HANDLE_INVALID;
-      wait_for_flash_and_reset();
+      beacon_mode_set(beacon_mode_normal);
       break;
 
     case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
@@ -408,7 +514,7 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
     case BLE_GAP_EVT_TIMEOUT:
       if (p_ble_evt->evt.gap_evt.params.timeout.src == BLE_GAP_TIMEOUT_SRC_ADVERTISEMENT)
       {
-          wait_for_flash_and_reset();
+          beacon_mode_set(beacon_mode_normal);
       }
       break;
 
@@ -440,9 +546,16 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 static void ble_stack_init(void)
 {
   uint32_t err_code;
-
-  // Initialize the SoftDevice handler module.
-  SOFTDEVICE_HANDLER_INIT(NRF_CLOCK_LFCLKSRC_XTAL_20_PPM, true);
+  static uint32_t ble_evt_buffer[CEIL_DIV(BLE_STACK_EVT_MSG_BUF_SIZE, sizeof(uint32_t))];
+
+  // Initialize the SoftDevice handler module. Events are pulled from the stack in the main
+  // loop through the scheduler, like SOFTDEVICE_HANDLER_INIT(..., true) does, but with the
+  // scheduler queue depth tracked.
+  err_code = softdevice_handler_init(NRF_CLOCK_LFCLKSRC_XTAL_20_PPM,
+                                     ble_evt_buffer,
+                                     sizeof(ble_evt_buffer),
+                                     softdevice_evt_sched_put);
+  APP_ERROR_CHECK(err_code);
 
   // Register with the SoftDevice handler module for BLE events.
   err_code = softdevice_ble_evt_handler_set(ble_evt_dispatch);
@@ -450,6 +563,48 @@ static void ble_stack_init(void)
 
 }
 
+/**@brief Function for initializing the services and modules only needed in config mode.
+ *
+ * @details The SoftDevice cannot remove GATT services once added, so this is done the first
+ *          time config mode is entered and the services are kept for later switches.
+ */
+static void config_services_init(void)
+{
+  uint32_t err_code;
+
+  gap_params_init();
+  err_code = ble_uri_init();
+  APP_ERROR_CHECK(err_code);
+  conn_params_init();
+  sec_params_init();
+
+  m_config_services_initialized = true;
+}
+
+/**@brief Function for switching between config and normal beacon mode at runtime.
+ *
+ * @details Stops advertising, lets pending configuration writes reach flash, swaps the
+ *          advertising data and parameters and restarts advertising. The SoftDevice and
+ *          services stay up, so no reset is needed to change modes. In normal mode an
+ *          unconfigured tag stays silent until the config button is pressed.
+ *
+ * @param[in]   mode   Mode to switch to.
+ */
+static void beacon_mode_set(beacon_mode_t mode)
+{
+  advertising_stop();
+  ble_uri_flash_commit();
+  wait_for_flash();
+
+  if ((mode == beacon_mode_config) && !m_config_services_initialized) {
+    config_services_init();
+  }
+
+  if (advertising_init(mode)) {
+    advertising_start();
+  }
+}
+
 //------------------------------------------------------------------//
 /**
  * @brief Function for handling pstorage events
@@ -479,19 +634,8 @@ int main(void)
   ble_stack_init();
   ble_uri_storage_init();
 
-  if(config_mode) {
-    gap_params_init();
-    err_code = ble_uri_init();
-    APP_ERROR_CHECK(err_code);
-    advertising_init(beacon_mode_config);
-    conn_params_init();
-    sec_params_init();
-  } else {
-    advertising_init(beacon_mode_normal);
-  }
-
   // Start execution.
-  advertising_start();
+  beacon_mode_set(config_mode ? beacon_mode_config : beacon_mode_normal);
 
   // Enter main loop.
   for (;;) {